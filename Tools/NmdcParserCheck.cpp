@@ -0,0 +1,451 @@
+/*
+ * Checks client/NmdcParser.h against the string based parsers it replaced
+ * and measures both on the same lines.
+ *
+ * g++ -std=c++14 -O2 -I../boost NmdcParserCheck.cpp -o NmdcParserCheck && ./NmdcParserCheck
+ */
+
+#include "../client/NmdcParser.h"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdio>
+
+using std::string;
+using std::vector;
+using boost::string_view;
+
+namespace Old
+{
+	static bool isWhiteSpace(int c)
+	{
+		return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+	}
+
+	// Util::toInt64
+	static int64_t toInt64(const char* s)
+	{
+		while (isWhiteSpace(*s)) s++;
+		bool negative = false;
+		if (*s == '-')
+		{
+			negative = true;
+			s++;
+		}
+		else if (*s == '+')
+			s++;
+		int64_t result = 0;
+		while (*s >= '0' && *s <= '9')
+		{
+			result = result*10 + *s - '0';
+			s++;
+		}
+		return negative ? -result : result;
+	}
+
+	// NmdcHub::unescape
+	static string unescape(string tmp)
+	{
+		string::size_type i = 0;
+		const auto j = tmp.find('&');
+		if (j != string::npos)
+		{
+			i = j;
+			while ((i = tmp.find("&#36;", i)) != string::npos)
+			{
+				tmp.replace(i, 5, "$");
+				i++;
+			}
+			i = j;
+			while ((i = tmp.find("&#124;", i)) != string::npos)
+			{
+				tmp.replace(i, 6, "|");
+				i++;
+			}
+			i = j;
+			while ((i = tmp.find("&amp;", i)) != string::npos)
+			{
+				tmp.replace(i, 5, "&");
+				i++;
+			}
+		}
+		return tmp;
+	}
+
+	// StringTokenizer<string>(param, "$$") with empty tokens skipped
+	static vector<string> nickList(const string& str)
+	{
+		vector<string> tokens;
+		string::size_type pos = 0;
+		while (true)
+		{
+			const string::size_type next = str.find("$$", pos);
+			if (next != string::npos)
+			{
+				tokens.push_back(str.substr(pos, next - pos));
+				pos = next + 2;
+			}
+			else
+			{
+				if (pos < str.size()) tokens.push_back(str.substr(pos));
+				break;
+			}
+		}
+		vector<string> result;
+		for (const string& s : tokens)
+			if (!s.empty()) result.push_back(s);
+		return result;
+	}
+
+	// Whatever NmdcHub::myInfoParse applied to the identity
+	struct MyInfo
+	{
+		bool hasNick = false;
+		string nick;
+		bool hasDescription = false;
+		string description;
+		bool hasTag = false;
+		string tag;
+		char mode = 0;
+		bool hasStatus = false;
+		char status = 0;
+		string connection;
+		bool hasEmail = false;
+		string email;
+		bool hasShare = false;
+		int64_t share = 0;
+	};
+
+	static void myInfoParse(const string& param, MyInfo& r)
+	{
+		string::size_type i = 5;
+		string::size_type j = param.find(' ', i);
+		if (j == string::npos || j == i)
+			return;
+		r.hasNick = true;
+		r.nick = param.substr(i, j - i);
+		i = j + 1;
+		j = param.find('$', i);
+		if (j == string::npos)
+			return;
+		string tmpDesc = unescape(param.substr(i, j - i));
+		if (!tmpDesc.empty() && tmpDesc[tmpDesc.size() - 1] == '>')
+		{
+			const string::size_type x = tmpDesc.rfind('<');
+			if (x != string::npos)
+			{
+				if (tmpDesc.length() > x + 2)
+				{
+					r.hasTag = true;
+					r.tag = tmpDesc.substr(x + 1, tmpDesc.length() - x - 2);
+				}
+				r.hasDescription = true;
+				r.description = tmpDesc.erase(x);
+			}
+		}
+		else
+		{
+			r.hasDescription = true;
+			r.description = tmpDesc;
+			if (param.size() > j + 3)
+			{
+				if (param[j] == '$')
+				{
+					if (param[j + 1] == 'A' || param[j + 1] == 'P')
+						r.mode = param[j + 1];
+				}
+			}
+		}
+		i = j + 3;
+		j = param.find('$', i);
+		if (j == string::npos)
+			return;
+		r.hasStatus = true;
+		r.status = param[j - 1];
+		if (!(i == j || j - i - 1 == 0))
+			r.connection = param.substr(i, j - i - 1);
+		i = j + 1;
+		j = param.find('$', i);
+		if (j == string::npos)
+			return;
+		r.hasEmail = true;
+		if (j != i)
+			r.email = unescape(param.substr(i, j - i));
+		i = j + 1;
+		j = param.find('$', i);
+		if (j == string::npos)
+			return;
+		r.hasShare = true;
+		r.share = toInt64(param.c_str() + i);
+		if (r.share < 0) r.share = 0;
+	}
+
+	// The $Search part of NmdcHub::searchParse
+	struct Search
+	{
+		bool valid = false;
+		bool isPassive = false;
+		string seeker;
+		int sizeMode = 0;
+		int64_t size = 0;
+		int fileType = 0;
+		string query;
+		string cacheKey;
+	};
+
+	static void searchParse(const string& param, Search& r)
+	{
+		if (param.length() < 4) return;
+		r.isPassive = param.compare(0, 4, "Hub:", 4) == 0;
+		string::size_type i = 0;
+		string::size_type j = param.find(' ', i);
+		if (j == string::npos || i == j)
+			return;
+		r.seeker = param.substr(i, j - i);
+		i = j + 1;
+		if (param.length() < i + 4)
+			return;
+		if (param[i + 1] != '?' || param[i + 3] != '?')
+			return;
+		string::size_type queryPos = i;
+		if (param[i] == 'F')
+			r.sizeMode = 0;
+		else if (param[i + 2] == 'F')
+			r.sizeMode = 1;
+		else
+			r.sizeMode = 2;
+		i += 4;
+		j = param.find('?', i);
+		if (j == string::npos || i == j)
+			return;
+		if (j - i == 1 && param[i] == '0')
+			r.size = 0;
+		else
+			r.size = toInt64(param.c_str() + i);
+		i = j + 1;
+		j = param.find('?', i);
+		if (j == string::npos || i == j)
+			return;
+		r.fileType = static_cast<int>(toInt64(param.c_str() + i)) - 1;
+		i = j + 1;
+		r.query = param.substr(i);
+		r.cacheKey = param.substr(queryPos);
+		r.valid = true;
+	}
+
+	// NmdcHub::toParse
+	struct PrivateMessage
+	{
+		int fields = 0;
+		string replyTo;
+		string from;
+		string text;
+	};
+
+	static void toParse(const string& param, PrivateMessage& r)
+	{
+		string::size_type pos_a = param.find(" From: ");
+		if (pos_a == string::npos)
+			return;
+		pos_a += 7;
+		string::size_type pos_b = param.find(" $<", pos_a);
+		if (pos_b == string::npos)
+			return;
+		r.fields = 1;
+		r.replyTo = param.substr(pos_a, pos_b - pos_a);
+		pos_a = pos_b + 3;
+		pos_b = param.find("> ", pos_a);
+		if (pos_b == string::npos)
+			return;
+		r.fields = 3;
+		r.from = param.substr(pos_a, pos_b - pos_a);
+		r.text = param.substr(pos_b + 2);
+	}
+}
+
+static int errors = 0;
+
+static void fail(const char* what, const string& line)
+{
+	if (++errors <= 20)
+		printf("MISMATCH %s: \"%s\"\n", what, line.c_str());
+}
+
+static void checkMyInfo(const string& line)
+{
+	Old::MyInfo o;
+	Old::myInfoParse(line, o);
+	NmdcParser::MyInfo n;
+	const int fields = NmdcParser::parseMyInfo(line, n);
+	bool ok = o.hasNick == (fields >= NmdcParser::MyInfo::FIELD_NICK);
+	if (ok && o.hasNick)
+		ok = o.nick == n.nick.to_string();
+	if (ok && fields >= NmdcParser::MyInfo::FIELD_DESCRIPTION)
+	{
+		// The old parser left the description alone when it ended with '>' but had no '<'
+		if (o.hasDescription)
+			ok = o.description == Old::unescape(n.description.to_string());
+		if (ok)
+			ok = o.hasTag == (n.hasTag && !n.tag.empty());
+		if (ok && o.hasTag)
+			ok = o.tag == Old::unescape(n.tag.to_string());
+		if (ok)
+			ok = o.mode == ((n.mode == 'A' || n.mode == 'P') ? n.mode : 0);
+	}
+	if (ok)
+		ok = o.hasStatus == (fields >= NmdcParser::MyInfo::FIELD_CONNECTION);
+	if (ok && o.hasStatus)
+		ok = o.status == n.status && o.connection == n.connection.to_string();
+	if (ok)
+		ok = o.hasEmail == (fields >= NmdcParser::MyInfo::FIELD_EMAIL);
+	if (ok && o.hasEmail)
+		ok = o.email == Old::unescape(n.email.to_string());
+	if (ok)
+		ok = o.hasShare == (fields >= NmdcParser::MyInfo::FIELD_SHARE);
+	if (ok && o.hasShare)
+		ok = o.share == n.share;
+	if (!ok)
+		fail("$MyINFO", line);
+}
+
+static void checkSearch(const string& line)
+{
+	Old::Search o;
+	Old::searchParse(line, o);
+	NmdcParser::Search n;
+	const bool valid = NmdcParser::parseSearch(line, n);
+	bool ok = o.valid == valid;
+	if (ok && valid)
+		ok = o.isPassive == n.isPassive && o.seeker == n.seeker.to_string() &&
+		     o.sizeMode == n.sizeMode && o.size == n.size && o.fileType == n.fileType &&
+		     o.query == n.query.to_string() && o.cacheKey == n.cacheKey.to_string();
+	if (!ok)
+		fail("$Search", line);
+}
+
+static void checkTTHSearch(const string& line)
+{
+	const bool oldValid = line.length() >= 41 && line[39] == ' ';
+	string_view tth, seeker;
+	const bool valid = NmdcParser::parseTTHSearch(line, tth, seeker);
+	bool ok = oldValid == valid;
+	if (ok && valid)
+		ok = line.substr(0, 39) == tth.to_string() && line.substr(40) == seeker.to_string();
+	if (!ok)
+		fail("$SA", line);
+}
+
+static void checkPrivateMessage(const string& line)
+{
+	Old::PrivateMessage o;
+	Old::toParse(line, o);
+	NmdcParser::PrivateMessage n;
+	const int fields = NmdcParser::parsePrivateMessage(line, n);
+	bool ok = o.fields == fields;
+	if (ok && fields >= NmdcParser::PrivateMessage::FIELD_REPLY_TO)
+		ok = o.replyTo == n.replyTo.to_string();
+	if (ok && fields >= NmdcParser::PrivateMessage::FIELD_TEXT)
+		ok = o.from == n.from.to_string() && o.text == n.text.to_string();
+	if (!ok)
+		fail("$To", line);
+}
+
+static void checkNickList(const string& line)
+{
+	const vector<string> o = Old::nickList(line);
+	vector<string> n;
+	NmdcParser::NickListTokenizer t(line);
+	string_view nick;
+	while (t.getNextNick(nick))
+		n.push_back(nick.to_string());
+	if (o != n)
+		fail("$NickList", line);
+}
+
+static const char* const corpus[] =
+{
+	"$ALL nick description<++ V:0.868,M:A,H:1/0/0,S:5>$ $100\x01$mail@host$1234567890$",
+	"$ALL nick descr&#36;iption<FlylinkDC++ V:r600,M:P,H:2/1/3,S:15,O:10>$ $LAN(T3)\x05$$0$",
+	"$ALL nick $A$DSL\x01$$-5$",
+	"$ALL nick $P$Cable\x09$&amp;&#124;$  42$",
+	"$ALL nick desc>$ $0.005\x01$$17$",
+	"$ALL nick <>$ $x\x01$e$1$",
+	"$ALL nick <a&#36;b>$ $x\x01$e$1$",
+	"$ALL  $ $x\x01$e$1$",
+	"Hub:nick F?T?0?1?foo$bar",
+	"1.2.3.4:412 T?F?1048576?2?some&#36;query",
+	"1.2.3.4:412 T?T?0005?9?TTH:ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFG",
+	"Hub:nick F?F? 12?-3?x",
+	"Hub:nick F?F?12?+3?",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFG 1.2.3.4:412",
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ234567ABCDEFG nick",
+	"me From: hub $<bot> hello $ world",
+	"me From:  $<> ",
+	"me From: a $<b>> c",
+	"nick1$$nick2$$$nick3$$$$nick4",
+	"$$",
+	"single",
+};
+
+int main()
+{
+	vector<string> lines;
+	for (const char* s : corpus)
+	{
+		const string line(s);
+		for (size_t len = 0; len <= line.length(); len++)
+			lines.push_back(line.substr(0, len));
+	}
+	static const char alphabet[] = "$ <>?:&#;,FTAPHub0123456789- xy";
+	std::mt19937 rnd(12345);
+	for (int k = 0; k < 200000; k++)
+	{
+		string line;
+		const int len = rnd() % 48;
+		for (int m = 0; m < len; m++)
+			line += alphabet[rnd() % (sizeof(alphabet) - 1)];
+		if (k & 1) line.insert(0, "$ALL ");
+		if (k % 3 == 0) line += " From: a $<b> c";
+		lines.push_back(line);
+	}
+
+	for (const string& line : lines)
+	{
+		checkMyInfo(line);
+		checkSearch(line);
+		checkTTHSearch(line);
+		checkPrivateMessage(line);
+		checkNickList(line);
+	}
+	printf("%u lines checked, %d mismatches\n", (unsigned) lines.size(), errors);
+
+	typedef std::chrono::steady_clock Clock;
+	const string myInfo = corpus[0];
+	const string search = corpus[9];
+	const int count = 1000000;
+	size_t sink = 0;
+	auto start = Clock::now();
+	for (int k = 0; k < count; k++)
+	{
+		Old::MyInfo o;
+		Old::myInfoParse(myInfo, o);
+		Old::Search s;
+		Old::searchParse(search, s);
+		sink += o.tag.length() + s.query.length();
+	}
+	const auto oldTime = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+	start = Clock::now();
+	for (int k = 0; k < count; k++)
+	{
+		NmdcParser::MyInfo o;
+		NmdcParser::parseMyInfo(myInfo, o);
+		NmdcParser::Search s;
+		NmdcParser::parseSearch(search, s);
+		sink += o.tag.length() + s.query.length();
+	}
+	const auto newTime = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+	printf("%d x ($MyINFO + $Search): old %d ms, new %d ms (%u)\n", count, (int) oldTime, (int) newTime, (unsigned) (sink & 1));
+	return errors ? 1 : 0;
+}
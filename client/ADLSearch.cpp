@@ -43,7 +43,8 @@ ADLSearch::ADLSearch() :
 	destDir("ADLSearch"),
 	ddIndex(0),
 	isForbidden(false),
-	raw(0)
+	raw(0),
+	isRegex(false)
 {
 }
 
@@ -142,9 +143,19 @@ const tstring& ADLSearch::sizeTypeToDisplayString(ADLSearch::SizeType t)
 
 void ADLSearch::prepare(StringMap& params)
 {
-	// Prepare quick search of substrings
 	stringSearches.clear();
-	
+	try
+	{
+		re.assign(searchString, std::regex_constants::icase);
+		isRegex = true;
+		return;
+	}
+	catch (...)
+	{
+		isRegex = false;
+	}
+
+	// Prepare quick search of substrings
 	// Replace parameters such as %[nick]
 	const string s = Util::formatParams(searchString, params, false);
 	
@@ -152,7 +163,8 @@ void ADLSearch::prepare(StringMap& params)
 	SimpleStringTokenizer<char> st(s, ' ');
 	string tok;
 	while (st.getNextNonEmptyToken(tok))
-		stringSearches.push_back(StringSearch(tok));
+		stringSearches.addPattern(tok);
+	stringSearches.compile();
 }
 
 inline void ADLSearch::unprepare()
@@ -206,22 +218,20 @@ bool ADLSearch::matchesDirectory(const string& d) const
 
 bool ADLSearch::searchAll(const string& s) const
 {
-	try
-	{
-		std::regex reg(searchString, std::regex_constants::icase);
-		return std::regex_search(s, reg);
-	}
-	catch (...) {}
-	
-	// Match all substrings
-	for (auto i = stringSearches.cbegin(), iend = stringSearches.cend(); i != iend; ++i)
+	if (isRegex)
 	{
-		if (!i->match(s))
+		try
+		{
+			return std::regex_search(s, re);
+		}
+		catch (...)
 		{
 			return false;
 		}
 	}
-	return !stringSearches.empty();
+	
+	// Match all substrings
+	return !stringSearches.empty() && stringSearches.match(s) == stringSearches.getMask();
 }
 
 ADLSearchManager::ADLSearchManager() : breakOnFirst(false), sentRaw(false)
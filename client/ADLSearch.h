@@ -25,8 +25,9 @@
 #define ADL_SEARCH_H
 
 #include "SettingsManager.h"
-#include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "DirectoryListing.h"
+#include <regex>
 
 class AdlSearchManager;
 
@@ -97,8 +98,11 @@ class ADLSearch
 		// Search for directory match
 		bool matchesDirectory(const string& d) const;
 		
-		// Substring searches
-		StringSearch::List stringSearches;
+		// Used when searchString is a valid regular expression
+		std::regex re;
+		bool isRegex;
+		// Substring searches, all of them must match
+		MultiStringSearch stringSearches;
 		bool searchAll(const string& s) const;
 };
 
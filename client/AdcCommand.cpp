@@ -21,19 +21,19 @@
 
 #include "ClientManager.h"
 
-AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : cmdInt(aCmd), from(0), to(0), type(aType)
+AdcCommand::AdcCommand(uint32_t aCmd, char aType /* = TYPE_CLIENT */) : cmdInt(aCmd), from(0), to(0), type(aType), lazy(false)
 {
 	dcassert(cmdChar[3] == 0);
 	cmdChar[3] = 0;
 }
 
-AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : cmdInt(aCmd), from(0), to(aTarget), type(aType)
+AdcCommand::AdcCommand(uint32_t aCmd, const uint32_t aTarget, char aType) : cmdInt(aCmd), from(0), to(aTarget), type(aType), lazy(false)
 {
 	dcassert(cmdChar[3] == 0);
 	cmdChar[3] = 0;
 }
 
-AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : cmdInt(CMD_STA), from(0), to(0), type(aType)
+AdcCommand::AdcCommand(Severity sev, Error err, const string& desc, char aType /* = TYPE_CLIENT */) : cmdInt(CMD_STA), from(0), to(0), type(aType), lazy(false)
 {
 	addParam((sev == SEV_SUCCESS && err == SUCCESS) ? "000" : Util::toString(sev * 100 + err));
 	addParam(desc);
@@ -72,95 +72,72 @@ int AdcCommand::parse(const string& line, bool nmdc /* = false */) noexcept
 	if (type == TYPE_INFO)
 		from = HUB_SID;
 	
-	string::size_type len = line.length();
-	const char* buf = line.c_str();
-	string cur;
-	cur.reserve(128);
+	// Parameters are only located here, they are unescaped when accessed
+	buffer = line;
+	parameters.clear();
+	spans.clear();
+	lazy = true;
+	string::size_type len = buffer.length();
+	const char* buf = buffer.c_str();
 	
 	bool toSet = false;
 	bool featureSet = false;
 	bool fromSet = nmdc; // $ADCxxx never have a from CID...
 	
-	while (i < len)
+	while (i <= len)
 	{
-		switch (buf[i])
+		// Find the end of the parameter and check escapes
+		ParamSpan span;
+		span.start = static_cast<uint32_t>(i);
+		span.escaped = false;
+		while (i < len && buf[i] != ' ')
 		{
-			case '\\':
+			if (buf[i] == '\\')
+			{
 				++i;
 				if (i == len)
 					return PARSE_ERROR_ESCAPE_AT_EOL;
-				if (buf[i] == 's')
-					cur += ' ';
-				else if (buf[i] == 'n')
-					cur += '\n';
-				else if (buf[i] == '\\')
-					cur += '\\';
-				else if (buf[i] == ' ' && nmdc) // $ADCGET escaping, leftover from old specs
-					cur += ' ';
-				else
+				if (!(buf[i] == 's' || buf[i] == 'n' || buf[i] == '\\' || (buf[i] == ' ' && nmdc)))
 					return PARSE_ERROR_ESCAPE_AT_EOL;
-				break;
-			case ' ': // New parameter...
-			{
-				if ((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet)
-				{
-					if (cur.length() != 4)
-						return PARSE_ERROR_INVALID_SID_LENGTH;
-					from = toSID(cur);
-					fromSet = true;
-				}
-				else if ((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet)
-				{
-					if (cur.length() != 4)
-						return PARSE_ERROR_INVALID_SID_LENGTH;
-					to = toSID(cur);
-					toSet = true;
-				}
-				else if (type == TYPE_FEATURE && !featureSet)
-				{
-					if (cur.length() % 5 != 0)
-						return PARSE_ERROR_INVALID_FEATURE_LENGTH;
-					// Skip...
-					featureSet = true;
-				}
-				else
-				{
-					parameters.push_back(cur);
-				}
-				cur.clear();
+				span.escaped = true;
 			}
-			break;
-			default:
-				cur += buf[i];
+			++i;
 		}
+		span.len = static_cast<uint32_t>(i - span.start);
+		// The last parameter is ignored if it's empty
+		if (i == len && !span.len)
+			break;
 		++i;
-	}
-	if (!cur.empty())
-	{
+		
 		if ((type == TYPE_BROADCAST || type == TYPE_DIRECT || type == TYPE_ECHO || type == TYPE_FEATURE) && !fromSet)
 		{
-			if (cur.length() != 4)
+			string tmp;
+			boost::string_view sid = getSpan(span, tmp);
+			if (sid.length() != 4)
 				return PARSE_ERROR_INVALID_SID_LENGTH;
-			from = toSID(cur);
+			from = *reinterpret_cast<const uint32_t*>(sid.data());
 			fromSet = true;
 		}
 		else if ((type == TYPE_DIRECT || type == TYPE_ECHO) && !toSet)
 		{
-			if (cur.length() != 4)
+			string tmp;
+			boost::string_view sid = getSpan(span, tmp);
+			if (sid.length() != 4)
 				return PARSE_ERROR_INVALID_SID_LENGTH;
-			to = toSID(cur);
+			to = *reinterpret_cast<const uint32_t*>(sid.data());
 			toSet = true;
 		}
 		else if (type == TYPE_FEATURE && !featureSet)
 		{
-			if (cur.length() % 5 != 0)
+			string tmp;
+			if (getSpan(span, tmp).length() % 5 != 0)
 				return PARSE_ERROR_INVALID_FEATURE_LENGTH;
 			// Skip...
 			featureSet = true;
 		}
 		else
 		{
-			parameters.push_back(cur);
+			spans.push_back(span);
 		}
 	}
 	
@@ -176,6 +153,59 @@ int AdcCommand::parse(const string& line, bool nmdc /* = false */) noexcept
 	return PARSE_OK;
 }
 
+boost::string_view AdcCommand::getSpan(const ParamSpan& span, string& tmp) const
+{
+	const char* p = buffer.data() + span.start;
+	if (!span.escaped)
+		return boost::string_view(p, span.len);
+	tmp.clear();
+	tmp.reserve(span.len);
+	for (uint32_t i = 0; i < span.len; ++i)
+	{
+		if (p[i] == '\\')
+		{
+			++i;
+			if (p[i] == 's')
+				tmp += ' ';
+			else if (p[i] == 'n')
+				tmp += '\n';
+			else
+				tmp += p[i]; // '\\' or ' '
+		}
+		else
+			tmp += p[i];
+	}
+	return tmp;
+}
+
+void AdcCommand::unpackParams() const
+{
+	dcassert(lazy);
+	parameters.clear();
+	parameters.reserve(spans.size());
+	string tmp;
+	for (const ParamSpan& span : spans)
+	{
+		boost::string_view val = getSpan(span, tmp);
+		parameters.emplace_back(val.data(), val.length());
+	}
+	spans.clear();
+	lazy = false;
+}
+
+boost::string_view AdcCommand::getParamView(size_t n, string& tmp) const
+{
+	if (lazy)
+	{
+		dcassert(spans.size() > n);
+		if (spans.size() <= n) return boost::string_view();
+		return getSpan(spans[n], tmp);
+	}
+	dcassert(parameters.size() > n);
+	if (parameters.size() <= n) return boost::string_view();
+	return parameters[n];
+}
+
 string AdcCommand::toString(const CID& aCID, bool nmdc /* = false */) const
 {
 	return getHeaderString(aCID) + getParamString(nmdc);
@@ -266,6 +296,7 @@ string AdcCommand::getParamString(bool nmdc) const
 {
 	string tmp;
 	tmp.reserve(65);
+	if (lazy) unpackParams();
 	for (auto i = parameters.cbegin(); i != parameters.cend(); ++i)
 	{
 		tmp += ' ';
@@ -281,6 +312,23 @@ string AdcCommand::getParamString(bool nmdc) const
 bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 {
 	uint16_t code = toCode(name);
+	if (lazy)
+	{
+		const char* buf = buffer.data();
+		for (size_t i = start; i < spans.size(); ++i)
+		{
+			const ParamSpan& span = spans[i];
+			// Codes never contain escaped characters
+			if (span.len >= 2 && code == toCode(buf + span.start) && buf[span.start] != '\\' && buf[span.start + 1] != '\\')
+			{
+				string tmp;
+				boost::string_view val = getSpan(span, tmp);
+				ret.assign(val.data() + 2, val.length() - 2);
+				return true;
+			}
+		}
+		return false;
+	}
 	for (string::size_type i = start; i < parameters.size(); ++i)
 	{
 		if (parameters[i].length() >= 2 && code == toCode(parameters[i].c_str()))
@@ -295,6 +343,17 @@ bool AdcCommand::getParam(const char* name, size_t start, string& ret) const
 bool AdcCommand::hasFlag(const char* name, size_t start) const
 {
 	uint16_t code = toCode(name);
+	if (lazy)
+	{
+		const char* buf = buffer.data();
+		for (size_t i = start; i < spans.size(); ++i)
+		{
+			const ParamSpan& span = spans[i];
+			if (span.len == 3 && !span.escaped && code == toCode(buf + span.start) && buf[span.start + 2] == '1')
+				return true;
+		}
+		return false;
+	}
 	for (string::size_type i = start; i < parameters.size(); ++i)
 	{
 		if (parameters[i].length() == 3 && code == toCode(parameters[i].c_str()) && parameters[i][2] == '1')
@@ -22,6 +22,7 @@
 #include "typedefs.h"
 #include "CID.h"
 #include "BaseUtil.h"
+#include <boost/utility/string_view.hpp>
 
 class AdcCommand
 {
@@ -167,25 +168,39 @@ class AdcCommand
 			return *this;
 		}
 		
-		StringList& getParameters() { return parameters; }
-		const StringList& getParameters() const { return parameters; }
+		StringList& getParameters()
+		{
+			if (lazy) unpackParams();
+			return parameters;
+		}
+		const StringList& getParameters() const
+		{
+			if (lazy) unpackParams();
+			return parameters;
+		}
+		size_t getParamCount() const { return lazy ? spans.size() : parameters.size(); }
+		/** Returns the n-th parameter without copying it, tmp is used only when it must be unescaped */
+		boost::string_view getParamView(size_t n, string& tmp) const;
 		
 		string toString(const CID& aCID, bool nmdc = false) const;
 		string toString(uint32_t sid, bool nmdc = false) const;
 		
 		AdcCommand& addParam(const string& name, const string& value)
 		{
+			if (lazy) unpackParams();
 			parameters.push_back(name);
 			parameters.back() += value;
 			return *this;
 		}
 		AdcCommand& addParam(const string& str)
 		{
+			if (lazy) unpackParams();
 			parameters.push_back(str);
 			return *this;
 		}
 		const string& getParam(size_t n) const
 		{
+			if (lazy) unpackParams();
 			dcassert(parameters.size() > n);
 			return parameters.size() > n ? parameters[n] : Util::emptyString;
 		}
@@ -220,7 +235,18 @@ class AdcCommand
 	private:
 		string getHeaderString(const CID& cid) const;
 		string getHeaderString(uint32_t sid, bool nmdc) const;
-		StringList parameters;
+		struct ParamSpan
+		{
+			uint32_t start;
+			uint32_t len;
+			bool escaped;
+		};
+
+		// Parsed commands keep the received line and the locations of the parameters.
+		// The parameter list is built when it's requested.
+		string buffer;
+		mutable vector<ParamSpan> spans;
+		mutable StringList parameters;
 		string features;
 		union
 		{
@@ -230,6 +256,10 @@ class AdcCommand
 		uint32_t from;
 		uint32_t to;
 		char type;
+		mutable bool lazy;
+
+		boost::string_view getSpan(const ParamSpan& span, string& tmp) const;
+		void unpackParams() const;
 };
 
 template<class T>
@@ -233,7 +233,7 @@ void AdcHub::clearUsers()
 
 void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	OnlineUserPtr ou; // [!] IRainman fix: use OnlineUserPtr here!
 	string cidStr;
@@ -279,66 +279,71 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 	auto& id = ou->getIdentity();
 	string ip4;
 	string ip6;
-	for (auto i = c.getParameters().cbegin(); i != c.getParameters().cend(); ++i)
+	string tmp;
+	const size_t count = c.getParamCount();
+	for (size_t n = 0; n < count; ++n)
 	{
-		if (i->length() < 2)
+		const boost::string_view i = c.getParamView(n, tmp);
+		if (i.length() < 2)
 			continue;
+		// Values are followed by a space or a null character, so numbers can be parsed in place
+		const char* value = i.length() > 2 ? i.data() + 2 : "";
 
-		switch (*(const uint16_t*)i->c_str())
+		switch (*(const uint16_t*)i.data())
 		{
 			case TAG('S', 'L'):
 			{
-				id.setSlots(Util::toInt(i->c_str() + 2));
+				id.setSlots(Util::toInt(value));
 				break;
 			}
 			case TAG('F', 'S'):
 			{
-				id.setFreeSlots(Util::toInt(i->c_str() + 2));
+				id.setFreeSlots(Util::toInt(value));
 				break;
 			}
 			case TAG('S', 'S'):
 			{
-				changeBytesShared(id, Util::toInt64(i->c_str() + 2));
+				changeBytesShared(id, Util::toInt64(value));
 				break;
 			}
 			case TAG('S', 'U'):
 			{
-				AdcSupports::setSupports(id, i->substr(2));
+				AdcSupports::setSupports(id, i.substr(2).to_string());
 				break;
 			}
 			case TAG('S', 'F'):
 			{
-				id.setSharedFiles(Util::toInt(i->c_str() + 2));
+				id.setSharedFiles(Util::toInt(value));
 				break;
 			}
 			case TAG('I', '4'):
 			{
-				ip4 = i->substr(2);
+				ip4 = i.substr(2).to_string();
 				break;
 			}
 			case TAG('U', '4'):
 			{
-				id.setUdp4Port(Util::toInt(i->c_str() + 2));
+				id.setUdp4Port(Util::toInt(value));
 				break;
 			}
 			case TAG('I', '6'):
 			{
-				ip6 = i->substr(2);
+				ip6 = i.substr(2).to_string();
 				break;
 			}
 			case TAG('U', '6'):
 			{
-				id.setUdp6Port(Util::toInt(i->c_str() + 2));
+				id.setUdp6Port(Util::toInt(value));
 				break;
 			}
 			case TAG('E', 'M'):
 			{
-				id.setEmail(i->substr(2));
+				id.setEmail(i.data() + 2, i.length() - 2);
 				break;
 			}
 			case TAG('D', 'E'):
 			{
-				id.setDescription(i->substr(2));
+				id.setDescription(i.data() + 2, i.length() - 2);
 				break;
 			}
 			case TAG('C', 'O'):
@@ -354,7 +359,7 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			}
 			case TAG('D', 'S'):
 			{
-				id.setDownloadSpeed(Util::toUInt32(i->c_str() + 2));
+				id.setDownloadSpeed(Util::toUInt32(value));
 				break;
 			}
 			case TAG('O', 'P'):
@@ -365,54 +370,54 @@ void AdcHub::handle(AdcCommand::INF, const AdcCommand& c) noexcept
 			}
 			case TAG('C', 'T'):
 			{
-				id.setClientType(Util::toInt(i->c_str() + 2));
+				id.setClientType(Util::toInt(value));
 				break;
 			}
 			case TAG('U', 'S'):
 			{
-				id.setLimit(Util::toUInt32(i->c_str() + 2));
+				id.setLimit(Util::toUInt32(value));
 				break;
 			}
 			case TAG('H', 'N'):
 			{
-				id.setHubsNormal(Util::toUInt32(i->c_str() + 2));
+				id.setHubsNormal(Util::toUInt32(value));
 				break;
 			}
 			case TAG('H', 'R'):
 			{
-				id.setHubsRegistered(Util::toUInt32(i->c_str() + 2));
+				id.setHubsRegistered(Util::toUInt32(value));
 				break;
 			}
 			case TAG('H', 'O'):
 			{
-				id.setHubsOperator(Util::toUInt32(i->c_str() + 2));
+				id.setHubsOperator(Util::toUInt32(value));
 				break;
 			}
 			case TAG('N', 'I'):
 			{
-				id.setNick(i->substr(2));
+				id.setNick(i.substr(2).to_string());
 				break;
 			}
 			case TAG('A', 'W'):
 			{
-				id.setStatusBit(Identity::SF_AWAY, i->length() == 3 && (*i)[2] == '1');
+				id.setStatusBit(Identity::SF_AWAY, i.length() == 3 && i[2] == '1');
 				break;
 			}
 #ifdef _DEBUG
 			case TAG('V', 'E'):
 			{
-				id.setStringParam("VE", i->substr(2));
+				id.setStringParam("VE", i.data() + 2, i.length() - 2);
 				break;
 			}
 			case TAG('A', 'P'):
 			{
-				id.setStringParam("AP", i->substr(2));
+				id.setStringParam("AP", i.data() + 2, i.length() - 2);
 				break;
 			}
 #endif
 			default:
 			{
-				id.setStringParam(i->c_str(), i->substr(2));
+				id.setStringParam(i.data(), i.data() + 2, i.length() - 2);
 			}
 		}
 	}
@@ -494,7 +499,7 @@ void AdcHub::handle(AdcCommand::SUP, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::SID, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 		
 	{
@@ -516,7 +521,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 	if (getSuppressChatAndPM())
 		return;
 	
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	auto user = findUser(c.getFrom());
 	if (!user)
@@ -554,7 +559,7 @@ void AdcHub::handle(AdcCommand::MSG, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GPA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	
 	setRegistered();
@@ -635,7 +640,7 @@ void AdcHub::handle(AdcCommand::CTM, const AdcCommand& c) noexcept
 	OnlineUserPtr ou = findUser(c.getFrom());
 	if (!ou || ou->getUser()->isMe())
 		return;
-	if (c.getParameters().size() < 3)
+	if (c.getParamCount() < 3)
 		return;
 		
 	const string& protocol = c.getParam(0);
@@ -687,7 +692,7 @@ void AdcHub::handle(AdcCommand::ZOF, const AdcCommand&) noexcept
 
 void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 		return;
 	
 	uint16_t localPort;
@@ -745,7 +750,7 @@ void AdcHub::handle(AdcCommand::RCM, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::CMD, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 		return;
 	if (!isFeatureSupported(FEATURE_FLAG_USER_COMMANDS))
 		return;
@@ -808,7 +813,7 @@ void AdcHub::sendUDP(const AdcCommand& cmd) noexcept
 
 void AdcHub::handle(AdcCommand::STA, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 		return;
 		
 	OnlineUserPtr ou;
@@ -925,7 +930,7 @@ void AdcHub::handle(AdcCommand::PSR, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::GET, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().empty())
+	if (c.getParamCount() == 0)
 	{
 		send(AdcCommand(AdcCommand::SEV_FATAL, AdcCommand::ERROR_PROTOCOL_GENERIC, "Too few parameters for GET", AdcCommand::TYPE_HUB));
 		return;
@@ -938,7 +943,7 @@ void AdcHub::handle(AdcCommand::GET, const AdcCommand& c) noexcept
 	}
 	
 	string sk, sh;
-	if (c.getParameters().size() < 5 || !c.getParam("BK", 4, sk) || !c.getParam("BH", 4, sh))
+	if (c.getParamCount() < 5 || !c.getParam("BK", 4, sk) || !c.getParam("BH", 4, sh))
 	{
 		send(AdcCommand(AdcCommand::SEV_FATAL, AdcCommand::ERROR_PROTOCOL_GENERIC, "Too few parameters for blom", AdcCommand::TYPE_HUB));
 		return;
@@ -985,7 +990,7 @@ void AdcHub::handle(AdcCommand::GET, const AdcCommand& c) noexcept
 
 void AdcHub::handle(AdcCommand::NAT, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 3)
+	if (c.getParamCount() < 3)
 		return;
 	
 	uint16_t localPort;
@@ -1033,7 +1038,7 @@ void AdcHub::handle(AdcCommand::RNT, const AdcCommand& c) noexcept
 {
 	// Sent request for NAT traversal cooperation, which
 	// was acknowledged (with requisite local port information).
-	if (c.getParameters().size() < 3)
+	if (c.getParamCount() < 3)
 		return;
 	
 	uint16_t localPort;
@@ -1567,7 +1572,7 @@ void AdcHub::info(bool/* forceUpdate*/)
 
 	addInfoParam(c, "SU", su);
 
-	if (!c.getParameters().empty())
+	if (c.getParamCount() != 0)
 		send(c);
 }
 
@@ -0,0 +1,166 @@
+#include "stdinc.h"
+#include "BZCompressor.h"
+#include <thread>
+
+BZBlockCompressor::BZBlockCompressor(unsigned maxThreads) : stopFlag(false)
+{
+	if (!maxThreads)
+	{
+		maxThreads = std::thread::hardware_concurrency();
+		if (!maxThreads) maxThreads = 1;
+	}
+	this->maxThreads = maxThreads;
+	workEvent.create();
+	doneEvent.create();
+	input.reserve(BZBlock::MAX_INPUT_SIZE);
+}
+
+BZBlockCompressor::~BZBlockCompressor()
+{
+	{
+		LOCK(cs);
+		stopFlag = true;
+		workEvent.notify();
+	}
+	for (auto& worker : workers)
+		worker->join();
+}
+
+void BZBlockCompressor::addData(const void* data, size_t len)
+{
+	const char* p = static_cast<const char*>(data);
+	while (len)
+	{
+		size_t part = min(len, BZBlock::MAX_INPUT_SIZE - input.length());
+		input.append(p, part);
+		p += part;
+		len -= part;
+		if (input.length() == BZBlock::MAX_INPUT_SIZE)
+			addJob();
+	}
+}
+
+void BZBlockCompressor::finishBlocks()
+{
+	if (!input.empty())
+		addJob();
+	while (!jobs.empty())
+		writeJob();
+}
+
+void BZBlockCompressor::addJob()
+{
+	auto job = std::make_shared<Job>();
+	job->data.swap(input);
+	input.reserve(BZBlock::MAX_INPUT_SIZE);
+	jobs.push_back(job);
+	{
+		LOCK(cs);
+		queue.push_back(job.get());
+		workEvent.notify();
+	}
+	// The writing thread compresses too while it waits
+	if (workers.size() + 1 < maxThreads && jobs.size() > workers.size() + 1)
+	{
+		workers.emplace_back(new Worker(*this));
+		workers.back()->start(0, "BZBlockCompressor");
+	}
+	while (jobs.size() >= 2 * maxThreads)
+		writeJob();
+}
+
+void BZBlockCompressor::writeJob()
+{
+	Job* job = jobs.front().get();
+	while (true)
+	{
+		Job* other = nullptr;
+		{
+			LOCK(cs);
+			if (job->done) break;
+			if (!queue.empty())
+			{
+				other = queue.front();
+				queue.pop_front();
+			}
+			else
+				doneEvent.reset();
+		}
+		if (other)
+			compress(other);
+		else
+			doneEvent.wait();
+	}
+	auto item = std::move(jobs.front());
+	jobs.pop_front();
+	if (item->failed)
+		throw Exception(item->error);
+	writeBlock(item->block, item->data);
+}
+
+void BZBlockCompressor::compress(Job* job) noexcept
+{
+	try
+	{
+		job->block.compress(job->data.data(), job->data.length());
+	}
+	catch (const Exception& e)
+	{
+		job->error = e.getError();
+		job->failed = true;
+	}
+	LOCK(cs);
+	job->done = true;
+	doneEvent.notify();
+}
+
+int BZBlockCompressor::Worker::run()
+{
+	while (true)
+	{
+		Job* job = nullptr;
+		{
+			LOCK(compressor.cs);
+			if (compressor.stopFlag) break;
+			if (!compressor.queue.empty())
+			{
+				job = compressor.queue.front();
+				compressor.queue.pop_front();
+			}
+			else
+				compressor.workEvent.reset();
+		}
+		if (job)
+			compressor.compress(job);
+		else
+			compressor.workEvent.wait();
+	}
+	return 0;
+}
+
+size_t ParallelBZOutputStream::write(const void* buf, size_t len)
+{
+	dcassert(len > 0);
+	if (flushed)
+		throw Exception("No filtered writes after flush");
+	int64_t prevSize = writer.getOutputSize();
+	addData(buf, len);
+	return static_cast<size_t>(writer.getOutputSize() - prevSize);
+}
+
+size_t ParallelBZOutputStream::flushBuffers(bool force)
+{
+	if (flushed)
+		return 0;
+
+	flushed = true;
+	int64_t prevSize = writer.getOutputSize();
+	finishBlocks();
+	writer.finish();
+	return static_cast<size_t>(writer.getOutputSize() - prevSize) + os->flushBuffers(force);
+}
+
+void ParallelBZOutputStream::writeBlock(const BZBlock& block, const string& /*data*/)
+{
+	writer.write(block);
+}
@@ -0,0 +1,93 @@
+#ifndef BZ_COMPRESSOR_H_
+#define BZ_COMPRESSOR_H_
+
+#include "BZUtils.h"
+#include "Streams.h"
+#include "Thread.h"
+#include "Locks.h"
+#include "WaitableEvent.h"
+
+/**
+ * Splits data into independent bzip2 blocks and compresses them on worker threads.
+ * Compressed blocks are passed to writeBlock in the original order.
+ * Workers are started only when there is more than one block to compress.
+ */
+class BZBlockCompressor
+{
+	public:
+		explicit BZBlockCompressor(unsigned maxThreads = 0);
+		virtual ~BZBlockCompressor();
+
+		BZBlockCompressor(const BZBlockCompressor&) = delete;
+		BZBlockCompressor& operator= (const BZBlockCompressor&) = delete;
+
+	protected:
+		void addData(const void* data, size_t len);
+		/**
+		 * Compress the remaining data and wait for all blocks to be written.
+		 */
+		void finishBlocks();
+		size_t getPendingSize() const { return input.length(); }
+
+		virtual void writeBlock(const BZBlock& block, const string& data) = 0;
+
+	private:
+		struct Job
+		{
+			string data;
+			BZBlock block;
+			string error;
+			bool failed = false;
+			bool done = false;
+		};
+
+		class Worker : public Thread
+		{
+			public:
+				explicit Worker(BZBlockCompressor& compressor) : compressor(compressor) {}
+
+			protected:
+				int run() override;
+
+			private:
+				BZBlockCompressor& compressor;
+		};
+
+		string input;
+		std::deque<std::shared_ptr<Job>> jobs; // in output order, used only by the writing thread
+		std::deque<Job*> queue; // waiting for compression
+		vector<std::unique_ptr<Worker>> workers;
+		unsigned maxThreads;
+		bool stopFlag;
+		FastCriticalSection cs;
+		WaitableEvent workEvent;
+		WaitableEvent doneEvent;
+
+		void addJob();
+		void writeJob();
+		void compress(Job* job) noexcept;
+};
+
+/**
+ * Multithreaded bzip2 output stream producing a standard single stream file.
+ * Can be used in place of FilteredOutputStream<BZFilter>.
+ */
+class ParallelBZOutputStream : public OutputStream, private BZBlockCompressor
+{
+	public:
+		explicit ParallelBZOutputStream(OutputStream* os, unsigned maxThreads = 0) :
+			BZBlockCompressor(maxThreads), os(os), writer(os), flushed(false) {}
+
+		using OutputStream::write;
+		size_t write(const void* buf, size_t len) override;
+		size_t flushBuffers(bool force) override;
+
+	private:
+		OutputStream* os;
+		BZBlockWriter writer;
+		bool flushed;
+
+		void writeBlock(const BZBlock& block, const string& data) override;
+};
+
+#endif // BZ_COMPRESSOR_H_
@@ -20,6 +20,7 @@
 #include "BZUtils.h"
 #include "Exception.h"
 #include "ResourceManager.h"
+#include "Streams.h"
 
 BZFilter::BZFilter()
 {
@@ -104,3 +105,118 @@ bool UnBZFilter::operator()(const void* in, size_t& insize, void* out, size_t& o
 	insize = insize - zs.avail_in;
 	return err == BZ_OK;
 }
+
+static const uint64_t BZ_BLOCK_MAGIC = 0x314159265359ull;
+static const uint64_t BZ_EOS_MAGIC = 0x177245385090ull;
+
+static uint64_t getBits(const uint8_t* data, uint64_t pos, int count)
+{
+	uint64_t result = 0;
+	for (int i = 0; i < count; ++i, ++pos)
+		result = result << 1 | ((data[pos >> 3] >> (7 - (pos & 7))) & 1);
+	return result;
+}
+
+void BZBlock::compress(const void* in, size_t size)
+{
+	dcassert(size && size <= MAX_INPUT_SIZE);
+	ByteVector out(size + size / 100 + 600);
+	unsigned outSize = out.size();
+	if (BZ2_bzBuffToBuffCompress(reinterpret_cast<char*>(out.data()), &outSize, (char*) in, size, 9, 0, 30) != BZ_OK)
+		throw Exception(STRING(COMPRESSION_ERROR));
+
+	// "BZh9", block magic, block CRC, block data, end of stream magic, stream CRC, padding
+	const uint8_t* p = out.data();
+	if (outSize < 24 || memcmp(p, "BZh9", 4) || getBits(p, 32, 48) != BZ_BLOCK_MAGIC)
+		throw Exception(STRING(COMPRESSION_ERROR));
+	crc = (uint32_t) getBits(p, 80, 32);
+
+	// Stream CRC of a single block stream equals to the block CRC
+	const uint64_t totalBits = (uint64_t) outSize << 3;
+	uint64_t end = 0;
+	for (int pad = 0; pad < 8; ++pad)
+	{
+		uint64_t pos = totalBits - 80 - pad;
+		if (getBits(p, pos, 48) == BZ_EOS_MAGIC && getBits(p, pos + 48, 32) == crc)
+		{
+			end = pos;
+			break;
+		}
+	}
+	if (end <= 32)
+		throw Exception(STRING(COMPRESSION_ERROR));
+
+	bits = end - 32;
+	data.assign(p + 4, p + 4 + (bits + 7) / 8);
+	if (bits & 7)
+		data.back() &= 0xFF << (8 - (bits & 7));
+}
+
+BZBlockWriter::BZBlockWriter(OutputStream* os) : os(os), outputSize(0), combinedCRC(0), bitBuf(0), bitCount(0)
+{
+	buf.reserve(256 * 1024);
+	static const char header[] = "BZh9";
+	buf.insert(buf.end(), header, header + 4);
+}
+
+void BZBlockWriter::putBits(uint32_t value, int count)
+{
+	dcassert(count > 0 && count <= 24);
+	bitBuf = bitBuf << count | (value & ((1u << count) - 1));
+	bitCount += count;
+	while (bitCount >= 8)
+	{
+		bitCount -= 8;
+		buf.push_back((uint8_t) (bitBuf >> bitCount));
+	}
+	bitBuf &= (1u << bitCount) - 1;
+}
+
+void BZBlockWriter::flushBuf(bool force)
+{
+	if (buf.size() >= 128 * 1024 || (force && !buf.empty()))
+	{
+		os->write(buf.data(), buf.size());
+		outputSize += buf.size();
+		buf.clear();
+	}
+}
+
+void BZBlockWriter::write(const BZBlock& block)
+{
+	combinedCRC = (combinedCRC << 1 | combinedCRC >> 31) ^ block.crc;
+
+	const uint8_t* p = block.data.data();
+	size_t fullBytes = block.bits >> 3;
+	if (bitCount == 0)
+	{
+		flushBuf(true);
+		os->write(p, fullBytes);
+		outputSize += fullBytes;
+	}
+	else
+	{
+		const int shift = bitCount;
+		for (size_t i = 0; i < fullBytes; ++i)
+		{
+			buf.push_back((uint8_t) (bitBuf << (8 - shift) | p[i] >> shift));
+			bitBuf = p[i] & ((1u << shift) - 1);
+			if (buf.size() >= 128 * 1024) flushBuf(false);
+		}
+	}
+	int rest = block.bits & 7;
+	if (rest)
+		putBits(p[fullBytes] >> (8 - rest), rest);
+	flushBuf(false);
+}
+
+void BZBlockWriter::finish()
+{
+	putBits((uint32_t) (BZ_EOS_MAGIC >> 24), 24);
+	putBits((uint32_t) BZ_EOS_MAGIC, 24);
+	putBits(combinedCRC >> 16, 16);
+	putBits(combinedCRC, 16);
+	if (bitCount)
+		putBits(0, 8 - bitCount);
+	flushBuf(true);
+}
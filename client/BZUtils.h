@@ -20,6 +20,9 @@
 #define BZ_UTILS_H_
 
 #include <bzlib.h>
+#include "typedefs.h"
+
+class OutputStream;
 
 class BZFilter
 {
@@ -59,4 +62,44 @@ class UnBZFilter
 		bz_stream zs;
 };
 
+/**
+ * A single bzip2 block compressed on its own. Blocks can be spliced into
+ * one standard bzip2 stream by BZBlockWriter in any order, so parts of a
+ * stream can be cached or compressed independently.
+ */
+struct BZBlock
+{
+	// Input of this size always fits into one 900k block (RLE1 expands data by 1.25 at most)
+	static const size_t MAX_INPUT_SIZE = 683 * 1024;
+
+	ByteVector data; // Block bits starting with the block header
+	uint64_t bits = 0;
+	uint32_t crc = 0;
+
+	void compress(const void* in, size_t size);
+};
+
+class BZBlockWriter
+{
+	public:
+		explicit BZBlockWriter(OutputStream* os);
+		void write(const BZBlock& block);
+		/**
+		* Write the end of stream marker. Output is not flushed.
+		*/
+		void finish();
+		int64_t getOutputSize() const { return outputSize; }
+
+	private:
+		OutputStream* os;
+		ByteVector buf;
+		int64_t outputSize;
+		uint32_t combinedCRC;
+		uint32_t bitBuf;
+		int bitCount;
+
+		void putBits(uint32_t value, int count);
+		void flushBuf(bool force);
+};
+
 #endif // !defined(BZ_UTILS_H_)
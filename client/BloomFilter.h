@@ -62,6 +62,28 @@ class BloomFilter
 		{
 			std::fill_n(table.begin(), table.size(), false);
 		}
+		void swap(BloomFilter& other)
+		{
+			table.swap(other.table);
+		}
+		size_t getTableSize() const
+		{
+			return table.size();
+		}
+		// Bits packed starting from the least significant bit of the first byte
+		void getBits(ByteVector& out) const
+		{
+			out.assign((table.size() + 7) / 8, 0);
+			for (size_t i = 0; i < table.size(); ++i)
+				if (table[i])
+					out[i >> 3] |= 1 << (i & 7);
+		}
+		void addBits(const uint8_t* data)
+		{
+			for (size_t i = 0; i < table.size(); ++i)
+				if (data[i >> 3] & 1 << (i & 7))
+					table[i] = true;
+		}
 		void getInfo(size_t& size, size_t& used) const
 		{
 			size = table.size();
@@ -139,6 +139,7 @@ BufferedSocket::BufferedSocket(char separator, BufferedSocketListener* listener)
 	protocol = Socket::PROTO_DEFAULT;
 	state = STARTING;
 	pollMask = pollState = 0;
+	throttled = false;
 	mode = MODE_LINE;
 	remainingSize = (size_t) -1;
 	maxLineSize = SETTING(MAX_COMMAND_LENGTH);
@@ -150,6 +151,9 @@ BufferedSocket::BufferedSocket(char separator, BufferedSocketListener* listener)
 	updateSent = updateReceived = 0;
 	gracefulDisconnectTimeout = 0;
 	ipVersion = 0;
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+	reactorAttached = false;
+#endif
 #ifdef FLYLINKDC_USE_SOCKET_COUNTER
 	++socketCounter;
 #endif
@@ -168,6 +172,18 @@ void BufferedSocket::start()
 	Thread::start(64, "BufferedSocket");
 }
 
+void BufferedSocket::joinThread()
+{
+	join();
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+	if (reactorAttached)
+	{
+		reactorDetachedEvent.wait();
+		reactorAttached = false;
+	}
+#endif
+}
+
 int BufferedSocket::run()
 {
 	const bool doLog = BOOLSETTING(LOG_SOCKET_INFO) && BOOLSETTING(LOG_SYSTEM);
@@ -180,10 +196,20 @@ int BufferedSocket::run()
 		{
 			if (state == RUNNING || state == CONNECT_PROXY)
 			{
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+				if (state == RUNNING && attachToReactor())
+				{
+					if (doLog)
+						LogManager::message("BufferedSocket " + Util::toHexString(this) + ": Attached to reactor, thread stopped", false);
+					return 0;
+				}
+#endif
 				int waitMask = pollState ^ (Socket::WAIT_READ | Socket::WAIT_WRITE);
-				if (waitMask)
+				if (throttled || waitMask)
 				{
-					int timeout = mode == MODE_DATA ? POLL_TIMEOUT : DISCONNECT_TIMEOUT;
+					// When out of tokens, retry in the next round
+					int timeout = throttled ? ThrottleManager::getInstance()->getRetryDelay() :
+						mode == MODE_DATA ? POLL_TIMEOUT : DISCONNECT_TIMEOUT;
 					int waitResult = sock->wait(timeout, waitMask | Socket::WAIT_CONTROL);
 					if (waitResult & Socket::WAIT_WRITE)
 						pollState |= Socket::WAIT_WRITE;
@@ -198,33 +224,52 @@ int BufferedSocket::run()
 					if (!dbg.empty()) dcdebug("%p wait:%s\n", this, dbg.c_str());
 #endif
 				}
-				processTask();
-				if (pollState & Socket::WAIT_WRITE)
-					writeData();
-				if (pollState & Socket::WAIT_READ)
-					readData();
+				processEvents();
 			} else
 			if (!processTask())
 				Thread::sleep(POLL_TIMEOUT);
 		}
 		catch (const Exception& e)
 		{
-			if (doLog)
-			{
-				string sockName;
-				printSockName(sockName);
-				LogManager::message(sockName + ": " + e.getError(), false);
-			}
-			if (sock)
-				sock->disconnect();
-			if (state != FAILED)
-			{
-				state = FAILED;
-				if (listener) listener->onFailed(e.getError());
-			}
+			handleException(e, doLog);
 			break;
 		}
 	}
+	closeSocket();
+	if (doLog)
+		LogManager::message("BufferedSocket " + Util::toHexString(this) + ": Thread stopped", false);
+	return 0;
+}
+
+void BufferedSocket::processEvents()
+{
+	throttled = false;
+	processTask();
+	if (pollState & Socket::WAIT_WRITE)
+		writeData();
+	if (pollState & Socket::WAIT_READ)
+		readData();
+}
+
+void BufferedSocket::handleException(const Exception& e, bool doLog) noexcept
+{
+	if (doLog)
+	{
+		string sockName;
+		printSockName(sockName);
+		LogManager::message(sockName + ": " + e.getError(), false);
+	}
+	if (sock)
+		sock->disconnect();
+	if (state != FAILED)
+	{
+		state = FAILED;
+		if (listener) listener->onFailed(e.getError());
+	}
+}
+
+void BufferedSocket::closeSocket() noexcept
+{
 	if (sock)
 		sock->close();
 	if (state != FAILED)
@@ -232,11 +277,60 @@ int BufferedSocket::run()
 		state = FAILED;
 		if (listener) listener->onFailed(STRING(DISCONNECTED));
 	}
-	if (doLog)
-		LogManager::message("BufferedSocket " + Util::toHexString(this) + ": Thread stopped", false);
-	return 0;
 }
 
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+bool BufferedSocket::attachToReactor()
+{
+	if (!BOOLSETTING(USE_SOCKET_REACTOR) || !SocketReactor::isValidInstance())
+		return false;
+	if (!reactorDetachedEvent.create())
+		return false;
+	// Must be set before the handler is added: the reactor may detach it at any moment
+	reactorAttached = true;
+	if (SocketReactor::getInstance()->addHandler(this, sock->getSock(), sock->getControlEventHandle()))
+		return true;
+	reactorAttached = false;
+	return false;
+}
+
+int BufferedSocket::onReactorEvent(int events) noexcept
+{
+	if (stopFlag)
+		return RESULT_DONE;
+	pollState |= events & (Socket::WAIT_READ | Socket::WAIT_WRITE);
+	try
+	{
+		processEvents();
+	}
+	catch (const Exception& e)
+	{
+		handleException(e, BOOLSETTING(LOG_SOCKET_INFO) && BOOLSETTING(LOG_SYSTEM));
+		return RESULT_DONE;
+	}
+	if (stopFlag)
+		return RESULT_DONE;
+	// Throttled sockets are retried on the reactor timer
+	if (throttled)
+		return RESULT_WAIT;
+	return (pollState & Socket::WAIT_READ) ? RESULT_AGAIN : RESULT_WAIT;
+}
+
+int BufferedSocket::getReactorWaitMask() const noexcept
+{
+	return pollState ^ (Socket::WAIT_READ | Socket::WAIT_WRITE);
+}
+
+void BufferedSocket::onReactorDetached() noexcept
+{
+	closeSocket();
+	if (BOOLSETTING(LOG_SOCKET_INFO) && BOOLSETTING(LOG_SYSTEM))
+		LogManager::message("BufferedSocket " + Util::toHexString(this) + ": Detached from reactor", false);
+	// The owner may destroy the socket as soon as the event is signaled
+	reactorDetachedEvent.notify();
+}
+#endif
+
 void BufferedSocket::readData()
 {
 	while (!stopFlag)
@@ -257,7 +351,9 @@ void BufferedSocket::readData()
 			result = sock->read(readBuf, readSize);
 		if (result == 0)
 			throw SocketException(STRING(CONNECTION_CLOSED));
-		if (result < 0)
+		if (result == ThrottleManager::THROTTLED)
+			throttled = true;
+		else if (result < 0)
 			pollState &= ~Socket::WAIT_READ; // EWOULDBLOCK
 		else
 		{
@@ -292,7 +388,7 @@ void BufferedSocket::readData()
 		}
 		if (resizeFlag) rb.grow();
 		rb.maybeShift();
-		if (!(pollState & Socket::WAIT_READ)) break;
+		if (throttled || !(pollState & Socket::WAIT_READ)) break;
 	}
 }
 
@@ -324,6 +420,26 @@ void BufferedSocket::writeData()
 		}
 		stream = outStream;
 	}
+#ifdef FLYLINKDC_USE_ZERO_COPY
+	// Plain TCP and no throttling: send the file directly from the page cache
+	if (stream && sb.readPtr == sb.writePtr &&
+	    sock->getSecureTransport() != Socket::SECURE_TRANSPORT_SSL &&
+	    ThrottleManager::getInstance()->isWriteUnlimited(sock.get()))
+	{
+		int64_t bytesLeft;
+		int fd = stream->getFileDescriptor(bytesLeft);
+		if (fd != -1)
+		{
+			if (!writeFileData(stream, fd, bytesLeft)) return;
+			{
+				LOCK(cs);
+				outStream = nullptr;
+			}
+			if (listener) listener->onTransmitDone();
+			return;
+		}
+	}
+#endif
 	bool transmitDone = false;
 	do
 	{
@@ -356,6 +472,11 @@ void BufferedSocket::writeData()
 			{
 				size_t writeSize = sb.writePtr - sb.readPtr;
 				int result = ThrottleManager::getInstance()->write(sock.get(), sb.buf + sb.readPtr, writeSize);
+				if (result == ThrottleManager::THROTTLED)
+				{
+					throttled = true;
+					return;
+				}
 				if (result < 0)
 				{
 					// EWOULDBLOCK
@@ -376,6 +497,31 @@ void BufferedSocket::writeData()
 		listener->onTransmitDone();
 }
 
+#ifdef FLYLINKDC_USE_ZERO_COPY
+// Returns false if the transfer is not finished yet
+bool BufferedSocket::writeFileData(InputStream* stream, int fd, int64_t bytesLeft)
+{
+	while (bytesLeft)
+	{
+		if (stopFlag) return false;
+		size_t sendSize = STREAM_BUF_SIZE;
+		if (bytesLeft != -1 && bytesLeft < (int64_t) sendSize) sendSize = (size_t) bytesLeft;
+		int result = sock->sendFile(fd, sendSize);
+		if (result < 0)
+		{
+			// EWOULDBLOCK
+			pollState &= ~Socket::WAIT_WRITE;
+			return false;
+		}
+		if (!result) break; // EOF
+		stream->skipSent(result);
+		if (bytesLeft != -1) bytesLeft -= result;
+		if (listener) listener->onBytesSent(result, result);
+	}
+	return true;
+}
+#endif
+
 void BufferedSocket::parseData(Buffer& b)
 {
 	bool doTrace = BOOLSETTING(LOG_TCP_MESSAGES);
@@ -6,11 +6,15 @@
 #include "Thread.h"
 #include "Locks.h"
 #include "Ip4Address.h"
+#include "SocketReactor.h"
 
 class UnZFilter;
 class InputStream;
 
 class BufferedSocket : private Thread
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+	, private SocketReactorHandler
+#endif
 {
 	public:
 		enum Modes
@@ -100,6 +104,11 @@ class BufferedSocket : private Thread
 			if (hasSocket())
 				sock->updateSocketBucket(connectionCount, tick);
 		}
+		void setThrottleClass(int throttleClass)
+		{
+			if (hasSocket())
+				sock->setThrottleClass(throttleClass);
+		}
 
 		void write(const string& data)
 		{
@@ -115,7 +124,7 @@ class BufferedSocket : private Thread
 		}
 
 		void start();
-		void joinThread() { join(); }
+		void joinThread();
 	
 	private:
 		enum State
@@ -189,6 +198,7 @@ class BufferedSocket : private Thread
 		State state;
 		int pollMask;
 		int pollState;
+		bool throttled;
 		Buffer rb;
 		Buffer wb;
 		Buffer zb;
@@ -212,12 +222,22 @@ class BufferedSocket : private Thread
 		uint64_t gracefulDisconnectTimeout;
 		BufferedSocketListener* listener;
 		int ipVersion;
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+		bool reactorAttached;
+		WaitableEvent reactorDetachedEvent;
+#endif
 
 		BufferedSocket(char separator, BufferedSocketListener* listener);
 		virtual ~BufferedSocket();
 
 		void writeData();
+#ifdef FLYLINKDC_USE_ZERO_COPY
+		bool writeFileData(InputStream* stream, int fd, int64_t bytesLeft);
+#endif
 		void readData();
+		void processEvents();
+		void handleException(const Exception& e, bool doLog) noexcept;
+		void closeSocket() noexcept;
 		bool processTask();
 		void parseData(Buffer& b);
 		void consumeData();
@@ -230,6 +250,13 @@ class BufferedSocket : private Thread
 		void checkSocksReply();
 		void printSockName(string& sockName) const;
 
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+		bool attachToReactor();
+		virtual int onReactorEvent(int events) noexcept override;
+		virtual int getReactorWaitMask() const noexcept override;
+		virtual void onReactorDetached() noexcept override;
+#endif
+
 	protected:
 		virtual int run() override;
 };
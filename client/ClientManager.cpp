@@ -936,18 +936,27 @@ void ClientManager::on(AdcSearch, const Client* c, const AdcCommand& adc, const
 	CID shareGroup;
 	getShareGroup(ou, hideShare, shareGroup);
 	AdcSearchParam param(adc.getParameters(), isUdpActive ? SearchParamBase::MAX_RESULTS_ACTIVE : SearchParamBase::MAX_RESULTS_PASSIVE, shareGroup);
-	ClientManagerListener::SearchReply re;
-	if (hideShare)
-		re = ClientManagerListener::SEARCH_MISS;
-	else if (!param.hasRoot && BOOLSETTING(INCOMING_SEARCH_TTH_ONLY))
-		re = ClientManagerListener::SEARCH_MISS;
-	else
-		re = SearchManager::getInstance()->respond(param, ou, c->getHubUrl(), hubIp, hubPort);
-	if (g_isSpyFrame)
+	if (hideShare || (!param.hasRoot && BOOLSETTING(INCOMING_SEARCH_TTH_ONLY)))
 	{
-		string description = param.getDescription();
-		Speaker<ClientManagerListener>::fire(ClientManagerListener::IncomingSearch(), ClientBase::TYPE_ADC, "Hub:" + ou->getIdentity().getNick(), c->getHubUrl(), description, re);
+		if (g_isSpyFrame)
+		{
+			string description = param.getDescription();
+			Speaker<ClientManagerListener>::fire(ClientManagerListener::IncomingSearch(), ClientBase::TYPE_ADC, "Hub:" + ou->getIdentity().getNick(), c->getHubUrl(), description, ClientManagerListener::SEARCH_MISS);
+		}
+		return;
 	}
+	// The token is sent back with the results, so it is not a part of the key
+	string key = "ADC ";
+	key += Util::toString(param.maxResults);
+	key += '|';
+	key += shareGroup.toBase32();
+	for (const string& p : adc.getParameters())
+		if (p.compare(0, 2, "TO", 2))
+		{
+			key += ' ';
+			key += p;
+		}
+	SearchManager::getInstance()->respond(param, key, ou, c->getHubUrl(), hubIp, hubPort);
 }
 
 void ClientManager::search(const SearchParamToken& sp)
@@ -216,6 +216,7 @@ class ClientManager : public Speaker<ClientManagerListener>,
 		
 		friend class Singleton<ClientManager>;
 		friend class NmdcHub;
+		friend class SearchManager;
 		
 		ClientManager();
 		~ClientManager();
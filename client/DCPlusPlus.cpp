@@ -26,6 +26,7 @@
 #include "QueueManager.h"
 #include "HashManager.h"
 #include "SearchManager.h"
+#include "IncomingSearchQueue.h"
 #include "LogManager.h"
 #include "FinishedManager.h"
 #include "ADLSearch.h"
@@ -36,6 +37,7 @@
 #include "HublistManager.h"
 #include "DatabaseManager.h"
 #include "dht/DHT.h"
+#include "SocketReactor.h"
 
 #include "IpGuard.h"
 #include "IpTrust.h"
@@ -82,6 +84,9 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 	VLDEnable();
 #endif
 	HublistManager::newInstance();
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+	SocketReactor::newInstance();
+#endif
 	SearchManager::newInstance();
 	ConnectionManager::newInstance();
 	DownloadManager::newInstance();
@@ -89,6 +94,7 @@ void startup(PROGRESSCALLBACKPROC pProgressCallbackProc, void* pProgressParam, G
 
 	QueueManager::newInstance();
 	LOAD_STEP_L(STARTUP_SHARE_MANAGER, ShareManager::newInstance());
+	IncomingSearchQueue::newInstance();
 	FavoriteManager::newInstance();
 	LOAD_STEP_L(STARTUP_IGNORE_LIST, UserManager::newInstance());
 	if (pGuiInitProc) pGuiInitProc(pGuiParam);
@@ -147,6 +153,7 @@ void preparingCoreToShutdown()
 		WebServerManager::getInstance()->shutdown();
 #endif
 		ClientManager::prepareClose();
+		IncomingSearchQueue::getInstance()->shutdown();
 		ShareManager::getInstance()->shutdown();
 #ifdef DEBUG_SHUTDOWN
 		sl.step("ShareManager");
@@ -236,6 +243,9 @@ void shutdown(GUIINITPROC pGuiInitProc, void *pGuiParam)
 #ifdef DEBUG_SHUTDOWN
 		LogManager::message("BufferedSockets deleted", false);
 #endif
+#endif
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+		SocketReactor::deleteInstance();
 #endif
 
 		ConnectivityManager::deleteInstance();
@@ -246,6 +256,7 @@ void shutdown(GUIINITPROC pGuiInitProc, void *pGuiParam)
 		{
 			pGuiInitProc(pGuiParam);
 		}
+		IncomingSearchQueue::deleteInstance();
 		ADLSearchManager::deleteInstance();
 		FinishedManager::deleteInstance();
 		ShareManager::deleteInstance();
@@ -274,6 +285,7 @@ void shutdown(GUIINITPROC pGuiInitProc, void *pGuiParam)
 		DatabaseManager::deleteInstance();
 		DatabaseManager::shutdown();
 		TimerManager::deleteInstance();
+		LogManager::shutdown();
 
 		SettingsManager::getInstance()->removeListeners();
 		SettingsManager::deleteInstance();
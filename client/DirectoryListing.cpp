@@ -507,6 +507,81 @@ void ListLoader::startTag(const string& name, StringPairList& attribs, bool simp
 	}
 }
 
+class ListScanner : public SimpleXMLReader::CallBack
+{
+	public:
+		ListScanner(DirectoryListing::ListVisitor& visitor, std::atomic_bool& abortFlag) :
+			visitor(visitor), abortFlag(abortFlag), inListing(false) {}
+
+		void startTag(const string& name, StringPairList& attribs, bool simple);
+		void endTag(const string& name, const string& data);
+
+	private:
+		DirectoryListing::ListVisitor& visitor;
+		std::atomic_bool& abortFlag;
+		bool inListing;
+};
+
+void ListScanner::startTag(const string& name, StringPairList& attribs, bool simple)
+{
+	if (ClientManager::isBeforeShutdown() || abortFlag.load())
+		throw AbortException("ListScanner::startTag - " + STRING(ABORT_EM));
+
+	if (!inListing)
+	{
+		if (name == tagFileListing && !simple)
+			inListing = true;
+		return;
+	}
+	if (name == tagFile)
+	{
+		const string& valFilename = getAttrib(attribs, attrName, 0);
+		const string& valSize = getAttrib(attribs, attrSize, 1);
+		const string& valTTH = getAttrib(attribs, attrTTH, 2);
+		if (valFilename.empty() || valSize.empty() || valTTH.length() != 39) return;
+
+		TTHValue tth;
+		bool error;
+		Encoder::fromBase32(valTTH.c_str(), tth.data, sizeof(tth.data), &error);
+		if (error || tth.isZero()) return;
+
+		int64_t size = Util::toInt64(valSize);
+		if (size < 0) return;
+
+		visitor.file(valFilename, size, tth);
+	}
+	else if (name == tagDirectory)
+	{
+		visitor.startDirectory(getAttrib(attribs, attrName, 0));
+		if (simple)
+			visitor.endDirectory();
+	}
+}
+
+void ListScanner::endTag(const string& name, const string&)
+{
+	if (!inListing) return;
+	if (name == tagDirectory)
+		visitor.endDirectory();
+	else if (name == tagFileListing)
+		inListing = false;
+}
+
+void DirectoryListing::scanFile(const string& fileName, ListVisitor& visitor, std::atomic_bool& abortFlag)
+{
+	ListScanner scanner(visitor, abortFlag);
+	::File ff(fileName, ::File::READ, ::File::OPEN);
+	if (Util::checkFileExt(fileName, extBZ2) || Util::isDclstFile(fileName))
+	{
+		FilteredInputStream<UnBZFilter, false> f(&ff);
+		SimpleXMLReader(&scanner).parse(f);
+	}
+	else if (Util::checkFileExt(fileName, extXML))
+	{
+		SimpleXMLReader(&scanner).parse(ff);
+	}
+}
+
 template<typename T>
 struct SortFunc
 {
@@ -275,6 +275,18 @@ class DirectoryListing : public UserInfoBase
 				void createCopiedPath(const Directory *dir, vector<const Directory*> &pathCache);
 		};
 		
+		/**
+		 * Receives entries of a file list while it's being parsed, without building the tree.
+		 */
+		class ListVisitor
+		{
+			public:
+				virtual ~ListVisitor() {}
+				virtual void startDirectory(const string& /*name*/) {}
+				virtual void endDirectory() {}
+				virtual void file(const string& name, int64_t size, const TTHValue& tth) = 0;
+		};
+
 		DirectoryListing(std::atomic_bool& abortFlag, bool createRoot = true, const DirectoryListing* src = nullptr);
 		~DirectoryListing();
 		
@@ -282,6 +294,8 @@ class DirectoryListing : public UserInfoBase
 		
 		void loadXML(const std::string&, ProgressNotif *progressNotif, bool ownList);
 		void loadXML(InputStream& xml, ProgressNotif *progressNotif, bool ownList);
+
+		static void scanFile(const string& fileName, ListVisitor& visitor, std::atomic_bool& abortFlag);
 		
 		void download(Directory* dir, const string& target, QueueItem::Priority prio, bool& getConnFlag);
 		void download(File* file, const string& target, bool view, QueueItem::Priority prio, bool isDclst, bool& getConnFlag);
@@ -19,6 +19,7 @@
 #include "stdinc.h"
 
 #include "DownloadManager.h"
+#include "ThrottleManager.h"
 #include "ConnectionManager.h"
 #include "QueueManager.h"
 #include "Download.h"
@@ -389,6 +390,7 @@ void DownloadManager::startData(UserConnection* source, int64_t start, int64_t b
 	d->setStartTime(source->getLastActivity());
 	
 	source->setState(UserConnection::STATE_RUNNING);
+	source->setThrottleClass(d->getType() == Transfer::TYPE_FILE ? ThrottleManager::CLASS_NORMAL : ThrottleManager::CLASS_FILE_LIST);
 	
 #ifdef FLYLINKDC_USE_DOWNLOAD_STARTING_FIRE
 	fire(DownloadManagerListener::Starting(), d);
@@ -599,7 +601,7 @@ void DownloadManager::abortDownload(const string& target)
 /** @todo Handle errors better */
 void DownloadManager::processSTA(UserConnection* source, const AdcCommand& cmd) noexcept
 {
-	if (cmd.getParameters().size() < 2)
+	if (cmd.getParamCount() < 2)
 	{
 		source->disconnect();
 		return;
@@ -27,9 +27,13 @@
 #include "CompatibilityManager.h"
 #endif
 
-#ifndef _WIN32
+#ifdef _WIN32
+#include <winioctl.h>
+#else
 #include <fnmatch.h>
 #include <sys/statvfs.h>
+#include <sys/sysmacros.h>
+#include <sys/mman.h>
 #endif
 
 #if defined(_WIN32) && defined(_CONSOLE)
@@ -412,6 +416,38 @@ bool File::getVolumeInfo(const wstring& path, VolumeInfo &vi) noexcept
 	return true;
 }
 
+bool File::getDeviceInfo(const string& fileName, string& key, bool& seekPenalty) noexcept
+{
+	seekPenalty = true;
+	wstring path = File::formatPath(Text::toT(fileName));
+	WCHAR volumePath[MAX_PATH];
+	if (!GetVolumePathNameW(path.c_str(), volumePath, MAX_PATH))
+		return false;
+	WCHAR volumeName[MAX_PATH];
+	if (!GetVolumeNameForVolumeMountPointW(volumePath, volumeName, MAX_PATH))
+	{
+		// Network share
+		key = Text::fromT(volumePath);
+		return true;
+	}
+	wstring deviceName = volumeName;
+	key = Text::fromT(deviceName);
+	if (!deviceName.empty() && deviceName.back() == L'\\')
+		deviceName.erase(deviceName.length() - 1);
+	HANDLE h = CreateFileW(deviceName.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (h == INVALID_HANDLE_VALUE)
+		return true;
+	STORAGE_PROPERTY_QUERY query = {};
+	query.PropertyId = StorageDeviceSeekPenaltyProperty;
+	query.QueryType = PropertyStandardQuery;
+	DEVICE_SEEK_PENALTY_DESCRIPTOR desc = {};
+	DWORD bytes;
+	if (DeviceIoControl(h, IOCTL_STORAGE_QUERY_PROPERTY, &query, sizeof(query), &desc, sizeof(desc), &bytes, nullptr) && bytes == sizeof(desc))
+		seekPenalty = desc.IncursSeekPenalty != FALSE;
+	CloseHandle(h);
+	return true;
+}
+
 uint64_t File::calcFilesSize(const string& path, const string& pattern)
 {
 	uint64_t size = 0;
@@ -668,6 +704,52 @@ size_t File::write(const void* buf, size_t len)
 	return len;
 }
 
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+size_t File::readAt(void* buf, size_t len, int64_t pos)
+{
+	while (true)
+	{
+		ssize_t result = ::pread(h, buf, len, pos);
+		if (result == -1)
+		{
+			if (errno == EINTR) continue;
+			throw FileException(Util::translateError());
+		}
+		return result;
+	}
+}
+
+void File::writeAt(const void* buf, size_t len, int64_t pos)
+{
+	while (len)
+	{
+		ssize_t result = ::pwrite(h, buf, len, pos);
+		if (result == -1)
+		{
+			if (errno == EINTR) continue;
+			throw FileException(Util::translateError());
+		}
+		len -= result;
+		pos += result;
+		buf = (const uint8_t*) buf + result;
+	}
+}
+
+void File::syncRange(int64_t pos, int64_t len, bool wait)
+{
+	unsigned flags = SYNC_FILE_RANGE_WRITE;
+	if (wait) flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+	// Only a hint: errors are reported by syncData
+	sync_file_range(h, pos, len, flags);
+}
+
+void File::syncData()
+{
+	if (fdatasync(h))
+		throw FileException(Util::translateError());
+}
+#endif
+
 static inline uint64_t timeSpecToLinear(const struct timespec& ts)
 {
 	return (uint64_t) 1000000000 * ts.tv_sec + ts.tv_nsec;
@@ -883,6 +965,38 @@ bool File::getVolumeInfo(const string& path, VolumeInfo &vi) noexcept
 	return true;
 }
 
+static bool readRotationalFlag(const string& path, bool& seekPenalty) noexcept
+{
+	try
+	{
+		File f(path, File::READ, File::OPEN);
+		string data = f.read(8);
+		if (data.empty()) return false;
+		seekPenalty = data[0] != '0';
+		return true;
+	}
+	catch (const FileException&)
+	{
+		return false;
+	}
+}
+
+bool File::getDeviceInfo(const string& fileName, string& key, bool& seekPenalty) noexcept
+{
+	seekPenalty = true;
+	struct stat st;
+	if (stat(fileName.c_str(), &st))
+		return false;
+	string dev = Util::toString(major(st.st_dev)) + ':' + Util::toString(minor(st.st_dev));
+	key = dev;
+	// Partitions have no queue directory of their own, use the parent device.
+	// Network file systems have no entry at all and are treated as rotational.
+	const string sysPath = "/sys/dev/block/" + dev;
+	if (!readRotationalFlag(sysPath + "/queue/rotational", seekPenalty))
+		readRotationalFlag(sysPath + "/../queue/rotational", seekPenalty);
+	return true;
+}
+
 StringList File::findFiles(const string& path, const string& pattern, bool appendPath /*= true */)
 {
 	StringList ret;
@@ -1062,6 +1176,86 @@ uint64_t FileAttributes::getTimeStamp() const
 }
 #endif
 
+bool FileMapping::open(File& file) noexcept
+{
+	close();
+	const int64_t fileSize = file.getSize();
+	if (fileSize <= 0 || (uint64_t) fileSize > SIZE_MAX)
+		return false;
+#ifdef _WIN32
+	HANDLE mapping = CreateFileMapping(file.getHandle(), nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping)
+	{
+		// The view keeps the mapping object alive
+		data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		CloseHandle(mapping);
+	}
+#else
+	void* ptr = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file.getHandle(), 0);
+	if (ptr != MAP_FAILED)
+	{
+		posix_madvise(ptr, fileSize, POSIX_MADV_WILLNEED);
+		data = static_cast<const uint8_t*>(ptr);
+	}
+#endif
+	if (!data)
+		return readFile(file, static_cast<size_t>(fileSize));
+	size = static_cast<size_t>(fileSize);
+	mapped = true;
+	return true;
+}
+
+void FileMapping::close() noexcept
+{
+	if (mapped)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap(const_cast<uint8_t*>(data), size);
+#endif
+		mapped = false;
+	}
+	ByteVector().swap(buf);
+	data = nullptr;
+	size = 0;
+}
+
+bool FileMapping::readFile(File& file, size_t fileSize) noexcept
+{
+	try
+	{
+		buf.resize(fileSize);
+		file.setPos(0);
+		size_t pos = 0;
+		while (pos < fileSize)
+		{
+			size_t len = fileSize - pos;
+			if (!file.read(buf.data() + pos, len))
+				break;
+			pos += len;
+		}
+		if (pos != fileSize)
+		{
+			ByteVector().swap(buf);
+			return false;
+		}
+	}
+	catch (const Exception&)
+	{
+		ByteVector().swap(buf);
+		return false;
+	}
+	catch (const std::bad_alloc&)
+	{
+		ByteVector().swap(buf);
+		return false;
+	}
+	data = buf.data();
+	size = fileSize;
+	return true;
+}
+
 int64_t File::getSize(const string& filename) noexcept
 {
 	FileAttributes attr;
@@ -104,6 +104,21 @@ class File : public IOStream
 		size_t write(const void* buf, size_t len);
 		size_t flushBuffers(bool force = true) override;
 		void closeStream() override;
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+		// Don't use or change the file offset, can be called from several threads
+		size_t readAt(void* buf, size_t len, int64_t pos);
+		void writeAt(const void* buf, size_t len, int64_t pos);
+		void syncRange(int64_t pos, int64_t len, bool wait);
+		void syncData();
+#endif
+#ifdef FLYLINKDC_USE_ZERO_COPY
+		// sendfile advances the file offset, so skipSent has nothing to do
+		int getFileDescriptor(int64_t& maxBytes) override
+		{
+			maxBytes = -1;
+			return h;
+		}
+#endif
 
 		static bool isExist(const string& fileName) noexcept;
 		static bool getAttributes(const string& filename, FileAttributes& attr) noexcept;
@@ -122,6 +137,8 @@ class File : public IOStream
 		static bool getCurrentDirectory(string& path) noexcept;
 		static bool setCurrentDirectory(const string& path) noexcept;
 		static bool getVolumeInfo(const string& path, VolumeInfo &vi) noexcept;
+		// Identifies the physical device (or network share) holding the path
+		static bool getDeviceInfo(const string& path, string& key, bool& seekPenalty) noexcept;
 
 		static uint64_t getTimeStamp(const string& fileName) noexcept;
 		static void setTimeStamp(const string& fileName, const uint64_t stamp);
@@ -177,6 +194,33 @@ class File : public IOStream
 		Handle h;
 };
 
+/**
+ * Read-only view of a whole file.
+ * The file is read into memory if it can't be mapped.
+ */
+class FileMapping
+{
+	public:
+		FileMapping() : data(nullptr), size(0), mapped(false) {}
+		~FileMapping() { close(); }
+
+		FileMapping(const FileMapping&) = delete;
+		FileMapping& operator= (const FileMapping&) = delete;
+
+		bool open(File& file) noexcept;
+		void close() noexcept;
+		const uint8_t* getData() const { return data; }
+		size_t getSize() const { return size; }
+
+	private:
+		const uint8_t* data;
+		size_t size;
+		bool mapped;
+		ByteVector buf;
+
+		bool readFile(File& file, size_t fileSize) noexcept;
+};
+
 class FileFindIter
 {
 	private:
@@ -25,6 +25,7 @@
 #include "ClientManager.h"
 #include "CompatibilityManager.h"
 #include "ShareManager.h"
+#include <thread>
 
 // Return values of fastHash and slowHash
 enum
@@ -45,6 +46,12 @@ static const size_t SLOW_HASH_BUF_SIZE = 512 * 1024;
 
 static_assert(SLOW_HASH_BUF_SIZE <= 2*FAST_HASH_BUF_SIZE, "FAST_HASH_BUF_SIZE must be larger");
 
+#ifdef __linux__
+// The kernel reads the next chunk in the background while the current one is hashed
+static const size_t LINUX_FAST_HASH_BUF_SIZE = 2 * 1024 * 1024;
+static_assert(SLOW_HASH_BUF_SIZE <= LINUX_FAST_HASH_BUF_SIZE, "LINUX_FAST_HASH_BUF_SIZE must be larger");
+#endif
+
 static const int MAX_SPEED = 256; // Upper limit for user supplied speed value
 
 #ifdef _WIN32
@@ -186,13 +193,19 @@ void HashManager::reportError(int64_t fileID, const SharedFilePtr& file, const s
 }
 
 HashManager::Hasher::Hasher() :
-	stopFlag(false), tempHashSpeed(0), skipFile(false),
+	queuedFiles(0), stopFlag(false), tempHashSpeed(0),
 	maxHashSpeed(SETTING(MAX_HASH_SPEED)),
-	currentFileRemaining(0),
 	totalBytesToHash(0), totalBytesHashed(0),
-	totalFilesHashed(0), startTick(0), startTickSavedSize(0)
+	totalFilesHashed(0), startTick(0), startTickSavedSize(0),
+	nextReadTick(0)
+{
+	nextDevice = devices.end();
+}
+
+HashManager::Hasher::~Hasher()
 {
-	semaphore.create();
+	for (Worker* worker : workers)
+		delete worker;
 }
 
 void HashManager::Hasher::hashFile(int64_t fileID, const SharedFilePtr& file, const string& fileName, int64_t size)
@@ -203,21 +216,33 @@ void HashManager::Hasher::hashFile(int64_t fileID, const SharedFilePtr& file, co
 	newItem.fileID = fileID;
 	newItem.file = file;
 
+	string key;
+	bool seekPenalty;
+	File::getDeviceInfo(fileName, key, seekPenalty);
+
 	uint64_t tick = GET_TICK();
-	bool signal;
 	{
 		LOCK(cs);
-		signal = wl.empty();
-		wl.emplace_back(std::move(newItem));
+		bool isEmpty = !queuedFiles && getRemainingL() == 0;
+		auto i = devices.find(key);
+		if (i == devices.end())
+		{
+			i = devices.insert(make_pair(key, DeviceQueue())).first;
+			i->second.seekPenalty = seekPenalty;
+			// Workers may not exist yet, start() updates the limit
+			i->second.maxRunning = seekPenalty ? 1 : std::max<int>(1, workers.size());
+			if (nextDevice == devices.end()) nextDevice = i;
+		}
+		i->second.items.emplace_back(std::move(newItem));
+		queuedFiles++;
 		totalBytesToHash += size;
-		if (signal)
+		if (isEmpty)
 		{
 			startTick = tick;
 			startTickSavedSize = 0;
 		}
 	}
-	if (signal)
-		semaphore.notify();
+	notifyWorkers();
 }
 
 void HashManager::Hasher::stopHashing(const string& baseDir)
@@ -227,16 +252,17 @@ void HashManager::Hasher::stopHashing(const string& baseDir)
 	{
 		{
 			LOCK(cs);
-			wl.clear();
-			if (!currentFile.empty())
-			{
-				currentFile.clear();
-				skipFile = true;
-			}
-			currentFileRemaining = totalBytesToHash = totalBytesHashed = 0;
-			totalFilesHashed = 0;
-			startTick = 0;
-			startTickSavedSize = 0;
+			for (auto& device : devices)
+				device.second.items.clear();
+			queuedFiles = 0;
+			for (Worker* worker : workers)
+				if (!worker->currentFile.empty())
+				{
+					worker->currentFile.clear();
+					worker->currentFileRemaining = 0;
+					worker->skipFile = true;
+				}
+			clearStatsL();
 			if (setMaxHashSpeed(0) < 0) signal = true;
 		}
 		HashManager::getInstance()->fire(HashManagerListener::HashingAborted());
@@ -244,38 +270,140 @@ void HashManager::Hasher::stopHashing(const string& baseDir)
 	else
 	{
 		LOCK(cs);
-		for (auto i = wl.cbegin(); i != wl.cend();)
+		for (auto& device : devices)
 		{
-			if (strnicmp(baseDir, i->path, baseDir.length()) == 0)
+			auto& items = device.second.items;
+			for (auto i = items.cbegin(); i != items.cend();)
 			{
-				totalBytesToHash -= i->fileSize;
-				wl.erase(i++);
+				if (strnicmp(baseDir, i->path, baseDir.length()) == 0)
+				{
+					totalBytesToHash -= i->fileSize;
+					queuedFiles--;
+					i = items.erase(i);
+				}
+				else
+				{
+					++i;
+				}
 			}
-			else
+		}
+		for (Worker* worker : workers)
+			if (!worker->currentFile.empty() && strnicmp(baseDir, worker->currentFile, baseDir.length()) == 0)
 			{
-				++i;
+				worker->currentFile.clear();
+				worker->currentFileRemaining = 0;
+				worker->skipFile = true;
 			}
-		}
-		if (!currentFile.empty() && strnicmp(baseDir, currentFile, baseDir.length()) == 0)
-		{
-			currentFile.clear();
-			currentFileRemaining = 0;
-			skipFile = true;
-		}
 		// TODO: notify ShareManager
 	}
 	if (signal)
-		semaphore.notify();
+		notifyWorkers();
 }
 
 bool HashManager::Hasher::isHashing() const
 {
 	LOCK(cs);
-	return !wl.empty() || !currentFile.empty();
+	if (queuedFiles) return true;
+	for (const Worker* worker : workers)
+		if (!worker->currentFile.empty()) return true;
+	return false;
+}
+
+int64_t HashManager::Hasher::getRemainingL() const
+{
+	int64_t result = 0;
+	for (const Worker* worker : workers)
+		result += worker->currentFileRemaining;
+	return result;
+}
+
+void HashManager::Hasher::clearStatsL()
+{
+	totalBytesToHash = totalBytesHashed = 0;
+	totalFilesHashed = 0;
+	startTick = 0;
+	startTickSavedSize = 0;
+}
+
+void HashManager::Hasher::notifyWorkers()
+{
+	for (Worker* worker : workers)
+		worker->notify();
+}
+
+bool HashManager::Hasher::getNextItem(Worker* worker, HashTaskItem& item)
+{
+	LOCK(cs);
+	dcassert(!worker->device);
+	if (queuedFiles)
+	{
+		// Round-robin over devices so that each device has a reader
+		for (size_t count = devices.size(); count; --count)
+		{
+			if (nextDevice == devices.end()) nextDevice = devices.begin();
+			DeviceQueue& dq = nextDevice->second;
+			++nextDevice;
+			if (dq.items.empty() || dq.running >= dq.maxRunning) continue;
+			item = std::move(dq.items.front());
+			dq.items.pop_front();
+			dq.running++;
+			queuedFiles--;
+			worker->device = &dq;
+			worker->currentFile = item.path;
+			worker->currentFileRemaining = item.fileSize;
+			worker->skipFile = false;
+			totalBytesHashed += item.fileSize;
+			totalFilesHashed++;
+			return true;
+		}
+		return false;
+	}
+	bool busy = false;
+	for (const Worker* w : workers)
+		if (w->device)
+		{
+			busy = true;
+			break;
+		}
+	if (!busy)
+		clearStatsL();
+	return false;
+}
+
+void HashManager::Hasher::itemDone(Worker* worker)
+{
+	{
+		LOCK(cs);
+		dcassert(worker->device);
+		worker->device->running--;
+		worker->device = nullptr;
+		worker->currentFile.clear();
+		worker->currentFileRemaining = 0;
+		worker->skipFile = false;
+	}
+	// A slot on the device became free, let idle workers pick up the next file
+	notifyWorkers();
+}
+
+bool HashManager::Hasher::waitSpeedLimit(size_t size, int speed)
+{
+	// The limit is shared by all workers: each read reserves its time slot
+	const uint64_t readTime = size * 1000LL / (speed << 20);
+	uint64_t waitTime;
+	{
+		LOCK(csSpeed);
+		const uint64_t now = GET_TICK();
+		if (nextReadTick < now) nextReadTick = now;
+		waitTime = nextReadTick - now;
+		nextReadTick += readTime;
+	}
+	if (waitTime)
+		Thread::sleep(waitTime);
+	return !stopFlag;
 }
 
 #ifdef _WIN32
-int HashManager::Hasher::fastHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree) noexcept
+int HashManager::Hasher::Worker::fastHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree) noexcept
 {
 	HANDLE h = ::CreateFile(File::formatPath(Text::toT(fileName)).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
 	                        FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, nullptr);
@@ -300,7 +428,6 @@ int HashManager::Hasher::fastHash(const string& fileName, int64_t fileSize, uint
 	
 	over.hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
 	
-	uint64_t lastRead = GET_TICK();
 	if (!::ReadFile(h, hbuf, FAST_HASH_BUF_SIZE, &hsize, &over))
 	{
 		int error = GetLastError();
@@ -317,33 +444,22 @@ int HashManager::Hasher::fastHash(const string& fileName, int64_t fileSize, uint
 	over.Offset = hsize;
 	while (fileSize)
 	{
-		if (stopFlag)
+		if (hasher.stopFlag)
 		{
 			result = RESULT_STOPPED;
 			goto cleanup;
 		}
-		int speed = getMaxHashSpeed();
+		int speed = hasher.getMaxHashSpeed();
 		if (speed < 0)
 		{
 			waitResume();
 			continue;
 		}
-		if (speed && speed <= MAX_SPEED)
+		if (speed && speed <= MAX_SPEED && !hasher.waitSpeedLimit(hsize, speed))
 		{
-			const uint64_t now = GET_TICK();
-			const uint64_t minTime = hsize * 1000LL / (speed << 20);
-			if (lastRead + minTime > now)
-			{
-				const uint64_t diff = now - lastRead;
-				sleep(minTime - diff);
-				if (stopFlag)
-				{
-					result = RESULT_STOPPED;
-					goto cleanup;
-				}
-			}
+			result = RESULT_STOPPED;
+			goto cleanup;
 		}
-		lastRead = GET_TICK();
 		
 		// Start a new overlapped read
 		BOOL readResult = ReadFile(h, rbuf, FAST_HASH_BUF_SIZE, &rsize, &over);
@@ -360,18 +476,10 @@ int HashManager::Hasher::fastHash(const string& fileName, int64_t fileSize, uint
 		if ((int64_t) rsize > fileSize)
 			rsize = fileSize;
 
+		if (!updateRemaining(rsize))
 		{
-			LOCK(cs);
-			if (skipFile)
-			{
-				skipFile = false;
-				result = RESULT_FILE_SKIPPED;
-				goto cleanup;
-			}
-			if ((int64_t) rsize > currentFileRemaining)
-				currentFileRemaining = 0;
-			else
-				currentFileRemaining -= rsize;		
+			result = RESULT_FILE_SKIPPED;
+			goto cleanup;
 		}
 
 		fileSize -= rsize;
@@ -385,7 +493,7 @@ int HashManager::Hasher::fastHash(const string& fileName, int64_t fileSize, uint
 	tree.finalize();
 	result = RESULT_OK;
 	{
-		LOCK(cs);
+		LOCK(hasher.cs);
 		currentFileRemaining = 0;
 	}
 	
@@ -394,56 +502,110 @@ cleanup:
 	CloseHandle(h);
 	if (result == RESULT_ERROR)
 	{
-		LOCK(cs);
+		LOCK(hasher.cs);
 		currentFileRemaining = savedFileSize; // restore the value of currentFileRemaining for slowHash
 	}
 	return result;
 }
-#endif
-
-int HashManager::Hasher::slowHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree)
+#elif defined(__linux__)
+int HashManager::Hasher::Worker::fastHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree) noexcept
 {
-	size_t size = 0;
-	File f(fileName, File::READ, File::OPEN);
-	uint64_t lastRead = GET_TICK();
+	int fd = open(fileName.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return RESULT_ERROR;
+
+	int result = RESULT_ERROR;
+	const int64_t savedFileSize = fileSize;
+	int64_t offset = 0;
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	if (fileSize)
+		readahead(fd, 0, LINUX_FAST_HASH_BUF_SIZE);
 	while (fileSize)
 	{
-		if (stopFlag) return RESULT_STOPPED;
-		int speed = getMaxHashSpeed();
+		if (hasher.stopFlag)
+		{
+			result = RESULT_STOPPED;
+			goto cleanup;
+		}
+		size_t size = LINUX_FAST_HASH_BUF_SIZE;
+		if (fileSize < (int64_t) size)
+			size = (size_t) fileSize;
+		int speed = hasher.getMaxHashSpeed();
 		if (speed < 0)
 		{
 			waitResume();
 			continue;
 		}
-		if (speed && speed <= MAX_SPEED)
+		if (speed && speed <= MAX_SPEED && !hasher.waitSpeedLimit(size, speed))
 		{
-			const uint64_t now = GET_TICK();
-			const uint64_t minTime = size * 1000LL / (speed << 20);
-			if (lastRead + minTime > now)
-			{
-				sleep(minTime - (now - lastRead));
-				if (stopFlag) return RESULT_STOPPED;
-			}
+			result = RESULT_STOPPED;
+			goto cleanup;
 		}
-		lastRead = GET_TICK();
 
-		size = SLOW_HASH_BUF_SIZE;
+		// Start reading the next chunk
+		if (fileSize > (int64_t) size)
+			readahead(fd, offset + size, LINUX_FAST_HASH_BUF_SIZE);
+
+		size_t bytesRead = 0;
+		while (bytesRead < size)
+		{
+			ssize_t n = pread(fd, buf + bytesRead, size - bytesRead, offset + bytesRead);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0)
+				goto cleanup;
+			bytesRead += n;
+		}
+
+		if (!updateRemaining(size))
+		{
+			result = RESULT_FILE_SKIPPED;
+			goto cleanup;
+		}
+		tree.update(buf, size);
+
+		// The data is hashed once, don't keep it in the page cache
+		posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+		offset += size;
+		fileSize -= size;
+	}
+
+	tree.finalize();
+	result = RESULT_OK;
+
+cleanup:
+	close(fd);
+	if (result == RESULT_ERROR)
+	{
+		LOCK(hasher.cs);
+		currentFileRemaining = savedFileSize; // restore the value of currentFileRemaining for slowHash
+	}
+	return result;
+}
+#endif
+
+int HashManager::Hasher::Worker::slowHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree)
+{
+	File f(fileName, File::READ, File::OPEN);
+	while (fileSize)
+	{
+		if (hasher.stopFlag) return RESULT_STOPPED;
+		size_t size = SLOW_HASH_BUF_SIZE;
 		if (fileSize < (int64_t) size)
 			size = (size_t) fileSize;
-		f.read(buf, size);
-		if (!size) break;
+		int speed = hasher.getMaxHashSpeed();
+		if (speed < 0)
 		{
-			LOCK(cs);
-			if (skipFile)
-			{
-				skipFile = false;
-				return RESULT_FILE_SKIPPED;
-			}
-			if ((int64_t) size > currentFileRemaining)
-				currentFileRemaining = 0;
-			else
-				currentFileRemaining -= size;
+			waitResume();
+			continue;
 		}
+		if (speed && speed <= MAX_SPEED && !hasher.waitSpeedLimit(size, speed))
+			return RESULT_STOPPED;
+
+		f.read(buf, size);
+		if (!size) break;
+		if (!updateRemaining(size))
+			return RESULT_FILE_SKIPPED;
 		tree.update(buf, size);
 		fileSize -= size;
 	}
@@ -451,10 +613,28 @@ int HashManager::Hasher::slowHash(const string& fileName, int64_t fileSize, uint
 	return RESULT_OK;
 }
 
+// Returns false if the file must be skipped
+bool HashManager::Hasher::Worker::updateRemaining(size_t size)
+{
+	LOCK(hasher.cs);
+	if (skipFile)
+	{
+		skipFile = false;
+		return false;
+	}
+	if ((int64_t) size > currentFileRemaining)
+		currentFileRemaining = 0;
+	else
+		currentFileRemaining -= size;
+	return true;
+}
+
 static uint8_t* allocateBuffer()
 {
 #ifdef _WIN32
 	return static_cast<uint8_t*>(VirtualAlloc(nullptr, FAST_HASH_BUF_SIZE*2, MEM_COMMIT, PAGE_READWRITE));
+#elif defined(__linux__)
+	return new uint8_t[LINUX_FAST_HASH_BUF_SIZE];
 #else
 	return new uint8_t[SLOW_HASH_BUF_SIZE];
 #endif
@@ -470,50 +650,28 @@ static void freeBuffer(uint8_t* buf)
 #endif
 }
 
-int HashManager::Hasher::run()
+int HashManager::Hasher::Worker::run()
 {
-	bool wait = false;
 #ifdef _WIN32
 	bool couldNotWriteTree = false;
 #endif
 	string currentDir;
-	string filename;
 	uint8_t* buf = nullptr;
 	TigerTree tree;
 
 	auto hashManager = HashManager::getInstance();
 	setThreadPriority(Thread::IDLE);
 	
-	while (!stopFlag)
+	while (!hasher.stopFlag)
 	{
-		if (wait)
-		{
-			semaphore.wait();
-			semaphore.reset();
-			if (stopFlag) break;
-		}
 		HashTaskItem currentItem;
+		if (!hasher.getNextItem(this, currentItem))
 		{
-			LOCK(cs);
-			if (wl.empty())
-			{
-				currentFile.clear();
-				totalBytesHashed = totalBytesToHash = 0;
-				totalFilesHashed = 0;
-				currentFileRemaining = 0;
-				startTick = 0;
-				startTickSavedSize = 0;
-				wait = true;
-				continue;
-			}
-			currentItem = std::move(wl.front());
-			currentFile = filename = currentItem.path;
-			currentFileRemaining = currentItem.fileSize;
-			totalBytesHashed += currentItem.fileSize;
-			totalFilesHashed++;
-			wl.pop_front();
-			wait = false;
+			event.wait();
+			event.reset();
+			continue;
 		}
+		const string& filename = currentItem.path;
 		string dir = Util::getFilePath(filename);
 		if (currentDir != dir)
 		{
@@ -522,12 +680,13 @@ int HashManager::Hasher::run()
 			couldNotWriteTree = false;
 #endif
 		}
-		maxHashSpeed = SETTING(MAX_HASH_SPEED);
-		if (tempHashSpeed < 0) waitResume();
+		hasher.maxHashSpeed = SETTING(MAX_HASH_SPEED);
+		if (hasher.tempHashSpeed < 0) waitResume();
 		FileAttributes attr;
 		if (!File::getAttributes(filename, attr))
 		{
 			hashManager->reportError(currentItem.fileID, currentItem.file, filename, STRING(ERROR_OPENING_FILE));
+			hasher.itemDone(this);
 			continue;
 		}
 		auto size = attr.getSize();
@@ -545,6 +704,7 @@ int HashManager::Hasher::run()
 		if (size != currentItem.fileSize)
 		{
 			hashManager->reportError(currentItem.fileID, currentItem.file, filename, STRING(ERROR_SIZE_MISMATCH));
+			hasher.itemDone(this);
 			continue;
 		}
 		if (!buf)
@@ -556,6 +716,7 @@ int HashManager::Hasher::run()
 		{
 			LogManager::message(STRING(LOAD_TTH_FROM_NTFS) + ' ' + filename, false);
 			hashManager->hashDone(GET_TICK(), currentItem.fileID, currentItem.file, filename, tree, 0, size);
+			hasher.itemDone(this);
 			continue;
 		}
 #endif
@@ -563,14 +724,22 @@ int HashManager::Hasher::run()
 		{
 			const uint64_t start = GET_TICK();
 			int result = RESULT_ERROR;
-#ifdef _WIN32
+#if defined(_WIN32) || defined(__linux__)
 			if (BOOLSETTING(FAST_HASH))
 				result = fastHash(filename, size, buf, tree);
 #endif
 			if (result == RESULT_ERROR)
+			{
+				// fastHash may have failed in the middle of the file
+				tree.clear();
 				result = slowHash(filename, size, buf, tree);
+			}
 			const uint64_t end = GET_TICK();
-			if (result == RESULT_STOPPED) break;
+			if (result == RESULT_STOPPED)
+			{
+				hasher.itemDone(this);
+				break;
+			}
 			if (result == RESULT_OK)
 			{
 				const uint64_t speed = end > start ? size * 1000 / (end - start) : 0;
@@ -596,18 +765,62 @@ int HashManager::Hasher::run()
 		{
 			hashManager->reportError(currentItem.fileID, currentItem.file, filename, e.getError());
 		}
+		hasher.itemDone(this);
 	}
 	freeBuffer(buf);
+	return 0;
+}
+
+void HashManager::Hasher::start()
+{
+	unsigned count = SETTING(HASH_THREADS);
+	if (!count)
+	{
+		count = std::thread::hardware_concurrency();
+		if (!count) count = 1;
+	}
 	{
 		LOCK(cs);
-		wl.clear();
-		currentFile.clear();
-		currentFileRemaining = totalBytesToHash = totalBytesHashed = 0;
-		totalFilesHashed = 0;
-		startTick = 0;
-		startTickSavedSize = 0;
+		dcassert(workers.empty());
+		for (unsigned i = 0; i < count; ++i)
+		{
+			Worker* worker = new Worker(*this);
+			worker->event.create();
+			workers.push_back(worker);
+		}
+		// Solid state devices are read by all workers
+		for (auto& device : devices)
+			if (!device.second.seekPenalty)
+				device.second.maxRunning = count;
 	}
-	return 0;
+	for (Worker* worker : workers)
+		worker->start(0, "HashManager");
+}
+
+void HashManager::Hasher::join()
+{
+	for (Worker* worker : workers)
+		worker->join();
+	LOCK(cs);
+	for (auto& device : devices)
+	{
+		device.second.items.clear();
+		device.second.running = 0;
+	}
+	queuedFiles = 0;
+	for (Worker* worker : workers)
+	{
+		worker->device = nullptr;
+		worker->currentFile.clear();
+		worker->currentFileRemaining = 0;
+	}
+	clearStatsL();
+}
+
+void HashManager::Hasher::setThreadPriority(Thread::Priority p)
+{
+	for (Worker* worker : workers)
+		worker->setThreadPriority(p);
 }
 
 int HashManager::Hasher::getMaxHashSpeed() const
@@ -620,42 +833,49 @@ int HashManager::Hasher::getMaxHashSpeed() const
 int HashManager::Hasher::setMaxHashSpeed(int val)
 {
 	val = tempHashSpeed.exchange(val);
-	semaphore.notify();
+	notifyWorkers();
 	return val;
 }
 
 void HashManager::Hasher::shutdown()
 {
 	stopFlag.store(true);
-	semaphore.notify();
+	notifyWorkers();
 }
 
-void HashManager::Hasher::waitResume()
+void HashManager::Hasher::Worker::waitResume()
 {
-	semaphore.wait();
-	semaphore.reset();
+	event.wait();
+	event.reset();
 	int64_t tick = GET_TICK();
-	LOCK(cs);
-	if (startTick)
+	LOCK(hasher.cs);
+	if (hasher.startTick)
 	{
-		startTick = tick;
-		startTickSavedSize = totalBytesHashed - currentFileRemaining;
+		hasher.startTick = tick;
+		hasher.startTickSavedSize = hasher.totalBytesHashed - hasher.getRemainingL();
 	}
 }
 
 void HashManager::Hasher::getInfo(HashManager::Info& info) const
 {
 	LOCK(cs);
-	info.filename = currentFile;
-	info.sizeToHash = totalBytesToHash;
-	info.sizeHashed = totalBytesHashed - currentFileRemaining;
-	info.filesHashed = totalFilesHashed;
-	info.filesLeft = wl.size();
-	if (currentFileRemaining && info.filesHashed)
+	info.filename.clear();
+	size_t activeFiles = 0;
+	int64_t remaining = 0;
+	for (const Worker* worker : workers)
 	{
-		info.filesHashed--;
-		info.filesLeft++;
+		if (worker->currentFile.empty()) continue;
+		if (info.filename.empty()) info.filename = worker->currentFile;
+		remaining += worker->currentFileRemaining;
+		if (worker->currentFileRemaining) activeFiles++;
 	}
+	info.sizeToHash = totalBytesToHash;
+	info.sizeHashed = totalBytesHashed - remaining;
+	info.filesHashed = totalFilesHashed;
+	info.filesLeft = queuedFiles;
+	if (activeFiles > info.filesHashed) activeFiles = info.filesHashed;
+	info.filesHashed -= activeFiles;
+	info.filesLeft += activeFiles;
 	info.startTick = startTick;
 	info.startTickSavedSize = startTickSavedSize;
 }
@@ -76,7 +76,7 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		
 		void startup()
 		{
-			hasher.start(0, "HashManager");
+			hasher.start();
 		}
 		
 		void shutdown()
@@ -120,22 +120,22 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 		static void deleteTree(const string& filePath) noexcept;
 #endif
 
-		class Hasher : public Thread
+		class Hasher
 		{
 			public:
 				Hasher();
+				~Hasher();
 					
 				void hashFile(int64_t fileID, const SharedFilePtr& file, const string& fileName, int64_t size);
 				
 				void stopHashing(const string& baseDir);
 				bool isHashing() const;
-#ifdef _WIN32
-				int fastHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree) noexcept;
-#endif
-				int slowHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree);
 				void getInfo(Info& info) const;
 				
+				void start();
 				void shutdown();
+				void join();
+				void setThreadPriority(Thread::Priority p);
 				int getMaxHashSpeed() const;
 				int getTempHashSpeed() const { return tempHashSpeed; }
 				int setMaxHashSpeed(int val);
@@ -148,31 +148,77 @@ class HashManager : public Singleton<HashManager>, public Speaker<HashManagerLis
 					int64_t fileID;
 					SharedFilePtr file;
 				};
+
+				/**
+				 * Files located on the same physical device.
+				 * Devices with a seek penalty are read by one worker at a time,
+				 * solid state devices are read by all workers in parallel.
+				 */
+				struct DeviceQueue
+				{
+					std::deque<HashTaskItem> items;
+					int running = 0;
+					int maxRunning = 1;
+					bool seekPenalty = true;
+				};
+
+				class Worker : public Thread
+				{
+					public:
+						explicit Worker(Hasher& hasher) : hasher(hasher), device(nullptr), skipFile(false), currentFileRemaining(0) {}
+
+						void notify() { event.notify(); }
+
+					private:
+						Hasher& hasher;
+						WaitableEvent event;
+						DeviceQueue* device;
+						// protected by Hasher::cs
+						string currentFile;
+						bool skipFile;
+						int64_t currentFileRemaining;
+
+#if defined(_WIN32) || defined(__linux__)
+						int fastHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree) noexcept;
+#endif
+						int slowHash(const string& fileName, int64_t fileSize, uint8_t* buf, TigerTree& tree);
+						bool updateRemaining(size_t size);
+						void waitResume();
+
+					protected:
+						virtual int run() override;
+
+					friend class Hasher;
+				};
 				
-				std::deque<HashTaskItem> wl;
+				std::map<string, DeviceQueue> devices;
+				std::map<string, DeviceQueue>::iterator nextDevice;
+				vector<Worker*> workers;
+				size_t queuedFiles;
 				mutable FastCriticalSection cs;
 				std::atomic_bool stopFlag;
 				std::atomic_int tempHashSpeed; // 0 = default, -1 = paused
-				WaitableEvent semaphore;
-				string currentFile;
-				bool skipFile;
-				int maxHashSpeed; // saved value of SETTING(MAX_HASH_SPEED)
-				int64_t currentFileRemaining;
+				std::atomic_int maxHashSpeed; // saved value of SETTING(MAX_HASH_SPEED)
 				int64_t totalBytesToHash, totalBytesHashed;
 				size_t totalFilesHashed;
 				int64_t startTick;
 				int64_t startTickSavedSize;
-		
-			protected:
-				virtual int run() override;
-				void waitResume();
+				FastCriticalSection csSpeed;
+				uint64_t nextReadTick;
+
+				bool getNextItem(Worker* worker, HashTaskItem& item);
+				void itemDone(Worker* worker);
+				bool waitSpeedLimit(size_t size, int speed);
+				void notifyWorkers();
+				int64_t getRemainingL() const;
+				void clearStatsL();
 		};
 		
 		friend class Hasher;
 
 	private:
 		Hasher hasher;
-		uint64_t nextPostTime = 0;
+		std::atomic<uint64_t> nextPostTime{0};
 		
 		void hashDone(uint64_t tick, int64_t fileID, const SharedFilePtr& file, const string& fileName, const TigerTree& tth, int64_t speed, int64_t Size);
 		void reportError(int64_t fileID, const SharedFilePtr& file, const string& fileName, const string& error);
@@ -0,0 +1,176 @@
+#include "stdinc.h"
+#include "IncomingSearchQueue.h"
+#include "TimerManager.h"
+#include <thread>
+
+IncomingSearchQueue::IncomingSearchQueue() :
+	queuedRequests(0), stopFlag(false),
+	searches(0), replies(0), coalesced(0), dropped(0), totalLatency(0), maxLatency(0)
+{
+	event.create();
+	unsigned count = std::thread::hardware_concurrency();
+	if (!count) count = 1;
+	if (count > MAX_WORKERS) count = MAX_WORKERS;
+	for (unsigned i = 0; i < count; ++i)
+		workers.push_back(new Worker(*this));
+	for (Worker* worker : workers)
+		worker->start(0, "IncomingSearchQueue");
+}
+
+IncomingSearchQueue::~IncomingSearchQueue()
+{
+	shutdown();
+}
+
+void IncomingSearchQueue::shutdown() noexcept
+{
+	{
+		LOCK(cs);
+		if (stopFlag && workers.empty()) return;
+		stopFlag = true;
+		event.notify();
+	}
+	for (Worker* worker : workers)
+	{
+		worker->join();
+		delete worker;
+	}
+	workers.clear();
+
+	LOCK(cs);
+	for (Item* item : queue)
+		delete item;
+	queue.clear();
+	items.clear();
+	hubQueued.clear();
+	queuedRequests = 0;
+}
+
+void IncomingSearchQueue::addRequest(const string& hub, const string& key, RequestPtr&& request) noexcept
+{
+	LOCK(cs);
+	if (stopFlag) return;
+	size_t& hubCount = hubQueued[hub];
+	if (hubCount >= MAX_QUEUED_PER_HUB)
+	{
+		++dropped;
+		return;
+	}
+	++hubCount;
+	++queuedRequests;
+
+	Item* item;
+	auto i = items.find(key);
+	if (i != items.end())
+	{
+		item = i->second;
+		++coalesced;
+	}
+	else
+	{
+		item = new Item;
+		item->key = key;
+		items.insert(make_pair(key, item));
+		queue.push_back(item);
+		event.notify();
+	}
+	item->requests.emplace_back(Pending{GET_TICK(), hub, std::move(request)});
+}
+
+void IncomingSearchQueue::getStats(Stats& stats) const noexcept
+{
+	LOCK(cs);
+	stats.queued = queuedRequests;
+	stats.searches = searches;
+	stats.replies = replies;
+	stats.coalesced = coalesced;
+	stats.dropped = dropped;
+	stats.avgLatency = replies ? totalLatency / replies : 0;
+	stats.maxLatency = maxLatency;
+}
+
+void IncomingSearchQueue::releaseHubL(const string& hub) noexcept
+{
+	auto i = hubQueued.find(hub);
+	if (i == hubQueued.end()) return;
+	if (--i->second == 0)
+		hubQueued.erase(i);
+}
+
+void IncomingSearchQueue::processItem(Item* item, vector<Pending>& requests) noexcept
+{
+	const uint64_t now = GET_TICK();
+	Request* first = nullptr;
+	{
+		// The item stays in the map while searching, so identical requests can still join it
+		LOCK(cs);
+		for (const Pending& p : item->requests)
+			if (p.time + MAX_WAIT_TIME >= now)
+			{
+				first = p.request.get();
+				break;
+			}
+	}
+
+	vector<SearchResultCore> results;
+	if (first)
+		first->search(results);
+
+	{
+		LOCK(cs);
+		items.erase(item->key);
+		requests.swap(item->requests);
+		for (const Pending& p : requests)
+			releaseHubL(p.hub);
+		queuedRequests -= requests.size();
+	}
+	delete item;
+
+	uint64_t sent = 0, expired = 0, latency = 0, maxTime = 0;
+	for (const Pending& p : requests)
+	{
+		if (p.time + MAX_WAIT_TIME < now)
+		{
+			++expired;
+			continue;
+		}
+		p.request->reply(results);
+		uint64_t time = GET_TICK() - p.time;
+		latency += time;
+		if (time > maxTime) maxTime = time;
+		++sent;
+	}
+	requests.clear();
+
+	LOCK(cs);
+	if (first) ++searches;
+	replies += sent;
+	dropped += expired;
+	totalLatency += latency;
+	if (maxTime > maxLatency) maxLatency = maxTime;
+}
+
+int IncomingSearchQueue::Worker::run()
+{
+	vector<IncomingSearchQueue::Pending> requests;
+	while (true)
+	{
+		Item* item = nullptr;
+		{
+			LOCK(queue.cs);
+			if (queue.stopFlag) break;
+			if (!queue.queue.empty())
+			{
+				item = queue.queue.front();
+				queue.queue.pop_front();
+			}
+			else
+				queue.event.reset();
+		}
+		if (item)
+			queue.processItem(item, requests);
+		else
+			queue.event.wait();
+	}
+	return 0;
+}
@@ -0,0 +1,105 @@
+#ifndef INCOMING_SEARCH_QUEUE_H_
+#define INCOMING_SEARCH_QUEUE_H_
+
+#include "Singleton.h"
+#include "Thread.h"
+#include "Locks.h"
+#include "WaitableEvent.h"
+#include "SearchResult.h"
+#include <boost/unordered/unordered_map.hpp>
+
+/**
+ * Runs incoming searches on a shared pool of worker threads, so hub threads
+ * are never blocked by share searches. Queued requests with the same key
+ * are searched once and the results are sent to every requester.
+ */
+class IncomingSearchQueue : public Singleton<IncomingSearchQueue>
+{
+	public:
+		class Request
+		{
+			public:
+				virtual ~Request() {}
+				/** Called on a worker thread, only for the first of coalesced requests */
+				virtual void search(vector<SearchResultCore>& results) noexcept = 0;
+				/** Called on a worker thread for each request */
+				virtual void reply(const vector<SearchResultCore>& results) noexcept = 0;
+		};
+
+		typedef std::unique_ptr<Request> RequestPtr;
+
+		struct Stats
+		{
+			size_t queued;
+			uint64_t searches;
+			uint64_t replies;
+			uint64_t coalesced;
+			uint64_t dropped;
+			uint64_t avgLatency; // ms, from receiving the search to sending the reply
+			uint64_t maxLatency;
+		};
+
+		/**
+		 * @param hub Requests from one hub are limited to MAX_QUEUED_PER_HUB, newer ones are dropped
+		 * @param key Requests with equal keys must produce equal results
+		 */
+		void addRequest(const string& hub, const string& key, RequestPtr&& request) noexcept;
+		void getStats(Stats& stats) const noexcept;
+		void shutdown() noexcept;
+
+	private:
+		friend class Singleton<IncomingSearchQueue>;
+
+		IncomingSearchQueue();
+		~IncomingSearchQueue();
+
+		static const size_t MAX_QUEUED_PER_HUB = 32;
+		static const unsigned MAX_WORKERS = 4;
+		static const uint64_t MAX_WAIT_TIME = 10000; // requests waiting longer are dropped
+
+		struct Pending
+		{
+			uint64_t time;
+			string hub;
+			RequestPtr request;
+		};
+
+		struct Item
+		{
+			string key;
+			vector<Pending> requests;
+		};
+
+		class Worker : public Thread
+		{
+			public:
+				explicit Worker(IncomingSearchQueue& queue) : queue(queue) {}
+
+			protected:
+				int run() override;
+
+			private:
+				IncomingSearchQueue& queue;
+		};
+
+		boost::unordered_map<string, Item*> items;
+		std::deque<Item*> queue;
+		boost::unordered_map<string, size_t> hubQueued;
+		vector<Worker*> workers;
+		size_t queuedRequests;
+		bool stopFlag;
+		mutable FastCriticalSection cs;
+		WaitableEvent event;
+
+		uint64_t searches;
+		uint64_t replies;
+		uint64_t coalesced;
+		uint64_t dropped;
+		uint64_t totalLatency;
+		uint64_t maxLatency;
+
+		void processItem(Item* item, vector<Pending>& requests) noexcept;
+		void releaseHubL(const string& hub) noexcept;
+};
+
+#endif // INCOMING_SEARCH_QUEUE_H_
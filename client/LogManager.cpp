@@ -22,6 +22,8 @@
 #include "ParamExpander.h"
 #include "TimerManager.h"
 #include "ClientManager.h"
+#include "Thread.h"
+#include "WaitableEvent.h"
 
 #ifdef _WIN32
 #include "CompatibilityManager.h"
@@ -30,6 +32,174 @@
 static const int FILE_TIMEOUT     = 240*1000; // 4 min
 static const int CLOSE_FILES_TIME = 300*1000; // 5 min
 
+/**
+ * Writes log messages on a background thread, so callers never wait for the disk.
+ * Messages are passed through a bounded lock-free queue; when it is full,
+ * new messages are dropped and counted.
+ */
+class LogWriter : public Thread
+{
+	public:
+		static const size_t QUEUE_SIZE = 8192; // must be a power of 2
+
+		LogWriter() : stopFlag(false), idle(false)
+		{
+			for (size_t i = 0; i < QUEUE_SIZE; ++i)
+				cells[i].sequence = i;
+			enqueuePos = dequeuePos = 0;
+			for (int i = 0; i < LogManager::LAST; ++i)
+				dropped[i] = 0;
+			event.create();
+		}
+
+		bool push(int area, string& path, string& msg) noexcept;
+		void stop() noexcept;
+
+	protected:
+		int run() override;
+
+	private:
+		struct Entry
+		{
+			int area;
+			string path;
+			string msg;
+		};
+
+		struct Cell
+		{
+			std::atomic<size_t> sequence;
+			Entry entry;
+		};
+
+		// Bounded MPMC queue by Dmitry Vyukov, used here with a single consumer
+		Cell cells[QUEUE_SIZE];
+		std::atomic<size_t> enqueuePos;
+		std::atomic<size_t> dequeuePos;
+
+		std::atomic<unsigned> dropped[LogManager::LAST];
+		std::atomic_bool stopFlag;
+		std::atomic_bool idle;
+		WaitableEvent event;
+
+		bool pop(Entry& entry) noexcept;
+		void flush(vector<Entry>& entries) noexcept;
+};
+
+static LogWriter g_writer;
+static std::atomic_bool g_writerActive(false);
+
+bool LogWriter::push(int area, string& path, string& msg) noexcept
+{
+	size_t pos = enqueuePos.load(std::memory_order_relaxed);
+	Cell* cell;
+	while (true)
+	{
+		cell = &cells[pos & (QUEUE_SIZE - 1)];
+		size_t seq = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+		if (diff == 0)
+		{
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+		{
+			// Queue is full
+			++dropped[area];
+			return false;
+		}
+		else
+			pos = enqueuePos.load(std::memory_order_relaxed);
+	}
+	cell->entry.area = area;
+	cell->entry.path = std::move(path);
+	cell->entry.msg = std::move(msg);
+	cell->sequence.store(pos + 1, std::memory_order_release);
+	if (idle.exchange(false))
+		event.notify();
+	return true;
+}
+
+bool LogWriter::pop(Entry& entry) noexcept
+{
+	size_t pos = dequeuePos.load(std::memory_order_relaxed);
+	Cell* cell = &cells[pos & (QUEUE_SIZE - 1)];
+	size_t seq = cell->sequence.load(std::memory_order_acquire);
+	if ((intptr_t) seq - (intptr_t) (pos + 1) < 0)
+		return false;
+	dequeuePos.store(pos + 1, std::memory_order_relaxed);
+	entry.area = cell->entry.area;
+	entry.path = std::move(cell->entry.path);
+	entry.msg = std::move(cell->entry.msg);
+	cell->sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+	return true;
+}
+
+void LogWriter::flush(vector<Entry>& entries) noexcept
+{
+	// Write all messages for the same file at once
+	std::stable_sort(entries.begin(), entries.end(),
+		[](const Entry& a, const Entry& b) { return a.area != b.area ? a.area < b.area : a.path < b.path; });
+	string data;
+	for (size_t i = 0; i < entries.size();)
+	{
+		const Entry& first = entries[i];
+		data.clear();
+		size_t j = i;
+		for (; j < entries.size() && entries[j].area == first.area && entries[j].path == first.path; ++j)
+			data += entries[j].msg;
+		unsigned count = dropped[first.area].exchange(0);
+		if (count)
+		{
+			data += "*** " + Util::toString(count) + " log messages dropped";
+#ifdef _WIN32
+			data += "\r\n";
+#else
+			data += '\n';
+#endif
+		}
+		LogManager::writeFile(first.area, first.path, data);
+		i = j;
+	}
+	entries.clear();
+}
+
+int LogWriter::run()
+{
+	vector<Entry> entries;
+	Entry entry;
+	while (true)
+	{
+		while (pop(entry))
+			entries.push_back(std::move(entry));
+		if (!entries.empty())
+		{
+			flush(entries);
+			continue;
+		}
+		if (stopFlag) break;
+		idle = true;
+		// Recheck after setting the flag: a message pushed before it was set doesn't wake us
+		if (pop(entry))
+		{
+			idle = false;
+			entries.push_back(std::move(entry));
+			continue;
+		}
+		event.wait();
+		event.reset();
+	}
+	return 0;
+}
+
+void LogWriter::stop() noexcept
+{
+	stopFlag = true;
+	event.notify();
+	join();
+}
+
 bool LogManager::g_isInit = false;
 int  LogManager::g_LogMessageID = 0;
 bool LogManager::g_isLogSpeakerEnabled = false;
@@ -81,6 +251,15 @@ void LogManager::init()
 	types[UDP_PACKETS].formatOption     = SettingsManager::LOG_FORMAT_UDP_PACKETS;
 	
 	g_isInit = true;
+
+	try
+	{
+		g_writer.start(0, "LogWriter");
+		g_writerActive = true;
+	}
+	catch (const ThreadException&)
+	{
+	}
 	
 #ifdef _WIN32
 	if (!CompatibilityManager::getStartupInfo().empty())
@@ -95,6 +274,13 @@ void LogManager::init()
 #endif
 }
 
+void LogManager::shutdown() noexcept
+{
+	// Messages logged from now on are written synchronously
+	if (g_writerActive.exchange(false))
+		g_writer.stop();
+}
+
 LogManager::LogManager()
 {
 }
@@ -115,16 +301,26 @@ void LogManager::logRaw(int area, const string& msg, Util::ParamExpander* ex) no
 {
 	dcassert(area >= 0 && area < LAST);
 	string path = SETTING(LOG_DIRECTORY);
-	LogArea& la = types[area];
-	la.cs.lock();
 	string filenameTemplate = SettingsManager::get((SettingsManager::StrSetting) types[area].fileOption);
 	path += Util::validateFileName(Util::formatParams(filenameTemplate, ex, true));
 	if (path.empty())
 	{
 		dcdebug("Empty log path for %d\n", area);
-		la.cs.unlock();
 		return;
 	}
+	if (g_writerActive)
+	{
+		string data = msg;
+		g_writer.push(area, path, data);
+		return;
+	}
+	writeFile(area, path, msg);
+}
+
+void LogManager::writeFile(int area, const string& path, const string& msg) noexcept
+{
+	LogArea& la = types[area];
+	la.cs.lock();
 	try
 	{
 		auto& lf = la.files[path];
@@ -62,6 +62,7 @@ class LogManager
 		};
 		             
 		static void init();
+		static void shutdown() noexcept;
 		static void log(int area, const string& msg) noexcept;
 		static void log(int area, const StringMap& params) noexcept;
 		static void log(int area, Util::ParamExpander* ex) noexcept;
@@ -85,6 +86,8 @@ class LogManager
 		static int  g_LogMessageID;
 
 	private:
+		friend class LogWriter;
+
 		static bool g_isInit;
 		static int64_t nextCloseTime;
 		
@@ -114,6 +117,7 @@ class LogManager
 		static LogArea types[LAST];		
 
 		static void logRaw(int area, const string& msg, Util::ParamExpander* ex) noexcept;
+		static void writeFile(int area, const string& path, const string& data) noexcept;
 };
 
 #define LOG(area, msg) LogManager::log(LogManager::area, msg)
@@ -114,32 +114,43 @@ class MerkleTree
 		 */
 		void update(const void* data, size_t len)
 		{
-			uint8_t* buf = (uint8_t*)data;
-			uint8_t zero = 0;
+			const uint8_t* buf = (const uint8_t*)data;
 			size_t i = 0;
 			
 			// Skip empty data sets if we already added at least one of them...
 			if (len == 0 && !(leaves.empty() && blocks.empty()))
 				return;
-				
-			do
+			
+			// Full leaves are independent, hash them in batches
+			const size_t batchSize = Hasher::MAX_PARALLEL * 4;
+			uint8_t result[batchSize * BYTES];
+			while (len - i >= baseBlockSize)
+			{
+				size_t count = min((len - i) / baseBlockSize, batchSize);
+				Hasher::hashParallel(buf + i, baseBlockSize, count, 0, result);
+				for (size_t j = 0; j < count; ++j)
+					addLeaf(MerkleValue(result + j * BYTES));
+				i += count * baseBlockSize;
+			}
+			
+			if (i < len || len == 0)
 			{
-				size_t n = min(baseBlockSize, len - i);
+				uint8_t zero = 0;
 				Hasher h;
 				h.update(&zero, 1);
-				h.update(buf + i, n);
-				if ((int64_t) baseBlockSize < blockSize)
-				{
-					blocks.push_back(MerkleBlock(MerkleValue(h.finalize()), baseBlockSize));
-					reduceBlocks();
-				}
-				else
-				{
-					leaves.push_back(MerkleValue(h.finalize()));
-				}
-				i += n;
+				h.update(buf + i, len - i);
+				addLeaf(MerkleValue(h.finalize()));
 			}
-			while (i < len);
+			fileSize += len;
+		}
+		
+		/**
+		 * Add the hash of a leaf calculated elsewhere.
+		 * @param len Length of the leaf data, must be BASE_BLOCK_SIZE unless it's the last leaf.
+		 */
+		void updateLeaf(const MerkleValue& value, size_t len)
+		{
+			addLeaf(value);
 			fileSize += len;
 		}
 		
@@ -297,6 +308,19 @@ class MerkleTree
 		}
 		
 	protected:
+		void addLeaf(const MerkleValue& value)
+		{
+			if ((int64_t) baseBlockSize < blockSize)
+			{
+				blocks.push_back(MerkleBlock(value, baseBlockSize));
+				reduceBlocks();
+			}
+			else
+			{
+				leaves.push_back(value);
+			}
+		}
+		
 		void reduceBlocks()
 		{
 			if (blocks.size() > 1)
@@ -0,0 +1,112 @@
+#include "stdinc.h"
+#include "MultiStringSearch.h"
+
+static const uint32_t NO_STATE = 0xFFFFFFFF;
+
+int MultiStringSearch::addPattern(const string& pattern)
+{
+	if (patterns.size() == MAX_PATTERNS) return -1;
+	patterns.push_back(Text::toLower(pattern));
+	return static_cast<int>(patterns.size() - 1);
+}
+
+void MultiStringSearch::clear()
+{
+	patterns.clear();
+	next.clear();
+	output.clear();
+	classCount = 0;
+	emptyMask = 0;
+}
+
+void MultiStringSearch::compile()
+{
+	memset(charClass, 0, sizeof(charClass));
+	classCount = 1;
+	emptyMask = 0;
+	for (const string& pattern : patterns)
+		for (char c : pattern)
+		{
+			uint16_t& cls = charClass[static_cast<uint8_t>(c)];
+			if (!cls) cls = classCount++;
+		}
+
+	// Build the trie
+	next.assign(classCount, NO_STATE);
+	output.assign(1, 0);
+	for (size_t i = 0; i < patterns.size(); ++i)
+	{
+		const string& pattern = patterns[i];
+		if (pattern.empty())
+		{
+			emptyMask |= Mask(1) << i;
+			continue;
+		}
+		uint32_t state = 0;
+		for (char c : pattern)
+		{
+			size_t index = state * classCount + charClass[static_cast<uint8_t>(c)];
+			if (next[index] == NO_STATE)
+			{
+				uint32_t newState = static_cast<uint32_t>(output.size());
+				next[index] = newState;
+				next.resize(next.size() + classCount, NO_STATE);
+				output.push_back(0);
+			}
+			state = next[index];
+		}
+		output[state] |= Mask(1) << i;
+	}
+
+	// Turn it into a DFA, states are visited in breadth-first order
+	vector<uint32_t> fail(output.size(), 0);
+	vector<uint32_t> queue;
+	queue.reserve(output.size());
+	for (unsigned c = 0; c < classCount; ++c)
+	{
+		uint32_t& target = next[c];
+		if (target == NO_STATE)
+			target = 0;
+		else
+			queue.push_back(target);
+	}
+	for (size_t i = 0; i < queue.size(); ++i)
+	{
+		uint32_t state = queue[i];
+		const uint32_t* failRow = &next[fail[state] * classCount];
+		uint32_t* row = &next[state * classCount];
+		for (unsigned c = 0; c < classCount; ++c)
+		{
+			if (row[c] == NO_STATE)
+				row[c] = failRow[c];
+			else
+			{
+				uint32_t target = row[c];
+				fail[target] = failRow[c];
+				output[target] |= output[failRow[c]];
+				queue.push_back(target);
+			}
+		}
+	}
+}
+
+MultiStringSearch::Mask MultiStringSearch::matchLower(const string& text) const noexcept
+{
+	dcassert(Text::toLower(text) == text);
+	const Mask all = getMask();
+	Mask result = emptyMask;
+	if (next.empty()) return result;
+	const uint32_t* table = next.data();
+	const Mask* out = output.data();
+	uint32_t state = 0;
+	for (char c : text)
+	{
+		state = table[state * classCount + charClass[static_cast<uint8_t>(c)]];
+		if (out[state])
+		{
+			result |= out[state];
+			if (result == all) break;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,53 @@
+#ifndef MULTI_STRING_SEARCH_H_
+#define MULTI_STRING_SEARCH_H_
+
+#include "Text.h"
+
+/**
+ * Finds all occurrences of up to 64 patterns in a single pass over the text
+ * (Aho-Corasick automaton with a full transition table).
+ * Bytes that don't occur in any pattern share one column of the table.
+ */
+class MultiStringSearch
+{
+	public:
+		typedef uint64_t Mask;
+		static const size_t MAX_PATTERNS = 64;
+
+		MultiStringSearch() : classCount(0), emptyMask(0) {}
+
+		/**
+		 * Adds a pattern. Must be called before compile.
+		 * @return Index of the pattern or -1 if there are too many patterns.
+		 */
+		int addPattern(const string& pattern);
+		void compile();
+		void clear();
+
+		/**
+		 * @return Mask of the patterns found in text, bit i is set if pattern i occurs in it.
+		 */
+		Mask matchLower(const string& text) const noexcept;
+		Mask match(const string& text) const noexcept
+		{
+			return matchLower(Text::toLower(text));
+		}
+
+		size_t size() const { return patterns.size(); }
+		bool empty() const { return patterns.empty(); }
+		const string& getPattern(size_t index) const { return patterns[index]; }
+		Mask getMask() const
+		{
+			return patterns.size() == MAX_PATTERNS ? ~Mask(0) : (Mask(1) << patterns.size()) - 1;
+		}
+
+	private:
+		StringList patterns;
+		uint16_t charClass[256];
+		unsigned classCount;
+		vector<uint32_t> next; // state * classCount + charClass
+		vector<Mask> output;
+		Mask emptyMask;
+};
+
+#endif // MULTI_STRING_SEARCH_H_
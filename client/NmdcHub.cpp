@@ -32,9 +32,11 @@
 #include "ParamExpander.h"
 #include "StringTokenizer.h"
 #include "SimpleStringTokenizer.h"
+#include "NmdcParser.h"
 #include "MappingManager.h"
 #include "CompatibilityManager.h"
 #include "LogManager.h"
+#include "IncomingSearchQueue.h"
 #include "../jsoncpp/include/json/json.h"
 
 static const string abracadabraLock("EXTENDEDPROTOCOLABCABCABCABCABCABC");
@@ -245,37 +247,40 @@ void NmdcHub::clearUsers()
 	}
 }
 
-void NmdcHub::updateFromTag(Identity& id, const string& tag)
+void NmdcHub::updateFromTag(Identity& id, boost::string_view tag)
 {
-	SimpleStringTokenizer<char> st(tag, ',');
-	string::size_type j;
+	NmdcParser::Tokenizer st(tag, ',');
+	boost::string_view::size_type j;
 	id.setLimit(0);
-	string tok;
+	boost::string_view tok;
 	while (st.getNextNonEmptyToken(tok))
 	{
 		if (tok.length() < 2)
 			continue;
 
-		else if (tok.compare(0, 2, "H:", 2) == 0)
+		else if (tok.starts_with("H:"))
 		{
-			unsigned u[3];
-			int items = sscanf(tok.c_str() + 2, "%u/%u/%u", &u[0], &u[1], &u[2]);
-			if (items != 3)
-				continue;
+			uint64_t u[3];
+			boost::string_view val = tok.substr(2);
+			if (!NmdcParser::parseUInt(val, u[0]) || !val.starts_with('/')) continue;
+			val.remove_prefix(1);
+			if (!NmdcParser::parseUInt(val, u[1]) || !val.starts_with('/')) continue;
+			val.remove_prefix(1);
+			if (!NmdcParser::parseUInt(val, u[2])) continue;
 			id.setHubsNormal(u[0]);
 			id.setHubsRegistered(u[1]);
 			id.setHubsOperator(u[2]);
 		}
-		else if (tok.compare(0, 2, "S:", 2) == 0)
+		else if (tok.starts_with("S:"))
 		{
-			const uint16_t slots = Util::toInt(tok.c_str() + 2);
+			const uint16_t slots = NmdcParser::toInt64(tok.substr(2));
 			id.setSlots(slots);
 #ifdef IRAINMAN_ENABLE_AUTO_BAN
 			if (slots > 0)
 				hubSupportsSlots = true;
 #endif // IRAINMAN_ENABLE_AUTO_BAN
 		}
-		else if (tok.compare(0, 2, "M:", 2) == 0)
+		else if (tok.starts_with("M:"))
 		{
 			if (tok.length() == 3)
 			{
@@ -285,34 +290,34 @@ void NmdcHub::updateFromTag(Identity& id, const string& tag)
 					id.getUser()->setFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
 			}
 		}
-		else if ((j = tok.find("V:")) != string::npos || (j = tok.find("v:")) != string::npos)
+		else if ((j = tok.find("V:")) != boost::string_view::npos || (j = tok.find("v:")) != boost::string_view::npos)
 		{
 			//dcassert(j > 1);
 			if (j > 1)
-				id.setStringParam("AP", tok.substr(0, j - 1));
-			id.setStringParam("VE", tok.substr(j + 2));
+				id.setStringParam("AP", tok.data(), j - 1);
+			id.setStringParam("VE", tok.data() + j + 2, tok.length() - j - 2);
 		}
-		else if ((j = tok.find("L:")) != string::npos)
+		else if ((j = tok.find("L:")) != boost::string_view::npos)
 		{
-			const uint32_t limit = Util::toInt(tok.c_str() + j + 2);
+			const uint32_t limit = NmdcParser::toInt64(tok.substr(j + 2));
 			id.setLimit(limit * 1024);
 		}
-		else if ((j = tok.find(' ')) != string::npos)
+		else if ((j = tok.find(' ')) != boost::string_view::npos)
 		{
 			//dcassert(j > 1);
 			if (j > 1)
-				id.setStringParam("AP", tok.substr(0, j - 1));
-			id.setStringParam("VE", tok.substr(j + 1));
+				id.setStringParam("AP", tok.data(), j - 1);
+			id.setStringParam("VE", tok.data() + j + 1, tok.length() - j - 1);
 		}
-		else if ((j = tok.find("++")) != string::npos)
+		else if ((j = tok.find("++")) != boost::string_view::npos)
 		{
-			id.setStringParam("AP", tok);
+			id.setStringParam("AP", tok.data(), tok.length());
 		}
-		else if (tok.compare(0, 2, "O:", 2) == 0)
+		else if (tok.starts_with("O:"))
 		{
 			// [?] TODO http://nmdc.sourceforge.net/NMDC.html#_tag
 		}
-		else if (tok.compare(0, 2, "C:", 2) == 0)
+		else if (tok.starts_with("C:"))
 		{
 			// http://dchublist.ru/forum/viewtopic.php?p=24035#p24035
 		}
@@ -320,7 +325,7 @@ void NmdcHub::updateFromTag(Identity& id, const string& tag)
 		else
 		{
 			LOCK(NmdcSupports::g_debugCsUnknownNmdcTagParam);
-			NmdcSupports::g_debugUnknownNmdcTagParam[tag]++;
+			NmdcSupports::g_debugUnknownNmdcTagParam[tag.to_string()]++;
 			// dcassert(0);
 			// TODO -      ?
 		}
@@ -330,14 +335,54 @@ void NmdcHub::updateFromTag(Identity& id, const string& tag)
 	// [-] id.setStringParam("TA", '<' + tag + '>'); [-] IRainman opt.
 }
 
+class NmdcSearchRequest : public IncomingSearchQueue::Request
+{
+	public:
+		NmdcSearchRequest(const std::shared_ptr<Client>& hub, const NmdcSearchParam& searchParam) :
+			hub(hub), searchParam(searchParam) {}
+
+		void search(vector<SearchResultCore>& results) noexcept override
+		{
+			if (ClientManager::isBeforeShutdown())
+				return;
+			ShareManager::getInstance()->search(results, searchParam, hub.get());
+		}
+
+		void reply(const vector<SearchResultCore>& results) noexcept override
+		{
+			if (ClientManager::isBeforeShutdown())
+				return;
+			static_cast<NmdcHub*>(hub.get())->sendSearchResults(searchParam, results);
+		}
+
+	private:
+		const std::shared_ptr<Client> hub;
+		const NmdcSearchParam searchParam;
+};
+
 void NmdcHub::handleSearch(const NmdcSearchParam& searchParam)
 {
-	ClientManagerListener::SearchReply reply = ClientManagerListener::SEARCH_MISS;
-	vector<SearchResultCore> searchResults;
 	dcassert(searchParam.maxResults > 0);
 	if (ClientManager::isBeforeShutdown())
 		return;
-	ShareManager::getInstance()->search(searchResults, searchParam, this);
+	string key = "NMDC ";
+	if (searchParam.cacheKey.empty())
+	{
+		key += Util::toString(searchParam.maxResults);
+		key += '=';
+		key += searchParam.filter;
+		key += '|';
+		key += searchParam.shareGroup.toBase32();
+	}
+	else
+		key += searchParam.cacheKey;
+	IncomingSearchQueue::getInstance()->addRequest(getHubUrl(), key,
+		IncomingSearchQueue::RequestPtr(new NmdcSearchRequest(getClientPtr(), searchParam)));
+}
+
+void NmdcHub::sendSearchResults(const NmdcSearchParam& searchParam, const vector<SearchResultCore>& searchResults)
+{
+	ClientManagerListener::SearchReply reply = ClientManagerListener::SEARCH_MISS;
 	if (!searchResults.empty())
 	{
 		if (BOOLSETTING(LOG_SEARCH_TRACE))
@@ -531,15 +576,12 @@ void NmdcHub::searchParse(const string& param, int type)
 	bool isPassive;
 	
 	if (type == ST_SEARCH)
-	{	
-		isPassive = param.compare(0, 4, "Hub:", 4) == 0;
-
-		string::size_type i = 0;
-		string::size_type j = param.find(' ', i);
-		if (j == string::npos || i == j)
+	{
+		NmdcParser::Search search;
+		if (!NmdcParser::parseSearch(param, search))
 			return;
-
-		searchParam.seeker = param.substr(i, j - i);
+		isPassive = search.isPassive;
+		searchParam.seeker = search.seeker.to_string();
 
 		// Filter own searches
 		if (isPassive)
@@ -564,43 +606,24 @@ void NmdcHub::searchParse(const string& param, int type)
 			if (searchParam.seeker == myIP + ":" + Util::toString(myPort))
 				return;
 		}
-		i = j + 1;
-		if (param.length() < i + 4)
-			return;
-		if (param[i + 1] != '?' || param[i + 3] != '?')
-			return;
-		string::size_type queryPos = i;
-		if (param[i] == 'F')
+		if (search.sizeMode == NmdcParser::Search::SIZE_DONTCARE)
 			searchParam.sizeMode = SIZE_DONTCARE;
-		else if (param[i + 2] == 'F')
+		else if (search.sizeMode == NmdcParser::Search::SIZE_ATLEAST)
 			searchParam.sizeMode = SIZE_ATLEAST;
 		else
 			searchParam.sizeMode = SIZE_ATMOST;
-		i += 4;
-		j = param.find('?', i);
-		if (j == string::npos || i == j)
-			return;
-		if (j - i == 1 && param[i] == '0')
-			searchParam.size = 0;
-		else
-			searchParam.size = Util::toInt64(param.c_str() + i);
-		i = j + 1;
-		j = param.find('?', i);
-		if (j == string::npos || i == j)
-			return;
-
-		searchParam.fileType = Util::toInt(param.c_str() + i) - 1;
-		i = j + 1;
+		searchParam.size = search.size;
+		searchParam.fileType = search.fileType;
 
 		if (searchParam.fileType == FILE_TYPE_TTH)
 		{
-			if (param.length() - i == 39 + 4)
-				searchParam.filter = param.substr(i);
+			if (search.query.length() == 39 + 4)
+				searchParam.filter = search.query.to_string();
 		}
 		else
 		{
-			searchParam.filter = unescape(param.substr(i));
-			searchParam.cacheKey = param.substr(queryPos);
+			searchParam.filter = unescape(search.query.to_string());
+			searchParam.cacheKey = search.cacheKey.to_string();
 			if (!searchParam.shareGroup.isZero())
 			{
 				searchParam.cacheKey += '|';
@@ -613,11 +636,13 @@ void NmdcHub::searchParse(const string& param, int type)
 	}
 	else
 	{
-		if (param.length() < 41 || param[39] != ' ') return;
-		if (!Encoder::isBase32(param.c_str(), 39)) return;
-		searchParam.filter = param.substr(0, 39);
-		searchParam.filter.insert(0, "TTH:", 4);
-		searchParam.seeker = param.substr(40);
+		boost::string_view tth, seeker;
+		if (!NmdcParser::parseTTHSearch(param, tth, seeker)) return;
+		if (!Encoder::isBase32(tth.data(), tth.length())) return;
+		searchParam.filter.reserve(4 + tth.length());
+		searchParam.filter = "TTH:";
+		searchParam.filter.append(tth.data(), tth.length());
+		searchParam.seeker = seeker.to_string();
 		isPassive = type == ST_SP;
 		if (isPassive)
 		{
@@ -1261,14 +1286,12 @@ void NmdcHub::nickListParse(const string& param)
 	if (!param.empty())
 	{
 		OnlineUserList v;
-		const StringTokenizer<string> t(param, "$$");
-		const StringList& sl = t.getTokens();
+		NmdcParser::NickListTokenizer t(param);
+		boost::string_view nick;
 		{
-			for (auto it = sl.cbegin(); it != sl.cend(); ++it)
+			while (t.getNextNick(nick))
 			{
-				if (it->empty())
-					continue;
-				OnlineUserPtr ou = getUser(*it);
+				OnlineUserPtr ou = getUser(nick.to_string());
 				v.push_back(ou);
 			}
 			
@@ -1307,15 +1330,12 @@ void NmdcHub::opListParse(const string& param)
 	if (!param.empty())
 	{
 		OnlineUserList v;
-		const StringTokenizer<string> t(param, "$$");
-		const StringList& sl = t.getTokens();
+		NmdcParser::NickListTokenizer t(param);
+		boost::string_view nick;
 		{
-			for (auto it = sl.cbegin(); it != sl.cend(); ++it)
+			while (t.getNextNick(nick))
 			{
-				if (it->empty())
-					continue;
-					
-				OnlineUserPtr ou = getUser(*it);
+				OnlineUserPtr ou = getUser(nick.to_string());
 				if (ou)
 				{
 					ou->getIdentity().setOp(true);
@@ -1349,18 +1369,12 @@ void NmdcHub::toParse(const string& param)
 	// string param = "FlylinkDC-dev4 From: FlylinkDC-dev4 $<!> ";
 	//"SCALOlaz From: 13382 $<k> "
 	//string param = p_param;
-	string::size_type pos_a = param.find(" From: ");
-	
-	if (pos_a == string::npos)
+	NmdcParser::PrivateMessage pm;
+	const int fields = NmdcParser::parsePrivateMessage(param, pm);
+	if (fields == NmdcParser::PrivateMessage::FIELD_NONE)
 		return;
 		
-	pos_a += 7;
-	string::size_type pos_b = param.find(" $<", pos_a);
-	
-	if (pos_b == string::npos)
-		return;
-		
-	const string rtNick = param.substr(pos_a, pos_b - pos_a);
+	const string rtNick = pm.replyTo.to_string();
 	
 	if (rtNick.empty())
 	{
@@ -1375,10 +1389,7 @@ void NmdcHub::toParse(const string& param)
 		LogManager::message("NmdcHub::toParse $To: invalid user: rtNick = " + rtNick + " param = " + param + " Hub = " + getHubUrl());
 #endif
 	
-	pos_a = pos_b + 3;
-	pos_b = param.find("> ", pos_a);
-	
-	if (pos_b == string::npos)
+	if (fields < NmdcParser::PrivateMessage::FIELD_TEXT)
 	{
 #ifdef _DEBUG
 		LogManager::message("NmdcHub::toParse pos_b == string::npos param = " + param + " Hub = " + getHubUrl());
@@ -1386,7 +1397,7 @@ void NmdcHub::toParse(const string& param)
 		return;
 	}
 	
-	const string fromNick = param.substr(pos_a, pos_b - pos_a);
+	const string fromNick = pm.from.to_string();
 	
 	if (fromNick.empty())
 	{
@@ -1396,7 +1407,7 @@ void NmdcHub::toParse(const string& param)
 		return;
 	}
 	
-	const string msgText = param.substr(pos_b + 2);
+	const string msgText = pm.text.to_string();
 	
 	if (msgText.empty())
 	{
@@ -1450,32 +1461,38 @@ void NmdcHub::onLine(const string& aLine)
 		return;
 	}
 	
-	string cmd;
-	string param;
-	string::size_type x = aLine.find(' ');
+	boost::string_view cmdView;
+	boost::string_view paramView;
+	NmdcParser::splitCommand(aLine, cmdView, paramView);
 	int searchType = ST_NONE;
 	bool isMyInfo = false;
-	if (x == string::npos)
-	{
-		cmd = aLine.substr(1);
-	}
-	else
+	if (paramView.data())
 	{
-		cmd = aLine.substr(1, x - 1);
-		param = toUtf8(aLine.substr(x + 1));
-		if (cmd.length() == 2 && cmd[0] == 'S')
+		if (cmdView.length() == 2 && cmdView[0] == 'S')
 		{
-			if (cmd[1] == 'A')
+			if (cmdView[1] == 'A')
 				searchType = ST_SA;
-			else if (cmd[1] == 'P')
+			else if (cmdView[1] == 'P')
 				searchType = ST_SP;
 		}
 		else
-			if (cmd == "Search")
+			if (cmdView == "Search")
 				searchType = ST_SEARCH;
 		if (searchType != ST_NONE && hideShare)
 			return;
 	}
+	// $MyINFO is parsed in place: it's the most frequent command, a hub join sends one for every user
+	if (cmdView == "MyINFO" && !paramView.empty())
+	{
+		if (getEncoding() == Text::CHARSET_UTF8)
+			myInfoParse(paramView);
+		else
+			myInfoParse(toUtf8(paramView.to_string()));
+		updateMyInfoState(true);
+		return;
+	}
+	const string cmd = cmdView.to_string();
+	const string param = paramView.empty() ? string() : toUtf8(paramView.to_string());
 	if (searchType == ST_NONE && isFloodCommand(cmd, param))
 	{
 		return;
@@ -2354,107 +2371,71 @@ bool NmdcHub::extJSONParse(const string& param)
 }
 #endif // FLYLINKDC_USE_EXT_JSON
 
-void NmdcHub::myInfoParse(const string& param)
+void NmdcHub::myInfoParse(boost::string_view param)
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
-	string::size_type i = 5;
-	string::size_type j = param.find(' ', i);
-	if (j == string::npos || j == i)
-		return;
-	const string nick = param.substr(i, j - i);
-	
-	dcassert(!nick.empty());
-	if (nick.empty())
-	{
-		dcassert(0);
+	NmdcParser::MyInfo info;
+	const int fields = NmdcParser::parseMyInfo(param, info);
+	if (fields == NmdcParser::MyInfo::FIELD_NONE)
 		return;
-	}
-	i = j + 1;
 	
-	OnlineUserPtr ou = getUser(nick);
+	OnlineUserPtr ou = getUser(info.nick.to_string());
 	//ou->getUser()->setFlag(User::IS_MYINFO);
-	j = param.find('$', i);
-	dcassert(j != string::npos);
-	if (j == string::npos)
+	dcassert(fields >= NmdcParser::MyInfo::FIELD_DESCRIPTION);
+	if (fields < NmdcParser::MyInfo::FIELD_DESCRIPTION)
 		return;
-	string tmpDesc = unescape(param.substr(i, j - i));
+	Identity& id = ou->getIdentity();
 	// Look for a tag...
-	if (!tmpDesc.empty() && tmpDesc[tmpDesc.size() - 1] == '>')
+	if (info.hasTag)
 	{
-		const string::size_type x = tmpDesc.rfind('<');
-		if (x != string::npos)
+		// Hm, we have something...disassemble it...
+		if (!info.tag.empty())
 		{
-			// Hm, we have something...disassemble it...
-			//dcassert(tmpDesc.length() > x + 2)
-			if (tmpDesc.length() > x + 2)
-			{
-				const string tag = tmpDesc.substr(x + 1, tmpDesc.length() - x - 2);
-				updateFromTag(ou->getIdentity(), tag);
-			}
-			ou->getIdentity().setDescription(tmpDesc.erase(x));
+			if (NmdcParser::hasEscapes(info.tag))
+				updateFromTag(id, unescape(info.tag.to_string()));
+			else
+				updateFromTag(id, info.tag);
 		}
 	}
-	else
+	else if (info.mode == 'A')
 	{
-		ou->getIdentity().setDescription(tmpDesc);
-		dcassert(param.size() > j + 2);
-		if (param.size() > j + 3)
-		{
-			if (param[j] == '$')
-			{
-				if (param[j + 1] == 'A')
-				{
-					ou->getIdentity().getUser()->unsetFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
-				}
-				else if (param[j + 1] == 'P')
-				{
-					ou->getIdentity().getUser()->setFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
-				}
-			}
-		}
+		id.getUser()->unsetFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
+	}
+	else if (info.mode == 'P')
+	{
+		id.getUser()->setFlag(User::NMDC_FILES_PASSIVE | User::NMDC_SEARCH_PASSIVE);
 	}
+	if (NmdcParser::hasEscapes(info.description))
+		id.setDescription(unescape(info.description.to_string()));
+	else
+		id.setDescription(info.description.data(), info.description.length());
 	
-	i = j + 3;
-	j = param.find('$', i);
-	if (j == string::npos)
+	if (fields < NmdcParser::MyInfo::FIELD_CONNECTION)
 		return;
-		
-	if (i == j || j - i - 1 == 0)
+	if (info.connection.empty())
 	{
 #if 0
 		// No connection = bot...
 		ou->getIdentity().setBot();
 #endif
-		NmdcSupports::setStatus(ou->getIdentity(), param[j - 1]);
+		NmdcSupports::setStatus(id, info.status);
 	}
 	else
 	{
-		NmdcSupports::setStatus(ou->getIdentity(), param[j - 1], param.substr(i, j - i - 1));
+		NmdcSupports::setStatus(id, info.status, info.connection.to_string());
 	}
 	
-	i = j + 1;
-	j = param.find('$', i);
-	
-	if (j == string::npos)
+	if (fields < NmdcParser::MyInfo::FIELD_EMAIL)
 		return;
-	if (j != i)
-	{
-		ou->getIdentity().setEmail(unescape(param.substr(i, j - i)));
-	}
+	if (NmdcParser::hasEscapes(info.email))
+		id.setEmail(unescape(info.email.to_string()));
 	else
-	{
-		ou->getIdentity().setEmail(Util::emptyString);
-	}
+		id.setEmail(info.email.data(), info.email.length());
 	
-	i = j + 1;
-	j = param.find('$', i);
-	if (j == string::npos)
+	if (fields < NmdcParser::MyInfo::FIELD_SHARE)
 		return;
-	
-	int64_t shareSize = Util::toInt64(param.c_str() + i);
-	if (shareSize < 0) shareSize = 0;
-	changeBytesShared(ou->getIdentity(), shareSize);
+	changeBytesShared(id, info.share);
 
 	fireUserUpdated(ou);
 }
@@ -23,13 +23,17 @@
 #include "User.h"
 #include "Text.h"
 #include "Client.h"
+#include <boost/utility/string_view.hpp>
 
 class ClientManager;
+class SearchResultCore;
 typedef boost::unordered_map<string, std::pair<std::string, unsigned>>  CFlyUnknownCommand;
 typedef boost::unordered_map<string, std::unordered_map<std::string, unsigned> >  CFlyUnknownCommandArray;
 
 class NmdcHub : public Client, private Flags
 {
+		friend class NmdcSearchRequest;
+
 	public:
 		using Client::send;
 		using Client::connect;
@@ -169,13 +173,14 @@ class NmdcHub : public Client, private Flags
 		                
 		static void sendUDP(const string& address, uint16_t port, string& sr);
 		void handleSearch(const NmdcSearchParam& searchParam);
+		void sendSearchResults(const NmdcSearchParam& searchParam, const vector<SearchResultCore>& searchResults);
 		bool handlePartialSearch(const NmdcSearchParam& searchParam);
 		string getMyExternalIP() const;
 		void getMyUDPAddr(string& ip, uint16_t& port) const;
 		void revConnectToMe(const OnlineUser& aUser);
 		bool resendMyINFO(bool alwaysSend, bool forcePassive);
 		void myInfo(bool alwaysSend, bool forcePassive = false);
-		void myInfoParse(const string& param);
+		void myInfoParse(boost::string_view param);
 #ifdef FLYLINKDC_USE_EXT_JSON
 		bool extJSONParse(const string& param);
 #endif
@@ -193,7 +198,7 @@ class NmdcHub : public Client, private Flags
 		void opListParse(const string& param);
 		void toParse(const string& param);
 		void chatMessageParse(const string& aLine);
-		void updateFromTag(Identity& id, const string& tag);
+		void updateFromTag(Identity& id, boost::string_view tag);
 		
 		void onConnected() noexcept override;
 		void onDataLine(const string& l) noexcept override;
@@ -0,0 +1,326 @@
+#ifndef NMDC_PARSER_H_
+#define NMDC_PARSER_H_
+
+#include <boost/utility/string_view.hpp>
+#include <stdint.h>
+
+/**
+ * Parsers for NMDC commands working on views of the received line.
+ * They don't allocate memory: the results point into the source string.
+ */
+namespace NmdcParser
+{
+	using boost::string_view;
+
+	/** Splits "$Command param" into the command name and the parameters */
+	inline bool splitCommand(string_view line, string_view& cmd, string_view& param)
+	{
+		if (line.empty() || line[0] != '$')
+			return false;
+		const auto x = line.find(' ');
+		if (x == string_view::npos)
+		{
+			cmd = line.substr(1);
+			param = string_view();
+		}
+		else
+		{
+			cmd = line.substr(1, x - 1);
+			param = line.substr(x + 1);
+		}
+		return true;
+	}
+
+	/** Same as SimpleStringTokenizer, but returns views */
+	class Tokenizer
+	{
+		public:
+			Tokenizer(string_view str, char c) : str(str), c(c), start(0) {}
+
+			bool getNextToken(string_view& res)
+			{
+				if (start >= str.length())
+				{
+					res.clear();
+					return false;
+				}
+				auto next = str.find(c, start);
+				if (next == string_view::npos) next = str.length();
+				res = str.substr(start, next - start);
+				start = next + 1;
+				return true;
+			}
+
+			bool getNextNonEmptyToken(string_view& res)
+			{
+				while (start < str.length())
+				{
+					if (str[start] == c)
+					{
+						start++;
+						continue;
+					}
+					return getNextToken(res);
+				}
+				return false;
+			}
+
+		private:
+			const string_view str;
+			const char c;
+			size_t start;
+	};
+
+	/** Parses an unsigned decimal number at the start of str, removes the parsed part */
+	inline bool parseUInt(string_view& str, uint64_t& result)
+	{
+		size_t i = 0;
+		result = 0;
+		while (i < str.length() && str[i] >= '0' && str[i] <= '9')
+			result = result * 10 + (str[i++] - '0');
+		str.remove_prefix(i);
+		return i != 0;
+	}
+
+	inline bool isWhiteSpace(char c)
+	{
+		return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+	}
+
+	/** Same as Util::toInt64 for views: skips leading white space, stops at the first non-digit */
+	inline int64_t toInt64(string_view str)
+	{
+		while (!str.empty() && isWhiteSpace(str[0]))
+			str.remove_prefix(1);
+		bool negative = false;
+		if (!str.empty() && (str[0] == '-' || str[0] == '+'))
+		{
+			negative = str[0] == '-';
+			str.remove_prefix(1);
+		}
+		uint64_t result;
+		parseUInt(str, result);
+		return negative ? -(int64_t) result : (int64_t) result;
+	}
+
+	/** Strings which may contain NMDC escape sequences (&#36; &#124; &amp;) */
+	inline bool hasEscapes(string_view str)
+	{
+		return str.find('&') != string_view::npos;
+	}
+
+	/** Fields of "$ALL <nick> <description><tag>$ $<connection><status>$<e-mail>$<share>$" */
+	struct MyInfo
+	{
+		enum
+		{
+			FIELD_NONE,
+			FIELD_NICK,
+			FIELD_DESCRIPTION,
+			FIELD_CONNECTION,
+			FIELD_EMAIL,
+			FIELD_SHARE
+		};
+
+		string_view nick;
+		string_view description; // escaped, without the tag
+		string_view tag;         // between '<' and '>'
+		bool hasTag;
+		char mode;               // 'A', 'P' or 0, only when the description has no tag
+		string_view connection;
+		char status;
+		string_view email;       // escaped
+		int64_t share;
+	};
+
+	/**
+	 * @return The last field parsed successfully.
+	 * Fields after it are not set: the old parser applied the fields it managed to parse.
+	 */
+	inline int parseMyInfo(string_view param, MyInfo& info)
+	{
+		info.hasTag = false;
+		info.mode = 0;
+		info.status = 0;
+		info.share = 0;
+
+		size_t i = 5;
+		size_t j = param.find(' ', i);
+		if (j == string_view::npos || j == i)
+			return MyInfo::FIELD_NONE;
+		info.nick = param.substr(i, j - i);
+		i = j + 1;
+
+		j = param.find('$', i);
+		if (j == string_view::npos)
+			return MyInfo::FIELD_NICK;
+		info.description = param.substr(i, j - i);
+		if (!info.description.empty() && info.description.back() == '>')
+		{
+			const auto x = info.description.rfind('<');
+			if (x != string_view::npos)
+			{
+				info.hasTag = true;
+				if (info.description.length() > x + 2)
+					info.tag = info.description.substr(x + 1, info.description.length() - x - 2);
+				info.description = info.description.substr(0, x);
+			}
+		}
+		else if (param.size() > j + 3)
+			info.mode = param[j + 1];
+
+		i = j + 3;
+		j = param.find('$', i);
+		if (j == string_view::npos)
+			return MyInfo::FIELD_DESCRIPTION;
+		info.status = param[j - 1];
+		if (!(i == j || j - i - 1 == 0))
+			info.connection = param.substr(i, j - i - 1);
+
+		i = j + 1;
+		j = param.find('$', i);
+		if (j == string_view::npos)
+			return MyInfo::FIELD_CONNECTION;
+		info.email = param.substr(i, j - i);
+
+		i = j + 1;
+		j = param.find('$', i);
+		if (j == string_view::npos)
+			return MyInfo::FIELD_EMAIL;
+		info.share = toInt64(param.substr(i, j - i));
+		if (info.share < 0) info.share = 0;
+		return MyInfo::FIELD_SHARE;
+	}
+
+	/** Fields of "$Search <seeker> <restricted>?<max>?<size>?<type>?<query>" */
+	struct Search
+	{
+		enum
+		{
+			SIZE_DONTCARE,
+			SIZE_ATLEAST,
+			SIZE_ATMOST
+		};
+
+		string_view seeker;   // "Hub:<nick>" or "<ip>:<port>"
+		bool isPassive;
+		int sizeMode;
+		int64_t size;
+		int fileType;         // zero based
+		string_view query;    // escaped, "TTH:<hash>" for TTH searches
+		string_view cacheKey; // everything after the seeker
+	};
+
+	inline bool parseSearch(string_view param, Search& search)
+	{
+		if (param.length() < 4)
+			return false;
+		search.isPassive = param.starts_with("Hub:");
+
+		size_t i = 0;
+		size_t j = param.find(' ', i);
+		if (j == string_view::npos || i == j)
+			return false;
+		search.seeker = param.substr(i, j - i);
+
+		i = j + 1;
+		if (param.length() < i + 4)
+			return false;
+		if (param[i + 1] != '?' || param[i + 3] != '?')
+			return false;
+		search.cacheKey = param.substr(i);
+		if (param[i] == 'F')
+			search.sizeMode = Search::SIZE_DONTCARE;
+		else if (param[i + 2] == 'F')
+			search.sizeMode = Search::SIZE_ATLEAST;
+		else
+			search.sizeMode = Search::SIZE_ATMOST;
+		i += 4;
+		j = param.find('?', i);
+		if (j == string_view::npos || i == j)
+			return false;
+		search.size = toInt64(param.substr(i, j - i));
+		i = j + 1;
+		j = param.find('?', i);
+		if (j == string_view::npos || i == j)
+			return false;
+		search.fileType = static_cast<int>(toInt64(param.substr(i, j - i))) - 1;
+		search.query = param.substr(j + 1);
+		return true;
+	}
+
+	/** Splits "<tth> <seeker>" of $SA and $SP, the hash is not validated */
+	inline bool parseTTHSearch(string_view param, string_view& tth, string_view& seeker)
+	{
+		if (param.length() < 41 || param[39] != ' ')
+			return false;
+		tth = param.substr(0, 39);
+		seeker = param.substr(40);
+		return true;
+	}
+
+	/** Fields of "$To: <nick> From: <replyTo> $<<from>> <text>" */
+	struct PrivateMessage
+	{
+		enum
+		{
+			FIELD_NONE,
+			FIELD_REPLY_TO,
+			FIELD_FROM,
+			FIELD_TEXT
+		};
+
+		string_view replyTo;
+		string_view from;
+		string_view text; // escaped
+	};
+
+	/** @return The last field parsed successfully */
+	inline int parsePrivateMessage(string_view param, PrivateMessage& pm)
+	{
+		size_t i = param.find(" From: ");
+		if (i == string_view::npos)
+			return PrivateMessage::FIELD_NONE;
+		i += 7;
+		size_t j = param.find(" $<", i);
+		if (j == string_view::npos)
+			return PrivateMessage::FIELD_NONE;
+		pm.replyTo = param.substr(i, j - i);
+
+		i = j + 3;
+		j = param.find("> ", i);
+		if (j == string_view::npos)
+			return PrivateMessage::FIELD_REPLY_TO;
+		pm.from = param.substr(i, j - i);
+		pm.text = param.substr(j + 2);
+		return PrivateMessage::FIELD_TEXT;
+	}
+
+	/** Returns the nicks of "$NickList" and "$OpList" ("nick1$$nick2$$"), skips empty ones */
+	class NickListTokenizer
+	{
+		public:
+			explicit NickListTokenizer(string_view str) : str(str), start(0) {}
+
+			bool getNextNick(string_view& res)
+			{
+				while (start < str.length())
+				{
+					auto next = str.find("$$", start);
+					if (next == string_view::npos) next = str.length();
+					res = str.substr(start, next - start);
+					start = next + 2;
+					if (!res.empty())
+						return true;
+				}
+				res.clear();
+				return false;
+			}
+
+		private:
+			const string_view str;
+			size_t start;
+	};
+}
+
+#endif // NMDC_PARSER_H_
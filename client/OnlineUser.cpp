@@ -227,9 +227,9 @@ void Identity::getParams(StringMap& sm, const string& prefix, bool compatibility
 		LOCK(cs);
 		SKIP_EMPTY("VE", getStringParamL(TAG('V', 'E')));
 		SKIP_EMPTY("AP", getStringParamL(TAG('A', 'P')));
-		for (auto i = stringInfo.cbegin(); i != stringInfo.cend(); ++i)
+		for (const auto& item : stringInfo)
 		{
-			sm[prefix + string((char*)(&i->first), 2)] = i->second;
+			sm[prefix + string((const char*)(&item.tag), 2)] = item.value.get();
 		}
 	}
 #undef APPEND
@@ -239,21 +239,21 @@ void Identity::getParams(StringMap& sm, const string& prefix, bool compatibility
 string Identity::getTag() const
 {
 	cs.lock();
-	auto itAP = stringInfo.find(TAG('A', 'P'));
-	auto itVE = stringInfo.find(TAG('V', 'E'));
-	if (itAP != stringInfo.cend() || itVE != stringInfo.cend())
+	auto itAP = findStringL(TAG('A', 'P'));
+	auto itVE = findStringL(TAG('V', 'E'));
+	if (itAP || itVE)
 	{
 		string result;
 		char tagItem[128];
-		if (itAP != stringInfo.cend())
+		if (itAP)
 		{
-			result = '<' + itAP->second + " V:";
+			result = '<' + itAP->get() + " V:";
 			// TODO: check if "V:" followed by empty string is OK
-			if (itVE != stringInfo.cend()) result += itVE->second;
+			if (itVE) result += itVE->get();
 		}
 		else
 		{
-			result = '<' + itVE->second;
+			result = '<' + itVE->get();
 		}
 		cs.unlock();
 		snprintf(tagItem, sizeof(tagItem), ",M:%c,H:%u/%u/%u,S:%u>",
@@ -345,10 +345,8 @@ const string& Identity::getStringParamL(uint16_t tag) const
 		}
 	}
 
-	const auto i = stringInfo.find(tag);
-	if (i != stringInfo.end())
-		return i->second;
-	return Util::emptyString;
+	const auto i = findStringL(tag);
+	return i ? i->get() : Util::emptyString;
 }
 
 string Identity::getStringParam(const char* name) const
@@ -373,14 +371,14 @@ string Identity::getStringParam(const char* name) const
 	}
 	{
 		LOCK(cs);
-		const auto i = stringInfo.find(tag);
-		if (i != stringInfo.end())
-			return i->second;
+		const auto i = findStringL(tag);
+		if (i)
+			return i->get();
 	}
 	return Util::emptyString;
 }
 
-void Identity::setStringParam(const char* name, const string& val)
+bool Identity::setStringParam(const char* name, const char* val, size_t len)
 {
 	uint16_t tag = *reinterpret_cast<const uint16_t*>(name);
 	CHECK_GET_SET_COMMAND();
@@ -389,21 +387,37 @@ void Identity::setStringParam(const char* name, const string& val)
 	{
 		case TAG('E', 'M'):
 		{
-			setNotEmptyStringBit(EM, !val.empty());
+			setNotEmptyStringBit(EM, len != 0);
 			break;
 		}
 		case TAG('D', 'E'):
 		{
-			setNotEmptyStringBit(DE, !val.empty());
+			setNotEmptyStringBit(DE, len != 0);
 			break;
 		}
 	}
 
+	{
+		// Most updates don't change anything
+		LOCK(cs);
+		const auto i = findStringL(tag);
+		if (i ? i->get().compare(0, string::npos, val, len) == 0 : len == 0)
+			return false;
+	}
+	InternedString newVal(val, len);
 	LOCK(cs);
-	if (val.empty())
-		stringInfo.erase(tag);
-	else
-		stringInfo[tag] = val;
+	for (auto i = stringInfo.begin(); i != stringInfo.end(); ++i)
+		if (i->tag == tag)
+		{
+			if (newVal.empty())
+				stringInfo.erase(i);
+			else
+				i->value = std::move(newVal);
+			return true;
+		}
+	if (!newVal.empty())
+		stringInfo.push_back(StringItem{tag, std::move(newVal)});
+	return true;
 }
 
 void FavoriteUser::update(const OnlineUser& info)
@@ -544,11 +558,11 @@ void Identity::getReport(string& report)
 			LOCK(cs);
 			for (auto i = stringInfo.cbegin(); i != stringInfo.cend(); ++i)
 			{
-				auto name = string((char*)(&i->first), 2);
-				const auto& value = i->second;
+				auto name = string((const char*)(&i->tag), 2);
+				const auto& value = i->value.get();
 				// TODO: translate known tags and format values to something more readable
 				bool append = true;
-				switch (i->first)
+				switch (i->tag)
 				{
 					case TAG('C', 'S'):
 						name = "Cheat description";
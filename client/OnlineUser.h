@@ -23,6 +23,7 @@
 #include "User.h"
 #include "UserInfoBase.h"
 #include "UserInfoColumns.h"
+#include "StringPool.h"
 
 #ifdef _DEBUG
 #include <atomic>
@@ -99,7 +100,8 @@ class Identity
 		
 #define GSMC(n, x, c)\
 		string get##n() const { return getStringParam(x); }\
-		void set##n(const string& v) { setStringParam(x, v); change(c); }
+		void set##n(const string& v) { if (setStringParam(x, v)) change(c); }\
+		void set##n(const char* v, size_t len) { if (setStringParam(x, v, len)) change(c); }
 
 #define GSM(n, x)\
 		string get##n() const { return getStringParam(x); }\
@@ -625,7 +627,11 @@ class Identity
 			else
 				return Util::emptyString;
 		}
-		void setStringParam(const char* name, const string& val);
+		bool setStringParam(const char* name, const string& val)
+		{
+			return setStringParam(name, val.data(), val.length());
+		}
+		bool setStringParam(const char* name, const char* val, size_t len);
 		
 #ifdef FLYLINKDC_USE_DETECT_CHEATING
 		string setCheat(const ClientBase& c, const string& aCheatDescription, bool aBadClient);
@@ -652,8 +658,15 @@ class Identity
 		void setExtJSON();
 		
 	private:
+		struct StringItem
+		{
+			uint16_t tag;
+			InternedString value;
+		};
+
 		mutable FastCriticalSection cs;
-		boost::unordered_map<uint16_t, string> stringInfo;
+		// Few items per user: a vector is searched faster than a hash map and takes much less memory
+		vector<StringItem> stringInfo;
 	
 #pragma pack(push,1)
 		struct
@@ -666,6 +679,12 @@ class Identity
 #pragma pack(pop)
 
 		const string& getStringParamL(uint16_t tag) const;
+		const InternedString* findStringL(uint16_t tag) const
+		{
+			for (const auto& item : stringInfo)
+				if (item.tag == tag) return &item.value;
+			return nullptr;
+		}
 };
 
 class OnlineUser :  public UserInfoBase
@@ -46,7 +46,6 @@ QueueItem::QueueItem(const string& target, int64_t size, Priority priority, bool
 	autoPriority(autoPriority),
 	tthRoot(tth),
 	downloadedBytes(0),
-	doneSegmentsSize(0),
 	lastsize(0),
 	averageSpeed(0),
 	cachedOnlineSourceCountInvalid(false),
@@ -263,7 +262,6 @@ void QueueItem::resetDownloaded()
 void QueueItem::resetDownloadedL()
 {
 	doneSegments.clear();
-	doneSegmentsSize = 0;
 }
 
 bool QueueItem::isFinished() const
@@ -272,8 +270,8 @@ bool QueueItem::isFinished() const
 	{
 		LOCK(csSegments);
 		return doneSegments.size() == 1 &&
-			doneSegments.begin()->getStart() == 0 &&
-			doneSegments.begin()->getSize() == getSize();
+			doneSegments.begin()->first == 0 &&
+			doneSegments.begin()->second == getSize();
 	}
 	return false;
 }
@@ -283,17 +281,11 @@ bool QueueItem::isChunkDownloaded(int64_t startPos, int64_t& len) const
 	if (len <= 0)
 		return false;
 	LOCK(csSegments);
-	for (auto i = doneSegments.cbegin(); i != doneSegments.cend(); ++i)
-	{
-		const int64_t start = i->getStart();
-		const int64_t end   = i->getEnd();
-		if (start <= startPos && startPos < end)
-		{
-			len = min(len, end - startPos);
-			return true;
-		}
-	}
-	return false;
+	auto i = doneSegments.find(startPos);
+	if (i == doneSegments.end())
+		return false;
+	len = min(len, i->second - startPos);
+	return true;
 }
 
 void QueueItem::removeSourceL(const UserPtr& user, Flags::MaskType reason)
@@ -406,133 +398,117 @@ bool QueueItem::removeDownload(const UserPtr& user)
 	return false;
 }
 
-Segment QueueItem::getNextSegmentForward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<int64_t>& posArray) const
+bool QueueItem::isBlockBusy(int64_t start, int64_t end, int64_t doneEnd, bool singleBlock, int64_t& busyStart, int64_t& busyEnd) const
+{
+	auto i = doneSegments.findAfter(start);
+	if (i != doneSegments.end())
+	{
+		// We accept partial overlaps of a single block, only consider it done if it is fully consumed by the done range
+		if (singleBlock ? (i->first <= start && i->second >= doneEnd) : i->first < end)
+		{
+			busyStart = i->first;
+			busyEnd = i->second;
+			return true;
+		}
+	}
+	for (auto j = downloads.cbegin(); j != downloads.cend(); ++j)
+	{
+		const Segment& segment = (*j)->getSegment();
+		if (segment.getStart() < end && start < segment.getEnd())
+		{
+			busyStart = segment.getStart();
+			busyEnd = segment.getEnd();
+			return true;
+		}
+	}
+	return false;
+}
+
+void QueueItem::addNeededParts(int64_t start, int64_t end, int64_t blockSize, const vector<Segment>& available, vector<Segment>& neededParts) const
+{
+	(void) blockSize; // only checked by dcassert
+	for (const Segment& part : available)
+	{
+		if (part.getStart() >= end || part.getEnd() <= start) continue;
+		int64_t b = max(start, part.getStart());
+		int64_t e = min(end, part.getEnd());
+		
+		// segment must be blockSize aligned
+		dcassert(b % blockSize == 0);
+		dcassert(e % blockSize == 0 || e == getSize());
+		
+		neededParts.push_back(Segment(b, e - b));
+	}
+}
+
+Segment QueueItem::getNextSegmentForward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<Segment>& available) const
 {
 	int64_t start = 0;
 	int64_t curSize = targetSize;
 	if (!doneSegments.empty())
 	{
-		const Segment& segBegin = *doneSegments.begin();
-		if (segBegin.getStart() == 0) start = segBegin.getEnd();
+		auto first = doneSegments.begin();
+		if (first->first == 0) start = first->second;
 	}
 	while (start < getSize())
 	{
 		int64_t end = std::min(getSize(), start + curSize);
-		Segment block(start, end - start);
-		bool overlaps = false;
-		for (auto i = doneSegments.cbegin(); !overlaps && i != doneSegments.cend(); ++i)
+		const bool singleBlock = curSize <= blockSize;
+		int64_t busyStart, busyEnd;
+		if (!isBlockBusy(start, end, end, singleBlock, busyStart, busyEnd))
 		{
-			if (curSize <= blockSize)
-			{
-				int64_t dstart = i->getStart();
-				int64_t dend = i->getEnd();
-				// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-				if (dstart <= start && dend >= end)
-					overlaps = true;
-			}
-			else
-				overlaps = block.overlaps(*i);
-		}
-		if (!overlaps)
-		{
-			for (auto i = downloads.cbegin(); !overlaps && i != downloads.cend(); ++i)
-				overlaps = block.overlaps((*i)->getSegment());
-		}
-				
-		if (!overlaps)
-		{
-			if (!neededParts) return block;
+			if (!neededParts) return Segment(start, end - start);
 			// store all chunks we could need
-			for (vector<int64_t>::size_type j = 0; j < posArray.size(); j += 2)
-			{
-				if ((posArray[j] <= start && start < posArray[j + 1]) || (start <= posArray[j] && posArray[j] < end))
-				{
-					int64_t b = max(start, posArray[j]);
-					int64_t e = min(end, posArray[j + 1]);
-
-					// segment must be blockSize aligned
-					dcassert(b % blockSize == 0);
-					dcassert(e % blockSize == 0 || e == getSize());
-
-					neededParts->push_back(Segment(b, e - b));
-				}
-			}
+			addNeededParts(start, end, blockSize, available, *neededParts);
+			start = end;
+			curSize = targetSize;
 		}
-
-		if (overlaps && curSize > blockSize)
+		else if (!singleBlock)
 		{
 			curSize -= blockSize;
 		}
 		else
 		{
-			start = end;
+			// skip all blocks ending inside the busy range at once
+			start += std::max<int64_t>(1, (busyEnd - start) / blockSize) * blockSize;
 			curSize = targetSize;
 		}
 	}
 	return Segment(0, 0);
 }
 
-Segment QueueItem::getNextSegmentBackward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<int64_t>& posArray) const
+Segment QueueItem::getNextSegmentBackward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<Segment>& available) const
 {
 	int64_t end = 0;
 	int64_t curSize = targetSize;
 	if (!doneSegments.empty())
 	{
-		const Segment& segEnd = *doneSegments.crbegin();
-		if (segEnd.getEnd() == getSize()) end = segEnd.getStart();
+		auto last = doneSegments.rbegin();
+		if (last->second == getSize()) end = last->first;
 	}
 	if (!end) end = Util::roundUp(getSize(), blockSize);
 	while (end > 0)
 	{
 		int64_t start = std::max<int64_t>(0, end - curSize);
-		Segment block(start, std::min(end, getSize()) - start);
-		bool overlaps = false;
-		for (auto i = doneSegments.crbegin(); !overlaps && i != doneSegments.crend(); ++i)
+		int64_t blockEnd = std::min(end, getSize());
+		const bool singleBlock = curSize <= blockSize;
+		int64_t busyStart, busyEnd;
+		if (!isBlockBusy(start, blockEnd, end, singleBlock, busyStart, busyEnd))
 		{
-			if (curSize <= blockSize)
-			{
-				int64_t dstart = i->getStart();
-				int64_t dend = i->getEnd();
-				// We accept partial overlaps, only consider the block done if it is fully consumed by the done block
-				if (dstart <= start && dend >= end)
-					overlaps = true;
-			}
-			else
-				overlaps = i->overlaps(block);
-		}
-		if (!overlaps)
-		{
-			for (auto i = downloads.crbegin(); !overlaps && i != downloads.crend(); ++i)
-				overlaps = (*i)->getSegment().overlaps(block);
-		}
-				
-		if (!overlaps)
-		{
-			if (!neededParts) return block;
+			if (!neededParts) return Segment(start, blockEnd - start);
 			// store all chunks we could need
-			for (vector<int64_t>::size_type j = 0; j < posArray.size(); j += 2)
-			{
-				if ((posArray[j] <= start && start < posArray[j + 1]) || (start <= posArray[j] && posArray[j] < end))
-				{
-					int64_t b = max(start, posArray[j]);
-					int64_t e = min(end, posArray[j + 1]);
-
-					// segment must be blockSize aligned
-					dcassert(b % blockSize == 0);
-					dcassert(e % blockSize == 0 || e == getSize());
-
-					neededParts->push_back(Segment(b, e - b));
-				}
-			}
+			addNeededParts(start, blockEnd, blockSize, available, *neededParts);
+			end = start;
+			curSize = targetSize;
 		}
-
-		if (overlaps && curSize > blockSize)
+		else if (!singleBlock)
 		{
 			curSize -= blockSize;
 		}
 		else
 		{
-			end = start;
+			// skip all blocks starting inside the busy range at once
+			end -= std::max<int64_t>(1, (end - busyStart) / blockSize) * blockSize;
 			curSize = targetSize;
 		}
 	}
@@ -542,13 +518,13 @@ Segment QueueItem::getNextSegmentBackward(const int64_t blockSize, const int64_t
 bool QueueItem::shouldSearchBackward() const
 {
 	if (!isSet(FLAG_WANT_END) || doneSegments.empty()) return false;
-	const Segment& segBegin = *doneSegments.begin();
-	if (segBegin.getStart() != 0 || segBegin.getSize() < 1024*1204) return false;
-	const Segment& segEnd = *doneSegments.rbegin();
-	if (segEnd.getEnd() == getSize())
+	auto segBegin = doneSegments.begin();
+	if (segBegin->first != 0 || segBegin->second < 1024*1204) return false;
+	auto segEnd = doneSegments.rbegin();
+	if (segEnd->second == getSize())
 	{
 		int64_t requiredSize = getSize()*3/100; // 3% of file
-		if (segEnd.getSize() > requiredSize) return false;
+		if (segEnd->second - segEnd->first > requiredSize) return false;
 	}
 	return true;
 }
@@ -574,23 +550,18 @@ Segment QueueItem::getNextSegmentL(const int64_t blockSize, const int64_t wanted
 		if (!doneSegments.empty())
 		{
 			LOCK(csSegments);
-			const Segment& first = *doneSegments.begin();
+			auto first = doneSegments.begin();
 			
-			if (first.getStart() > 0)
+			if (first->first > 0)
 			{
-				end = Util::roundUp(first.getStart(), blockSize);
+				end = Util::roundUp(first->first, blockSize);
 			}
 			else
 			{
-				start = Util::roundDown(first.getEnd(), blockSize);
-				{
-					LOCK(csSegments);
-					if (doneSegments.size() > 1)
-					{
-						const Segment& second = *(++doneSegments.begin());
-						end = Util::roundUp(second.getStart(), blockSize);
-					}
-				}
+				start = Util::roundDown(first->second, blockSize);
+				auto second = std::next(first);
+				if (second != doneSegments.end())
+					end = Util::roundUp(second->first, blockSize);
 			}
 		}
 		
@@ -607,25 +578,27 @@ Segment QueueItem::getNextSegmentL(const int64_t blockSize, const int64_t wanted
 	}
 	
 	/* added for PFS */
-	vector<int64_t> posArray;
+	vector<Segment> available;
 	vector<Segment> neededParts;
 	
 	if (partialSource && partialSource->getBlockSize() == blockSize)
 	{
-		posArray.reserve(partialSource->getParts().size());
-		
 		// Convert block index to file position
-		for (auto i = partialSource->getParts().cbegin(); i != partialSource->getParts().cend(); ++i)
+		const auto& parts = partialSource->getParts();
+		available.reserve(parts.size() / 2);
+		for (size_t i = 0; i + 1 < parts.size(); i += 2)
 		{
-			int64_t pos = (int64_t) *i * blockSize;
-			posArray.push_back(min(getSize(), pos));
+			const int64_t start = min(getSize(), (int64_t) parts[i] * blockSize);
+			const int64_t end = min(getSize(), (int64_t) parts[i + 1] * blockSize);
+			if (start < end)
+				available.push_back(Segment(start, end - start));
 		}
 	}
 	
 	double donePart;
 	{
 		LOCK(csSegments);
-		donePart = static_cast<double>(doneSegmentsSize) / getSize();
+		donePart = static_cast<double>(doneSegments.getTotal()) / getSize();
 	}
 	
 	// We want smaller blocks at the end of the transfer, squaring gives a nice curve...
@@ -646,8 +619,8 @@ Segment QueueItem::getNextSegmentL(const int64_t blockSize, const int64_t wanted
 		{
 			LOCK(csSegments);
 			Segment block = shouldSearchBackward()?
-				getNextSegmentBackward(blockSize, targetSize, partialSource? &neededParts : nullptr, posArray) :
-				getNextSegmentForward(blockSize, targetSize, partialSource? &neededParts : nullptr, posArray);
+				getNextSegmentBackward(blockSize, targetSize, partialSource? &neededParts : nullptr, available) :
+				getNextSegmentForward(blockSize, targetSize, partialSource? &neededParts : nullptr, available);
 			if (block.getSize()) return block;
 		}
 	} // end lock
@@ -721,7 +694,7 @@ void QueueItem::updateDownloadedBytesAndSpeedL()
 	int64_t totalSpeed = 0;
 	{
 		LOCK(csSegments);
-		downloadedBytes = doneSegmentsSize;
+		downloadedBytes = doneSegments.getTotal();
 	}
 	// count running segments
 	LOCK(csDownloads);
@@ -737,7 +710,7 @@ void QueueItem::updateDownloadedBytesAndSpeedL()
 void QueueItem::updateDownloadedBytes()
 {
 	LOCK(csSegments);
-	downloadedBytes = doneSegmentsSize;
+	downloadedBytes = doneSegments.getTotal();
 }
 
 void QueueItem::addSegment(const Segment& segment)
@@ -749,29 +722,7 @@ void QueueItem::addSegment(const Segment& segment)
 void QueueItem::addSegmentL(const Segment& segment)
 {
 	dcassert(!segment.getOverlapped());
-	doneSegments.insert(segment);
-	doneSegmentsSize += segment.getSize();
-	// Consolidate segments
-	if (doneSegments.size() == 1)
-		return;
-	for (auto current = ++doneSegments.cbegin(); current != doneSegments.cend();)
-	{
-		SegmentSet::iterator prev = current;
-		--prev;
-		const Segment& segCurrent = *current;
-		const Segment& segPrev = *prev;
-		if (segPrev.getEnd() >= segCurrent.getStart())
-		{
-			int64_t bigEnd = std::max(segCurrent.getEnd(), segPrev.getEnd());
-			Segment big(segPrev.getStart(), bigEnd - segPrev.getStart());
-			int64_t removedSize = segPrev.getSize() + segCurrent.getSize();
-			doneSegments.erase(prev);
-			doneSegments.erase(current++);
-			doneSegments.insert(big);
-			doneSegmentsSize -= removedSize;
-			doneSegmentsSize += big.getSize();
-		} else ++current;
-	}
+	doneSegments.add(segment.getStart(), segment.getEnd());
 }
 
 bool QueueItem::isNeededPart(const PartsInfo& theirParts, const PartsInfo& ourParts)
@@ -821,10 +772,10 @@ void QueueItem::getParts(PartsInfo& partialInfo, uint64_t blockSize) const
 	const size_t maxSize = min(doneSegments.size() * 2, (size_t) 510);
 	partialInfo.reserve(maxSize);
 	
-	for (auto i = doneSegments.cbegin(); i != doneSegments.cend() && partialInfo.size() < maxSize; ++i)
+	for (auto i = doneSegments.begin(); i != doneSegments.end() && partialInfo.size() < maxSize; ++i)
 	{
-		uint16_t s = (uint16_t)((i->getStart() + blockSize - 1) / blockSize); // round up
-		int64_t end = i->getEnd();
+		uint16_t s = (uint16_t)((i->first + blockSize - 1) / blockSize); // round up
+		int64_t end = i->second;
 		if (end >= getSize()) end += blockSize - 1;
 		uint16_t e = (uint16_t)(end / blockSize); // round down for all chunks but last
 		partialInfo.push_back(s);
@@ -851,8 +802,8 @@ void QueueItem::getDoneSegments(vector<Segment>& done) const
 	done.clear();
 	LOCK(csSegments);
 	done.reserve(doneSegments.size());
-	for (auto i = doneSegments.cbegin(); i != doneSegments.cend(); ++i)
-		done.push_back(*i);
+	for (auto i = doneSegments.begin(); i != doneSegments.end(); ++i)
+		done.push_back(Segment(i->first, i->second - i->first));
 }
 
 void QueueItem::getChunksVisualisation(vector<RunningSegment>& running, vector<Segment>& done) const
@@ -875,8 +826,8 @@ void QueueItem::getChunksVisualisation(vector<RunningSegment>& running, vector<S
 	{
 		LOCK(csSegments);
 		done.reserve(doneSegments.size());
-		for (auto i = doneSegments.cbegin(); i != doneSegments.cend(); ++i)
-			done.push_back(*i);
+		for (auto i = doneSegments.begin(); i != doneSegments.end(); ++i)
+			done.push_back(Segment(i->first, i->second - i->first));
 	}
 }
 
@@ -21,6 +21,7 @@
 #define DCPLUSPLUS_DCPP_QUEUE_ITEM_H
 
 #include "Segment.h"
+#include "RangeSet.h"
 #include "HintedUser.h"
 #include "RWLock.h"
 #include "Download.h"
@@ -166,8 +167,6 @@ class QueueItem
 		typedef SourceMap::iterator SourceIter;
 		typedef SourceMap::const_iterator SourceConstIter;
 
-		typedef std::set<Segment> SegmentSet;
-		
 		QueueItem(const string& aTarget, int64_t aSize, Priority aPriority, bool aAutoPriority, Flags::MaskType aFlag,
 		          time_t aAdded, const TTHValue& tth, uint8_t maxSegments, const string& aTempTarget);
 		          
@@ -284,8 +283,10 @@ class QueueItem
 		const TTHValue tthRoot;
 		uint64_t blockSize;
 
-		Segment getNextSegmentForward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<int64_t>& posArray) const;
-		Segment getNextSegmentBackward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<int64_t>& posArray) const;
+		bool isBlockBusy(int64_t start, int64_t end, int64_t doneEnd, bool singleBlock, int64_t& busyStart, int64_t& busyEnd) const;
+		void addNeededParts(int64_t start, int64_t end, int64_t blockSize, const vector<Segment>& available, vector<Segment>& neededParts) const;
+		Segment getNextSegmentForward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<Segment>& available) const;
+		Segment getNextSegmentBackward(const int64_t blockSize, const int64_t targetSize, vector<Segment>* neededParts, const vector<Segment>& available) const;
 		bool shouldSearchBackward() const;
 
 	public:
@@ -307,8 +308,7 @@ class QueueItem
 		DownloadList downloads;		
 		mutable FastCriticalSection csDownloads;
 		
-		SegmentSet doneSegments;
-		int64_t doneSegmentsSize;
+		RangeSet doneSegments;
 		int64_t downloadedBytes;				
 		mutable FastCriticalSection csSegments;
 		
@@ -46,14 +46,14 @@ static const int PFS_QUERY_INTERVAL = 300000; // 5 minutes
 
 QueueManager::FileQueue QueueManager::fileQueue;
 QueueManager::UserQueue QueueManager::userQueue;
-bool QueueManager::g_dirty = false;
+std::atomic_bool QueueManager::g_dirty(false);
 uint64_t QueueManager::g_lastSave = 0;
 QueueManager::UserQueue::UserQueueMap QueueManager::UserQueue::userQueueMap[QueueItem::LAST];
 QueueManager::UserQueue::RunningMap QueueManager::UserQueue::runningMap;
 #ifdef FLYLINKDC_USE_RUNNING_QUEUE_CS
 std::unique_ptr<RWLock> QueueManager::UserQueue::csRunningMap = std::unique_ptr<RWLock>(RWLock::create());
 #endif
-size_t QueueManager::UserQueue::totalDownloads = 0;
+std::atomic<size_t> QueueManager::UserQueue::totalDownloads(0);
 
 using boost::adaptors::map_values;
 using boost::range::for_each;
@@ -231,6 +231,40 @@ int QueueManager::FileQueue::findQueueItems(QueueItemList& ql, const TTHValue& t
 	return count;
 }
 
+void QueueManager::FileQueue::findQueueItems(QueueItemList& ql, const boost::unordered_map<TTHValue, int64_t>& tthMap) const
+{
+	QueueRLock(*csFQ);
+	if (tthMap.size() < queue.size())
+	{
+		for (auto i = tthMap.cbegin(); i != tthMap.cend(); ++i)
+		{
+			auto j = queueTTH.find(i->first);
+			if (j == queueTTH.end()) continue;
+			for (const QueueItemPtr& qi : j->second)
+				if (qi->getSize() == i->second)
+					ql.push_back(qi);
+		}
+	}
+	else
+	{
+		for (auto i = queue.cbegin(); i != queue.cend(); ++i)
+		{
+			const QueueItemPtr& qi = i->second;
+			const auto j = tthMap.find(qi->getTTH());
+			if (j != tthMap.cend() && j->second == qi->getSize())
+				ql.push_back(qi);
+		}
+	}
+}
+
+void QueueManager::FileQueue::getItems(vector<QueueItemPtr>& items) const
+{
+	QueueRLock(*csFQ);
+	items.reserve(queue.size());
+	for (auto i = queue.cbegin(); i != queue.cend(); ++i)
+		items.push_back(i->second);
+}
+
 QueueItemPtr QueueManager::FileQueue::findQueueItem(const TTHValue& tth) const
 {
 	QueueRLock(*csFQ);
@@ -499,19 +533,17 @@ void QueueManager::UserQueue::addDownload(const QueueItemPtr& qi, const Download
 	{
 		WRITE_LOCK(*csRunningMap);
 		runningMap[d->getUser()] = qi;
-		totalDownloads++;
 	}
+	totalDownloads++;
 }
 
 void QueueManager::UserQueue::modifyRunningCount(int count)
 {
-	WRITE_LOCK(*csRunningMap);
 	totalDownloads += count;
 }
 
 size_t QueueManager::UserQueue::getRunningCount()
 {
-	READ_LOCK(*csRunningMap);
 	return totalDownloads;
 }
 
@@ -539,8 +571,10 @@ void QueueManager::UserQueue::removeRunning(const UserPtr& user)
 bool QueueManager::UserQueue::removeDownload(const QueueItemPtr& qi, const UserPtr& user)
 {
 	bool result = qi->removeDownload(user);
-	WRITE_LOCK(*csRunningMap);
-	runningMap.erase(user);
+	{
+		WRITE_LOCK(*csRunningMap);
+		runningMap.erase(user);
+	}
 	if (result)
 	{
 		dcassert(totalDownloads > 0);
@@ -1245,44 +1279,78 @@ int QueueManager::matchListing(DirectoryListing& dl) noexcept
 		return 0;
 	}
 	
+	if (fileQueue.empty())
+		return 0;
+	if (!dl.getTTHSet()) dl.buildTTHSet();
+	return addMatchedSources(dl.getUser(), *dl.getTTHSet());
+}
+
+// Collects queued files found in a list while it's being parsed
+class QueuedFilesMatcher : public DirectoryListing::ListVisitor
+{
+	public:
+		boost::unordered_set<TTHValue> queued;
+		DirectoryListing::TTHMap found;
+
+		void file(const string&, int64_t size, const TTHValue& tth) override
+		{
+			if (size && queued.find(tth) != queued.end())
+				found.insert(make_pair(tth, size));
+		}
+};
+
+int QueueManager::matchListing(const string& fileName, const UserPtr& user, std::atomic_bool& abortFlag)
+{
+	dcassert(user);
+	QueuedFilesMatcher matcher;
+	{
+		QueueRLock(*fileQueue.csFQ);
+		for (auto i = fileQueue.getQueueL().cbegin(); i != fileQueue.getQueueL().cend(); ++i)
+			matcher.queued.insert(i->second->getTTH());
+	}
+	if (matcher.queued.empty())
+		return 0;
+	DirectoryListing::scanFile(fileName, matcher, abortFlag);
+	if (matcher.found.empty())
+		return 0;
+	return addMatchedSources(user, matcher.found);
+}
+
+int QueueManager::addMatchedSources(const UserPtr& user, const boost::unordered_map<TTHValue, int64_t>& tthMap) noexcept
+{
 	int matches = 0;
-	if (!fileQueue.empty())
+	bool sourceAdded = false;
+	if (!tthMap.empty())
 	{
-		if (!dl.getTTHSet()) dl.buildTTHSet();
-		const DirectoryListing::TTHMap& tthMap = *dl.getTTHSet();
-		bool sourceAdded = false;
-		if (!tthMap.empty())
+		// Candidates are found without the queue lock, it's taken only to add the sources
+		QueueItemList found;
+		fileQueue.findQueueItems(found, tthMap);
+		if (found.empty())
+			return 0;
+		QueueWLock(*QueueItem::g_cs);
+		for (const QueueItemPtr& qi : found)
 		{
-			QueueWLock(*QueueItem::g_cs);
+			if (qi->isFinished())
+				continue;
+			if (qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
+				continue;
+			// Removed while the lock was not held
+			if (fileQueue.findTarget(qi->getTarget()) != qi)
+				continue;
+			matches++;
+			try
 			{
-				QueueRLock(*fileQueue.csFQ);
-				for (auto i = fileQueue.getQueueL().cbegin(); i != fileQueue.getQueueL().cend(); ++i)
-				{
-					const QueueItemPtr& qi = i->second;
-					if (qi->isFinished())
-						continue;
-					if (qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
-						continue;
-					const auto j = tthMap.find(qi->getTTH());
-					if (j != tthMap.cend() && j->second == qi->getSize())
-					{
-						matches++;
-						try
-						{
-							addSourceL(qi, dl.getUser(), QueueItem::Source::FLAG_FILE_NOT_AVAILABLE);
-							sourceAdded = true;
-						}
-						catch (const Exception&)
-						{
-							// Ignore...
-						}
-					}
-				}
+				addSourceL(qi, user, QueueItem::Source::FLAG_FILE_NOT_AVAILABLE);
+				sourceAdded = true;
+			}
+			catch (const Exception&)
+			{
+				// Ignore...
 			}
 		}
-		if (sourceAdded)
-			getDownloadConnection(dl.getUser());
 	}
+	if (sourceAdded)
+		getDownloadConnection(user);
 	return matches;
 }
 
@@ -1397,6 +1465,7 @@ DownloadPtr QueueManager::getDownload(UserConnection* source, Download::ErrorInf
 	dcdebug("Getting download for %s...", u->getCID().toBase32().c_str());
 	QueueItemPtr q;
 	DownloadPtr d;
+	string tempTarget;
 	{
 		QueueWLock(*QueueItem::g_cs);
 		
@@ -1423,16 +1492,16 @@ DownloadPtr QueueManager::getDownload(UserConnection* source, Download::ErrorInf
 			return d;
 		}
 		
-		// Check that the file we will be downloading to exists
 		q->updateDownloadedBytesAndSpeedL();
 		if (q->getDownloadedBytes() > 0)
-		{
-			if (!File::isExist(q->getTempTarget()))
-			{
-				// Temp target gone?
-				q->resetDownloaded();
-			}
-		}
+			tempTarget = q->getTempTarget();
+	}
+
+	// Check that the file we will be downloading to exists, without holding the queue lock
+	if (!tempTarget.empty() && !File::isExist(tempTarget))
+	{
+		// Temp target gone?
+		q->resetDownloaded();
 	}
 	
 	//   new Download   QueueItem::g_cs
@@ -2018,6 +2087,21 @@ void QueueManager::processList(const string& name, const HintedUser& hintedUser,
 {
 	dcassert(hintedUser.user);
 	std::atomic_bool unusedAbortFlag(false);
+	if ((flags & (QueueItem::FLAG_MATCH_QUEUE | QueueItem::FLAG_DIRECTORY_DOWNLOAD | QueueItem::FLAG_TEXT)) == QueueItem::FLAG_MATCH_QUEUE)
+	{
+		// Only matching is needed, don't build the tree
+		try
+		{
+			logMatchedFiles(hintedUser.user, matchListing(name, hintedUser.user, unusedAbortFlag));
+		}
+		catch (const Exception&)
+		{
+			LogManager::message(STRING(UNABLE_TO_OPEN_FILELIST) + ' ' + name);
+		}
+		LOCK(csDirectories);
+		directories.erase(hintedUser.user);
+		return;
+	}
 	DirectoryListing dirList(unusedAbortFlag);
 	dirList.setHintedUser(hintedUser);
 	try
@@ -2373,48 +2457,56 @@ void QueueManager::saveQueue(bool force) noexcept
 		f.write(LIT("<Downloads Version=\"" VERSION_STR "\">\r\n"));
 		string tmp;
 		string b32tmp;
+		string itemXml;
 		vector<Segment> done;	
 
-		QueueRLock(*QueueItem::g_cs);
-		{
-			QueueRLock(*fileQueue.csFQ);
+		// Changes made while saving are saved next time
+		g_dirty = false;
 
-			for (auto i = fileQueue.getQueueL().cbegin(); i != fileQueue.getQueueL().cend(); ++i)
+		// The queue lock is held for one item at a time, not for the whole file
+		vector<QueueItemPtr> items;
+		fileQueue.getItems(items);
+		for (const QueueItemPtr& qi : items)
+		{
+			itemXml.clear();
 			{
-				auto qi = i->second;
-				if (!qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP))
+				StringOutputStream os(itemXml);
+				QueueRLock(*QueueItem::g_cs);
+				// Skip items removed or finished while the lock was not held
+				if (!qi->isAnySet(QueueItem::FLAG_USER_LIST | QueueItem::FLAG_USER_GET_IP) &&
+				    fileQueue.findTarget(qi->getTarget()) == qi)
 				{
-					f.write(LIT("\t<Download Target=\""));
-					f.write(SimpleXML::escape(qi->getTarget(), tmp, true));
-					f.write(LIT("\" Size=\""));
-					f.write(Util::toString(qi->getSize()));
-					f.write(LIT("\" Priority=\""));
-					f.write(Util::toString((int)qi->getPriority()));
-					f.write(LIT("\" Added=\""));
-					f.write(Util::toString(qi->getAdded()));
+					os.write(LIT("\t<Download Target=\""));
+					os.write(SimpleXML::escape(qi->getTarget(), tmp, true));
+					os.write(LIT("\" Size=\""));
+					os.write(Util::toString(qi->getSize()));
+					os.write(LIT("\" Priority=\""));
+					os.write(Util::toString((int)qi->getPriority()));
+					os.write(LIT("\" Added=\""));
+					os.write(Util::toString(qi->getAdded()));
 					b32tmp.clear();
-					f.write(LIT("\" TTH=\""));
-					f.write(qi->getTTH().toBase32(b32tmp));
+					os.write(LIT("\" TTH=\""));
+					os.write(qi->getTTH().toBase32(b32tmp));
 					qi->getDoneSegments(done);
 					if (!done.empty())
 					{
-						f.write(LIT("\" TempTarget=\""));
-						f.write(SimpleXML::escape(qi->getTempTarget(), tmp, true));
+						os.write(LIT("\" TempTarget=\""));
+						os.write(SimpleXML::escape(qi->getTempTarget(), tmp, true));
 					}
-					f.write(LIT("\" AutoPriority=\""));
-					f.write(Util::toString(qi->getAutoPriority()));
-					f.write(LIT("\" MaxSegments=\""));
-					f.write(Util::toString(qi->getMaxSegments()));
+					os.write(LIT("\" AutoPriority=\""));
+					os.write(Util::toString(qi->getAutoPriority()));
+					os.write(LIT("\" MaxSegments=\""));
+					os.write(Util::toString(qi->getMaxSegments()));
 
-					f.write(LIT("\">\r\n"));
+					os.write(LIT("\">\r\n"));
 
 					for (auto j = done.cbegin(); j != done.cend(); ++j)
 					{
-						f.write(LIT("\t\t<Segment Start=\""));
-						f.write(Util::toString(j->getStart()));
-						f.write(LIT("\" Size=\""));
-						f.write(Util::toString(j->getSize()));
-						f.write(LIT("\"/>\r\n"));
+						os.write(LIT("\t\t<Segment Start=\""));
+						os.write(Util::toString(j->getStart()));
+						os.write(LIT("\" Size=\""));
+						os.write(Util::toString(j->getSize()));
+						os.write(LIT("\"/>\r\n"));
 					}
 
 				
@@ -2429,24 +2521,25 @@ void QueueManager::saveQueue(bool force) noexcept
 #if 0
 						const string& hint = user.hint;
 #endif
-						f.write(LIT("\t\t<Source CID=\""));
-						f.write(cid.toBase32());
-						f.write(LIT("\" Nick=\""));
-						f.write(SimpleXML::escape(user->getLastNick(), tmp, true));
+						os.write(LIT("\t\t<Source CID=\""));
+						os.write(cid.toBase32());
+						os.write(LIT("\" Nick=\""));
+						os.write(SimpleXML::escape(user->getLastNick(), tmp, true));
 #if 0
-						f.write(SimpleXML::escape(ClientManager::getInstance()->getNicks(cid, hint)[0], tmp, true));
+						os.write(SimpleXML::escape(ClientManager::getInstance()->getNicks(cid, hint)[0], tmp, true));
 						if (!hint.empty())
 						{
-							f.write(LIT("\" HubHint=\""));
-							f.write(hint);
+							os.write(LIT("\" HubHint=\""));
+							os.write(hint);
 						}
 #endif
-						f.write(LIT("\"/>\r\n"));
+						os.write(LIT("\"/>\r\n"));
 					}
 
-					f.write(LIT("\t</Download>\r\n"));
+					os.write(LIT("\t</Download>\r\n"));
 				}
 			}
+			f.write(itemXml);
 		}
 		
 		f.write(LIT("</Downloads>\r\n"));
@@ -2455,12 +2548,10 @@ void QueueManager::saveQueue(bool force) noexcept
 
 		File::copyFile(queueFile, queueFile + ".bak");
 		File::renameFile(tempFile, queueFile);
-
-		g_dirty = false;
 	}
 	catch(...)
 	{
-		// ...
+		g_dirty = true;
 	}
 	// Put this here to avoid very many saves tries when disk is full...
 	g_lastSave = GET_TICK();
@@ -2996,16 +3087,13 @@ void QueueManager::ListMatcherJob::run()
 		if (!u)
 			continue;
 
-		DirectoryListing dl(manager.listMatcherAbortFlag, false);
-		dl.setHintedUser(HintedUser(u, Util::emptyString));
 		try
 		{
-			dl.loadFile(*i, nullptr, false);
-			logMatchedFiles(u, QueueManager::getInstance()->matchListing(dl));
+			logMatchedFiles(u, QueueManager::getInstance()->matchListing(*i, u, manager.listMatcherAbortFlag));
 		}
 		catch (const Exception&)
 		{
-			if (ClientManager::isBeforeShutdown() || dl.isAborted()) break;
+			if (ClientManager::isBeforeShutdown() || manager.listMatcherAbortFlag.load()) break;
 		}
 	}
 	manager.listMatcherRunning.clear();
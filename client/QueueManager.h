@@ -176,10 +176,12 @@ class QueueManager : public Singleton<QueueManager>,
 		/** Add a directory to the queue (downloads filelist and matches the directory). */
 		void addDirectory(const string& dir, const UserPtr& user, const string& target, QueueItem::Priority p, int flag) noexcept;
 		int matchListing(DirectoryListing& dl) noexcept;
+		int matchListing(const string& fileName, const UserPtr& user, std::atomic_bool& abortFlag);
 		size_t getDirectoryItemCount() const noexcept;
 
 	private:
 		void removeItem(const QueueItemPtr& qi, bool removeFromUserQueue);
+		int addMatchedSources(const UserPtr& user, const boost::unordered_map<TTHValue, int64_t>& tthMap) noexcept;
 
 	public:
 		static bool getTTH(const string& target, TTHValue& tth)
@@ -262,6 +264,8 @@ class QueueManager : public Singleton<QueueManager>,
 				bool getTTH(const string& name, TTHValue& tth) const;
 				QueueItemPtr findTarget(const string& target) const;
 				int findQueueItems(QueueItemList& ql, const TTHValue& tth, int maxCount = 0) const;
+				void findQueueItems(QueueItemList& ql, const boost::unordered_map<TTHValue, int64_t>& tthMap) const;
+				void getItems(vector<QueueItemPtr>& items) const;
 				QueueItemPtr findQueueItem(const TTHValue& tth) const;
 				static uint8_t getMaxSegments(const uint64_t filesize);
 				// find some PFS sources to exchange parts info
@@ -328,7 +332,7 @@ class QueueManager : public Singleton<QueueManager>,
 #ifdef FLYLINKDC_USE_RUNNING_QUEUE_CS
 				static std::unique_ptr<RWLock> csRunningMap;
 #endif
-				static size_t totalDownloads;
+				static std::atomic<size_t> totalDownloads;
 		};
 
 		/** QueueItems by user */
@@ -369,7 +373,7 @@ class QueueManager : public Singleton<QueueManager>,
 		/** Recent searches list, to avoid searching for the same thing too often */
 		deque<string> m_recent;
 		/** The queue needs to be saved */
-		static bool g_dirty;
+		static std::atomic_bool g_dirty;
 		/** Next search */
 		uint64_t nextSearch;
 
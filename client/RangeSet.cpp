@@ -0,0 +1,39 @@
+#include "stdinc.h"
+#include "RangeSet.h"
+
+RangeSet::const_iterator RangeSet::findAfter(int64_t pos) const
+{
+	// Ranges don't overlap, so the one starting before pos is the only candidate among the preceding ones
+	auto i = ranges.upper_bound(pos);
+	if (i != ranges.cbegin())
+	{
+		auto prev = std::prev(i);
+		if (prev->second > pos) return prev;
+	}
+	return i;
+}
+
+void RangeSet::add(int64_t start, int64_t end)
+{
+	if (start >= end) return;
+	// Merge with the ranges touching or overlapping [start, end)
+	auto i = ranges.upper_bound(start);
+	if (i != ranges.begin())
+	{
+		auto prev = std::prev(i);
+		if (prev->second >= start)
+		{
+			if (prev->second >= end) return;
+			start = prev->first;
+			i = prev;
+		}
+	}
+	while (i != ranges.end() && i->first <= end)
+	{
+		if (i->second > end) end = i->second;
+		total -= i->second - i->first;
+		i = ranges.erase(i);
+	}
+	ranges.emplace_hint(i, start, end);
+	total += end - start;
+}
@@ -0,0 +1,63 @@
+#ifndef RANGE_SET_H_
+#define RANGE_SET_H_
+
+#include <map>
+#include <stdint.h>
+
+/**
+ * Set of half-open ranges [start, end).
+ * Overlapping and adjacent ranges are merged, so each position belongs to at most one range
+ * and all lookups take O(log n).
+ */
+class RangeSet
+{
+	public:
+		typedef std::map<int64_t, int64_t> RangeMap; // start -> end
+		typedef RangeMap::const_iterator const_iterator;
+		typedef RangeMap::const_reverse_iterator const_reverse_iterator;
+
+		RangeSet() : total(0) {}
+
+		void add(int64_t start, int64_t end);
+		void clear()
+		{
+			ranges.clear();
+			total = 0;
+		}
+
+		bool empty() const { return ranges.empty(); }
+		size_t size() const { return ranges.size(); }
+		/** Total length of all ranges */
+		int64_t getTotal() const { return total; }
+
+		const_iterator begin() const { return ranges.cbegin(); }
+		const_iterator end() const { return ranges.cend(); }
+		const_reverse_iterator rbegin() const { return ranges.crbegin(); }
+		const_reverse_iterator rend() const { return ranges.crend(); }
+
+		/** First range which ends after pos */
+		const_iterator findAfter(int64_t pos) const;
+		/** Range containing pos, end() if there is none */
+		const_iterator find(int64_t pos) const
+		{
+			auto i = findAfter(pos);
+			return i != ranges.cend() && i->first <= pos ? i : ranges.cend();
+		}
+		/** True if [start, end) is inside one range */
+		bool contains(int64_t start, int64_t end) const
+		{
+			auto i = findAfter(start);
+			return i != ranges.cend() && i->first <= start && i->second >= end;
+		}
+		bool overlaps(int64_t start, int64_t end) const
+		{
+			auto i = findAfter(start);
+			return i != ranges.cend() && i->first < end;
+		}
+
+	private:
+		RangeMap ranges;
+		int64_t total;
+};
+
+#endif // RANGE_SET_H_
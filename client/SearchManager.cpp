@@ -28,6 +28,7 @@
 #include "PortTest.h"
 #include "ConnectivityManager.h"
 #include "LogManager.h"
+#include "IncomingSearchQueue.h"
 #include "NetworkUtil.h"
 #include "dht/DHT.h"
 
@@ -60,7 +61,7 @@ ResourceManager::Strings SearchManager::getTypeStr(int type)
 	return types[type];
 }
 
-SearchManager::SearchManager(): stopFlag(false), failed{false, false}
+SearchManager::SearchManager(): failed{false, false}, stopFlag(false), sendBlocked{false, false}
 {
 #ifdef _WIN32
 	events[EVENT_COMMAND].create();
@@ -117,7 +118,7 @@ void SearchManager::listenUDP(int af)
 
 #ifdef _WIN32
 		socket_t nativeSocket = sockets[index]->getSock();
-		WSAEventSelect(nativeSocket, events[index].getHandle(), FD_READ);
+		WSAEventSelect(nativeSocket, events[index].getHandle(), FD_READ | FD_WRITE);
 #else
 		sockets[index]->setBlocking(false);
 #endif
@@ -212,15 +213,25 @@ int SearchManager::run()
 		if (result >= 0 && result < numEvents)
 		{
 			int index = eventInfo[result];
-			if ((index == 0 || index == 1) && receivePackets(index)) goto terminate;
+			if (index == 0 || index == 1)
+			{
+				sendBlocked[index] = false;
+				if (receivePackets(index)) goto terminate;
+			}
 		}
 #else
+		for (int i = 0; i < numEvents; ++i)
+			pfd[i].events = sendBlocked[eventInfo[i]] ? POLLIN | POLLOUT : POLLIN;
 		poll(pfd, numEvents, -1);
 		for (int i = 0; i < numEvents; ++i)
+		{
+			if (pfd[i].revents & POLLOUT)
+				sendBlocked[eventInfo[i]] = false;
 			if (pfd[i].revents & POLLIN)
 			{
 				if (receivePackets(eventInfo[i])) goto terminate;
 			}
+		}
 #endif
 		processSendQueue();
 	}
@@ -232,20 +243,33 @@ int SearchManager::run()
 
 bool SearchManager::receivePackets(int index)
 {
-	static const int BUFSIZE = 8192;
-	char buf[BUFSIZE];
-	IpAddress remoteIp;
-	uint16_t remotePort;
+	if (receiveBuf.empty())
+	{
+		receiveBuf.resize(RECEIVE_BATCH_SIZE * RECEIVE_BUF_SIZE);
+		for (int i = 0; i < RECEIVE_BATCH_SIZE; ++i)
+		{
+			receivePacketInfo[i].buffer = &receiveBuf[i * RECEIVE_BUF_SIZE];
+			receivePacketInfo[i].bufLen = RECEIVE_BUF_SIZE;
+		}
+	}
 	Socket& socket = *sockets[index].get();
 	for (;;)
 	{
-		int len = socket.receivePacket(buf, BUFSIZE, remoteIp, remotePort);
+		int count = socket.receivePackets(receivePacketInfo, RECEIVE_BATCH_SIZE);
 		if (isShutdown())
 			return true;
-		if (len < 0 && Socket::getLastError() == SE_EWOULDBLOCK)
-			break;
-		if (len >= 4)
-			onData(buf, len, remoteIp, remotePort);
+		if (count < 0)
+		{
+			if (Socket::getLastError() == SE_EWOULDBLOCK)
+				break;
+			continue;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			const Socket::InPacket& p = receivePacketInfo[i];
+			if (p.len >= 4)
+				onData(static_cast<const char*>(p.buffer), p.len, p.ip, p.port);
+		}
 	}
 	return false;
 }
@@ -406,7 +430,7 @@ bool SearchManager::processRES(const char* buf, int len, const IpAddress& remote
 #endif
 			return false;
 		}
-		if (c.getParameters().empty()) return false;
+		if (c.getParamCount() == 0) return false;
 		const string& cid = c.getParam(0);
 		if (cid.size() != 39) return false;
 		UserPtr user = ClientManager::findUser(CID(cid));
@@ -430,7 +454,7 @@ bool SearchManager::processPSR(const char* buf, int len, const IpAddress& remote
 #endif
 			return false;
 		}
-		if (c.getParameters().empty()) return false;
+		if (c.getParamCount() == 0) return false;
 		const string& cid = c.getParam(0);
 		if (cid.size() != 39) return false;
 		UserPtr user;
@@ -642,31 +666,64 @@ void SearchManager::onPSR(const AdcCommand& cmd, bool skipCID, UserPtr from, con
 	
 }
 
-ClientManagerListener::SearchReply SearchManager::respond(AdcSearchParam& param, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort)
+class AdcSearchRequest : public IncomingSearchQueue::Request
+{
+	public:
+		AdcSearchRequest(const AdcSearchParam& param, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort) :
+			param(param), ou(ou), hubUrl(hubUrl), hubIp(hubIp), hubPort(hubPort) {}
+
+		void search(vector<SearchResultCore>& results) noexcept override
+		{
+			if (ClientManager::isBeforeShutdown())
+				return;
+			ShareManager::getInstance()->search(results, param);
+		}
+
+		void reply(const vector<SearchResultCore>& results) noexcept override
+		{
+			if (ClientManager::isBeforeShutdown())
+				return;
+			SearchManager::getInstance()->sendSearchResults(param, results, ou, hubUrl, hubIp, hubPort);
+		}
+
+	private:
+		AdcSearchParam param;
+		const OnlineUserPtr ou;
+		const string hubUrl;
+		const IpAddress hubIp;
+		const uint16_t hubPort;
+};
+
+void SearchManager::respond(const AdcSearchParam& param, const string& key, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort)
 {
 	// Filter own searches
 	const CID& from = ou->getUser()->getCID();
-	if (from == ClientManager::getMyCID())
-		return ClientManagerListener::SEARCH_MISS;
-	
+	if (from == ClientManager::getMyCID() || !ClientManager::findUser(from))
+	{
+		if (ClientManager::g_isSpyFrame)
+			ClientManager::getInstance()->fireIncomingSearch(ClientBase::TYPE_ADC, "Hub:" + ou->getIdentity().getNick(), hubUrl, param.getDescription(), ClientManagerListener::SEARCH_MISS);
+		return;
+	}
+
+	IncomingSearchQueue::getInstance()->addRequest(hubUrl, key,
+		IncomingSearchQueue::RequestPtr(new AdcSearchRequest(param, ou, hubUrl, hubIp, hubPort)));
+}
+
+void SearchManager::sendSearchResults(const AdcSearchParam& param, const vector<SearchResultCore>& searchResults, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort)
+{
+	const CID& from = ou->getUser()->getCID();
 	const UserPtr user = ClientManager::findUser(from);
 	if (!user)
-		return ClientManagerListener::SEARCH_MISS;
-	
-	vector<SearchResultCore> searchResults;
-	ShareManager::getInstance()->search(searchResults, param);
-	
+		return;
+
 	ClientManagerListener::SearchReply sr = ClientManagerListener::SEARCH_MISS;
 	
 	// TODO: don't send replies to passive users
 	if (searchResults.empty())
 	{
-		if (!param.hasRoot)
-			return sr;
-
 		QueueItem::PartsInfo outParts;
 		uint64_t blockSize;
-		if (QueueManager::handlePartialSearch(param.root, outParts, blockSize))
+		if (param.hasRoot && QueueManager::handlePartialSearch(param.root, outParts, blockSize))
 		{
 			AdcCommand cmd(AdcCommand::CMD_PSR, AdcCommand::TYPE_UDP);
 			string tth = param.root.toBase32();
@@ -714,7 +771,8 @@ ClientManagerListener::SearchReply SearchManager::respond(AdcSearchParam& param,
 		}
 		sr = ClientManagerListener::SEARCH_HIT;
 	}
-	return sr;
+	if (ClientManager::g_isSpyFrame)
+		ClientManager::getInstance()->fireIncomingSearch(ClientBase::TYPE_ADC, "Hub:" + ou->getIdentity().getNick(), hubUrl, param.getDescription(), sr);
 }
 
 string SearchManager::getPartsString(const QueueItem::PartsInfo& partsInfo)
@@ -761,19 +819,68 @@ void SearchManager::addToSendQueue(string& data, const IpAddress& address, uint1
 void SearchManager::processSendQueue() noexcept
 {
 	csSendQueue.lock();
-	for (auto i = sendQueue.cbegin(); i != sendQueue.cend(); ++i)
+	sendQueue.swap(sendingItems);
+	csSendQueue.unlock();
+	if (sendingItems.empty()) return;
+
+	// Packets are sent in batches, one batch per socket
+	Socket::OutPacket packets[2][Socket::MAX_BATCH_PACKETS];
+	size_t itemIndex[2][Socket::MAX_BATCH_PACKETS];
+	int count[2] = { 0, 0 };
+	vector<size_t> unsent;
+	const bool logPackets = BOOLSETTING(LOG_UDP_PACKETS);
+	auto sendBatch = [&](int index)
 	{
-		int index = i->address.type == AF_INET6 ? 1 : 0;
-		if (sockets[index])
+		int processed = sockets[index]->sendPackets(packets[index], count[index]);
+		if (logPackets)
+			for (int j = 0; j < processed; ++j)
+			{
+				const SendQueueItem& item = sendingItems[itemIndex[index][j]];
+				if (!(item.flags & FLAG_NO_TRACE))
+					LogManager::commandTrace(item.data, LogManager::FLAG_UDP, Util::printIpAddress(item.address, true), item.port);
+			}
+		if (processed < count[index])
 		{
-			const string& data = i->data;
-			sockets[index]->sendPacket(data.data(), data.length(), i->address, i->port);
-			if (BOOLSETTING(LOG_UDP_PACKETS) && !(i->flags & FLAG_NO_TRACE))
-				LogManager::commandTrace(data, LogManager::FLAG_UDP, Util::printIpAddress(i->address, true), i->port);
+			// Send buffer is full: keep the rest until the socket becomes writable
+			sendBlocked[index] = true;
+			unsent.insert(unsent.end(), itemIndex[index] + processed, itemIndex[index] + count[index]);
 		}
+		count[index] = 0;
+	};
+	for (size_t i = 0; i < sendingItems.size(); ++i)
+	{
+		const SendQueueItem& item = sendingItems[i];
+		int index = item.address.type == AF_INET6 ? 1 : 0;
+		if (!sockets[index]) continue;
+		if (sendBlocked[index])
+		{
+			unsent.push_back(i);
+			continue;
+		}
+		Socket::OutPacket& p = packets[index][count[index]];
+		p.data = item.data.data();
+		p.len = static_cast<int>(item.data.length());
+		p.ip = item.address;
+		p.port = item.port;
+		itemIndex[index][count[index]] = i;
+		if (++count[index] == Socket::MAX_BATCH_PACKETS)
+			sendBatch(index);
 	}
-	sendQueue.clear();
-	csSendQueue.unlock();
+	for (int index = 0; index < 2; ++index)
+		if (count[index])
+			sendBatch(index);
+	if (!unsent.empty())
+	{
+		std::sort(unsent.begin(), unsent.end());
+		vector<SendQueueItem> items;
+		items.reserve(unsent.size());
+		for (size_t i : unsent)
+			items.push_back(std::move(sendingItems[i]));
+		csSendQueue.lock();
+		sendQueue.insert(sendQueue.begin(), std::make_move_iterator(items.begin()), std::make_move_iterator(items.end()));
+		csSendQueue.unlock();
+	}
+	sendingItems.clear();
 }
 
 void SearchManager::sendNotif()
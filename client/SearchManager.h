@@ -40,7 +40,8 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 
 		void searchAuto(const string& tth);
 
-		ClientManagerListener::SearchReply respond(AdcSearchParam& param, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort);
+		void respond(const AdcSearchParam& param, const string& key, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort);
+		void sendSearchResults(const AdcSearchParam& param, const vector<SearchResultCore>& searchResults, const OnlineUserPtr& ou, const string& hubUrl, const IpAddress& hubIp, uint16_t hubPort);
 
 		static uint16_t getUdpPort() { return udpPort; }
 
@@ -92,8 +93,15 @@ class SearchManager : public Speaker<SearchManagerListener>, public Singleton<Se
 		std::atomic_bool stopFlag;
 		std::atomic_bool restartFlag;
 		vector<SendQueueItem> sendQueue;
+		vector<SendQueueItem> sendingItems;
+		bool sendBlocked[2]; // waiting for the socket to become writable
 		CriticalSection csSendQueue;
 
+		static const int RECEIVE_BATCH_SIZE = 16;
+		static const int RECEIVE_BUF_SIZE = 8192;
+		vector<char> receiveBuf;
+		Socket::InPacket receivePacketInfo[RECEIVE_BATCH_SIZE];
+
 		SearchManager();
 
 		virtual int run() override;
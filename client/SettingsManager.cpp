@@ -301,6 +301,8 @@ static const char* g_settingTags[] =
 	"MaxHubUserCommands",
 	"MyInfoDelay",
 	"PSRDelay",
+	"UseSocketReactor",
+	"SocketReactorThreads",
 
 	// Sharing
 	"AutoRefreshTime",
@@ -309,11 +311,13 @@ static const char* g_settingTags[] =
 	"ShareSystem",
 	"ShareVirtual",
 	"MaxHashSpeed",
+	"HashThreads",
 	"SaveTthInNtfsFilestream",
 	"SetMinLengthTthInNtfsFilestream",
 	"FastHash",
 	"EnableHitFileList",
 	"FileListUseTS",
+	"WatchSharedDirs",
 
 	// Downloads & Queue
 	"DownloadSlots", 
@@ -968,6 +972,8 @@ void SettingsManager::setDefaults()
 	setDefault(MAX_HUB_USER_COMMANDS, 100);
 	setDefault(MYINFO_DELAY, 35);
 	setDefault(PSR_DELAY, 30);
+	setDefault(USE_SOCKET_REACTOR, FALSE);
+	setDefault(SOCKET_REACTOR_THREADS, 0);
 
 	// Sharing (Ints)
 	setDefault(AUTO_REFRESH_TIME, 60);
@@ -976,8 +982,10 @@ void SettingsManager::setDefaults()
 	setDefault(SAVE_TTH_IN_NTFS_FILESTREAM, TRUE);
 	setDefault(SET_MIN_LENGTH_TTH_IN_NTFS_FILESTREAM, 16);
 	setDefault(FAST_HASH, TRUE);
+	setDefault(HASH_THREADS, 0);
 	setDefault(FILELIST_INCLUDE_HIT, TRUE);
 	setDefault(FILELIST_INCLUDE_TIMESTAMP, TRUE);
+	setDefault(WATCH_SHARED_DIRS, FALSE);
 
 	// Downloads & Queue
 	setDefault(EXTRA_DOWNLOAD_SLOTS, 3);
@@ -1771,6 +1779,12 @@ bool SettingsManager::set(IntSetting key, int value)
 			break;
 		}
 #endif
+		case SOCKET_REACTOR_THREADS:
+		case HASH_THREADS:
+		{
+			VERIFY(0, 64);
+			break;
+		}
 		case NUMBER_OF_SEGMENTS:
 		{
 			VERIFY(1, 200);
@@ -277,6 +277,8 @@ class SettingsManager : public Singleton<SettingsManager>, public Speaker<Settin
 			MAX_HUB_USER_COMMANDS,
 			MYINFO_DELAY,
 			PSR_DELAY, // Unused, visible in UI
+			USE_SOCKET_REACTOR,
+			SOCKET_REACTOR_THREADS,
 
 			// Sharing (Ints)
 			AUTO_REFRESH_TIME,
@@ -285,11 +287,13 @@ class SettingsManager : public Singleton<SettingsManager>, public Speaker<Settin
 			SHARE_SYSTEM,
 			SHARE_VIRTUAL,
 			MAX_HASH_SPEED,
+			HASH_THREADS,
 			SAVE_TTH_IN_NTFS_FILESTREAM,
 			SET_MIN_LENGTH_TTH_IN_NTFS_FILESTREAM,
 			FAST_HASH,
 			FILELIST_INCLUDE_HIT,
 			FILELIST_INCLUDE_TIMESTAMP,
+			WATCH_SHARED_DIRS,
 
 			// Downloads & Queue
 			DOWNLOAD_SLOTS,
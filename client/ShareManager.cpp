@@ -26,6 +26,7 @@
 #include "SimpleXMLReader.h"
 #include "FilteredFile.h"
 #include "BZUtils.h"
+#include "BZCompressor.h"
 #include "ClientManager.h"
 #include "HashBloom.h"
 #include "HashManager.h"
@@ -35,6 +36,7 @@
 #include "DatabaseManager.h"
 #include "LogManager.h"
 #include "DebugManager.h"
+#include <thread>
 
 STANDARD_EXCEPTION(ShareLoaderException);
 STANDARD_EXCEPTION(ShareWriterException);
@@ -53,6 +55,7 @@ static const string attrTS = "TS";
 static const string attrShared = "Shared";
 
 static const string fileShareData("Share.dat");
+static const string fileShareImage("Share.img");
 static const string fileBZXml("files.xml.bz2");
 static const string fileAttrXml("FileAttr.xml");
 
@@ -195,7 +198,7 @@ string ShareManager::validateVirtual(const string& virt) noexcept
 void ShareManager::loadSharedFile(SharedDir* current, const string& filename, int64_t size, const TTHValue& tth, uint64_t timestamp, uint64_t timeShared, unsigned hit) noexcept
 {
 	SharedFilePtr file = std::make_shared<SharedFile>(filename, tth, size, timestamp, timeShared, getFileTypesFromFileName(filename), hit);
-	current->files.insert(make_pair(file->getLowerName(), file));
+	current->files.insert(file);
 	current->filesTypesMask |= file->getFileTypes();
 	current->totalSize += file->getSize();	
 	fileCounter++;
@@ -356,7 +359,11 @@ ShareManager::ShareManager() :
 	finishedScanDirs(false),
 	bloomNew(1<<20),
 	scanShareFlags(0), scanAllFlags(0),
-	nextFileID(0), maxSharedFileID(0), maxHashedFileID(0),
+	nextFileID(0),
+	scanQueued(0), scanRunning(0),
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	watcher(nullptr), hashingChangedFiles(false), watchSharedDirs(false),
+#endif
 	optionShareHidden(false), optionShareSystem(false), optionShareVirtual(false),
 	optionIncludeHit(false), optionIncludeTimestamp(false),
 	tickUpdateList(std::numeric_limits<uint64_t>::max()),
@@ -367,6 +374,7 @@ ShareManager::ShareManager() :
 {
 	autoRefreshMode = REFRESH_MODE_NONE;
 	scanProgress[0] = scanProgress[1] = 0;
+	nextScanDevice = scanDevices.end();
 	const string fileAttrPath = Util::getConfigPath() + fileAttrXml;
 	CID fileCID;
 	if (!readFileAttr(fileAttrPath, fileAttr, fileCID) || fileCID != ClientManager::getMyCID())
@@ -400,8 +408,8 @@ ShareManager::~ShareManager()
 {
 	renameXmlFiles();
 	removeOldShareGroupFiles();
-	if (!tempShareDataFile.empty())
-		File::renameFile(Util::getConfigPath() + tempShareDataFile, Util::getConfigPath() + fileShareData);
+	if (!tempShareImageFile.empty())
+		File::renameFile(Util::getConfigPath() + tempShareImageFile, Util::getConfigPath() + fileShareImage);
 }
 
 static const uint8_t SHARE_DATA_DIR_START = 1;
@@ -586,54 +594,369 @@ void ShareManager::loadShareData(File& file)
 	}
 }
 
-static const size_t TEMP_BUF_SIZE = 64 * 1024;
+// Share.img keeps the share tree in flat arrays which are used without parsing.
+// Directories are stored in depth-first order, each one is followed by its files
+// in the files array, search index ids follow the same order.
+static const uint32_t SHARE_IMAGE_MAGIC      = 0x474D4953; // "SIMG"
+static const uint32_t SHARE_IMAGE_VERSION    = 1;
+static const uint32_t SHARE_IMAGE_BYTE_ORDER = 0x01020304;
+static const uint32_t SHARE_IMAGE_NONE       = 0xFFFFFFFF;
+
+struct ShareImageHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t byteOrder;
+	uint32_t headerSize;
+	uint64_t fileSize;
+	uint64_t dirCount;
+	uint64_t fileCount;
+	uint64_t stringsSize;
+	uint64_t bloomSize; // in bits
+	uint64_t indexIdCount;
+	uint64_t dirsOffset;
+	uint64_t filesOffset;
+	uint64_t stringsOffset;
+	uint64_t bloomOffset;
+	uint64_t indexOffset; // ShareSearchIndex::getTableSize() + 1 offsets followed by the ids
+};
+
+struct ShareImageName
+{
+	uint32_t offset;
+	uint32_t lowerOffset; // SHARE_IMAGE_NONE if the name is in lower case
+	uint16_t length;
+	uint16_t lowerLength;
+};
+
+struct ShareImageDir
+{
+	int64_t totalSize;
+	ShareImageName name;
+	uint32_t parent; // SHARE_IMAGE_NONE for shares
+	uint32_t fileCount;
+	uint16_t filesTypesMask;
+	uint16_t dirsTypesMask;
+};
+
+struct ShareImageFile
+{
+	int64_t size;
+	uint64_t timestamp;
+	uint64_t timeShared;
+	uint8_t tth[TTHValue::BYTES];
+	ShareImageName name;
+	uint32_t hit;
+	uint16_t typesMask;
+	uint16_t reserved[3];
+};
+
+static_assert(sizeof(ShareImageHeader) == 104 && sizeof(ShareImageDir) == 32 && sizeof(ShareImageFile) == 72, "unexpected share image layout");
 
-static bool addAttribValue(uint8_t outBuf[], size_t& ptr, uint8_t type, const void* data, size_t size)
+struct ShareManager::ShareImageBuilder
 {
-	if (ptr + size + 3 > TEMP_BUF_SIZE || size > 32768) return false;
-	outBuf[ptr++] = type;
-	if (!type) return true;
-	if (size < 128)
+	vector<ShareImageDir> dirs;
+	vector<ShareImageFile> files;
+	string strings;
+	ByteVector bloom;
+	size_t bloomSize;
+	ShareSearchIndex index; // built only to save the table
+
+	ShareImageBuilder() : bloomSize(0) {}
+
+	void addName(const BaseDirItem* item, ShareImageName& out)
+	{
+		const string& name = item->getName();
+		const string& lowerName = item->getLowerName();
+		out.offset = addString(name);
+		out.length = (uint16_t) name.length();
+		if (&lowerName == &name)
+		{
+			out.lowerOffset = SHARE_IMAGE_NONE;
+			out.lowerLength = 0;
+		}
+		else
+		{
+			out.lowerOffset = addString(lowerName);
+			out.lowerLength = (uint16_t) lowerName.length();
+		}
+	}
+
+	uint32_t addString(const string& s)
 	{
-		outBuf[ptr++] = (uint8_t) size;
-	} else
+		if (s.length() > 0xFFFF || strings.length() + s.length() >= SHARE_IMAGE_NONE)
+			throw ShareWriterException("Share is too large");
+		uint32_t offset = (uint32_t) strings.length();
+		strings += s;
+		return offset;
+	}
+
+	void write(OutputStream* os)
+	{
+		vector<uint32_t> indexOffsets, indexIds;
+		index.getTable(indexOffsets, indexIds);
+
+		ShareImageHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = SHARE_IMAGE_MAGIC;
+		header.version = SHARE_IMAGE_VERSION;
+		header.byteOrder = SHARE_IMAGE_BYTE_ORDER;
+		header.headerSize = sizeof(header);
+		header.dirCount = dirs.size();
+		header.fileCount = files.size();
+		header.stringsSize = strings.length();
+		header.bloomSize = bloomSize;
+		header.indexIdCount = indexIds.size();
+		uint64_t offset = sizeof(header);
+		header.dirsOffset = offset;
+		offset += dirs.size() * sizeof(ShareImageDir);
+		header.filesOffset = offset;
+		offset += files.size() * sizeof(ShareImageFile);
+		header.indexOffset = offset;
+		offset += (indexOffsets.size() + indexIds.size()) * sizeof(uint32_t);
+		header.bloomOffset = offset;
+		offset += bloom.size();
+		header.stringsOffset = offset;
+		offset += strings.length();
+		header.fileSize = offset;
+
+		os->write(&header, sizeof(header));
+		os->write(dirs.data(), dirs.size() * sizeof(ShareImageDir));
+		os->write(files.data(), files.size() * sizeof(ShareImageFile));
+		os->write(indexOffsets.data(), indexOffsets.size() * sizeof(uint32_t));
+		os->write(indexIds.data(), indexIds.size() * sizeof(uint32_t));
+		os->write(bloom.data(), bloom.size());
+		os->write(strings.data(), strings.length());
+	}
+};
+
+static inline bool checkImageSection(const ShareImageHeader* header, uint64_t offset, uint64_t count, size_t itemSize, size_t align)
+{
+	return offset % align == 0 && offset <= header->fileSize && count <= (header->fileSize - offset) / itemSize;
+}
+
+static inline bool getImageName(const ShareImageHeader* header, const char* strings, const ShareImageName& name, string& out, string& outLower)
+{
+	if (!name.length || (uint64_t) name.offset + name.length > header->stringsSize)
+		return false;
+	out.assign(strings + name.offset, name.length);
+	if (name.lowerOffset == SHARE_IMAGE_NONE)
 	{
-		outBuf[ptr++] = (uint8_t) ((size >> 8) | 0x80);
-		outBuf[ptr++] = size & 0xFF;
+		outLower = out;
+		return true;
 	}
-	memcpy(outBuf + ptr, data, size);
-	ptr += size;
+	if (!name.lowerLength || (uint64_t) name.lowerOffset + name.lowerLength > header->stringsSize)
+		return false;
+	outLower.assign(strings + name.lowerOffset, name.lowerLength);
 	return true;
 }
 
-void ShareManager::writeShareDataDirStart(OutputStream* os, const SharedDir* dir, uint8_t tempBuf[])
+bool ShareManager::loadShareImage(const string& path, bool& indexLoaded)
 {
-	tempBuf[0] = SHARE_DATA_DIR_START;
-	size_t ptr = 1;
-	if (!addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_NAME, dir->name.data(), dir->name.length()) ||
-	    !addAttribValue(tempBuf, ptr, 0, nullptr, 0))
-		throw ShareWriterException("Can't write directory attributes");
-	os->write(tempBuf, ptr);
+	indexLoaded = false;
+	File file(path, File::READ, File::OPEN);
+	FileMapping mapping;
+	if (!mapping.open(file) || mapping.getSize() < sizeof(ShareImageHeader))
+		return false;
+	const uint8_t* data = mapping.getData();
+	const ShareImageHeader* header = reinterpret_cast<const ShareImageHeader*>(data);
+	if (header->magic != SHARE_IMAGE_MAGIC || header->byteOrder != SHARE_IMAGE_BYTE_ORDER ||
+	    header->version != SHARE_IMAGE_VERSION || header->headerSize != sizeof(ShareImageHeader))
+		return false;
+	const uint64_t tableSize = ShareSearchIndex::getTableSize();
+	if (header->fileSize != mapping.getSize() ||
+	    header->dirCount >= SHARE_IMAGE_NONE || header->fileCount >= SHARE_IMAGE_NONE ||
+	    header->indexIdCount >= SHARE_IMAGE_NONE || header->bloomSize / 8 > header->fileSize ||
+	    !checkImageSection(header, header->dirsOffset, header->dirCount, sizeof(ShareImageDir), 8) ||
+	    !checkImageSection(header, header->filesOffset, header->fileCount, sizeof(ShareImageFile), 8) ||
+	    !checkImageSection(header, header->indexOffset, tableSize + 1 + header->indexIdCount, sizeof(uint32_t), 4) ||
+	    !checkImageSection(header, header->bloomOffset, (header->bloomSize + 7) / 8, 1, 1) ||
+	    !checkImageSection(header, header->stringsOffset, header->stringsSize, 1, 1))
+		throw ShareLoaderException("Invalid header");
+
+	const ShareImageDir* imageDirs = reinterpret_cast<const ShareImageDir*>(data + header->dirsOffset);
+	const ShareImageFile* imageFiles = reinterpret_cast<const ShareImageFile*>(data + header->filesOffset);
+	const uint32_t* indexOffsets = reinterpret_cast<const uint32_t*>(data + header->indexOffset);
+	const char* strings = reinterpret_cast<const char*>(data + header->stringsOffset);
+
+	// Without the bloom bits of the same size names are added one by one
+	const bool useBloom = header->bloomSize == bloom.getTableSize();
+	if (useBloom)
+		bloom.addBits(data + header->bloomOffset);
+
+	const uint32_t dirCount = (uint32_t) header->dirCount;
+	vector<SharedDir*> dirs(dirCount);
+	vector<ShareSearchIndex::Item> items;
+	items.reserve(dirCount + header->fileCount);
+	bool allLoaded = true;
+	tthIndex.reserve(tthIndex.size() + header->fileCount);
+	string name, lowerName;
+	uint64_t fileIndex = 0;
+	SharedDir* root = nullptr;
+	for (uint32_t i = 0; i < dirCount; ++i)
+	{
+		const ShareImageDir& imageDir = imageDirs[i];
+		if (imageDir.fileCount > header->fileCount - fileIndex)
+			throw ShareLoaderException("Invalid file count");
+		const ShareImageFile* imageFile = imageFiles + fileIndex;
+		fileIndex += imageDir.fileCount;
+		if (!getImageName(header, strings, imageDir.name, name, lowerName))
+			throw ShareLoaderException("Invalid directory name");
+		SharedDir* dir;
+		if (imageDir.parent == SHARE_IMAGE_NONE)
+		{
+			if (root)
+				for (ShareListItem& sli : shares)
+					if (sli.dir == root)
+					{
+						sli.totalFiles = fileCounter;
+						break;
+					}
+			root = nullptr;
+			auto it = getByVirtualL(name);
+			if (it == shares.cend() || !it->dir->dirs.empty() || !it->dir->files.empty())
+			{
+				LogManager::message("Share " + name + " was removed but kept in " + fileShareImage, false);
+				allLoaded = false;
+				continue;
+			}
+			dir = root = it->dir;
+			fileCounter = 0;
+		}
+		else
+		{
+			if (imageDir.parent >= i)
+				throw ShareLoaderException("Invalid parent directory");
+			SharedDir* parent = dirs[imageDir.parent];
+			if (!parent) continue;
+			dir = new SharedDir(name, lowerName, parent);
+			if (parent->dirs.emplace_hint(parent->dirs.end(), lowerName, dir)->second != dir)
+			{
+				delete dir;
+				throw ShareLoaderException("Duplicate directory " + name);
+			}
+			if (!useBloom) bloom.add(lowerName);
+		}
+		dirs[i] = dir;
+		// Sizes and masks are computed from the files loaded, images written by older versions
+		// counted files which were not hashed yet
+		dir->totalSize = 0;
+		dir->filesTypesMask = dir->dirsTypesMask = 0;
+		items.push_back(ShareSearchIndex::Item{dir, SharedFilePtr()});
+
+		dir->files.reserve(imageDir.fileCount);
+		TTHMapItem tthItem;
+		tthItem.dir = dir;
+		for (uint32_t j = 0; j < imageDir.fileCount; ++j, ++imageFile)
+		{
+			if (!getImageName(header, strings, imageFile->name, name, lowerName))
+				throw ShareLoaderException("Invalid file name");
+			SharedFilePtr file = std::make_shared<SharedFile>(name, lowerName, imageFile->size, imageFile->timestamp, imageFile->typesMask);
+			memcpy(file->tth.data, imageFile->tth, TTHValue::BYTES);
+			file->timeShared = imageFile->timeShared;
+			file->hit = imageFile->hit;
+			dir->files.insert(file);
+			dir->totalSize += imageFile->size;
+			dir->filesTypesMask |= imageFile->typesMask;
+			if (!useBloom) bloom.add(lowerName);
+			tthItem.file = file;
+			tthIndex.insert(make_pair(file->tth, tthItem));
+			items.push_back(ShareSearchIndex::Item{dir, std::move(file)});
+		}
+		fileCounter += imageDir.fileCount;
+	}
+	if (root)
+		for (ShareListItem& sli : shares)
+			if (sli.dir == root)
+			{
+				sli.totalFiles = fileCounter;
+				break;
+			}
+	// Parents are stored before their subdirectories
+	for (uint32_t i = dirCount; i--; )
+	{
+		const SharedDir* dir = dirs[i];
+		if (!dir || imageDirs[i].parent == SHARE_IMAGE_NONE) continue;
+		SharedDir* parent = dirs[imageDirs[i].parent];
+		parent->totalSize += dir->totalSize;
+		parent->dirsTypesMask |= dir->getTypes();
+	}
+
+	// Item ids in the saved table are valid only if nothing was skipped
+	if (allLoaded && indexOffsets[tableSize] == header->indexIdCount)
+		indexLoaded = searchIndex.setTable(items, indexOffsets, indexOffsets + tableSize + 1);
+	return true;
 }
 
-void ShareManager::writeShareDataFile(OutputStream* os, const SharedFilePtr& file, uint8_t tempBuf[])
+// Drops everything loaded below the share roots, used when the image turns out to be corrupt
+void ShareManager::clearSharedTreesL()
 {
-	tempBuf[0] = SHARE_DATA_FILE;
-	size_t ptr = 1;
-	if (!addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_NAME, file->name.data(), file->name.length()) ||
-	    !addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_SIZE, &file->size, sizeof(file->size)) ||
-		!addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_TTH, file->tth.data, TTHValue::BYTES) ||
-		!addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_TIMESTAMP, &file->timestamp, sizeof(file->timestamp)) ||
-		(file->timeShared && !addAttribValue(tempBuf, ptr, SHARE_DATA_ATTRIB_TIME_SHARED, &file->timeShared, sizeof(file->timeShared))) ||
-		!addAttribValue(tempBuf, ptr, 0, nullptr, 0))
-		throw ShareWriterException("Can't write file attributes");
-	os->write(tempBuf, ptr);
+	for (ShareListItem& sli : shares)
+	{
+		SharedDir* root = sli.dir;
+		for (auto i = root->dirs.begin(); i != root->dirs.end(); ++i)
+			SharedDir::deleteTree(i->second);
+		root->dirs.clear();
+		root->files.clear();
+		root->totalSize = 0;
+		root->filesTypesMask = root->dirsTypesMask = 0;
+		sli.totalFiles = 0;
+	}
+	fileCounter = 0;
+	tthIndex.clear();
+	bloom.clear();
+	for (const ShareListItem& sli : shares)
+		bloom.add(sli.dir->getLowerName());
 }
 
-void ShareManager::writeShareDataDirEnd(OutputStream* os)
+// Sizes and type masks are computed from the records written: files not hashed yet are not stored
+void ShareManager::writeShareImageL(const SharedDir* dir, uint32_t parent, ShareImageBuilder& builder) const
 {
-	uint8_t b = SHARE_DATA_DIR_END;
-	os->write(&b, 1);
+	const uint32_t index = (uint32_t) builder.dirs.size();
+	if (index == SHARE_IMAGE_NONE)
+		throw ShareWriterException("Share is too large");
+	builder.dirs.emplace_back();
+	builder.index.addDir(dir);
+	uint32_t fileCount = 0;
+	int64_t totalSize = 0;
+	uint16_t filesTypesMask = 0;
+	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
+	{
+		const SharedFilePtr& file = *i;
+		if (file->flags & BaseDirItem::FLAG_HASH_FILE)
+			continue;
+		builder.files.emplace_back();
+		ShareImageFile& imageFile = builder.files.back();
+		memset(&imageFile, 0, sizeof(imageFile));
+		imageFile.size = file->size;
+		imageFile.timestamp = file->timestamp;
+		imageFile.timeShared = file->timeShared;
+		memcpy(imageFile.tth, file->tth.data, TTHValue::BYTES);
+		builder.addName(file.get(), imageFile.name);
+		imageFile.hit = file->hit;
+		imageFile.typesMask = file->getFileTypes();
+		builder.index.addFile(dir, file);
+		totalSize += file->size;
+		filesTypesMask |= imageFile.typesMask;
+		++fileCount;
+	}
+	uint16_t dirsTypesMask = 0;
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+	{
+		const uint32_t childIndex = (uint32_t) builder.dirs.size();
+		writeShareImageL(i->second, index, builder);
+		const ShareImageDir& child = builder.dirs[childIndex];
+		totalSize += child.totalSize;
+		dirsTypesMask |= child.filesTypesMask | child.dirsTypesMask;
+	}
+	ShareImageDir& imageDir = builder.dirs[index];
+	memset(&imageDir, 0, sizeof(imageDir));
+	imageDir.totalSize = totalSize;
+	builder.addName(dir, imageDir.name);
+	imageDir.parent = parent;
+	imageDir.fileCount = fileCount;
+	imageDir.filesTypesMask = filesTypesMask;
+	imageDir.dirsTypesMask = dirsTypesMask;
 }
 
 static inline bool isSubDir(const string& dir, const string& parent)
@@ -754,6 +1077,7 @@ void ShareManager::addDirectory(const string& realPath, const string& virtualNam
 		sli.totalFiles = 0;
 		sli.flags = 0;
 		bloom.add(sli.dir->getLowerName());
+		searchIndex.addDir(sli.dir);
 		shares.push_back(sli);
 		shareListChanged = fileListChanged = true;
 		++shareListVersion;
@@ -820,7 +1144,7 @@ void ShareManager::renameDirectory(const string& realPath, const string& virtual
 		if (i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
 		if (i->realPath.getLowerName() == pathLower)
 			dir = i->dir;
-		else if (i->dir->lowerName == virtualLower)
+		else if (i->dir->getLowerName() == virtualLower)
 		{
 			string realPathNoSlash = i->realPath.getName();
 			Util::removePathSeparator(realPathNoSlash);
@@ -830,6 +1154,7 @@ void ShareManager::renameDirectory(const string& realPath, const string& virtual
 	if (!dir || virtualName == dir->name) return;
 	dir->setName(virtualName);
 	updateBloomL();
+	updateSearchIndexL();
 	fileListChanged = true;
 	++shareListVersion;
 }
@@ -1094,7 +1419,7 @@ void ShareManager::addFile(const string& path, const TTHValue& root)
 
 	uint64_t currentTime = TimerManager::getFileTime();
 	SharedFilePtr file = std::make_shared<SharedFile>(fileName, root, size, timestamp, currentTime, typesMask, 0);
-	if (!dir->files.insert(make_pair(file->getLowerName(), file)).second)
+	if (!dir->files.insert(file).second)
 		throw ShareException(STRING(FILE_ALREADY_SHARED), path);
 
 	dir->updateSize(size);
@@ -1106,6 +1431,17 @@ void ShareManager::addFile(const string& path, const TTHValue& root)
 	tthIndex.insert(make_pair(root, tthItem));
 
 	bloom.add(file->getLowerName());
+	searchIndex.addFile(dir, file);
+
+	// Update version of the share, its part of the file list is no longer valid
+	const SharedDir* topDir = dir;
+	while (topDir->parent) topDir = topDir->parent;
+	for (auto& sli : shares)
+		if (sli.dir == topDir)
+		{
+			sli.version = ++versionCounter;
+			break;
+		}
 }
 
 void ShareManager::saveShareList(SimpleXML& xml) const
@@ -1241,10 +1577,10 @@ bool ShareManager::parseVirtualPathL(const string& virtualPath, const SharedDir*
 		return false;
 	string filenameLower;
 	Text::toLower(filename, filenameLower);
-	auto it = dir->files.find(filenameLower);
+	auto it = dir->findFile(filenameLower);
 	if (it == dir->files.cend())
 		return false;
-	file = it->second;
+	file = *it;
 	return true;
 }
 
@@ -1487,11 +1823,11 @@ bool ShareManager::findByRealPathL(const string& pathLower, SharedDir* &dir, Sha
 	if (!findByRealPathL(pathLower, dir, filename))
 		return false;
 	
-	auto it = dir->files.find(filename);
+	auto it = dir->findFile(filename);
 	if (it == dir->files.cend())
 		return false;
 
-	file = it->second;
+	file = *it;
 	return true;
 }
 
@@ -1615,21 +1951,6 @@ void ShareManager::getHashBloom(ByteVector& v, size_t k, size_t m, size_t h) con
 	bloom.copy_to(v);
 }
 
-void ShareManager::writeShareDataL(const SharedDir* dir, OutputStream* shareDataFile, uint8_t tempBuf[]) const
-{
-	writeShareDataDirStart(shareDataFile, dir, tempBuf);
-	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
-		writeShareDataL(i->second, shareDataFile, tempBuf);
-	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
-	{
-		const auto& f = i->second;
-		if (f->flags & BaseDirItem::FLAG_HASH_FILE)
-			continue;
-		writeShareDataFile(shareDataFile, f, tempBuf);
-	}
-	writeShareDataDirEnd(shareDataFile);
-}
-
 class BufferedTigerTreeHasher
 {
 	private:
@@ -1700,6 +2021,94 @@ struct FileListFilter
 	}
 };
 
+class TTHOutputStream : public OutputStream
+{
+	public:
+		explicit TTHOutputStream(OutputStream* os) : size(0), os(os) {}
+		using OutputStream::write;
+
+		size_t write(const void* buf, size_t len) override
+		{
+			tree.update(buf, len);
+			size += len;
+			return os->write(buf, len);
+		}
+
+		size_t flushBuffers(bool force) override
+		{
+			return os->flushBuffers(force);
+		}
+
+		BufferedTigerTreeHasher tree;
+		int64_t size;
+
+	private:
+		OutputStream* os;
+};
+
+// Part of the XML file list stored as whole bzip2 blocks and leaf hashes of the original data
+struct FileListFragment
+{
+	vector<BZBlock> blocks;
+	TigerTree::MerkleList leaves;
+	int64_t size = 0;
+	int64_t version = 0;
+	string name;
+	bool includeTimestamp = false;
+};
+
+class FileListFragmentWriter : public OutputStream, private BZBlockCompressor
+{
+	public:
+		explicit FileListFragmentWriter(FileListFragment& fragment) : fragment(fragment) {}
+		using OutputStream::write;
+
+		size_t write(const void* data, size_t len) override
+		{
+			addData(data, len);
+			return len;
+		}
+
+		size_t flushBuffers(bool) override
+		{
+			return 0;
+		}
+
+		/**
+		 * Compress the remaining data. Fragments followed by other fragments are padded
+		 * with whitespace to full leaves, so their leaf hashes stay valid in the whole list.
+		 */
+		void finish(bool pad)
+		{
+			size_t partial = getPendingSize() % TigerTree::BASE_BLOCK_SIZE;
+			if (pad && partial)
+			{
+				size_t padSize = TigerTree::BASE_BLOCK_SIZE - partial;
+				string padding(padSize, ' ');
+				if (padSize >= 2)
+				{
+					padding[padSize - 2] = '\r';
+					padding[padSize - 1] = '\n';
+				}
+				addData(padding.data(), padding.length());
+			}
+			finishBlocks();
+		}
+
+	private:
+		FileListFragment& fragment;
+
+		void writeBlock(const BZBlock& block, const string& data) override
+		{
+			fragment.blocks.push_back(block);
+			TigerTree tree(TigerTree::BASE_BLOCK_SIZE);
+			tree.update(data.data(), data.length());
+			const auto& leaves = tree.getLeaves();
+			fragment.leaves.insert(fragment.leaves.end(), leaves.cbegin(), leaves.cend());
+			fragment.size += data.length();
+		}
+};
+
 #define LITERAL(n) n, sizeof(n)-1
 
 void ShareManager::writeXmlL(const SharedDir* dir, OutputStream& xmlFile, string& indent, string& tmp, int mode) const
@@ -1748,7 +2157,7 @@ void ShareManager::writeXmlFilesL(const SharedDir* dir, OutputStream& xmlFile, s
 {
 	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
 	{
-		const auto& f = i->second;
+		const auto& f = *i;
 		if (f->flags & BaseDirItem::FLAG_HASH_FILE)
 			continue;
 		if (!indent.empty())
@@ -1826,30 +2235,62 @@ bool ShareManager::writeShareGroupXml(const CID& id)
 	bool result = false;
 
 	{
-		File outFileXml(newXmlName, File::WRITE, File::TRUNCATE | File::CREATE);
-		FilteredOutputStream<FileListFilter, false> newXmlFile(&outFileXml);
-
-		newXmlFile.write(SimpleXML::utf8Header);
-		newXmlFile.write(LITERAL("<FileListing Version=\"1\" CID=\""));
-		newXmlFile.write(ClientManager::getMyCID().toBase32());
-		newXmlFile.write(LITERAL("\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n"));
+		// Parts of unchanged shares are taken from the cache and spliced into the output
+		vector<std::shared_ptr<FileListFragment>> fragments;
+		auto header = std::make_shared<FileListFragment>();
+		{
+			FileListFragmentWriter writer(*header);
+			writer.write(SimpleXML::utf8Header);
+			writer.write(LITERAL("<FileListing Version=\"1\" CID=\""));
+			writer.write(ClientManager::getMyCID().toBase32());
+			writer.write(LITERAL("\" Base=\"/\" Generator=\"DC++ " DCVERSIONSTRING "\">\r\n"));
+			writer.finish(true);
+		}
+		fragments.push_back(header);
 		{
 			READ_LOCK(*csShare);
 			for (const ShareListItem& sli : shares)
 			{
 				if (sli.flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
 				if (selectedShares.find(sli.realPath.getLowerName()) == selectedShares.end()) continue;
-				writeXmlL(sli.dir, newXmlFile, indent, tmp, MODE_FULL_LIST);
+				fragments.push_back(getFileListFragmentL(sli, indent, tmp));
+			}
+		}
+		auto footer = std::make_shared<FileListFragment>();
+		{
+			FileListFragmentWriter writer(*footer);
+			writer.write(LITERAL("</FileListing>"));
+			writer.finish(false);
+		}
+		fragments.push_back(footer);
+
+		File outFileXml(newXmlName, File::WRITE, File::TRUNCATE | File::CREATE);
+		TTHOutputStream newXmlFile(&outFileXml);
+		BZBlockWriter bzWriter(&newXmlFile);
+		TigerTree treeOriginal(1ll<<40);
+		int64_t sizeOriginal = 0;
+		for (const auto& fragment : fragments)
+		{
+			for (const BZBlock& block : fragment->blocks)
+				bzWriter.write(block);
+			int64_t size = fragment->size;
+			for (const TTHValue& leaf : fragment->leaves)
+			{
+				size_t len = (size_t) min<int64_t>(size, TigerTree::BASE_BLOCK_SIZE);
+				treeOriginal.updateLeaf(leaf, len);
+				size -= len;
 			}
+			sizeOriginal += fragment->size;
 		}
-		newXmlFile.write(LITERAL("</FileListing>"));
+		bzWriter.finish();
 		newXmlFile.flushBuffers(true);
 
-		newXmlFile.getFilter().treeOriginal.finalize(attr[FILE_ATTR_FILES_XML].root);
-		newXmlFile.getFilter().treeCompressed.finalize(attr[FILE_ATTR_FILES_BZ_XML].root);
+		treeOriginal.finalize();
+		attr[FILE_ATTR_FILES_XML].root = treeOriginal.getRoot();
+		newXmlFile.tree.finalize(attr[FILE_ATTR_FILES_BZ_XML].root);
 
-		attr[FILE_ATTR_FILES_XML].size = newXmlFile.getFilter().sizeOriginal;
-		attr[FILE_ATTR_FILES_BZ_XML].size = newXmlFile.getFilter().sizeCompressed;
+		attr[FILE_ATTR_FILES_XML].size = sizeOriginal;
+		attr[FILE_ATTR_FILES_BZ_XML].size = newXmlFile.size;
 
 #if defined DEBUG_FILELIST
 		LogManager::message(origXmlName + " uncompressed size: " + Util::toString(xmlListLen[0]), false);
@@ -1880,6 +2321,46 @@ bool ShareManager::writeShareGroupXml(const CID& id)
 	return result;
 }
 
+std::shared_ptr<FileListFragment> ShareManager::getFileListFragmentL(const ShareListItem& sli, string& indent, string& tmp)
+{
+	const string& key = sli.realPath.getLowerName();
+	auto i = fileListFragments.find(key);
+	if (i != fileListFragments.end())
+	{
+		const FileListFragment& fragment = *i->second;
+		if (fragment.version == sli.version && fragment.name == sli.dir->getName() &&
+		    fragment.includeTimestamp == optionIncludeTimestamp)
+			return i->second;
+		fileListFragments.erase(i);
+	}
+
+	auto fragment = std::make_shared<FileListFragment>();
+	FileListFragmentWriter writer(*fragment);
+	writeXmlL(sli.dir, writer, indent, tmp, MODE_FULL_LIST);
+	writer.finish(true);
+
+	// Hit counters and files being hashed change without changing the share version
+	if (!optionIncludeHit && !hasUnhashedFiles(sli.dir))
+	{
+		fragment->version = sli.version;
+		fragment->name = sli.dir->getName();
+		fragment->includeTimestamp = optionIncludeTimestamp;
+		fileListFragments.insert(make_pair(key, fragment));
+	}
+	return fragment;
+}
+
+bool ShareManager::hasUnhashedFiles(const SharedDir* dir) noexcept
+{
+	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
+		if ((*i)->flags & BaseDirItem::FLAG_HASH_FILE)
+			return true;
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+		if (hasUnhashedFiles(i->second))
+			return true;
+	return false;
+}
+
 bool ShareManager::generateFileList(uint64_t tick) noexcept
 {
 	if (tick <= tickUpdateList)
@@ -1890,31 +2371,35 @@ bool ShareManager::generateFileList(uint64_t tick) noexcept
 		return false;
 
 	LogManager::message("Generating file list...", false);
-	uint8_t tempBuf[TEMP_BUF_SIZE];
-
 	optionIncludeHit = BOOLSETTING(FILELIST_INCLUDE_HIT);
 	optionIncludeTimestamp = BOOLSETTING(FILELIST_INCLUDE_TIMESTAMP);
 	
-	const string shareDataFileName = Util::getConfigPath() + fileShareData;
+	const string shareImageFileName = Util::getConfigPath() + fileShareImage;
 	string skipBZXmlFile;
 	try
 	{
-		// Write Share.dat
+		// Write Share.img
 		++tempFileCount;
-		string newShareDataName = Util::getConfigPath() + "Share" + Util::toString(tempFileCount) + ".dat";
+		string newShareImageName = Util::getConfigPath() + "Share" + Util::toString(tempFileCount) + ".img";
 		{
-			File outFileShareData(newShareDataName, File::WRITE, File::TRUNCATE | File::CREATE);
-			BufferedOutputStream<false> newShareDataFile(&outFileShareData, 256 * 1024);
-			READ_LOCK(*csShare);
-			for (auto i = shares.cbegin(); i != shares.cend(); ++i)
-				if (!(i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED))
-					writeShareDataL(i->dir, &newShareDataFile, tempBuf);
-			newShareDataFile.flushBuffers(true);
+			ShareImageBuilder builder;
+			{
+				READ_LOCK(*csShare);
+				for (auto i = shares.cbegin(); i != shares.cend(); ++i)
+					if (!(i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED))
+						writeShareImageL(i->dir, SHARE_IMAGE_NONE, builder);
+				bloom.getBits(builder.bloom);
+				builder.bloomSize = bloom.getTableSize();
+			}
+			File outFileShareImage(newShareImageName, File::WRITE, File::TRUNCATE | File::CREATE);
+			BufferedOutputStream<false> newShareImageFile(&outFileShareImage, 256 * 1024);
+			builder.write(&newShareImageFile);
+			newShareImageFile.flushBuffers(true);
 		}
-		if (File::renameFile(newShareDataName, shareDataFileName))
-			tempShareDataFile.clear();
+		if (File::renameFile(newShareImageName, shareImageFileName))
+			tempShareImageFile.clear();
 		else
-			tempShareDataFile = Util::getFileName(newShareDataName);
+			tempShareImageFile = Util::getFileName(newShareImageName);
 
 		boost::unordered_set<CID> updateGroups;
 		{
@@ -1951,6 +2436,17 @@ bool ShareManager::generateFileList(uint64_t tick) noexcept
 				result = false;
 		}
 
+		{
+			READ_LOCK(*csShare);
+			for (auto i = fileListFragments.begin(); i != fileListFragments.end();)
+			{
+				if (getByRealL(i->first) == shares.cend())
+					i = fileListFragments.erase(i);
+				else
+					++i;
+			}
+		}
+
 		if (!result)
 			tickRestoreFileList.store(GET_TICK() + 60000);
 		tickUpdateList = std::numeric_limits<uint64_t>::max();
@@ -1962,7 +2458,7 @@ bool ShareManager::generateFileList(uint64_t tick) noexcept
 		tickUpdateList = GET_TICK() + 60000;
 	}		
 
-	deleteTempFiles(shareDataFileName, tempShareDataFile);
+	deleteTempFiles(shareImageFileName, tempShareImageFile);
 
 	doingCreateFileList.store(false);
 	return true;
@@ -2075,14 +2571,40 @@ MemoryInputStream* ShareManager::generatePartialList(const string& dir, bool rec
 void ShareManager::load(SimpleXML& xml)
 {
 	string xmlFile = Util::getConfigPath() + fileBZXml;
+	bool indexLoaded = false;
 	try
 	{
 		loadShareList(xml);
+		string shareImageFile = Util::getConfigPath() + fileShareImage;
 		string shareDataFile = Util::getConfigPath() + fileShareData;
-		if (File::isExist(shareDataFile))
+		const uint64_t startTick = GET_TICK();
+		bool imageLoaded = false;
+		if (File::isExist(shareImageFile))
+		{
+			// Share.img of an unknown version is ignored
+			try
+			{
+				imageLoaded = loadShareImage(shareImageFile, indexLoaded);
+			}
+			catch (const Exception& e)
+			{
+				LogManager::message("Error loading " + fileShareImage + ": " + e.getError(), false);
+				clearSharedTreesL();
+				indexLoaded = false;
+			}
+		}
+		if (imageLoaded)
+		{
+			LogManager::message("Share loaded from " + fileShareImage + " in " + Util::toString(GET_TICK() - startTick) + " ms", false);
+			// Share.dat is kept as a fallback until an image has been loaded
+			if (File::isExist(shareDataFile))
+				File::deleteFile(shareDataFile);
+		}
+		else if (File::isExist(shareDataFile))
 		{
 			File file(shareDataFile, File::READ, File::OPEN);
 			loadShareData(file);
+			LogManager::message("Share loaded from " + fileShareData + " in " + Util::toString(GET_TICK() - startTick) + " ms", false);
 		}
 		else
 		{
@@ -2091,6 +2613,7 @@ void ShareManager::load(SimpleXML& xml)
 			File file(xmlFile, File::READ, File::OPEN);
 			FilteredInputStream<UnBZFilter, false> f(&file);
 			reader.parse(f);
+			LogManager::message("Share loaded from " + fileBZXml + " in " + Util::toString(GET_TICK() - startTick) + " ms", false);
 		}
 	}
 	catch (const FileException& e)
@@ -2106,6 +2629,8 @@ void ShareManager::load(SimpleXML& xml)
 		LogManager::message("Error loading share data: " + e.getError(), false);
 	}
 	updateSharedSizeL();
+	if (!indexLoaded)
+		updateSearchIndexL();
 	initDefaultShareGroupL();
 	if (!File::isExist(xmlFile))
 	{
@@ -2115,6 +2640,12 @@ void ShareManager::load(SimpleXML& xml)
 	}
 	if (autoRefreshMode == REFRESH_MODE_FILE_LIST)
 		tickUpdateList = 0;
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	// Otherwise the watcher is started after the refresh
+	watchSharedDirs = BOOLSETTING(WATCH_SHARED_DIRS);
+	if (watchSharedDirs && autoRefreshMode != REFRESH_MODE_FULL)
+		updateWatcher();
+#endif
 	autoRefreshMode = REFRESH_MODE_NONE;
 }
 
@@ -2167,7 +2698,7 @@ bool ShareManager::searchTTH(const TTHValue& tth, vector<SearchResultCore>& resu
  * has been matched in the directory name. This new stringlist should also be used in all descendants,
  * but not the parents...
  */
-void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& results, const StringSearch::List& strings, const SearchParamBase& sp) noexcept
+void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& results, const MultiStringSearch& matcher, MultiStringSearch::Mask remaining, const SearchParamBase& sp) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
@@ -2176,25 +2707,12 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 	if (!dir->hasType(sp.fileType))
 		return;
 		
-	const StringSearch::List* cur = &strings;
-	unique_ptr<StringSearch::List> newStr;
-	
 	// Find any matches in the directory name
-	for (auto k = strings.cbegin(); k != strings.cend(); ++k)
-	{
-		if (k->matchLower(dir->getLowerName()))
-		{
-			if (!newStr.get())
-				newStr = std::make_unique<StringSearch::List>(strings);
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-		}
-	}
-	
-	if (newStr.get())
-		cur = newStr.get();
+	if (remaining)
+		remaining &= ~matcher.matchLower(dir->getLowerName());
 	
 	const bool sizeOk = sp.sizeMode != SIZE_ATLEAST || sp.size == 0;
-	if (cur->empty() &&
+	if (!remaining &&
 	    ((sp.fileType == FILE_TYPE_ANY && sizeOk) || sp.fileType == FILE_TYPE_DIRECTORY))
 	{
 		// We satisfied all the search words! Add the directory...(NMDC searches don't support directory size)
@@ -2206,7 +2724,7 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 	{
 		for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
 		{
-			const SharedFilePtr& file = i->second;
+			const SharedFilePtr& file = *i;
 			if ((sp.sizeMode == SIZE_ATLEAST && file->getSize() < sp.size) ||
 			    (sp.sizeMode == SIZE_ATMOST && file->getSize() > sp.size))
 				continue;
@@ -2214,10 +2732,7 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 			if (!file->hasType(sp.fileType))
 				continue;
 
-			const string& name = file->getLowerName();
-			auto j = cur->cbegin();
-			while (j != cur->cend() && j->matchLower(name)) ++j;
-			if (j != cur->cend())
+			if (remaining && (matcher.matchLower(file->getLowerName()) & remaining) != remaining)
 				continue;
 			
 			results.emplace_back(SearchResult::TYPE_FILE, file->getSize(), getNMDCPathL(dir) + file->getName(), file->getTTH());
@@ -2229,11 +2744,110 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 	if (sp.fileType == FILE_TYPE_ANY || (dir->dirsTypesMask & 1<<sp.fileType))
 		for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
 		{
-			searchL(i->second, results, *cur, sp);
+			searchL(i->second, results, matcher, remaining, sp);
 			if (results.size() >= sp.maxResults) break;
 		}
 }
 
+void ShareManager::getSearchRootsL(const ShareGroup& sg, vector<const SharedDir*>& roots) const noexcept
+{
+	for (const ShareListItem& sli : shares)
+	{
+		if (sli.dir->flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
+		if (!sg.hasShare(sli)) continue;
+		roots.push_back(sli.dir);
+	}
+}
+
+// Returns the search term with the shortest candidate list or -1 if none can be looked up in the index
+int ShareManager::getIndexTermL(const StringSearch::List& ssl) const noexcept
+{
+	int result = -1;
+	size_t best = SIZE_MAX;
+	for (size_t i = 0; i < ssl.size(); ++i)
+	{
+		size_t count = searchIndex.estimate(ssl[i].getPattern());
+		if (count < best)
+		{
+			best = count;
+			result = (int) i;
+		}
+	}
+	return result;
+}
+
+// Returns the patterns found in the names of dir and its parents, ignoring excluded names
+static MultiStringSearch::Mask matchParents(const SharedDir* dir, const MultiStringSearch& matcher, MultiStringSearch::Mask excludeMask)
+{
+	MultiStringSearch::Mask result = 0;
+	for (; dir; dir = dir->getParent())
+	{
+		MultiStringSearch::Mask found = matcher.matchLower(dir->getLowerName());
+		if (!(found & excludeMask))
+			result |= found;
+	}
+	return result;
+}
+
+bool ShareManager::isIndexItemValidL(const ShareSearchIndex::Item& item, const StringSearch& ss, const vector<const SharedDir*>& roots) const noexcept
+{
+	// Removed by the share watcher
+	if (!item.dir) return false;
+	const string& name = item.file ? item.file->getLowerName() : item.dir->getLowerName();
+	if (!ss.matchLower(name)) return false;
+	// Items inside a directory matching the same term are found by searching that directory
+	const SharedDir* root = item.dir;
+	for (const SharedDir* dir = item.file ? item.dir : item.dir->getParent(); dir; dir = dir->getParent())
+	{
+		if (ss.matchLower(dir->getLowerName())) return false;
+		root = dir;
+	}
+	if (item.file)
+	{
+		// File could have been removed after a hashing error
+		auto i = item.dir->findFile(name);
+		if (i == item.dir->files.cend() || *i != item.file) return false;
+	}
+	return std::find(roots.cbegin(), roots.cend(), root) != roots.cend();
+}
+
+// NMDC search using the index
+bool ShareManager::searchIndexL(vector<SearchResultCore>& results, const StringSearch::List& ssl, const MultiStringSearch& matcher, const SearchParamBase& sp, const vector<const SharedDir*>& roots) noexcept
+{
+	const int term = getIndexTermL(ssl);
+	if (term < 0) return false;
+	vector<uint32_t> ids;
+	searchIndex.find(ssl[term].getPattern(), ids);
+	const MultiStringSearch::Mask all = matcher.getMask();
+	for (uint32_t id : ids)
+	{
+		const ShareSearchIndex::Item& item = searchIndex.getItem(id);
+		if (!isIndexItemValidL(item, ssl[term], roots)) continue;
+		if (item.file)
+		{
+			const SharedFilePtr& file = item.file;
+			if (sp.fileType == FILE_TYPE_DIRECTORY) continue;
+			if ((sp.sizeMode == SIZE_ATLEAST && file->getSize() < sp.size) ||
+			    (sp.sizeMode == SIZE_ATMOST && file->getSize() > sp.size))
+				continue;
+			if (!file->hasType(sp.fileType))
+				continue;
+			MultiStringSearch::Mask found = matcher.matchLower(file->getLowerName());
+			if (found != all && (found | matchParents(item.dir, matcher, 0)) != all)
+				continue;
+			results.emplace_back(SearchResult::TYPE_FILE, file->getSize(), getNMDCPathL(item.dir) + file->getName(), file->getTTH());
+			incHits();
+		}
+		else
+		{
+			// Remove the terms matched by parent directories
+			searchL(item.dir, results, matcher, all & ~matchParents(item.dir->getParent(), matcher, 0), sp);
+		}
+		if (results.size() >= sp.maxResults) break;
+	}
+	return true;
+}
+
 void ShareManager::search(vector<SearchResultCore>& results, const NmdcSearchParam& sp, const Client* client) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
@@ -2272,25 +2886,29 @@ void ShareManager::search(vector<SearchResultCore>& results, const NmdcSearchPar
 	}
 	
 	StringSearch::List ssl;
+	MultiStringSearch matcher;
 	ssl.reserve(sl.size());
 	for (auto i = sl.cbegin(); i != sl.cend(); ++i)
 	{
-		if (!i->empty())
+		if (!i->empty() && matcher.addPattern(*i) >= 0)
 			ssl.push_back(StringSearch(*i));
 	}
 	if (!ssl.empty())
 	{
+		matcher.compile();
 		READ_LOCK(*csShare);
 		auto i = shareGroups.find(sp.shareGroup);
 		if (i == shareGroups.cend()) return;
-		const auto& shareGroup = i->second;
 
-		for (const ShareListItem& sli : shares)
+		vector<const SharedDir*> roots;
+		getSearchRootsL(i->second, roots);
+		if (!searchIndexL(results, ssl, matcher, sp, roots))
 		{
-			if (sli.dir->flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
-			if (!shareGroup.hasShare(sli)) continue;
-			searchL(sli.dir, results, ssl, sp);
-			if (results.size() >= sp.maxResults) break;
+			for (const SharedDir* root : roots)
+			{
+				searchL(root, results, matcher, matcher.getMask(), sp);
+				if (results.size() >= sp.maxResults) break;
+			}
 		}
 	}
 
@@ -2311,7 +2929,7 @@ inline static uint16_t toCode(char a, char b)
 }
 
 AdcSearchParam::AdcSearchParam(const StringList& params, unsigned maxResults, const CID& shareGroup) noexcept :
-	shareGroup(shareGroup), gt(0), lt(std::numeric_limits<int64_t>::max()), hasRoot(false), isDirectory(false), maxResults(maxResults)
+	includeMask(0), excludeMask(0), shareGroup(shareGroup), gt(0), lt(std::numeric_limits<int64_t>::max()), hasRoot(false), isDirectory(false), maxResults(maxResults)
 {
 	for (auto i = params.cbegin(); i != params.cend(); ++i)
 	{
@@ -2397,13 +3015,28 @@ AdcSearchParam::AdcSearchParam(const StringList& params, unsigned maxResults, co
 		}
 		cacheKey.insert(0, Util::toString(maxResults) + '=');
 	}
+
+	// Patterns that don't fit into the matcher are ignored
+	for (const StringSearch& ss : include)
+	{
+		int index = matcher.addPattern(ss.getPattern());
+		if (index < 0) break;
+		includeMask |= MultiStringSearch::Mask(1) << index;
+	}
+	include.erase(include.begin() + matcher.size(), include.end());
+	for (const StringSearch& ss : exclude)
+	{
+		int index = matcher.addPattern(ss.getPattern());
+		if (index < 0) break;
+		excludeMask |= MultiStringSearch::Mask(1) << index;
+	}
+	exclude.erase(exclude.begin() + (matcher.size() - include.size()), exclude.end());
+	matcher.compile();
 }
 
 bool AdcSearchParam::isExcluded(const string& strLower) const noexcept
 {
-	for (auto i = exclude.cbegin(); i != exclude.cend(); ++i)
-		if (i->matchLower(strLower)) return true;
-	return false;
+	return excludeMask && (matcher.matchLower(strLower) & excludeMask) != 0;
 }
 
 bool AdcSearchParam::hasExt(const string& name) noexcept
@@ -2442,30 +3075,21 @@ string AdcSearchParam::getDescription() const noexcept
 }
 
 // ADC search
-void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& results, AdcSearchParam& sp, const StringSearch::List* replaceInclude) noexcept
+void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& results, AdcSearchParam& sp, MultiStringSearch::Mask remaining) noexcept
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
 		
-	const StringSearch::List* cur = replaceInclude ? replaceInclude : &sp.include;
-	unique_ptr<StringSearch::List> newStr;
-	
 	// Find any matches in the directory name
-	for (auto k = cur->cbegin(); k != cur->cend(); ++k)
+	if (remaining)
 	{
-		if (k->matchLower(dir->getLowerName()) && !sp.isExcluded(dir->getLowerName()))
-		{
-			if (!newStr.get())
-				newStr = std::make_unique<StringSearch::List>(*cur);
-			newStr->erase(remove(newStr->begin(), newStr->end(), *k), newStr->end());
-		}
+		MultiStringSearch::Mask found = sp.matcher.matchLower(dir->getLowerName());
+		if (!(found & sp.excludeMask))
+			remaining &= ~found;
 	}
 	
-	if (newStr.get())
-		cur = newStr.get();
-	
 	const bool sizeOk = sp.gt == 0;
-	if (cur->empty() && sp.exts.empty() && sizeOk)
+	if (!remaining && sp.exts.empty() && sizeOk)
 	{
 		// We satisfied all the search words! Add the directory...
 		results.emplace_back(SearchResult::TYPE_DIRECTORY, dir->totalSize, getNMDCPathL(dir), TTHValue());
@@ -2474,24 +3098,25 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 	
 	if (!sp.isDirectory)
 	{
+		const MultiStringSearch::Mask checkMask = remaining | sp.excludeMask;
 		for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
 		{
-			const SharedFilePtr& file = i->second;
+			const SharedFilePtr& file = *i;
 			if (file->getSize() < sp.gt || file->getSize() > sp.lt) continue;
 			
-			if (sp.isExcluded(file->getLowerName()))
-				continue;
+			// Check include and exclude patterns in one pass
+			const string& name = file->getLowerName();
+			if (checkMask)
+			{
+				MultiStringSearch::Mask found = sp.matcher.matchLower(name);
+				if ((found & sp.excludeMask) || (found & remaining) != remaining)
+					continue;
+			}
 				
 			// Check file type...
-			const string& name = file->getLowerName();
 			if (!sp.hasExt(name))
 				continue;
 
-			auto j = cur->cbegin();
-			while (j != cur->cend() && j->matchLower(name)) ++j;
-			if (j != cur->cend())
-				continue;
-
 			results.emplace_back(SearchResult::TYPE_FILE, file->getSize(), getNMDCPathL(dir) + file->getName(), file->getTTH());
 			incHits();
 			if (results.size() >= sp.maxResults)
@@ -2500,11 +3125,49 @@ void ShareManager::searchL(const SharedDir* dir, vector<SearchResultCore>& resul
 	}	
 	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
 	{
-		searchL(i->second, results, sp, newStr.get());
+		searchL(i->second, results, sp, remaining);
 		if (results.size() >= sp.maxResults) break;
 	}
 }
 
+// ADC search using the index
+bool ShareManager::searchIndexL(vector<SearchResultCore>& results, AdcSearchParam& sp, const vector<const SharedDir*>& roots) noexcept
+{
+	const int term = getIndexTermL(sp.include);
+	if (term < 0) return false;
+	vector<uint32_t> ids;
+	searchIndex.find(sp.include[term].getPattern(), ids);
+	for (uint32_t id : ids)
+	{
+		const ShareSearchIndex::Item& item = searchIndex.getItem(id);
+		if (!isIndexItemValidL(item, sp.include[term], roots)) continue;
+		if (item.file)
+		{
+			const SharedFilePtr& file = item.file;
+			if (sp.isDirectory) continue;
+			if (file->getSize() < sp.gt || file->getSize() > sp.lt) continue;
+			const string& name = file->getLowerName();
+			MultiStringSearch::Mask found = sp.matcher.matchLower(name);
+			if (found & sp.excludeMask)
+				continue;
+			if (!sp.hasExt(name))
+				continue;
+			found &= sp.includeMask;
+			if (found != sp.includeMask && ((found | matchParents(item.dir, sp.matcher, sp.excludeMask)) & sp.includeMask) != sp.includeMask)
+				continue;
+			results.emplace_back(SearchResult::TYPE_FILE, file->getSize(), getNMDCPathL(item.dir) + file->getName(), file->getTTH());
+			incHits();
+		}
+		else
+		{
+			// Remove the terms matched by parent directories
+			searchL(item.dir, results, sp, sp.includeMask & ~matchParents(item.dir->getParent(), sp.matcher, sp.excludeMask));
+		}
+		if (results.size() >= sp.maxResults) break;
+	}
+	return true;
+}
+
 // ADC search
 void ShareManager::search(vector<SearchResultCore>& results, AdcSearchParam& sp) noexcept
 {
@@ -2536,14 +3199,16 @@ void ShareManager::search(vector<SearchResultCore>& results, AdcSearchParam& sp)
 
 		auto j = shareGroups.find(sp.shareGroup);
 		if (j == shareGroups.cend()) return;
-		const auto& shareGroup = j->second;
 
-		for (const ShareListItem& sli : shares)
+		vector<const SharedDir*> roots;
+		getSearchRootsL(j->second, roots);
+		if (!searchIndexL(results, sp, roots))
 		{
-			if (sli.dir->flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
-			if (!shareGroup.hasShare(sli)) continue;
-			searchL(sli.dir, results, sp, nullptr);
-			if (results.size() >= sp.maxResults) break;
+			for (const SharedDir* root : roots)
+			{
+				searchL(root, results, sp, sp.includeMask);
+				if (results.size() >= sp.maxResults) break;
+			}
 		}
 	}
 
@@ -2579,12 +3244,48 @@ bool ShareManager::isDirectoryExcludedL(const string& path) const noexcept
 	return false;
 }
 
-void ShareManager::scanDir(SharedDir* dir, const string& path)
+bool ShareManager::isSkippedEntry(const FileFindIter::DirData& data, const string& fileName) const noexcept
+{
+	if (Util::isReservedDirName(fileName) || fileName.empty())
+		return true;
+	if (data.isTemporary())
+		return true;
+	if (data.isHidden() && !optionShareHidden)
+		return true;
+	if (data.isSystem() && !optionShareSystem)
+		return true;
+	if (data.isVirtual() && !optionShareVirtual)
+		return true;
+	return false;
+}
+
+bool ShareManager::isSkippedDirectory(const string& fullPath) const noexcept
+{
+	if (Util::locatedInSysPath(fullPath))
+		return true;
+	return stricmp(fullPath, SETTING(TEMP_DOWNLOAD_DIRECTORY)) == 0 ||
+	       stricmp(fullPath, Util::getConfigPath()) == 0 ||
+	       stricmp(fullPath, SETTING(LOG_DIRECTORY)) == 0 ||
+	       isDirectoryExcludedL(fullPath);
+}
+
+bool ShareManager::isSkippedFile(const string& lowerName, const string& fullPath, int64_t size, const std::regex* skipList) noexcept
+{
+	if (!(skipList && std::regex_match(lowerName, *skipList)))
+		return false;
+	// !qb, jc!, ob!, dmf, mta, dmfr, !ut, !bt, bc!, getright, antifrag, pusd, dusd, download, crdownload
+	string pathStr = Util::ellipsizePath(fullPath);
+	string sizeStr = Util::formatBytes(size);
+	LogManager::message(STRING_F(SKIPPING_FILE, pathStr % sizeStr));
+	return true;
+}
+
+void ShareManager::scanDir(ScanTask* task, const std::regex* skipList)
 {
 	scanProgress[0]++;
-	int64_t deltaSize = 0;
+	SharedDir* dir = task->dir;
+	const string& path = task->path;
 	uint16_t filesTypesMask = 0;
-	uint16_t dirsTypesMask = 0;
 	size_t countFiles = dir->files.size();
 	size_t countDirs = dir->dirs.size();
 	size_t foundFiles = 0;
@@ -2592,71 +3293,67 @@ void ShareManager::scanDir(SharedDir* dir, const string& path)
 	for (auto i = dir->dirs.begin(); i != dir->dirs.end(); ++i)
 		i->second->flags |= BaseDirItem::FLAG_NOT_FOUND;
 	for (auto i = dir->files.begin(); i != dir->files.end(); ++i)
-		i->second->flags |= BaseDirItem::FLAG_NOT_FOUND;
+		(*i)->flags |= BaseDirItem::FLAG_NOT_FOUND;
 
 	string lowerName;
 	for (FileFindIter i(path + '*'); i != FileFindIter::end; ++i)
 	{
 		if (stopScanning) break;
 		const string& fileName = i->getFileName();
-		if (Util::isReservedDirName(fileName) || fileName.empty())
-			continue;
-		if (i->isTemporary())
-			continue;
-		if (i->isHidden() && !optionShareHidden)
-			continue;
-		if (i->isSystem() && !optionShareSystem)
-			continue;
-		if (i->isVirtual() && !optionShareVirtual)
+		if (isSkippedEntry(*i, fileName))
 			continue;
 		Text::toLower(fileName, lowerName);
 		if (i->isDirectory())
 		{
 			const string fullPath = path + fileName + PATH_SEPARATOR;
-			if (Util::locatedInSysPath(fullPath))
+			if (isSkippedDirectory(fullPath))
 				continue;
-				
-			if (stricmp(fullPath, SETTING(TEMP_DOWNLOAD_DIRECTORY)) == 0 ||
-			    stricmp(fullPath, Util::getConfigPath()) == 0 ||
-			    stricmp(fullPath, SETTING(LOG_DIRECTORY)) == 0 ||
-			    isDirectoryExcludedL(fullPath)) continue;
 
 			SharedDir* subdir;
 			auto itDir = dir->dirs.find(lowerName);
 			if (itDir != dir->dirs.end())
 			{
 				subdir = itDir->second;
-				subdir->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
-				foundDirs++;
+				if (subdir->flags & BaseDirItem::FLAG_NOT_FOUND)
+				{
+					subdir->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
+					foundDirs++;
+				}
+				else
+				{
+					// Names differing only in case: the directory is scanned using the path found last
+					for (auto j = task->children.begin(); j != task->children.end(); ++j)
+						if (j->task->dir == subdir)
+						{
+							delete j->task;
+							task->children.erase(j);
+							break;
+						}
+				}
 			}
 			else
 			{
 				subdir = new SharedDir(fileName, dir);
 				dir->dirs.insert(make_pair(lowerName, subdir));
-				if (!(scanShareFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM))
-					bloomNew.add(dir->getLowerName());
-				scanShareFlags |= SCAN_SHARE_FLAG_ADDED;
+				task->newDirs = true;
+				task->flags |= SCAN_SHARE_FLAG_ADDED;
 #ifdef DEBUG_SHARE_MANAGER
 				LogManager::message("New directory shared: " + fullPath, false);
 #endif
 			}
-			scanDir(subdir, fullPath);
-			dirsTypesMask |= subdir->getTypes();
+			ScanTask::Child child;
+			child.task = new ScanTask(subdir, fullPath);
+			child.foundFiles = task->foundFiles.size();
+			child.newFiles = task->newFiles.size();
+			task->children.push_back(child);
 		}
 		else
 		{
 			// Not a directory, assume it's a file...make sure we're not sharing the settings file...
-			string ext = Util::getFileExtWithoutDot(lowerName);
 			const string fullPath = path + fileName;
 			int64_t size = i->getSize();
-			if (isInSkipList(lowerName))
-			{
-				// !qb, jc!, ob!, dmf, mta, dmfr, !ut, !bt, bc!, getright, antifrag, pusd, dusd, download, crdownload
-				string pathStr = Util::ellipsizePath(fullPath);
-				string sizeStr = Util::formatBytes(size);
-				LogManager::message(STRING_F(SKIPPING_FILE, pathStr % sizeStr));
+			if (isSkippedFile(lowerName, fullPath, size, skipList))
 				continue;
-			}
 #ifdef _WIN32
 			if (i->isLink() && size == 0) // https://github.com/pavel-pimenov/flylinkdc-r5xx/issues/14
 			{
@@ -2671,24 +3368,21 @@ void ShareManager::scanDir(SharedDir* dir, const string& path)
 				}
 			}
 #endif
-			fileCounter++;
+			task->fileCount++;
 			scanProgress[1]++;
-			auto itFile = dir->files.find(lowerName);
+			auto itFile = dir->findFile(lowerName);
 			const uint64_t timestamp = i->getTimeStamp();
 			int64_t oldSize = 0;
 			if (itFile != dir->files.end())
 			{
 				foundFiles++;
-				SharedFilePtr& file = itFile->second;
+				const SharedFilePtr& file = *itFile;
 				filesTypesMask |= file->getFileTypes();
 				oldSize = file->size;
 				if (oldSize == size && file->timestamp == timestamp)
 				{
 					file->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
-					TTHMapItem tthItem;
-					tthItem.file = file;
-					tthItem.dir = dir;
-					tthIndexNew.insert(make_pair(file->getTTH(), tthItem));
+					task->foundFiles.push_back(file);
 					continue;
 				}
 			}
@@ -2697,18 +3391,18 @@ void ShareManager::scanDir(SharedDir* dir, const string& path)
 			SharedFilePtr newFile = std::make_shared<SharedFile>(fileName, lowerName, size, timestamp, types);
 			filesTypesMask |= types;
 			newFile->flags |= BaseDirItem::FLAG_HASH_FILE;
-			dir->files.insert_or_assign(lowerName, newFile);
-			deltaSize += newFile->getSize() - oldSize;
-			if (!(scanShareFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM))
-				bloomNew.add(newFile->getLowerName());
+			if (itFile != dir->files.end())
+				dir->files.erase(itFile);
+			dir->files.insert(newFile);
+			task->deltaSize += newFile->getSize() - oldSize;
 #ifdef DEBUG_SHARE_MANAGER
 			LogManager::message("New file: " + fullPath, false);
 #endif
 			FileToHash fth;
 			fth.file = newFile;
 			fth.path = fullPath;
-			filesToHash.push_back(fth);
-			scanShareFlags |= SCAN_SHARE_FLAG_ADDED;
+			task->newFiles.push_back(fth);
+			task->flags |= SCAN_SHARE_FLAG_ADDED;
 		}
 	}
 
@@ -2717,16 +3411,16 @@ void ShareManager::scanDir(SharedDir* dir, const string& path)
 		auto i = dir->files.begin();
 		while (i != dir->files.end())
 		{
-			SharedFilePtr& file = i->second;
+			const SharedFilePtr& file = *i;
 			if (file->flags & BaseDirItem::FLAG_NOT_FOUND)
 			{
 				string fullPath = path + file->getName();
-				deltaSize -= file->getSize();
+				task->deltaSize -= file->getSize();
 #ifdef DEBUG_SHARE_MANAGER
 				LogManager::message("File removed: " + fullPath, false);
 #endif
 				i = dir->files.erase(i);
-				scanShareFlags |= SCAN_SHARE_FLAG_REMOVED | SCAN_SHARE_FLAG_REBUILD_BLOOM;
+				task->flags |= SCAN_SHARE_FLAG_REMOVED | SCAN_SHARE_FLAG_REBUILD_BLOOM;
 			} else ++i;
 		}
 	}
@@ -2739,26 +3433,691 @@ void ShareManager::scanDir(SharedDir* dir, const string& path)
 			if (d->flags & BaseDirItem::FLAG_NOT_FOUND)
 			{
 				string fullPath = path + d->getName();
-				deltaSize -= d->totalSize;
+				task->deltaSize -= d->totalSize;
 #ifdef DEBUG_SHARE_MANAGER
 				LogManager::message("Directory removed: " + fullPath, false);
 #endif
 				SharedDir::deleteTree(d);
 				i = dir->dirs.erase(i);
-				scanShareFlags |= SCAN_SHARE_FLAG_REMOVED | SCAN_SHARE_FLAG_REBUILD_BLOOM;
+				task->flags |= SCAN_SHARE_FLAG_REMOVED | SCAN_SHARE_FLAG_REBUILD_BLOOM;
 			} else ++i;
 		}
 	}
+	task->filesTypesMask = filesTypesMask;
+	string().swap(task->path);
+}
+
+void ShareManager::mergeScanResults(ScanTask* task)
+{
+	SharedDir* dir = task->dir;
+	uint16_t dirsTypesMask = 0;
+	size_t foundPos = 0;
+	size_t newPos = 0;
+	auto addFiles = [this, task, &foundPos, &newPos](size_t foundEnd, size_t newEnd)
+	{
+		for (; foundPos < foundEnd; ++foundPos)
+		{
+			TTHMapItem tthItem;
+			tthItem.file = task->foundFiles[foundPos];
+			tthItem.dir = task->dir;
+			tthIndexNew.insert(make_pair(tthItem.file->getTTH(), tthItem));
+		}
+		for (; newPos < newEnd; ++newPos)
+		{
+			FileToHash& fth = task->newFiles[newPos];
+			if (!(scanShareFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM))
+				bloomNew.add(fth.file->getLowerName());
+			filesToHash.push_back(std::move(fth));
+		}
+	};
+	for (const ScanTask::Child& child : task->children)
+	{
+		addFiles(child.foundFiles, child.newFiles);
+		mergeScanResults(child.task);
+		dirsTypesMask |= child.task->dir->getTypes();
+		delete child.task;
+	}
+	addFiles(task->foundFiles.size(), task->newFiles.size());
+	if (task->newDirs && !(scanShareFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM))
+		bloomNew.add(dir->getLowerName());
+
+	fileCounter += task->fileCount;
+	scanShareFlags |= task->flags;
+	if (task->deltaSize)
+		dir->updateSize(task->deltaSize);
+	if (scanShareFlags & SCAN_SHARE_FLAG_REMOVED)
+		dir->updateTypes(task->filesTypesMask, dirsTypesMask);
+	else
+		dir->addTypes(task->filesTypesMask, dirsTypesMask);
+}
+
+ShareManager::ScanWorker::ScanWorker(ShareManager& manager) : manager(manager)
+{
+	LOCK(manager.csSkipList);
+	skipList = manager.reSkipList;
+	hasSkipList = manager.hasSkipList;
+}
+
+int ShareManager::ScanWorker::run()
+{
+	while (true)
+	{
+		ScanTask* task;
+		ScanDevice* device;
+		if (!manager.getNextScanTask(task, device))
+			break;
+		if (!task)
+		{
+			event.wait();
+			event.reset();
+			continue;
+		}
+		manager.scanDir(task, hasSkipList ? &skipList : nullptr);
+		manager.scanTaskDone(task, device);
+	}
+	return 0;
+}
+
+bool ShareManager::getNextScanTask(ScanTask* &task, ScanDevice* &device)
+{
+	task = nullptr;
+	LOCK(csScan);
+	if (stopScanning || (!scanQueued && !scanRunning))
+		return false;
+	if (scanQueued)
+	{
+		// Round-robin over devices so that each device has a reader
+		for (size_t count = scanDevices.size(); count; --count)
+		{
+			if (nextScanDevice == scanDevices.end()) nextScanDevice = scanDevices.begin();
+			ScanDevice& sd = nextScanDevice->second;
+			++nextScanDevice;
+			if (sd.tasks.empty() || sd.running >= sd.maxRunning) continue;
+			task = sd.tasks.back();
+			sd.tasks.pop_back();
+			sd.running++;
+			scanRunning++;
+			scanQueued--;
+			device = &sd;
+			break;
+		}
+	}
+	return true;
+}
+
+void ShareManager::scanTaskDone(ScanTask* task, ScanDevice* device)
+{
+	bool notify;
+	{
+		LOCK(csScan);
+		// Pushed in reverse order, so that subdirectories are taken in the order they were found
+		for (auto i = task->children.crbegin(); i != task->children.crend(); ++i)
+			device->tasks.push_back(i->task);
+		scanQueued += task->children.size();
+		device->running--;
+		scanRunning--;
+		notify = !task->children.empty() || !scanRunning || stopScanning;
+	}
+	if (notify)
+		for (ScanWorker* worker : scanWorkers)
+			worker->notify();
+}
+
+void ShareManager::walkShares(const vector<ScanTask*>& roots)
+{
+	unsigned maxThreads = std::thread::hardware_concurrency();
+	if (!maxThreads) maxThreads = 1;
+	int totalRunning = 0;
+	{
+		LOCK(csScan);
+		for (ScanTask* root : roots)
+		{
+			string key;
+			bool seekPenalty;
+			if (!File::getDeviceInfo(root->path, key, seekPenalty))
+			{
+				key = root->path;
+				seekPenalty = true;
+			}
+			auto i = scanDevices.find(key);
+			if (i == scanDevices.end())
+			{
+				i = scanDevices.insert(make_pair(key, ScanDevice())).first;
+				i->second.maxRunning = seekPenalty ? 1 : maxThreads;
+				totalRunning += i->second.maxRunning;
+			}
+			i->second.tasks.insert(i->second.tasks.begin(), root);
+		}
+		nextScanDevice = scanDevices.begin();
+		scanQueued = roots.size();
+		scanRunning = 0;
+		dcassert(scanWorkers.empty());
+		int count = std::min(totalRunning, MAX_SCAN_THREADS);
+		for (int i = 0; i < count; ++i)
+		{
+			ScanWorker* worker = new ScanWorker(*this);
+			worker->event.create();
+			scanWorkers.push_back(worker);
+		}
+	}
+	for (ScanWorker* worker : scanWorkers)
+		worker->start(0, "ShareScanner");
+	for (ScanWorker* worker : scanWorkers)
+		worker->join();
+	LOCK(csScan);
+	for (ScanWorker* worker : scanWorkers)
+		delete worker;
+	scanWorkers.clear();
+	// Tasks left after stopping are still owned by their parents
+	scanDevices.clear();
+	nextScanDevice = scanDevices.end();
+	scanQueued = 0;
+}
+
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+void ShareManager::removeIndexFileL(const SharedFilePtr& file) noexcept
+{
+	if (file->flags & BaseDirItem::FLAG_HASH_FILE) return;
+	auto p = tthIndex.equal_range(file->getTTH());
+	for (auto i = p.first; i != p.second; ++i)
+		if (i->second.file == file)
+		{
+			tthIndex.erase(i);
+			break;
+		}
+}
+
+void ShareManager::removeIndexDirL(const SharedDir* dir) noexcept
+{
+	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
+		removeIndexFileL(*i);
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+		removeIndexDirL(i->second);
+}
+
+void ShareManager::getSubDirs(const SharedDir* dir, std::unordered_set<const SharedDir*>& result)
+{
+	result.insert(dir);
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+		getSubDirs(i->second, result);
+}
+
+int64_t ShareManager::getFileCount(const SharedDir* dir) noexcept
+{
+	int64_t result = dir->files.size();
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+		result += getFileCount(i->second);
+	return result;
+}
+
+ShareManager::ShareListItem* ShareManager::getShareL(const SharedDir* dir) noexcept
+{
+	while (dir->parent) dir = dir->parent;
+	for (auto& sli : shares)
+		if (sli.dir == dir)
+			return &sli;
+	return nullptr;
+}
+
+void ShareManager::updateDirTypes(SharedDir* dir) noexcept
+{
+	uint16_t filesTypesMask = 0;
+	uint16_t dirsTypesMask = 0;
+	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
+		filesTypesMask |= (*i)->getFileTypes();
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+		dirsTypesMask |= i->second->getTypes();
+	dir->updateTypes(filesTypesMask, dirsTypesMask);
+}
+
+// Moves the item without hashing it again. The parent directories are checked by applyUpdateL afterwards.
+bool ShareManager::renameL(const ShareWatcher::Rename& rename) noexcept
+{
+	string fromLower, toLower;
+	Text::toLower(rename.from, fromLower);
+	Text::toLower(rename.to, toLower);
+	string realName = rename.to;
+	if (rename.isDirectory)
+	{
+		fromLower.pop_back();
+		toLower.pop_back();
+		realName.pop_back();
+	}
+	auto pos = realName.rfind(PATH_SEPARATOR);
+	if (pos != string::npos) realName.erase(0, pos + 1);
+
+	SharedDir* fromDir;
+	SharedDir* toDir;
+	string fromName, toName;
+	if (!findByRealPathL(fromLower, fromDir, fromName) || fromName.empty() ||
+	    !findByRealPathL(toLower, toDir, toName) || toName.empty())
+		return false;
+
+	ShareListItem* fromShare = getShareL(fromDir);
+	ShareListItem* toShare = getShareL(toDir);
+	int64_t fileCount = 0;
+	if (rename.isDirectory)
+	{
+		auto i = fromDir->dirs.find(fromName);
+		if (i == fromDir->dirs.end() || toDir->dirs.find(toName) != toDir->dirs.end())
+			return false;
+		SharedDir* dir = i->second;
+		fromDir->dirs.erase(i);
+		fromDir->updateSize(-dir->totalSize);
+		dir->setName(realName);
+		dir->parent = toDir;
+		toDir->dirs.insert(make_pair(toName, dir));
+		toDir->updateSize(dir->totalSize);
+		bloom.add(dir->getLowerName());
+		// The old entry of the directory can't be found by the new name.
+		// Entries of its subdirectories are still valid.
+		std::unordered_set<const SharedDir*> dirs;
+		dirs.insert(dir);
+		searchIndex.removeDirs(dirs);
+		searchIndex.addDir(dir);
+		for (auto j = dir->files.cbegin(); j != dir->files.cend(); ++j)
+			searchIndex.addFile(dir, *j);
+		if (fromShare != toShare)
+			fileCount = getFileCount(dir);
+	}
+	else
+	{
+		auto i = fromDir->findFile(fromName);
+		if (i == fromDir->files.end() || toDir->findFile(toName) != toDir->files.end())
+			return false;
+		const SharedFilePtr oldFile = *i;
+		if (oldFile->flags & BaseDirItem::FLAG_HASH_FILE)
+			return false;
+		SharedFilePtr file = std::make_shared<SharedFile>(realName, oldFile->tth, oldFile->size, oldFile->timestamp,
+			oldFile->timeShared, getFileTypesFromFileName(realName), oldFile->hit);
+		removeIndexFileL(oldFile);
+		fromDir->files.erase(i);
+		fromDir->updateSize(-file->size);
+		toDir->files.insert(file);
+		toDir->updateSize(file->size);
+		TTHMapItem tthItem;
+		tthItem.file = file;
+		tthItem.dir = toDir;
+		tthIndex.insert(make_pair(file->getTTH(), tthItem));
+		bloom.add(file->getLowerName());
+		searchIndex.addFile(toDir, file);
+		fileCount = 1;
+	}
+	updateDirTypes(fromDir);
+	updateDirTypes(toDir);
+	if (fromShare)
+	{
+		if (fromShare != toShare) fromShare->totalFiles -= fileCount;
+		fromShare->version = ++versionCounter;
+	}
+	if (toShare && toShare != fromShare)
+	{
+		toShare->totalFiles += fileCount;
+		toShare->version = ++versionCounter;
+	}
+	return true;
+}
+
+// Lists the directory and scans new subdirectories, the shared tree is not changed
+bool ShareManager::prepareUpdate(DirUpdate& update, const std::regex* skipList) noexcept
+{
+	DirUpdate::Entry entry;
+	entry.newDir = nullptr;
+	entry.newDirFiles = 0;
+	for (FileFindIter i(update.path + '*'); i != FileFindIter::end; ++i)
+	{
+		if (stopScanning) return false;
+		entry.name = i->getFileName();
+		if (isSkippedEntry(*i, entry.name))
+			continue;
+		Text::toLower(entry.name, entry.lowerName);
+		if (i->isDirectory())
+		{
+			if (isSkippedDirectory(update.path + entry.name + PATH_SEPARATOR))
+				continue;
+			update.dirs.push_back(entry);
+		}
+		else
+		{
+			entry.size = i->getSize();
+			entry.timestamp = i->getTimeStamp();
+			if (isSkippedFile(entry.lowerName, update.path + entry.name, entry.size, skipList))
+				continue;
+			update.files.push_back(entry);
+		}
+	}
+
+	string pathLower;
+	Text::toLower(update.path, pathLower);
+	{
+		READ_LOCK(*csShare);
+		SharedDir* dir;
+		string unused;
+		// Directory is not shared or its parent is new: it's added with the parent
+		if (!findByRealPathL(pathLower, dir, unused) || !unused.empty())
+			return false;
+		for (DirUpdate::Entry& e : update.dirs)
+			if (dir->dirs.find(e.lowerName) == dir->dirs.cend())
+				e.newDir = new SharedDir(e.name, nullptr);
+	}
+
+	for (DirUpdate::Entry& e : update.dirs)
+	{
+		if (!e.newDir) continue;
+		ScanTask* root = new ScanTask(e.newDir, update.path + e.name + PATH_SEPARATOR);
+		vector<ScanTask*> tasks(1, root);
+		while (!tasks.empty())
+		{
+			ScanTask* task = tasks.back();
+			tasks.pop_back();
+			scanDir(task, skipList);
+			for (const ScanTask::Child& child : task->children)
+				tasks.push_back(child.task);
+		}
+		// The bloom filter is updated when the tree is attached
+		scanShareFlags = SCAN_SHARE_FLAG_REBUILD_BLOOM;
+		fileCounter = 0;
+		mergeScanResults(root);
+		delete root;
+		e.newDirFiles = fileCounter;
+		e.filesToHash.swap(filesToHash);
+	}
+	return true;
+}
+
+bool ShareManager::applyUpdateL(DirUpdate& update, vector<FileToHash>& newFiles, vector<SharedDir*>& removedDirs) noexcept
+{
+	string pathLower;
+	Text::toLower(update.path, pathLower);
+	SharedDir* dir;
+	string unused;
+	if (!findByRealPathL(pathLower, dir, unused) || !unused.empty())
+		return false;
+
+	int64_t deltaSize = 0;
+	int64_t deltaFiles = 0;
+	bool changed = false;
+	for (auto i = dir->dirs.begin(); i != dir->dirs.end(); ++i)
+		i->second->flags |= BaseDirItem::FLAG_NOT_FOUND;
+	for (auto i = dir->files.begin(); i != dir->files.end(); ++i)
+		(*i)->flags |= BaseDirItem::FLAG_NOT_FOUND;
+
+	for (const DirUpdate::Entry& e : update.files)
+	{
+		auto i = dir->findFile(e.lowerName);
+		if (i != dir->files.end())
+		{
+			const SharedFilePtr file = *i;
+			// Names differing only in case
+			if (!(file->flags & BaseDirItem::FLAG_NOT_FOUND))
+				continue;
+			if (file->size == e.size && file->timestamp == e.timestamp)
+			{
+				file->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
+				continue;
+			}
+			deltaSize -= file->size;
+			removeIndexFileL(file);
+			dir->files.erase(i);
+		}
+		else
+			deltaFiles++;
+		SharedFilePtr newFile = std::make_shared<SharedFile>(e.name, e.lowerName, e.size, e.timestamp, getFileTypesFromFileName(e.name));
+		newFile->flags |= BaseDirItem::FLAG_HASH_FILE;
+		dir->files.insert(newFile);
+		deltaSize += e.size;
+		bloom.add(newFile->getLowerName());
+		searchIndex.addFile(dir, newFile);
+#ifdef DEBUG_SHARE_MANAGER
+		LogManager::message("New file: " + update.path + e.name, false);
+#endif
+		FileToHash fth;
+		fth.file = newFile;
+		fth.path = update.path + e.name;
+		newFiles.push_back(fth);
+		changed = true;
+	}
+
+	for (DirUpdate::Entry& e : update.dirs)
+	{
+		auto i = dir->dirs.find(e.lowerName);
+		if (!e.newDir)
+		{
+			if (i != dir->dirs.end())
+				i->second->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
+			continue;
+		}
+		if (i != dir->dirs.end())
+		{
+			i->second->flags &= ~BaseDirItem::FLAG_NOT_FOUND;
+			SharedDir::deleteTree(e.newDir);
+			e.newDir = nullptr;
+			continue;
+		}
+		SharedDir* newDir = e.newDir;
+		e.newDir = nullptr;
+		newDir->parent = dir;
+		dir->dirs.insert(make_pair(e.lowerName, newDir));
+		deltaSize += newDir->totalSize;
+		deltaFiles += e.newDirFiles;
+		updateBloomDir(bloom, newDir);
+		searchIndex.addTree(newDir);
+#ifdef DEBUG_SHARE_MANAGER
+		LogManager::message("New directory shared: " + update.path + e.name, false);
+#endif
+		for (FileToHash& fth : e.filesToHash)
+			newFiles.push_back(std::move(fth));
+		changed = true;
+	}
+
+	for (auto i = dir->files.begin(); i != dir->files.end();)
+	{
+		const SharedFilePtr& file = *i;
+		if (file->flags & BaseDirItem::FLAG_NOT_FOUND)
+		{
+#ifdef DEBUG_SHARE_MANAGER
+			LogManager::message("File removed: " + update.path + file->getName(), false);
+#endif
+			deltaSize -= file->getSize();
+			deltaFiles--;
+			removeIndexFileL(file);
+			i = dir->files.erase(i);
+			changed = true;
+		} else ++i;
+	}
+	for (auto i = dir->dirs.begin(); i != dir->dirs.end();)
+	{
+		SharedDir* d = i->second;
+		if (d->flags & BaseDirItem::FLAG_NOT_FOUND)
+		{
+#ifdef DEBUG_SHARE_MANAGER
+			LogManager::message("Directory removed: " + update.path + d->getName(), false);
+#endif
+			deltaSize -= d->totalSize;
+			deltaFiles -= getFileCount(d);
+			removeIndexDirL(d);
+			// Deleted by the caller after removing it from the search index
+			d->parent = nullptr;
+			removedDirs.push_back(d);
+			i = dir->dirs.erase(i);
+			changed = true;
+		} else ++i;
+	}
+
 	if (deltaSize)
 		dir->updateSize(deltaSize);
-	if (scanShareFlags & SCAN_SHARE_FLAG_REMOVED)
-		dir->updateTypes(filesTypesMask, dirsTypesMask);
+	updateDirTypes(dir);
+	if (changed)
+	{
+		ShareListItem* sli = getShareL(dir);
+		if (sli)
+		{
+			sli->totalFiles += deltaFiles;
+			sli->version = ++versionCounter;
+		}
+	}
+	return changed;
+}
+
+// Called by the watcher thread. Returns false if the changes must be retried after a full refresh.
+bool ShareManager::updateDirectories(const vector<ShareWatcher::Rename>& renames, const StringList& paths) noexcept
+{
+	if (doingScanDirs) return false;
+	LOCK(csUpdateDirs);
+	if (stopScanning) return true;
+
+	optionShareHidden = BOOLSETTING(SHARE_HIDDEN);
+	optionShareSystem = BOOLSETTING(SHARE_SYSTEM);
+	optionShareVirtual = BOOLSETTING(SHARE_VIRTUAL);
+	std::regex skipList;
+	bool useSkipList;
+	{
+		LOCK(csSkipList);
+		skipList = reSkipList;
+		useSkipList = hasSkipList;
+	}
+
+	bool changed = false;
+	{
+		READ_LOCK(*csShare);
+		newNotShared = notShared;
+	}
+	if (!renames.empty())
+	{
+		WRITE_LOCK(*csShare);
+		for (const auto& rename : renames)
+			if (renameL(rename))
+				changed = true;
+	}
+
+	vector<DirUpdate> updates;
+	for (const string& path : paths)
+	{
+		DirUpdate update;
+		update.path = path;
+		if (prepareUpdate(update, useSkipList ? &skipList : nullptr))
+			updates.push_back(std::move(update));
+		else
+		{
+			for (const DirUpdate::Entry& e : update.dirs)
+				SharedDir::deleteTree(e.newDir);
+		}
+	}
+
+	vector<FileToHash> newFiles;
+	vector<SharedDir*> removedDirs;
+	{
+		WRITE_LOCK(*csShare);
+		for (DirUpdate& update : updates)
+		{
+			if (applyUpdateL(update, newFiles, removedDirs))
+				changed = true;
+			for (const DirUpdate::Entry& e : update.dirs)
+				SharedDir::deleteTree(e.newDir);
+		}
+		if (!removedDirs.empty())
+		{
+			// The search index has pointers to the removed directories
+			std::unordered_set<const SharedDir*> dirs;
+			for (const SharedDir* d : removedDirs)
+				getSubDirs(d, dirs);
+			searchIndex.removeDirs(dirs);
+			for (SharedDir* d : removedDirs)
+				SharedDir::deleteTree(d);
+		}
+		if (changed)
+			updateSharedSizeL();
+	}
+	if (!changed)
+		return true;
+
+	{
+		LOCK(csSearchCache);
+		searchCache.clear();
+	}
+	if (!newFiles.empty())
+	{
+		HashManager* hm = HashManager::getInstance();
+		for (const FileToHash& fth : newFiles)
+		{
+			hm->hashFile(++nextFileID, fth.file, fth.path, fth.file->size);
+		}
+		hashingChangedFiles.store(true);
+	}
 	else
-		dir->addTypes(filesTypesMask, dirsTypesMask);
+		scheduleFileListUpdate();
+	ClientManager::infoUpdated();
+	return true;
 }
 
+void ShareManager::getDirectoriesL(const SharedDir* dir, string& path, StringList& out) const noexcept
+{
+	out.push_back(path);
+	const size_t len = path.length();
+	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
+	{
+		path += i->second->getName();
+		path += PATH_SEPARATOR;
+		getDirectoriesL(i->second, path, out);
+		path.erase(len);
+	}
+}
+
+void ShareManager::updateWatcher() noexcept
+{
+	StringList dirs;
+	if (BOOLSETTING(WATCH_SHARED_DIRS))
+	{
+		READ_LOCK(*csShare);
+		for (const auto& sli : shares)
+		{
+			if (sli.dir->flags & BaseDirItem::FLAG_SHARE_REMOVED) continue;
+			string path = sli.realPath.getName();
+			getDirectoriesL(sli.dir, path, dirs);
+		}
+	}
+	LOCK(csWatcher);
+	if (stopScanning) return;
+	if (!watcher)
+	{
+		if (dirs.empty()) return;
+		ShareWatcher* newWatcher = new ShareWatcher(*this);
+		bool started = false;
+		if (newWatcher->init())
+		{
+			try
+			{
+				newWatcher->start(0, "ShareWatcher");
+				started = true;
+			}
+			catch (const ThreadException&)
+			{
+			}
+		}
+		if (!started)
+		{
+			delete newWatcher;
+			LogManager::message("Unable to watch shared directories", false);
+			return;
+		}
+		watcher = newWatcher;
+	}
+	watcher->setDirectories(dirs);
+}
+
+void ShareManager::scheduleFileListUpdate() noexcept
+{
+	const uint64_t tick = GET_TICK() + FILE_LIST_UPDATE_DELAY;
+	if (tickUpdateList > tick)
+		tickUpdateList = tick;
+}
+#endif // FLYLINKDC_USE_SHARE_WATCHER
+
 void ShareManager::scanDirs()
 {
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	LOCK(csUpdateDirs);
+#endif
 	LogManager::message(STRING(FILE_LIST_REFRESH_INITIATED));
 
 	optionShareHidden = BOOLSETTING(SHARE_HIDDEN);
@@ -2801,14 +4160,21 @@ void ShareManager::scanDirs()
 	filesToHash.clear();
 
 	rebuildSkipList();
+	vector<ScanTask*> roots;
 	for (ShareListItem& sli : newShares)
 	{
-		if (stopScanning) break;
 		const string& path = sli.realPath.getName();
 		LogManager::message("Scanning share: " + path, false);
+		roots.push_back(new ScanTask(sli.dir, path));
+	}
+	walkShares(roots);
+	for (size_t i = 0; i < newShares.size(); ++i)
+	{
+		ShareListItem& sli = newShares[i];
 		scanShareFlags = scanAllFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM;
 		fileCounter = 0;
-		scanDir(sli.dir, path);
+		mergeScanResults(roots[i]);
+		delete roots[i];
 		sli.flags = scanShareFlags & ~SCAN_SHARE_FLAG_REBUILD_BLOOM;
 		sli.totalFiles = fileCounter;
 		scanAllFlags |= scanShareFlags;
@@ -2818,26 +4184,46 @@ void ShareManager::scanDirs()
 	LogManager::message("Finished scanning directories", false);
 #endif
 
+	searchIndexNew.clear();
+	for (const ShareListItem& sli : newShares)
+		searchIndexNew.addTree(sli.dir);
+	if (scanAllFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM)
+	{
+		bloomNew.clear();
+		for (const ShareListItem& sli : newShares)
+			updateBloomDir(bloomNew, sli.dir);
+	}
+
+	// Only pointers and containers are swapped under the lock,
+	// the previous trees and indexes are freed after releasing it.
+	// There are no snapshot reads: searches and uploads still wait for every writer of csShare,
+	// so writers must keep their exclusive sections short. Hashed files are added to the live
+	// tree and tthIndex one at a time, and paths are resolved through the parents of SharedDir.
+	vector<SharedDir*> oldTrees;
+	boost::unordered_multimap<TTHValue, TTHMapItem> oldTTHIndex;
 	{
 		bool updateIndex = false;
+		bool updateSearchIndex = false;
 		WRITE_LOCK(*csShare);
 		shareListChanged = false;
 		for (auto i = shares.begin(); i != shares.end();)
 		{
 			if (i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED)
 			{
-				SharedDir::deleteTree(i->dir);
+				oldTrees.push_back(i->dir);
 				i = shares.erase(i);
 				continue;
 			}
+			bool found = false;
 			for (auto j = newShares.begin(); j != newShares.end(); ++j)
 				if (i->realPath.getLowerName() == j->realPath.getLowerName())
 				{
+					found = true;
 					if (i->version == j->version)
 					{
-						SharedDir::deleteTree(i->dir);
+						oldTrees.push_back(i->dir);
 						i->dir = j->dir;
-						if (j->flags) i->version++;
+						if (j->flags) i->version = ++versionCounter;
 						i->totalFiles = j->totalFiles;
 #ifdef DEBUG_SHARE_MANAGER
 						LogManager::message("Share " + i->realPath.getName() + ": flags=" + Util::toString(j->flags) + ", version=" + Util::toString(i->version));
@@ -2849,13 +4235,15 @@ void ShareManager::scanDirs()
 #ifdef DEBUG_SHARE_MANAGER
 						LogManager::message("Share " + i->realPath.getName() + " was changed during update");
 #endif
-						SharedDir::deleteTree(j->dir);
+						oldTrees.push_back(j->dir);
 						newShares.erase(j);
 						updateIndex = true;
 						shareListChanged = true;
 					}
 					break;
 				}
+			// Share was added during the scan
+			if (!found) updateSearchIndex = true;
 			++i;
 		}
 		if (!newShares.empty())
@@ -2863,26 +4251,35 @@ void ShareManager::scanDirs()
 			updateIndex = true;
 			scanAllFlags |= SCAN_SHARE_FLAG_REMOVED | SCAN_SHARE_FLAG_REBUILD_BLOOM;
 			for (auto i = newShares.begin(); i != newShares.end(); ++i)
-				SharedDir::deleteTree(i->dir);
+				oldTrees.push_back(i->dir);
 			newShares.clear();
 		}
 		if (updateIndex)
 		{
 			LogManager::message("TTH Index will be rebuilt", false);
-			tthIndex.clear();
-			tthIndexNew.clear();
+			oldTTHIndex.swap(tthIndex);
 			for (auto i = shares.cbegin(); i != shares.cend(); ++i)
 				updateIndexDirL(i->dir);
 		}
 		else
 		{
-			tthIndex = std::move(tthIndexNew);
-			tthIndexNew.clear();
+			oldTTHIndex.swap(tthIndex);
+			tthIndex.swap(tthIndexNew);
+		}
+		// Trees of shares added during the scan are not in bloomNew
+		if (updateIndex || updateSearchIndex)
+		{
+			if (scanAllFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM)
+				updateBloomL();
+			else
+				bloom.swap(bloomNew);
+			updateSearchIndexL();
 		}
-		if (scanAllFlags & SCAN_SHARE_FLAG_REBUILD_BLOOM)
-			updateBloomL();
 		else
-			bloom = std::move(bloomNew);
+		{
+			bloom.swap(bloomNew);
+			searchIndex.swap(searchIndexNew);
+		}
 		updateSharedSizeL();
 #ifdef DEBUG_SHARE_MANAGER
 		for (const auto& i : shareGroups)
@@ -2893,6 +4290,12 @@ void ShareManager::scanDirs()
 		LogManager::message("Total: size=" + Util::toString(totalSize) + ", files=" + Util::toString(totalFiles), false);
 #endif
 	}
+	for (SharedDir* dir : oldTrees)
+		SharedDir::deleteTree(dir);
+	oldTrees.clear();
+	oldTTHIndex.clear();
+	tthIndexNew.clear();
+	searchIndexNew.clear();
 
 	{
 		LOCK(csSearchCache);
@@ -2904,8 +4307,7 @@ void ShareManager::scanDirs()
 		HashManager* hm = HashManager::getInstance();
 		for (auto i = filesToHash.begin(); i != filesToHash.end(); ++i)
 		{
-			maxSharedFileID = ++nextFileID;
-			hm->hashFile(maxSharedFileID, i->file, i->path, i->file->size);
+			hm->hashFile(++nextFileID, i->file, i->path, i->file->size);
 		}
 		filesToHash.clear();
 		filesToHash.shrink_to_fit();
@@ -2923,6 +4325,9 @@ void ShareManager::scanDirs()
 
 	if (scanAllFlags & (SCAN_SHARE_FLAG_ADDED | SCAN_SHARE_FLAG_REMOVED))
 		ClientManager::infoUpdated(true);
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	updateWatcher();
+#endif
 	finishedScanDirs.store(true);
 	LogManager::message(STRING(FILE_LIST_REFRESH_FINISHED));
 }
@@ -2961,7 +4366,7 @@ void ShareManager::updateIndexDirL(const SharedDir* dir) noexcept
 	ShareManager::TTHMapItem tthItem;
 	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
 	{
-		const SharedFilePtr& file = i->second;
+		const SharedFilePtr& file = *i;
 		if (file->flags & BaseDirItem::FLAG_HASH_FILE) continue;
 		tthItem.dir = dir;
 		tthItem.file = file;
@@ -2971,13 +4376,13 @@ void ShareManager::updateIndexDirL(const SharedDir* dir) noexcept
 		updateIndexDirL(i->second);
 }
 
-void ShareManager::updateBloomDirL(const SharedDir* dir) noexcept
+void ShareManager::updateBloomDir(Bloom& bloom, const SharedDir* dir) noexcept
 {
 	bloom.add(dir->getLowerName());
 	for (auto i = dir->files.cbegin(); i != dir->files.cend(); ++i)
-		bloom.add(i->second->getLowerName());
+		bloom.add((*i)->getLowerName());
 	for (auto i = dir->dirs.cbegin(); i != dir->dirs.cend(); ++i)
-		updateBloomDirL(i->second);
+		updateBloomDir(bloom, i->second);
 }
 
 void ShareManager::updateBloomL() noexcept
@@ -2986,7 +4391,15 @@ void ShareManager::updateBloomL() noexcept
 	bloom.clear();
 	for (auto i = shares.cbegin(); i != shares.cend(); ++i)
 		if (!(i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED))
-			updateBloomDirL(i->dir);
+			updateBloomDir(bloom, i->dir);
+}
+
+void ShareManager::updateSearchIndexL() noexcept
+{
+	searchIndex.clear();
+	for (auto i = shares.cbegin(); i != shares.cend(); ++i)
+		if (!(i->dir->flags & BaseDirItem::FLAG_SHARE_REMOVED))
+			searchIndex.addTree(i->dir);
 }
 
 void ShareManager::updateSharedSizeL() noexcept
@@ -3185,7 +4598,7 @@ void ShareManager::rebuildSkipList()
 	hasSkipList = result;
 }
 
-void ShareManager::on(FileHashed, int64_t fileID, const SharedFilePtr& file, const string& fileName, const TTHValue& root, int64_t size) noexcept
+void ShareManager::on(FileHashed, int64_t /*fileID*/, const SharedFilePtr& file, const string& fileName, const TTHValue& root, int64_t size) noexcept
 {
 	if (!file) return;
 	string pathLower;
@@ -3206,11 +4619,9 @@ void ShareManager::on(FileHashed, int64_t fileID, const SharedFilePtr& file, con
 		tthItem.dir = dir;
 		tthIndex.insert(make_pair(root, tthItem));
 	}
-	if (fileID > maxHashedFileID)
-		maxHashedFileID = fileID;
 }
 
-void ShareManager::on(HashingError, int64_t fileID, const SharedFilePtr& file, const string& fileName) noexcept
+void ShareManager::on(HashingError, int64_t /*fileID*/, const SharedFilePtr& file, const string& fileName) noexcept
 {
 	if (!file) return;
 	string pathLower;
@@ -3220,9 +4631,7 @@ void ShareManager::on(HashingError, int64_t fileID, const SharedFilePtr& file, c
 	SharedFilePtr storedFile;
 	SharedDir* dir;
 	if (findByRealPathL(pathLower, dir, storedFile))
-		dir->files.erase(storedFile->getLowerName());
-	if (fileID > maxHashedFileID)
-		maxHashedFileID = fileID;
+		dir->files.erase(storedFile);
 }
 
 void ShareManager::on(HashingAborted) noexcept
@@ -3245,7 +4654,10 @@ void ShareManager::on(Second, uint64_t tick) noexcept
 		join();
 		doingScanDirs.store(false);
 	}
-	if (doingHashFiles && maxHashedFileID >= maxSharedFileID)
+	// Files are hashed by several workers in any order: wait until the queue is empty.
+	// FileHashed and HashingError are fired before the file is removed from the queue.
+	const bool hashing = (doingHashFiles || hashingChangedFiles) && HashManager::getInstance()->isHashing();
+	if (doingHashFiles && !hashing)
 	{
 		tickLastRefresh = tick;
 		if (autoRefreshTime)
@@ -3255,6 +4667,13 @@ void ShareManager::on(Second, uint64_t tick) noexcept
 		tickUpdateList.store(0);
 		doingHashFiles.store(false);
 	}
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	if (hashingChangedFiles && !hashing)
+	{
+		hashingChangedFiles.store(false);
+		scheduleFileListUpdate();
+	}
+#endif
 	if (tick > tickRestoreFileList)
 	{
 		if (renameXmlFiles())
@@ -3269,6 +4688,14 @@ void ShareManager::on(Second, uint64_t tick) noexcept
 
 void ShareManager::on(Repaint) noexcept
 {
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	const bool newWatchSharedDirs = BOOLSETTING(WATCH_SHARED_DIRS);
+	if (newWatchSharedDirs != watchSharedDirs)
+	{
+		watchSharedDirs = newWatchSharedDirs;
+		updateWatcher();
+	}
+#endif
 	unsigned newAutoRefreshTime = SETTING(AUTO_REFRESH_TIME) * 60000;
 	if (newAutoRefreshTime == autoRefreshTime) return;
 	autoRefreshTime = newAutoRefreshTime;
@@ -3283,6 +4710,22 @@ void ShareManager::shutdown()
 	HashManager::getInstance()->removeListener(this);
 	TimerManager::getInstance()->removeListener(this);
 	SettingsManager::getInstance()->removeListener(this);
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+	ShareWatcher* savedWatcher;
+	{
+		LOCK(csWatcher);
+		stopScanning.store(true);
+		savedWatcher = watcher;
+		watcher = nullptr;
+	}
+	if (savedWatcher)
+	{
+		// The watcher may be waiting for the scan, which is stopped too
+		savedWatcher->stop();
+		savedWatcher->join();
+		delete savedWatcher;
+	}
+#endif
 	if (doingScanDirs)
 	{
 		stopScanning.store(true);
@@ -30,8 +30,12 @@
 #include "SearchParam.h"
 #include "SearchResult.h"
 #include "StringSearch.h"
+#include "MultiStringSearch.h"
 #include "BloomFilter.h"
+#include "ShareSearchIndex.h"
 #include "LruCache.h"
+#include "WaitableEvent.h"
+#include "ShareWatcher.h"
 #include <regex>
 
 class OutputStream;
@@ -50,6 +54,9 @@ struct AdcSearchParam
 
 	StringSearch::List include;
 	StringSearch::List exclude;
+	MultiStringSearch matcher; // include patterns, then exclude patterns
+	MultiStringSearch::Mask includeMask;
+	MultiStringSearch::Mask excludeMask;
 	StringList exts;
 	StringList noExts;
 			
@@ -66,6 +73,8 @@ struct AdcSearchParam
 	string cacheKey;
 };
 
+struct FileListFragment;
+
 class ShareManager :
 	public Singleton<ShareManager>,
 	private HashManagerListener,
@@ -76,6 +85,9 @@ class ShareManager :
 	public:
 		friend class Singleton<ShareManager>;
 		friend class ShareLoader;
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+		friend class ShareWatcher;
+#endif
 
 		enum
 		{
@@ -239,6 +251,7 @@ class ShareManager :
 		};
 
 		typedef vector<ShareListItem> ShareList;
+		// Protects the shared trees and indexes. Readers are blocked by writers, keep write sections short.
 		std::unique_ptr<RWLock> csShare;
 		ShareList shares;
 		StringList notShared;
@@ -256,6 +269,7 @@ class ShareManager :
 
 		boost::unordered_multimap<TTHValue, TTHMapItem> tthIndex;
 		Bloom bloom;
+		ShareSearchIndex searchIndex;
 		
 		size_t hits;
 
@@ -267,13 +281,108 @@ class ShareManager :
 		StringList newNotShared;
 		boost::unordered_multimap<TTHValue, TTHMapItem> tthIndexNew;
 		Bloom bloomNew;
+		ShareSearchIndex searchIndexNew;
 		unsigned scanShareFlags;
 		unsigned scanAllFlags;
 		int64_t nextFileID;
-		std::atomic<int64_t> maxSharedFileID;
-		std::atomic<int64_t> maxHashedFileID;
 		std::atomic<int64_t> scanProgress[2];
 		vector<FileToHash> filesToHash;
+
+		/**
+		 * Directory scanned by one of the scan workers.
+		 * Workers change only the directory itself, the sizes, type masks and indexes
+		 * are updated by mergeScanResults in the same depth-first order as a sequential scan.
+		 */
+		struct ScanTask
+		{
+			struct Child
+			{
+				ScanTask* task;
+				size_t foundFiles; // sizes of foundFiles and newFiles when the subdirectory was found
+				size_t newFiles;
+			};
+
+			SharedDir* const dir;
+			string path;
+			vector<Child> children;
+			vector<SharedFilePtr> foundFiles;
+			vector<FileToHash> newFiles;
+			int64_t deltaSize;
+			size_t fileCount;
+			unsigned flags;
+			uint16_t filesTypesMask;
+			bool newDirs;
+
+			ScanTask(SharedDir* dir, const string& path) :
+				dir(dir), path(path), deltaSize(0), fileCount(0), flags(0), filesTypesMask(0), newDirs(false) {}
+		};
+
+		/**
+		 * Directories located on the same physical device.
+		 * Devices with a seek penalty are scanned by one worker at a time.
+		 */
+		struct ScanDevice
+		{
+			vector<ScanTask*> tasks; // subdirectories found last are taken first
+			int running = 0;
+			int maxRunning = 1;
+		};
+
+		class ScanWorker : public Thread
+		{
+			public:
+				explicit ScanWorker(ShareManager& manager);
+				void notify() { event.notify(); }
+
+			private:
+				ShareManager& manager;
+				WaitableEvent event;
+				std::regex skipList; // own copy, so that workers don't share csSkipList
+				bool hasSkipList;
+
+			protected:
+				virtual int run() override;
+
+			friend class ShareManager;
+		};
+
+		static const int MAX_SCAN_THREADS = 32;
+
+		std::map<string, ScanDevice> scanDevices;
+		std::map<string, ScanDevice>::iterator nextScanDevice;
+		vector<ScanWorker*> scanWorkers;
+		size_t scanQueued;
+		int scanRunning;
+		FastCriticalSection csScan;
+
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+		// Directory changed on disk, prepared by the watcher thread without locking csShare
+		struct DirUpdate
+		{
+			struct Entry
+			{
+				string name;
+				string lowerName;
+				int64_t size;
+				uint64_t timestamp;
+				SharedDir* newDir; // scanned tree of a new subdirectory
+				int64_t newDirFiles;
+				vector<FileToHash> filesToHash;
+			};
+
+			string path;
+			vector<Entry> files;
+			vector<Entry> dirs;
+		};
+
+		static const uint64_t FILE_LIST_UPDATE_DELAY = 15000;
+
+		ShareWatcher* watcher;
+		FastCriticalSection csWatcher;
+		CriticalSection csUpdateDirs; // held by scanDirs and updateDirectories
+		std::atomic_bool hashingChangedFiles;
+		bool watchSharedDirs; // saved value of SETTING(WATCH_SHARED_DIRS)
+#endif
 		bool optionShareHidden, optionShareSystem, optionShareVirtual;
 		mutable bool optionIncludeHit, optionIncludeTimestamp;
 
@@ -287,7 +396,11 @@ class ShareManager :
 		unsigned autoRefreshTime;
 		
 		unsigned tempFileCount;
-		string tempShareDataFile;
+		string tempShareImageFile;
+
+		// Compressed file list parts of individual shares, keyed by lower case real path.
+		// Used only by the thread generating file lists.
+		boost::unordered_map<string, std::shared_ptr<FileListFragment>> fileListFragments;
 		
 		std::regex reSkipList;
 		bool hasSkipList;
@@ -312,6 +425,8 @@ class ShareManager :
 		bool hasShareL(const string& virtualName, const string& realName, bool& foundVirtual) const noexcept;
 		void loadShareList(SimpleXML& xml);
 		void loadShareData(File& file);
+		bool loadShareImage(const string& path, bool& indexLoaded);
+		void clearSharedTreesL();
 		void loadSharedFile(SharedDir* current, const string& filename, int64_t size, const TTHValue& tth, uint64_t timestamp, uint64_t timeShared, unsigned hit) noexcept;
 		void loadSharedDir(SharedDir* &current, const string& filename) noexcept;
 		bool addExcludeFolderL(const string& path) noexcept;
@@ -319,15 +434,15 @@ class ShareManager :
 		static void removeShareGroupFiles(const string& path) noexcept;
 		void removeOldShareGroupFiles() noexcept;
 
-		static void writeShareDataDirStart(OutputStream* os, const SharedDir* dir, uint8_t tempBuf[]);
-		static void writeShareDataDirEnd(OutputStream* os);
-		static void writeShareDataFile(OutputStream* os, const SharedFilePtr& file, uint8_t tempBuf[]);
-		void writeShareDataL(const SharedDir* dir, OutputStream* shareDataFile, uint8_t tempBuf[]) const;
+		struct ShareImageBuilder;
+		void writeShareImageL(const SharedDir* dir, uint32_t parent, ShareImageBuilder& builder) const;
 		void writeXmlL(const SharedDir* dir, OutputStream& xmlFile, string& indent, string& tmp, int mode) const;
 		void writeXmlFilesL(const SharedDir* dir, OutputStream& xmlFile, string& indent, string& tmp) const;
 		bool renameXmlFiles() noexcept;
 		bool getXmlFileInfo(const CID& id, bool compressed, TTHValue& tth, int64_t& size) const noexcept;
 		bool writeShareGroupXml(const CID& id);
+		std::shared_ptr<FileListFragment> getFileListFragmentL(const ShareListItem& sli, string& indent, string& tmp);
+		static bool hasUnhashedFiles(const SharedDir* dir) noexcept;
 		bool writeEmptyFileList(const string& path) noexcept;
 		bool generateFileList(uint64_t tick) noexcept;
 
@@ -340,15 +455,43 @@ class ShareManager :
 		bool findByRealPathL(const string& pathLower, SharedDir* &dir, string& filename) const noexcept;
 		bool findByRealPathL(const string& pathLower, SharedDir* &dir, SharedFilePtr& file) const noexcept;
 		
-		void searchL(const SharedDir* dir, vector<SearchResultCore>& results, const StringSearch::List& ssl, const SearchParamBase& sp) noexcept;
-		void searchL(const SharedDir* dir, vector<SearchResultCore>& results, AdcSearchParam& sp, const StringSearch::List* replaceInclude) noexcept;
+		void searchL(const SharedDir* dir, vector<SearchResultCore>& results, const MultiStringSearch& matcher, MultiStringSearch::Mask remaining, const SearchParamBase& sp) noexcept;
+		void searchL(const SharedDir* dir, vector<SearchResultCore>& results, AdcSearchParam& sp, MultiStringSearch::Mask remaining) noexcept;
+		bool searchIndexL(vector<SearchResultCore>& results, const StringSearch::List& ssl, const MultiStringSearch& matcher, const SearchParamBase& sp, const vector<const SharedDir*>& roots) noexcept;
+		bool searchIndexL(vector<SearchResultCore>& results, AdcSearchParam& sp, const vector<const SharedDir*>& roots) noexcept;
+		int getIndexTermL(const StringSearch::List& ssl) const noexcept;
+		bool isIndexItemValidL(const ShareSearchIndex::Item& item, const StringSearch& ss, const vector<const SharedDir*>& roots) const noexcept;
+		void getSearchRootsL(const ShareGroup& sg, vector<const SharedDir*>& roots) const noexcept;
 
 		void scanDirs();
-		void scanDir(SharedDir* dir, const string& path);
+		void scanDir(ScanTask* task, const std::regex* skipList);
+		void walkShares(const vector<ScanTask*>& roots);
+		bool getNextScanTask(ScanTask* &task, ScanDevice* &device);
+		void scanTaskDone(ScanTask* task, ScanDevice* device);
+		void mergeScanResults(ScanTask* task);
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+		bool updateDirectories(const vector<ShareWatcher::Rename>& renames, const StringList& paths) noexcept;
+		bool prepareUpdate(DirUpdate& update, const std::regex* skipList) noexcept;
+		bool applyUpdateL(DirUpdate& update, vector<FileToHash>& newFiles, vector<SharedDir*>& removedDirs) noexcept;
+		bool renameL(const ShareWatcher::Rename& rename) noexcept;
+		void removeIndexFileL(const SharedFilePtr& file) noexcept;
+		void removeIndexDirL(const SharedDir* dir) noexcept;
+		static int64_t getFileCount(const SharedDir* dir) noexcept;
+		static void getSubDirs(const SharedDir* dir, std::unordered_set<const SharedDir*>& result);
+		ShareListItem* getShareL(const SharedDir* dir) noexcept;
+		static void updateDirTypes(SharedDir* dir) noexcept;
+		void getDirectoriesL(const SharedDir* dir, string& path, StringList& out) const noexcept;
+		void updateWatcher() noexcept;
+		void scheduleFileListUpdate() noexcept;
+#endif
 		bool isDirectoryExcludedL(const string& path) const noexcept;
+		bool isSkippedEntry(const FileFindIter::DirData& data, const string& fileName) const noexcept;
+		bool isSkippedDirectory(const string& fullPath) const noexcept;
+		static bool isSkippedFile(const string& lowerName, const string& fullPath, int64_t size, const std::regex* skipList) noexcept;
 		void updateIndexDirL(const SharedDir* dir) noexcept; 
-		void updateBloomDirL(const SharedDir* dir) noexcept;
+		static void updateBloomDir(Bloom& bloom, const SharedDir* dir) noexcept;
 		void updateBloomL() noexcept;
+		void updateSearchIndexL() noexcept;
 		void updateSharedSizeL() noexcept;
 
 		void initDefaultShareGroupL() noexcept;
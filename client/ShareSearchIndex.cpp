@@ -0,0 +1,140 @@
+#include "stdinc.h"
+#include "ShareSearchIndex.h"
+
+static_assert(ShareSearchIndex::NGRAM_SIZE == 3, "getPos expects trigrams");
+
+ShareSearchIndex::ShareSearchIndex() : table(TABLE_SIZE)
+{
+}
+
+void ShareSearchIndex::addName(const string& lowerName, uint32_t id) noexcept
+{
+	if (lowerName.length() < NGRAM_SIZE) return;
+	const size_t last = lowerName.length() - NGRAM_SIZE;
+	for (size_t i = 0; i <= last; ++i)
+	{
+		vector<uint32_t>& v = table[getPos(lowerName.data() + i)];
+		// Ids are added in ascending order, skip repeated trigrams of the same name
+		if (v.empty() || v.back() != id)
+			v.push_back(id);
+	}
+}
+
+void ShareSearchIndex::addDir(const SharedDir* dir) noexcept
+{
+	const uint32_t id = (uint32_t) items.size();
+	items.push_back(Item{dir, SharedFilePtr()});
+	addName(dir->getLowerName(), id);
+}
+
+void ShareSearchIndex::addFile(const SharedDir* dir, const SharedFilePtr& file) noexcept
+{
+	const uint32_t id = (uint32_t) items.size();
+	items.push_back(Item{dir, file});
+	addName(file->getLowerName(), id);
+}
+
+void ShareSearchIndex::addTree(const SharedDir* root) noexcept
+{
+	addDir(root);
+	for (auto i = root->files.cbegin(); i != root->files.cend(); ++i)
+		addFile(root, *i);
+	for (auto i = root->dirs.cbegin(); i != root->dirs.cend(); ++i)
+		addTree(i->second);
+}
+
+void ShareSearchIndex::removeDirs(const std::unordered_set<const SharedDir*>& dirs) noexcept
+{
+	if (dirs.empty()) return;
+	for (Item& item : items)
+		if (item.dir && dirs.find(item.dir) != dirs.cend())
+		{
+			item.dir = nullptr;
+			item.file.reset();
+		}
+}
+
+void ShareSearchIndex::clear() noexcept
+{
+	items.clear();
+	for (auto& v : table)
+		vector<uint32_t>().swap(v);
+}
+
+void ShareSearchIndex::swap(ShareSearchIndex& other) noexcept
+{
+	items.swap(other.items);
+	table.swap(other.table);
+}
+
+void ShareSearchIndex::getTable(vector<uint32_t>& offsets, vector<uint32_t>& ids) const noexcept
+{
+	offsets.resize(TABLE_SIZE + 1);
+	ids.clear();
+	for (size_t i = 0; i < TABLE_SIZE; ++i)
+	{
+		offsets[i] = (uint32_t) ids.size();
+		ids.insert(ids.end(), table[i].cbegin(), table[i].cend());
+	}
+	offsets[TABLE_SIZE] = (uint32_t) ids.size();
+}
+
+bool ShareSearchIndex::setTable(vector<Item>& newItems, const uint32_t* offsets, const uint32_t* ids) noexcept
+{
+	const uint32_t itemCount = (uint32_t) newItems.size();
+	if (offsets[0]) return false;
+	for (size_t i = 0; i < TABLE_SIZE; ++i)
+	{
+		if (offsets[i + 1] < offsets[i]) return false;
+		uint32_t prev = 0;
+		for (uint32_t j = offsets[i]; j < offsets[i + 1]; ++j)
+		{
+			// find() relies on ascending ids
+			if (ids[j] >= itemCount || (j != offsets[i] && ids[j] <= prev)) return false;
+			prev = ids[j];
+		}
+	}
+	items.swap(newItems);
+	for (size_t i = 0; i < TABLE_SIZE; ++i)
+		table[i].assign(ids + offsets[i], ids + offsets[i + 1]);
+	return true;
+}
+
+size_t ShareSearchIndex::estimate(const string& patternLower) const noexcept
+{
+	if (patternLower.length() < NGRAM_SIZE) return SIZE_MAX;
+	size_t result = SIZE_MAX;
+	const size_t last = patternLower.length() - NGRAM_SIZE;
+	for (size_t i = 0; i <= last; ++i)
+	{
+		size_t count = table[getPos(patternLower.data() + i)].size();
+		if (count < result) result = count;
+	}
+	return result;
+}
+
+bool ShareSearchIndex::find(const string& patternLower, vector<uint32_t>& out) const noexcept
+{
+	out.clear();
+	if (patternLower.length() < NGRAM_SIZE) return false;
+	vector<const vector<uint32_t>*> lists;
+	const size_t last = patternLower.length() - NGRAM_SIZE;
+	for (size_t i = 0; i <= last; ++i)
+	{
+		const vector<uint32_t>* v = &table[getPos(patternLower.data() + i)];
+		if (v->empty()) return true;
+		if (std::find(lists.cbegin(), lists.cend(), v) == lists.cend())
+			lists.push_back(v);
+	}
+	std::sort(lists.begin(), lists.end(),
+		[](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+	out = *lists[0];
+	vector<uint32_t> tmp;
+	for (size_t i = 1; i < lists.size() && !out.empty(); ++i)
+	{
+		tmp.clear();
+		std::set_intersection(out.cbegin(), out.cend(), lists[i]->cbegin(), lists[i]->cend(), std::back_inserter(tmp));
+		out.swap(tmp);
+	}
+	return true;
+}
@@ -0,0 +1,65 @@
+#ifndef SHARE_SEARCH_INDEX_H_
+#define SHARE_SEARCH_INDEX_H_
+
+#include "SharedFile.h"
+
+/**
+ * Trigram index over lower case names of shared directories and files.
+ * It only narrows down the set of items, candidates must be checked
+ * with StringSearch::matchLower.
+ */
+class ShareSearchIndex
+{
+	public:
+		struct Item
+		{
+			const SharedDir* dir; // parent directory for files, the directory itself for directories
+			SharedFilePtr file;   // nullptr for directories
+		};
+
+		static const size_t NGRAM_SIZE = 3;
+
+		ShareSearchIndex();
+
+		void addDir(const SharedDir* dir) noexcept;
+		void addFile(const SharedDir* dir, const SharedFilePtr& file) noexcept;
+		void addTree(const SharedDir* root) noexcept;
+		/**
+		 * Clears the items of the directories and of the files in them without rebuilding the table.
+		 * find() still returns their ids, getItem() returns an item with a null dir.
+		 */
+		void removeDirs(const std::unordered_set<const SharedDir*>& dirs) noexcept;
+		void clear() noexcept;
+		void swap(ShareSearchIndex& other) noexcept;
+
+		/** Returns the upper bound of items matching the pattern, or SIZE_MAX if the pattern is too short. */
+		size_t estimate(const string& patternLower) const noexcept;
+		/** Returns ids of the items which may contain the pattern, in the order they were added. */
+		bool find(const string& patternLower, vector<uint32_t>& out) const noexcept;
+
+		const Item& getItem(uint32_t id) const { return items[id]; }
+		size_t size() const { return items.size(); }
+
+		/** Flat copy of the trigram table, offsets has getTableSize() + 1 elements. */
+		void getTable(vector<uint32_t>& offsets, vector<uint32_t>& ids) const noexcept;
+		/** Replaces the index with a table saved by getTable. Ids must refer to the items in the same order. */
+		bool setTable(vector<Item>& newItems, const uint32_t* offsets, const uint32_t* ids) noexcept;
+		static size_t getTableSize() { return TABLE_SIZE; }
+
+	private:
+		static const size_t TABLE_SIZE = 1 << 16;
+
+		vector<Item> items;
+		vector<vector<uint32_t>> table;
+
+		void addName(const string& lowerName, uint32_t id) noexcept;
+		static size_t getPos(const char* s)
+		{
+			const uint8_t* p = reinterpret_cast<const uint8_t*>(s);
+			uint32_t h = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16;
+			h *= 0x9E3779B1;
+			return h >> 16;
+		}
+};
+
+#endif // SHARE_SEARCH_INDEX_H_
@@ -0,0 +1,289 @@
+#include "stdinc.h"
+#include "ShareWatcher.h"
+
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+
+#include "ShareManager.h"
+#include "File.h"
+#include "LogManager.h"
+#include "TimerManager.h"
+#include <sys/inotify.h>
+#include <poll.h>
+
+// File creation is not watched: files are picked up when they are closed after writing
+static const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_ATTRIB |
+	IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR | IN_EXCL_UNLINK;
+
+static const unsigned QUIET_TIME = 2000; // changes are applied after no events came for this time
+static const unsigned MAX_DELAY = 10000; // ... or after this time since the first change
+
+ShareWatcher::ShareWatcher(ShareManager& manager) :
+	manager(manager), fd(-1), stopFlag(false), hasNewDirs(false),
+	moveCookie(0), firstChangeTick(0), lastChangeTick(0), overflow(false), limitReached(false)
+{
+}
+
+ShareWatcher::~ShareWatcher()
+{
+	if (fd != -1) close(fd);
+}
+
+bool ShareWatcher::init() noexcept
+{
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	return fd != -1 && wakeEvent.create();
+}
+
+void ShareWatcher::stop() noexcept
+{
+	stopFlag = true;
+	wakeEvent.notify();
+}
+
+void ShareWatcher::setDirectories(StringList& paths) noexcept
+{
+	{
+		LOCK(csNewDirs);
+		newDirs.swap(paths);
+		hasNewDirs = true;
+	}
+	wakeEvent.notify();
+}
+
+// Returns false if the directory was already watched or can't be watched
+bool ShareWatcher::addWatch(const string& path) noexcept
+{
+	if (limitReached) return false;
+	int wd = inotify_add_watch(fd, path.c_str(), WATCH_MASK);
+	if (wd < 0)
+	{
+		if (errno == ENOSPC)
+		{
+			limitReached = true;
+			LogManager::message("Not all shared directories are watched, increase fs.inotify.max_user_watches", false);
+		}
+		return false;
+	}
+	// Same directory reachable by another path
+	if (watches.find(wd) != watches.end()) return false;
+	auto i = dirs.insert(make_pair(path, wd)).first;
+	i->second = wd;
+	watches[wd] = i;
+	return true;
+}
+
+void ShareWatcher::addTree(const string& path) noexcept
+{
+	if (!addWatch(path)) return;
+	for (FileFindIter i(path + '*'); i != FileFindIter::end; ++i)
+	{
+		if (stopFlag) break;
+		if (!i->isDirectory()) continue;
+		const string fileName = i->getFileName();
+		if (Util::isReservedDirName(fileName)) continue;
+		addTree(path + fileName + PATH_SEPARATOR);
+	}
+}
+
+void ShareWatcher::removeTree(const string& path) noexcept
+{
+	auto i = dirs.lower_bound(path);
+	while (i != dirs.end() && i->first.compare(0, path.length(), path) == 0)
+	{
+		inotify_rm_watch(fd, i->second);
+		watches.erase(i->second);
+		i = dirs.erase(i);
+	}
+}
+
+// Watch descriptors stay valid after a rename, only the paths are changed
+void ShareWatcher::moveTree(const string& from, const string& to) noexcept
+{
+	vector<pair<string, int>> moved;
+	auto i = dirs.lower_bound(from);
+	while (i != dirs.end() && i->first.compare(0, from.length(), from) == 0)
+	{
+		moved.emplace_back(to + i->first.substr(from.length()), i->second);
+		watches.erase(i->second);
+		i = dirs.erase(i);
+	}
+	for (const auto& item : moved)
+	{
+		auto j = dirs.insert(item).first;
+		j->second = item.second;
+		watches[item.second] = j;
+	}
+}
+
+void ShareWatcher::applyNewDirs(StringList& paths) noexcept
+{
+	DirMap oldDirs;
+	oldDirs.swap(dirs);
+	watches.clear();
+	limitReached = false;
+	for (const string& path : paths)
+		addWatch(path);
+	// inotify_add_watch returns the same descriptors for directories which were already watched
+	for (const auto& i : oldDirs)
+		if (watches.find(i.second) == watches.end())
+			inotify_rm_watch(fd, i.second);
+}
+
+void ShareWatcher::addChange(const string& dir) noexcept
+{
+	changedDirs.insert(dir);
+	lastChangeTick = GET_TICK();
+	if (!firstChangeTick) firstChangeTick = lastChangeTick;
+}
+
+void ShareWatcher::readEvents() noexcept
+{
+	char buf[16 * 1024] __attribute__((aligned(__alignof__(inotify_event))));
+	while (!stopFlag)
+	{
+		ssize_t len = read(fd, buf, sizeof(buf));
+		if (len <= 0)
+		{
+			if (len < 0 && errno == EINTR) continue;
+			break;
+		}
+		for (const char* p = buf; p < buf + len;)
+		{
+			const inotify_event* ev = reinterpret_cast<const inotify_event*>(p);
+			p += sizeof(inotify_event) + ev->len;
+			if (ev->mask & IN_Q_OVERFLOW)
+			{
+				overflow = true;
+				addChange(Util::emptyString);
+				continue;
+			}
+			auto i = watches.find(ev->wd);
+			if (i == watches.end()) continue;
+			if (ev->mask & IN_IGNORED)
+			{
+				if (i->second->second == ev->wd)
+					dirs.erase(i->second);
+				watches.erase(i);
+				continue;
+			}
+			if (!ev->len) continue;
+			const string dir = i->second->first;
+			const bool isDirectory = (ev->mask & IN_ISDIR) != 0;
+			string path = dir + ev->name;
+			if (isDirectory) path += PATH_SEPARATOR;
+
+			// A rename produces IN_MOVED_FROM immediately followed by IN_MOVED_TO with the same cookie
+			if (moveCookie && !((ev->mask & IN_MOVED_TO) && ev->cookie == moveCookie))
+			{
+				if (moveFrom.isDirectory) removeTree(moveFrom.from);
+				moveCookie = 0;
+			}
+			if (ev->mask & IN_MOVED_FROM)
+			{
+				moveCookie = ev->cookie;
+				moveFrom.from = std::move(path);
+				moveFrom.isDirectory = isDirectory;
+			}
+			else if (ev->mask & IN_MOVED_TO)
+			{
+				if (moveCookie)
+				{
+					if (isDirectory) moveTree(moveFrom.from, path);
+					moveFrom.to = std::move(path);
+					renames.push_back(moveFrom);
+					moveCookie = 0;
+				}
+				else if (isDirectory)
+					addTree(path);
+			}
+			else if (ev->mask & IN_CREATE)
+			{
+				if (!isDirectory) continue;
+				addTree(path);
+			}
+			else if (ev->mask & IN_DELETE)
+			{
+				if (isDirectory) removeTree(path);
+			}
+			addChange(dir);
+		}
+	}
+	// The pair was split between reads or the item was moved out of the watched directories
+	if (moveCookie)
+	{
+		if (moveFrom.isDirectory) removeTree(moveFrom.from);
+		moveCookie = 0;
+	}
+}
+
+void ShareWatcher::flushChanges(uint64_t tick) noexcept
+{
+	if (!firstChangeTick) return;
+	if (tick < lastChangeTick + QUIET_TIME && tick < firstChangeTick + MAX_DELAY) return;
+	bool result;
+	if (overflow)
+	{
+		LogManager::message("Too many changes in shared directories, refreshing share", false);
+		result = manager.refreshShare();
+		if (result) overflow = false;
+	}
+	else
+	{
+		StringList paths(changedDirs.cbegin(), changedDirs.cend());
+		std::sort(paths.begin(), paths.end());
+		result = manager.updateDirectories(renames, paths);
+	}
+	if (result)
+	{
+		changedDirs.clear();
+		renames.clear();
+		firstChangeTick = 0;
+	}
+	else
+	{
+		// A full refresh is running, try again later
+		firstChangeTick = lastChangeTick = tick;
+	}
+}
+
+int ShareWatcher::run() noexcept
+{
+	pollfd pfd[2];
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = wakeEvent.getHandle();
+	pfd[1].events = POLLIN;
+	while (!stopFlag)
+	{
+		bool update;
+		StringList paths;
+		{
+			LOCK(csNewDirs);
+			update = hasNewDirs;
+			hasNewDirs = false;
+			paths.swap(newDirs);
+		}
+		if (update)
+			applyNewDirs(paths);
+
+		int timeout = -1;
+		if (firstChangeTick)
+		{
+			const uint64_t tick = GET_TICK();
+			const uint64_t next = std::min<uint64_t>(lastChangeTick + QUIET_TIME, firstChangeTick + MAX_DELAY);
+			timeout = next > tick ? static_cast<int>(next - tick) : 0;
+		}
+		pfd[0].revents = pfd[1].revents = 0;
+		if (poll(pfd, 2, timeout) < 0 && errno != EINTR)
+			break;
+		if (pfd[1].revents & POLLIN)
+			wakeEvent.reset();
+		if (pfd[0].revents & POLLIN)
+			readEvents();
+		if (!stopFlag)
+			flushChanges(GET_TICK());
+	}
+	return 0;
+}
+
+#endif // FLYLINKDC_USE_SHARE_WATCHER
@@ -0,0 +1,79 @@
+#ifndef SHARE_WATCHER_H_
+#define SHARE_WATCHER_H_
+
+#ifdef FLYLINKDC_USE_SHARE_WATCHER
+
+#include "typedefs.h"
+#include "Thread.h"
+#include "Locks.h"
+#include "WaitableEvent.h"
+#include <boost/unordered/unordered_map.hpp>
+#include <boost/unordered/unordered_set.hpp>
+
+class ShareManager;
+
+/**
+ * Watches shared directories with inotify.
+ * Changes are collected until the directories stay quiet for a while,
+ * then the changed directories and renames are passed to ShareManager::updateDirectories.
+ * If the kernel queue overflows, a full refresh is requested instead.
+ */
+class ShareWatcher : public Thread
+{
+	public:
+		struct Rename
+		{
+			string from;
+			string to;
+			bool isDirectory;
+		};
+
+		explicit ShareWatcher(ShareManager& manager);
+		~ShareWatcher();
+
+		bool init() noexcept;
+		void stop() noexcept;
+
+		/** Replaces the set of watched directories. Paths end with a separator. */
+		void setDirectories(StringList& dirs) noexcept;
+
+	protected:
+		virtual int run() noexcept override;
+
+	private:
+		typedef std::map<string, int> DirMap;
+
+		ShareManager& manager;
+		int fd;
+		WaitableEvent wakeEvent;
+		std::atomic_bool stopFlag;
+
+		FastCriticalSection csNewDirs;
+		StringList newDirs;
+		bool hasNewDirs;
+
+		// Used only by the watcher thread
+		DirMap dirs;
+		boost::unordered_map<int, DirMap::iterator> watches;
+		boost::unordered_set<string> changedDirs;
+		vector<Rename> renames;
+		uint32_t moveCookie;
+		Rename moveFrom;
+		uint64_t firstChangeTick;
+		uint64_t lastChangeTick;
+		bool overflow;
+		bool limitReached;
+
+		bool addWatch(const string& path) noexcept;
+		void addTree(const string& path) noexcept;
+		void removeTree(const string& path) noexcept;
+		void moveTree(const string& from, const string& to) noexcept;
+		void applyNewDirs(StringList& paths) noexcept;
+		void readEvents() noexcept;
+		void addChange(const string& dir) noexcept;
+		void flushChanges(uint64_t tick) noexcept;
+};
+
+#endif // FLYLINKDC_USE_SHARE_WATCHER
+
+#endif // SHARE_WATCHER_H_
@@ -70,11 +70,7 @@ SharedDir* SharedDir::copyTree(const SharedDir* root)
 	newRoot->totalSize = root->totalSize;
 	newRoot->filesTypesMask = root->filesTypesMask;
 	newRoot->dirsTypesMask = root->dirsTypesMask;
-	for (auto i = root->files.cbegin(); i != root->files.cend(); i++)
-	{
-		const SharedFilePtr& file = i->second;
-		newRoot->files.insert(make_pair(file->getLowerName(), file));
-	}
+	newRoot->files = root->files;
 	for (auto i = newRoot->dirs.begin(); i != newRoot->dirs.end(); ++i)
 	{
 		SharedDir* dir = copyTree(i->second);
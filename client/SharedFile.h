@@ -36,11 +36,16 @@ class BaseDirItem
 		{
 			this->name = name;
 			Text::toLower(name, lowerName);
+			if (lowerName == name) string().swap(lowerName);
 		}
 };
 
 typedef std::shared_ptr<SharedFile> SharedFilePtr;
 
+// Files are keyed by their lower case name, without a separate copy of the key
+struct SharedFileHash;
+struct SharedFileEqual;
+
 class SharedFile: public BaseDirItem
 {
 		friend class ShareManager;
@@ -48,30 +53,31 @@ class SharedFile: public BaseDirItem
 	
 	public:		
 		SharedFile(const string& name, const TTHValue& root, int64_t size, uint64_t timestamp, uint64_t timeShared, uint16_t typesMask, unsigned hit) :
-			tth(root), size(size), timestamp(timestamp), timeShared(timeShared), typesMask(typesMask), hit(hit), flags(0)
+			size(size), timestamp(timestamp), timeShared(timeShared), tth(root), hit(hit), typesMask(typesMask), flags(0)
 		{
 			dcassert(name.find('\\') == string::npos);
 			setName(name);
 		}
 
 		SharedFile(const string& name, const string& lowerName, int64_t size, uint64_t timestamp, uint16_t typesMask) :
-			size(size), timestamp(timestamp), timeShared(0), typesMask(typesMask), hit(0), flags(0)
+			size(size), timestamp(timestamp), timeShared(0), hit(0), typesMask(typesMask), flags(0)
 		{
 			dcassert(name.find('\\') == string::npos);
 			this->name = name;
-			this->lowerName = lowerName;
+			if (lowerName != name) this->lowerName = lowerName;
 		}
 
-		typedef boost::unordered_map<string, SharedFilePtr> FileMap;
+		typedef boost::unordered_set<SharedFilePtr, SharedFileHash, SharedFileEqual> FileMap;
 	
 	private:
+		// Ordered by size to avoid padding
 		int64_t size;
-		const uint16_t typesMask;
-		TTHValue tth;
-		uint16_t flags;
 		uint64_t timestamp;
 		uint64_t timeShared;
+		TTHValue tth;
 		unsigned hit;
+		const uint16_t typesMask;
+		uint16_t flags;
 
 	public:
 		uint16_t getFileTypes() const { return typesMask; }
@@ -81,18 +87,41 @@ class SharedFile: public BaseDirItem
 		void incHit() { ++hit; }
 };
 
+struct SharedFileHash
+{
+	size_t operator()(const SharedFilePtr& file) const { return boost::hash<string>()(file->getLowerName()); }
+	size_t operator()(const string& lowerName) const { return boost::hash<string>()(lowerName); }
+};
+
+struct SharedFileEqual
+{
+	bool operator()(const SharedFilePtr& a, const SharedFilePtr& b) const { return a->getLowerName() == b->getLowerName(); }
+	bool operator()(const string& lowerName, const SharedFilePtr& file) const { return lowerName == file->getLowerName(); }
+};
+
 class SharedDir: public BaseDirItem
 {
 		friend class ShareManager;
 		friend class ShareLoader;
+		friend class ShareSearchIndex;
 	
 	public:
 		SharedDir(const string& name, SharedDir* parent): parent(parent), totalSize(0), filesTypesMask(0), dirsTypesMask(0), flags(0)
 		{
 			setName(name);
 		}
+		SharedDir(const string& name, const string& lowerName, SharedDir* parent): parent(parent), totalSize(0), filesTypesMask(0), dirsTypesMask(0), flags(0)
+		{
+			this->name = name;
+			if (lowerName != name) this->lowerName = lowerName;
+		}
 		typedef std::map<string, SharedDir*> DirectoryMap;
 
+		SharedFile::FileMap::const_iterator findFile(const string& lowerName) const
+		{
+			return files.find(lowerName, SharedFileHash(), SharedFileEqual());
+		}
+
 	private:
 		SharedDir* parent;
 		SharedFile::FileMap files;
@@ -27,6 +27,10 @@ static const int64_t MAX_MAPPED_FILE_SIZE = 2ll << 30;
 std::vector<bool> SharedFileStream::badDrives(26, false);
 #endif
 
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+static const int64_t WRITEBACK_BATCH_SIZE = 8 << 20;
+#endif
+
 CriticalSection SharedFileStream::csPool;
 std::map<std::string, unsigned > SharedFileStream::filesToDelete;
 SharedFileStream::SharedFileHandleMap SharedFileStream::readPool;
@@ -35,6 +39,10 @@ SharedFileStream::SharedFileHandleMap SharedFileStream::writePool;
 SharedFileHandle::SharedFileHandle(const string& path, int access, int mode) :
 	refCount(1), path(path), mode(mode), access(access), lastFileSize(0)
 {
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+	syncRequests = 0;
+	syncCompleted = 0;
+#endif
 }
 
 #ifdef _WIN32
@@ -117,6 +125,9 @@ SharedFileStream::SharedFileStream(const string& fileName, int access, int mode,
 	dcassert(!fileName.empty());
 
 	pos = 0;
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+	dirtyStart = dirtyEnd = unflushedStart = 0;
+#endif
 	LOCK(csPool);
 	if (access == File::READ)
 	{
@@ -251,6 +262,43 @@ SharedFileStream::~SharedFileStream()
 	}
 }
 
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+size_t SharedFileStream::write(const void* buf, size_t len)
+{
+	// Each segment has its own stream and position, no lock is needed
+	sfh->file.writeAt(buf, len, pos);
+	if (dirtyStart == dirtyEnd)
+		dirtyStart = unflushedStart = pos;
+	else if (pos != dirtyEnd)
+	{
+		// Not sequential: start a new range
+		sfh->file.syncRange(dirtyStart, dirtyEnd - dirtyStart, false);
+		dirtyStart = unflushedStart = pos;
+	}
+	pos += len;
+	dirtyEnd = pos;
+	if (dirtyEnd - unflushedStart >= WRITEBACK_BATCH_SIZE)
+	{
+		// Start writeback early instead of accumulating dirty pages until the segment is completed
+		sfh->file.syncRange(unflushedStart, dirtyEnd - unflushedStart, false);
+		unflushedStart = dirtyEnd;
+	}
+	int64_t fileSize = sfh->lastFileSize;
+	while (fileSize < pos)
+	{
+		dcassert(0);
+		if (sfh->lastFileSize.compare_exchange_weak(fileSize, pos)) break;
+	}
+	return len;
+}
+
+size_t SharedFileStream::read(void* buf, size_t& len)
+{
+	len = sfh->file.readAt(buf, len, pos);
+	pos += len;
+	return len;
+}
+#else
 size_t SharedFileStream::write(const void* buf, size_t len)
 {
 	LOCK(sfh->cs);
@@ -283,6 +331,7 @@ size_t SharedFileStream::read(void* buf, size_t& len)
 	pos += len;
 	return len;
 }
+#endif
 
 int64_t SharedFileStream::getFastFileSize()
 {
@@ -300,6 +349,25 @@ void SharedFileStream::setSize(int64_t newSize)
 
 size_t SharedFileStream::flushBuffers(bool aForce)
 {
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+	if (dirtyStart != dirtyEnd)
+	{
+		sfh->file.syncRange(dirtyStart, dirtyEnd - dirtyStart, aForce);
+		dirtyStart = dirtyEnd = unflushedStart = 0;
+	}
+	if (aForce && !ClientManager::isBeforeShutdown())
+	{
+		// Segments completed while another fdatasync was running are covered by the next one
+		uint64_t request = ++sfh->syncRequests;
+		LOCK(sfh->csSync);
+		if (sfh->syncCompleted < request)
+		{
+			uint64_t last = sfh->syncRequests;
+			sfh->file.syncData();
+			sfh->syncCompleted = last;
+		}
+	}
+#else
 	if (!ClientManager::isBeforeShutdown())
 	{
 		try
@@ -316,12 +384,15 @@ size_t SharedFileStream::flushBuffers(bool aForce)
 			dcassert(0);
 		}
 	}
+#endif
 	return 0;
 }
 
 void SharedFileStream::setPos(int64_t pos)
 {
+#ifndef FLYLINKDC_USE_POSITIONAL_IO
 	LOCK(sfh->cs);
+#endif
 	this->pos = pos;
 }
 
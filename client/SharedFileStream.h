@@ -37,7 +37,17 @@ struct SharedFileHandle
 		int refCount;
 		const int mode;
 		const int access;
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+		std::atomic<int64_t> lastFileSize;
+
+		// Forced flushes of all segments are merged into one fdatasync.
+		// Held while fdatasync runs, so it must not be a spin lock.
+		CriticalSection csSync;
+		std::atomic<uint64_t> syncRequests;
+		uint64_t syncCompleted;
+#else
 		int64_t lastFileSize;
+#endif
 #ifdef _WIN32
 		HANDLE mapping = INVALID_HANDLE_VALUE;
 		uint8_t* mappingPtr = nullptr;
@@ -83,6 +93,12 @@ class SharedFileStream : public IOStream
 	private:
 		std::shared_ptr<SharedFileHandle> sfh;
 		int64_t pos;
+#ifdef FLYLINKDC_USE_POSITIONAL_IO
+		// Range written since the last flush
+		int64_t dirtyStart;
+		int64_t dirtyEnd;
+		int64_t unflushedStart;
+#endif
 
 		static void cleanupL(SharedFileHandleMap& pool);
 };
@@ -9,6 +9,7 @@ typedef int socklen_t;
 typedef SOCKET socket_t;
 #define SE_EWOULDBLOCK WSAEWOULDBLOCK
 #define SE_EADDRINUSE  WSAEADDRINUSE
+#define SE_ENOBUFS     WSAENOBUFS
 
 #else
 
@@ -19,6 +20,7 @@ static const int INVALID_SOCKET = -1;
 #define SOCKET_ERROR -1
 #define SE_EWOULDBLOCK EWOULDBLOCK
 #define SE_EADDRINUSE  EADDRINUSE
+#define SE_ENOBUFS     ENOBUFS
 
 #endif
 
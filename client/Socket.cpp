@@ -31,6 +31,10 @@
 #define SHUT_RDWR SD_BOTH
 #endif
 
+#ifdef FLYLINKDC_USE_ZERO_COPY
+#include <sys/sendfile.h>
+#endif
+
 /// @todo remove when MinGW has this
 #ifdef __MINGW32__
 #ifndef EADDRNOTAVAIL
@@ -497,6 +501,28 @@ int Socket::write(const void* buffer, int len)
 	return sent;
 }
 
+#ifdef FLYLINKDC_USE_ZERO_COPY
+int Socket::sendFile(int fd, size_t len)
+{
+	dcassert(sock != INVALID_SOCKET);
+	dcassert(type == TYPE_TCP);
+	ssize_t sent;
+	do
+	{
+		sent = ::sendfile(sock, fd, nullptr, len);
+	}
+	while (sent < 0 && errno == EINTR);
+	if (sent < 0)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return -1;
+		throw SocketException(errno);
+	}
+	g_stats.tcp.uploaded += sent;
+	return static_cast<int>(sent);
+}
+#endif
+
 int Socket::sendPacket(const void* buffer, int bufLen, const IpAddress& ip, uint16_t port) noexcept
 {
 	dcassert(type == TYPE_UDP);
@@ -522,6 +548,113 @@ int Socket::receivePacket(void* buffer, int bufLen, IpAddress& ip, uint16_t& por
 	return res;
 }
 
+#ifdef FLYLINKDC_USE_MMSG
+int Socket::sendPackets(const OutPacket* packets, int count) noexcept
+{
+	dcassert(type == TYPE_UDP);
+	mmsghdr msg[MAX_BATCH_PACKETS];
+	iovec iov[MAX_BATCH_PACKETS];
+	sockaddr_u sockAddr[MAX_BATCH_PACKETS];
+	int processed = 0;
+	while (count > 0)
+	{
+		int batchSize = min(count, MAX_BATCH_PACKETS);
+		memset(msg, 0, sizeof(mmsghdr) * batchSize);
+		for (int i = 0; i < batchSize; ++i)
+		{
+			socklen_t sockLen;
+			toSockAddr(sockAddr[i], sockLen, packets[i].ip, packets[i].port);
+			iov[i].iov_base = const_cast<void*>(packets[i].data);
+			iov[i].iov_len = packets[i].len;
+			msg[i].msg_hdr.msg_name = &sockAddr[i];
+			msg[i].msg_hdr.msg_namelen = sockLen;
+			msg[i].msg_hdr.msg_iov = &iov[i];
+			msg[i].msg_hdr.msg_iovlen = 1;
+		}
+		int res = sendmmsg(sock, msg, batchSize, 0);
+		if (res < 0)
+		{
+			const int error = errno;
+			if (error == EINTR) continue;
+			if (error == EAGAIN || error == EWOULDBLOCK || error == ENOBUFS) break;
+			// Skip the packet that caused the error
+			res = 1;
+		}
+		else
+		{
+			for (int i = 0; i < res; ++i)
+				g_stats.udp.uploaded += msg[i].msg_len;
+		}
+		packets += res;
+		count -= res;
+		processed += res;
+	}
+	return processed;
+}
+
+int Socket::receivePackets(InPacket* packets, int count) noexcept
+{
+	dcassert(type == TYPE_UDP);
+	mmsghdr msg[MAX_BATCH_PACKETS];
+	iovec iov[MAX_BATCH_PACKETS];
+	sockaddr_u sockAddr[MAX_BATCH_PACKETS];
+	if (count > MAX_BATCH_PACKETS) count = MAX_BATCH_PACKETS;
+	memset(msg, 0, sizeof(mmsghdr) * count);
+	for (int i = 0; i < count; ++i)
+	{
+		iov[i].iov_base = packets[i].buffer;
+		iov[i].iov_len = packets[i].bufLen;
+		msg[i].msg_hdr.msg_name = &sockAddr[i];
+		msg[i].msg_hdr.msg_namelen = sizeof(sockAddr[i]);
+		msg[i].msg_hdr.msg_iov = &iov[i];
+		msg[i].msg_hdr.msg_iovlen = 1;
+	}
+	int res;
+	do
+	{
+		res = recvmmsg(sock, msg, count, MSG_DONTWAIT, nullptr);
+	}
+	while (res < 0 && errno == EINTR);
+	for (int i = 0; i < res; ++i)
+	{
+		packets[i].len = msg[i].msg_len;
+		g_stats.udp.downloaded += msg[i].msg_len;
+		fromSockAddr(packets[i].ip, packets[i].port, sockAddr[i]);
+	}
+	return res;
+}
+#else
+int Socket::sendPackets(const OutPacket* packets, int count) noexcept
+{
+	int processed = 0;
+	while (processed < count)
+	{
+		const OutPacket& p = packets[processed];
+		if (sendPacket(p.data, p.len, p.ip, p.port) < 0)
+		{
+			const int error = getLastError();
+			if (error == SE_EWOULDBLOCK || error == SE_ENOBUFS) break;
+		}
+		++processed;
+	}
+	return processed;
+}
+
+int Socket::receivePackets(InPacket* packets, int count) noexcept
+{
+	int received = 0;
+	while (received < count)
+	{
+		InPacket& p = packets[received];
+		p.len = receivePacket(p.buffer, p.bufLen, p.ip, p.port);
+		if (p.len < 0)
+			return received ? received : -1;
+		++received;
+	}
+	return received;
+}
+#endif
+
 /**
  * Blocks until timeout is reached one of the specified conditions have been fulfilled
  * @param millis Max milliseconds to block.
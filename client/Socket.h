@@ -106,11 +106,11 @@ class Socket
 			bool resolveNames;
 		};
 
-		Socket() : sock(INVALID_SOCKET), connected(false),
-			maxSpeed(0), currentBucket(0), bucketUpdateTick(0),
-			type(TYPE_TCP), port(0), proto(PROTO_DEFAULT)
+		Socket() : sock(INVALID_SOCKET), proto(PROTO_DEFAULT), type(TYPE_TCP), connected(false),
+			port(0), maxSpeed(0), currentBucket(0), bucketUpdateTick(0), throttleClass(0)
 		{
 			ip.type = 0;
+			memset(throttleState, 0, sizeof(throttleState));
 #ifdef _WIN32
 			currentMask = 0;
 			lastWaitResult = WAIT_WRITE;
@@ -129,6 +129,8 @@ class Socket
 			port = src.port;
 			maxSpeed = src.maxSpeed;
 			currentBucket = src.currentBucket;
+			throttleClass = src.throttleClass;
+			memcpy(throttleState, src.throttleState, sizeof(throttleState));
 			src.sock = INVALID_SOCKET;
 			return *this;
 		}
@@ -204,6 +206,39 @@ class Socket
 		}
 		int receivePacket(void* buffer, int bufLen, IpAddress& ip, uint16_t& port) noexcept;
 
+		struct OutPacket
+		{
+			const void* data;
+			int len;
+			IpAddress ip;
+			uint16_t port;
+		};
+
+		struct InPacket
+		{
+			void* buffer;
+			int bufLen;
+			int len;
+			IpAddress ip;
+			uint16_t port;
+		};
+
+		static const int MAX_BATCH_PACKETS = 64;
+
+		/**
+		 * Sends several datagrams, using a single system call where possible.
+		 * Packets rejected by the system (e.g. bad address) are skipped.
+		 * Stops when the send buffer is full.
+		 * @return Number of packets sent or skipped; the remaining ones should be sent again later.
+		 */
+		int sendPackets(const OutPacket* packets, int count) noexcept;
+
+		/**
+		 * Receives up to count datagrams from a non-blocking socket.
+		 * @return Number of packets received or -1 if the first read failed.
+		 */
+		int receivePackets(InPacket* packets, int count) noexcept;
+
 		virtual int wait(int millis, int waitFor);
 
 		static int resolveHost(Ip4Address* v4, Ip6AddressEx* v6, int af, const string& host, bool* isNumeric = nullptr) noexcept;		
@@ -282,9 +317,32 @@ class Socket
 
 		uint64_t getBucketUpdateTick() const { return bucketUpdateTick; }
 
+		void setThrottleClass(int throttleClass) { this->throttleClass = throttleClass; }
+		int getThrottleClass() const { return throttleClass; }
+
+		// Scheduling state used by ThrottleManager, one per direction
+		struct ThrottleState
+		{
+			uint64_t round;
+			int64_t deficit;
+		};
+		ThrottleState& getThrottleState(int dir) { return throttleState[dir]; }
+
 		static bool getProxyConfig(ProxyConfig& proxy);
+#ifdef FLYLINKDC_USE_ZERO_COPY
+		/**
+		 * Sends up to len bytes starting at the current offset of the file, bypassing user-space buffers.
+		 * Must not be used with secure sockets.
+		 * @return Number of bytes sent, 0 at the end of file and -1 if the call would block.
+		 * @throw SocketException Send failed.
+		 */
+		int sendFile(int fd, size_t len);
+#endif
 		void createControlEvent();
 		void signalControlEvent();
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+		int getControlEventHandle() const { return controlEvent.getHandle(); }
+#endif
 		void setConnected() { connected = true; }
 		void printSockName(string& s) const;
 
@@ -298,6 +356,7 @@ class Socket
 		int64_t maxSpeed;
 		int64_t currentBucket;
 		uint64_t bucketUpdateTick;
+		int throttleClass;
 #ifdef _WIN32
 		unsigned lastWaitResult;
 #endif
@@ -330,6 +389,8 @@ class Socket
 		}
 
 	private:
+		ThrottleState throttleState[2];
+
 		static socket_t checksocket(socket_t ret)
 		{
 			if (ret == INVALID_SOCKET)
@@ -0,0 +1,279 @@
+#include "stdinc.h"
+#include "SocketReactor.h"
+
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+
+#include "Socket.h"
+#include "SettingsManager.h"
+#include "TimerManager.h"
+#include <sys/epoll.h>
+#include <thread>
+
+static const int TIMER_INTERVAL = 250;
+static const int MAX_EVENTS = 64;
+static const unsigned MAX_THREADS = 64;
+
+SocketReactor::~SocketReactor()
+{
+	shutdown();
+}
+
+bool SocketReactor::startThreads() noexcept
+{
+	unsigned count = SETTING(SOCKET_REACTOR_THREADS);
+	if (!count)
+	{
+		count = std::thread::hardware_concurrency();
+		if (!count) count = 1;
+	}
+	if (count > MAX_THREADS) count = MAX_THREADS;
+	for (unsigned i = 0; i < count; ++i)
+	{
+		IoThread* t = new IoThread;
+		if (!t->init())
+		{
+			delete t;
+			break;
+		}
+		try
+		{
+			t->start(64, "SocketReactor");
+		}
+		catch (const ThreadException&)
+		{
+			delete t;
+			break;
+		}
+		threads.push_back(t);
+	}
+	return !threads.empty();
+}
+
+bool SocketReactor::addHandler(SocketReactorHandler* handler, int sockFd, int controlFd) noexcept
+{
+	LOCK(cs);
+	if (shutdownFlag) return false;
+	if (threads.empty() && !startThreads()) return false;
+	Entry* entry = new Entry;
+	entry->handler = handler;
+	entry->sockFd = sockFd;
+	entry->controlFd = controlFd;
+	entry->epollMask = 0;
+	entry->pending = true;
+	entry->sockSource.entry = entry;
+	entry->sockSource.control = false;
+	entry->controlSource.entry = entry;
+	entry->controlSource.control = true;
+	threads[nextThread++ % threads.size()]->addEntry(entry);
+	return true;
+}
+
+void SocketReactor::shutdown() noexcept
+{
+	vector<IoThread*> savedThreads;
+	{
+		LOCK(cs);
+		shutdownFlag = true;
+		savedThreads.swap(threads);
+	}
+	for (IoThread* t : savedThreads)
+		t->stop();
+	for (IoThread* t : savedThreads)
+	{
+		t->join();
+		delete t;
+	}
+}
+
+SocketReactor::IoThread::IoThread() : epollFd(-1), stopFlag(false)
+{
+}
+
+SocketReactor::IoThread::~IoThread()
+{
+	if (epollFd != -1) close(epollFd);
+}
+
+bool SocketReactor::IoThread::init() noexcept
+{
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1 || !wakeEvent.create()) return false;
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	return epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeEvent.getHandle(), &ev) == 0;
+}
+
+void SocketReactor::IoThread::addEntry(Entry* entry) noexcept
+{
+	bool notify;
+	{
+		LOCK(csNew);
+		notify = newEntries.empty();
+		newEntries.push_back(entry);
+	}
+	if (notify) wakeEvent.notify();
+}
+
+void SocketReactor::IoThread::stop() noexcept
+{
+	stopFlag = true;
+	wakeEvent.notify();
+}
+
+void SocketReactor::IoThread::registerEntry(Entry* entry) noexcept
+{
+	epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = &entry->controlSource;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, entry->controlFd, &ev) ||
+	    (ev.events = 0, ev.data.ptr = &entry->sockSource, epoll_ctl(epollFd, EPOLL_CTL_ADD, entry->sockFd, &ev)))
+	{
+		dcassert(0);
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->controlFd, nullptr);
+		entry->handler->onReactorDetached();
+		delete entry;
+		return;
+	}
+	entries.push_back(entry);
+}
+
+void SocketReactor::IoThread::updateMask(Entry* entry) noexcept
+{
+	int waitMask = entry->handler->getReactorWaitMask();
+	uint32_t mask = 0;
+	if (waitMask & Socket::WAIT_READ) mask |= EPOLLIN;
+	if (waitMask & Socket::WAIT_WRITE) mask |= EPOLLOUT;
+	if (mask == entry->epollMask) return;
+	epoll_event ev;
+	ev.events = mask;
+	ev.data.ptr = &entry->sockSource;
+	if (epoll_ctl(epollFd, EPOLL_CTL_MOD, entry->sockFd, &ev) == 0)
+		entry->epollMask = mask;
+}
+
+void SocketReactor::IoThread::removeEntry(Entry* entry) noexcept
+{
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->sockFd, nullptr);
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, entry->controlFd, nullptr);
+	auto i = std::find(entries.begin(), entries.end(), entry);
+	if (i != entries.end())
+	{
+		*i = entries.back();
+		entries.pop_back();
+	}
+	SocketReactorHandler* handler = entry->handler;
+	entry->handler = nullptr;
+	handler->onReactorDetached();
+}
+
+bool SocketReactor::IoThread::processEntry(Entry* entry, int events) noexcept
+{
+	int result = entry->handler->onReactorEvent(events);
+	if (result == SocketReactorHandler::RESULT_DONE)
+	{
+		removeEntry(entry);
+		return false;
+	}
+	entry->pending = result == SocketReactorHandler::RESULT_AGAIN;
+	updateMask(entry);
+	return true;
+}
+
+int SocketReactor::IoThread::run() noexcept
+{
+	epoll_event events[MAX_EVENTS];
+	vector<Entry*> removed;
+	vector<Entry*> pending;
+	uint64_t nextTick = GET_TICK() + TIMER_INTERVAL;
+	while (!stopFlag)
+	{
+		{
+			LOCK(csNew);
+			pending.swap(newEntries);
+		}
+		for (Entry* entry : pending)
+			registerEntry(entry);
+		pending.clear();
+
+		bool hasPending = false;
+		for (const Entry* entry : entries)
+			if (entry->pending)
+			{
+				hasPending = true;
+				break;
+			}
+
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, hasPending ? 0 : TIMER_INTERVAL);
+		if (count < 0)
+		{
+			if (errno != EINTR)
+			{
+				dcassert(0);
+				Thread::sleep(TIMER_INTERVAL);
+			}
+			count = 0;
+		}
+		for (int i = 0; i < count; ++i)
+		{
+			const Source* source = static_cast<const Source*>(events[i].data.ptr);
+			if (!source)
+			{
+				wakeEvent.reset();
+				continue;
+			}
+			Entry* entry = source->entry;
+			if (!entry->handler) continue;
+			int flags;
+			if (source->control)
+			{
+				uint64_t val;
+				while (read(entry->controlFd, &val, sizeof(val)) > 0) {}
+				flags = Socket::WAIT_CONTROL;
+			}
+			else
+			{
+				flags = 0;
+				if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) flags |= Socket::WAIT_READ;
+				if (events[i].events & EPOLLOUT) flags |= Socket::WAIT_WRITE;
+			}
+			entry->pending = false;
+			if (!processEntry(entry, flags))
+				removed.push_back(entry);
+		}
+
+		uint64_t tick = GET_TICK();
+		bool timer = tick >= nextTick;
+		if (timer) nextTick = tick + TIMER_INTERVAL;
+		pending = entries;
+		for (Entry* entry : pending)
+			if (entry->handler && (entry->pending || timer) && !processEntry(entry, 0))
+				removed.push_back(entry);
+		pending.clear();
+
+		// Entries are deleted only after the whole batch is handled because
+		// epoll may still return events referencing them in the same batch
+		for (Entry* entry : removed)
+			delete entry;
+		removed.clear();
+	}
+
+	{
+		LOCK(csNew);
+		pending.swap(newEntries);
+	}
+	for (Entry* entry : pending)
+	{
+		entry->handler->onReactorDetached();
+		delete entry;
+	}
+	while (!entries.empty())
+	{
+		Entry* entry = entries.back();
+		removeEntry(entry);
+		delete entry;
+	}
+	return 0;
+}
+
+#endif // FLYLINKDC_USE_SOCKET_REACTOR
@@ -0,0 +1,115 @@
+#ifndef SOCKET_REACTOR_H_
+#define SOCKET_REACTOR_H_
+
+#ifdef FLYLINKDC_USE_SOCKET_REACTOR
+
+#include "Thread.h"
+#include "Locks.h"
+#include "Singleton.h"
+#include "WaitableEvent.h"
+
+class SocketReactorHandler
+{
+	public:
+		enum
+		{
+			RESULT_WAIT,  // wait for the events returned by getReactorWaitMask
+			RESULT_AGAIN, // more work is pending, call again without waiting
+			RESULT_DONE   // the handler must be detached
+		};
+
+		virtual ~SocketReactorHandler() {}
+
+		/**
+		 * Called on the I/O thread the handler is bound to.
+		 * @param events Socket::WAIT_READ, WAIT_WRITE and WAIT_CONTROL flags that became ready, 0 on timer.
+		 */
+		virtual int onReactorEvent(int events) noexcept = 0;
+
+		/** @return Socket::WAIT_READ and/or WAIT_WRITE flags the handler is waiting for */
+		virtual int getReactorWaitMask() const noexcept = 0;
+
+		/** Called once after the handler has been removed from the reactor; the handler is not touched afterwards. */
+		virtual void onReactorDetached() noexcept = 0;
+};
+
+/**
+ * Multiplexes connected sockets over a small fixed pool of epoll threads.
+ * Each handler is bound to one I/O thread for its whole lifetime,
+ * so callbacks for a given handler are never run concurrently.
+ */
+class SocketReactor : public Singleton<SocketReactor>
+{
+	public:
+		bool addHandler(SocketReactorHandler* handler, int sockFd, int controlFd) noexcept;
+		void shutdown() noexcept;
+
+		size_t getThreadCount() const noexcept
+		{
+			LOCK(cs);
+			return threads.size();
+		}
+
+	private:
+		friend class Singleton<SocketReactor>;
+
+		SocketReactor() : nextThread(0), shutdownFlag(false) {}
+		~SocketReactor();
+
+		struct Entry;
+
+		struct Source
+		{
+			Entry* entry;
+			bool control;
+		};
+
+		struct Entry
+		{
+			SocketReactorHandler* handler;
+			int sockFd;
+			int controlFd;
+			uint32_t epollMask;
+			bool pending;
+			Source sockSource;
+			Source controlSource;
+		};
+
+		class IoThread : public Thread
+		{
+			public:
+				IoThread();
+				~IoThread();
+
+				bool init() noexcept;
+				void addEntry(Entry* entry) noexcept;
+				void stop() noexcept;
+
+			protected:
+				virtual int run() noexcept override;
+
+			private:
+				int epollFd;
+				WaitableEvent wakeEvent;
+				FastCriticalSection csNew;
+				vector<Entry*> newEntries;
+				vector<Entry*> entries;
+				std::atomic_bool stopFlag;
+
+				void registerEntry(Entry* entry) noexcept;
+				bool processEntry(Entry* entry, int events) noexcept;
+				void updateMask(Entry* entry) noexcept;
+				void removeEntry(Entry* entry) noexcept;
+		};
+
+		bool startThreads() noexcept;
+
+		mutable CriticalSection cs;
+		vector<IoThread*> threads;
+		unsigned nextThread;
+		bool shutdownFlag;
+};
+
+#endif // FLYLINKDC_USE_SOCKET_REACTOR
+
+#endif // SOCKET_REACTOR_H_
@@ -94,6 +94,17 @@ class InputStream
 		virtual int64_t getInputSize() const { return -1; }
 		virtual int64_t getTotalRead() const { return -1; }
 
+#ifdef FLYLINKDC_USE_ZERO_COPY
+		/**
+		 * Used to send the data directly from the page cache.
+		 * @param maxBytes Receives the number of bytes left or -1 if the stream ends at the end of file.
+		 * @return File descriptor positioned at the current stream offset, -1 if the stream is not a plain file.
+		 */
+		virtual int getFileDescriptor(int64_t& /*maxBytes*/) { return -1; }
+		/* Called after len bytes were sent from the file descriptor returned by getFileDescriptor */
+		virtual void skipSent(size_t /*len*/) { }
+#endif
+
 		InputStream(const InputStream &) = delete;
 		InputStream& operator= (const InputStream &) = delete;
 };
@@ -219,6 +230,23 @@ class LimitedInputStream : public InputStream
 		{
 			s->closeStream();
 		}
+
+#ifdef FLYLINKDC_USE_ZERO_COPY
+		int getFileDescriptor(int64_t& bytesLeft) override
+		{
+			int64_t streamBytesLeft;
+			int fd = s->getFileDescriptor(streamBytesLeft);
+			if (fd == -1) return -1;
+			bytesLeft = streamBytesLeft == -1 ? maxBytes : min(maxBytes, streamBytesLeft);
+			return fd;
+		}
+
+		void skipSent(size_t len) override
+		{
+			maxBytes -= len;
+			s->skipSent(len);
+		}
+#endif
 		
 	private:
 		InputStream* const s;
@@ -342,7 +370,7 @@ class StringOutputStream : public OutputStream
 		explicit StringOutputStream(string& out) : str(out) { }
 		using OutputStream::write;
 		
-		size_t flushBuffers(bool force) override
+		size_t flushBuffers(bool /*force*/) override
 		{
 			return 0;
 		}
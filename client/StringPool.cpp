@@ -0,0 +1,56 @@
+#include "stdinc.h"
+#include "StringPool.h"
+
+StringPool::Shard StringPool::shards[StringPool::SHARD_COUNT];
+
+InternedString::InternedString(const char* s, size_t len) : entry(len ? StringPool::intern(s, len) : nullptr)
+{
+}
+
+void InternedString::release(Entry* entry) noexcept
+{
+	// Only the last reference is dropped under the lock: intern() may find the entry concurrently
+	unsigned refs = entry->refs;
+	while (refs > 1)
+		if (entry->refs.compare_exchange_weak(refs, refs - 1))
+			return;
+	StringPool::Shard& shard = StringPool::getShard(entry->hash);
+	shard.cs.lock();
+	if (--entry->refs)
+	{
+		shard.cs.unlock();
+		return;
+	}
+	shard.strings.erase(entry);
+	shard.cs.unlock();
+	delete entry;
+}
+
+InternedString::Entry* StringPool::intern(const char* s, size_t len) noexcept
+{
+	const size_t hash = boost::hash_range(s, s + len);
+	Shard& shard = getShard(hash);
+	LOCK(shard.cs);
+	auto i = shard.strings.find(hash, [](size_t hash) { return hash; },
+		[s, len](size_t, const InternedString::Entry* e) { return e->value.compare(0, string::npos, s, len) == 0; });
+	if (i != shard.strings.end())
+	{
+		++(*i)->refs;
+		return *i;
+	}
+	auto entry = new InternedString::Entry(s, len, hash);
+	shard.strings.insert(entry);
+	return entry;
+}
+
+void StringPool::getStats(Stats& stats) noexcept
+{
+	stats.strings = stats.bytes = 0;
+	for (Shard& shard : shards)
+	{
+		LOCK(shard.cs);
+		stats.strings += shard.strings.size();
+		for (const auto* entry : shard.strings)
+			stats.bytes += entry->value.length();
+	}
+}
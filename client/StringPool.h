@@ -0,0 +1,107 @@
+#ifndef STRING_POOL_H_
+#define STRING_POOL_H_
+
+#include "BaseUtil.h"
+#include "Locks.h"
+#include <boost/unordered/unordered_set.hpp>
+
+/**
+ * Immutable string shared by all holders of an equal value.
+ * Used for user attributes repeated across many users (client tags, descriptions, e-mails).
+ * An empty InternedString does not allocate anything.
+ */
+class InternedString
+{
+	public:
+		InternedString() : entry(nullptr) {}
+		explicit InternedString(const string& s) : InternedString(s.data(), s.length()) {}
+		InternedString(const char* s, size_t len);
+		InternedString(const InternedString& src) : entry(src.entry)
+		{
+			if (entry) ++entry->refs;
+		}
+		InternedString(InternedString&& src) noexcept : entry(src.entry)
+		{
+			src.entry = nullptr;
+		}
+		~InternedString()
+		{
+			if (entry) release(entry);
+		}
+
+		InternedString& operator= (const InternedString& src)
+		{
+			if (entry != src.entry)
+			{
+				if (src.entry) ++src.entry->refs;
+				if (entry) release(entry);
+				entry = src.entry;
+			}
+			return *this;
+		}
+		InternedString& operator= (InternedString&& src) noexcept
+		{
+			std::swap(entry, src.entry);
+			return *this;
+		}
+
+		const string& get() const { return entry ? entry->value : Util::emptyString; }
+		bool empty() const { return entry == nullptr; }
+		bool operator== (const string& s) const { return get() == s; }
+		bool operator!= (const string& s) const { return get() != s; }
+
+	private:
+		friend class StringPool;
+
+		struct Entry
+		{
+			std::atomic<unsigned> refs;
+			const size_t hash;
+			const string value;
+
+			Entry(const char* value, size_t len, size_t hash) : refs(1), hash(hash), value(value, len) {}
+		};
+
+		Entry* entry;
+
+		static void release(Entry* entry) noexcept;
+};
+
+class StringPool
+{
+	public:
+		struct Stats
+		{
+			size_t strings;
+			size_t bytes;
+		};
+
+		static void getStats(Stats& stats) noexcept;
+
+	private:
+		friend class InternedString;
+
+		struct EntryHash
+		{
+			size_t operator()(const InternedString::Entry* e) const { return e->hash; }
+		};
+
+		struct EntryEq
+		{
+			bool operator()(const InternedString::Entry* a, const InternedString::Entry* b) const { return a->value == b->value; }
+		};
+
+		struct Shard
+		{
+			FastCriticalSection cs;
+			boost::unordered_set<InternedString::Entry*, EntryHash, EntryEq> strings;
+		};
+
+		static const size_t SHARD_COUNT = 64;
+		static Shard shards[SHARD_COUNT];
+
+		static Shard& getShard(size_t hash) { return shards[(hash >> 8) % SHARD_COUNT]; }
+		static InternedString::Entry* intern(const char* s, size_t len) noexcept;
+};
+
+#endif // STRING_POOL_H_
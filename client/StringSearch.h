@@ -28,7 +28,7 @@
  * one pattern against many strings (currently Quick Search, a variant of
  * Boyer-Moore. Code based on "A very fast substring search algorithm" by
  * D. Sunday).
- * @todo Perhaps find an algo suitable for matching multiple substrings.
+ * Use MultiStringSearch to match multiple substrings.
  */
 class StringSearch
 {
@@ -18,26 +18,131 @@
 
 #include "stdinc.h"
 #include "ThrottleManager.h"
+#include "ClientManager.h"
 
-#include "DownloadManager.h"
+static const unsigned ROUND_TIME = 250;
+static const unsigned MAX_ROUNDS = 2; // maximum amount of tokens, in rounds
+static const int64_t MIN_QUANTUM = 1024;
 
-#include "UploadManager.h"
-
-#include <boost/date_time/posix_time/posix_time.hpp>
-
-#define CONDWAIT_TIMEOUT        250
+static const unsigned classWeight[ThrottleManager::CLASS_COUNT] =
+{
+	2, // CLASS_NORMAL
+	4, // CLASS_FAVORITE
+	1, // CLASS_MINI_SLOT
+	2  // CLASS_FILE_LIST
+};
 
-ThrottleManager::ThrottleManager() : downTokens(0), upTokens(0), downLimit(0), upLimit(0)
+ThrottleManager::ThrottleManager()
 {
+	for (Limiter& l : limiters)
+	{
+		l.limit = 0;
+		l.tokens = 0;
+		l.lastRefill = 0;
+		l.round = 0;
+		l.reserved = 0;
+		memset(l.weight, 0, sizeof(l.weight));
+		memset(l.connections, 0, sizeof(l.connections));
+		for (int i = 0; i < CLASS_COUNT; ++i)
+		{
+			l.bytes[i] = 0;
+			l.prevBytes[i] = 0;
+			l.speed[i] = 0;
+		}
+	}
 }
 
 ThrottleManager::~ThrottleManager()
 {
 	TimerManager::getInstance()->removeListener(this);
-	
-	// release conditional variables on exit
-	downCond.notify_all();
-	upCond.notify_all();
+}
+
+static inline int getThrottleClass(const Socket* sock)
+{
+	int cls = sock->getThrottleClass();
+	return cls >= 0 && cls < ThrottleManager::CLASS_COUNT ? cls : ThrottleManager::CLASS_NORMAL;
+}
+
+/*
+ * Returns the number of bytes the socket may transfer now
+ */
+size_t ThrottleManager::getTokens(int dir, Socket* sock, size_t len)
+{
+	Limiter& l = limiters[dir];
+	const int64_t limit = l.limit;
+	const int64_t budget = limit * ROUND_TIME / 1000;
+	const int cls = getThrottleClass(sock);
+	const uint64_t tick = GET_TICK();
+	const uint64_t round = tick / ROUND_TIME;
+	LOCK(l.cs);
+	if (tick > l.lastRefill)
+	{
+		l.tokens = std::min<int64_t>(l.tokens + limit * int64_t(tick - l.lastRefill) / 1000, budget * MAX_ROUNDS);
+		l.lastRefill = tick;
+	}
+	if (round != l.round)
+	{
+		// Deficits of the previous round expire
+		if (round == l.round + 1)
+		{
+			l.weight[1] = l.weight[0];
+			memcpy(l.connections[1], l.connections[0], sizeof(l.connections[1]));
+		}
+		else
+		{
+			l.weight[1] = 0;
+			memset(l.connections[1], 0, sizeof(l.connections[1]));
+		}
+		l.weight[0] = 0;
+		memset(l.connections[0], 0, sizeof(l.connections[0]));
+		l.reserved = 0;
+		l.round = round;
+	}
+	Socket::ThrottleState& ts = sock->getThrottleState(dir);
+	if (ts.round != round)
+	{
+		// First request of this connection in the round
+		l.weight[0] += classWeight[cls];
+		l.connections[0][cls]++;
+		const unsigned totalWeight = std::max(l.weight[0], l.weight[1]);
+		int64_t quantum = budget * classWeight[cls] / totalWeight;
+		if (quantum < MIN_QUANTUM) quantum = MIN_QUANTUM;
+		ts.round = round;
+		ts.deficit = quantum;
+		l.reserved += quantum;
+	}
+	if (l.tokens <= 0) return 0;
+
+	// Tokens expected to be claimed by the connections of the previous round which are not seen yet
+	int64_t expected = 0;
+	if (l.weight[1] > l.weight[0])
+		expected = budget * (l.weight[1] - l.weight[0]) / l.weight[1];
+	int64_t spare = l.tokens - l.reserved - expected;
+	if (spare < 0) spare = 0;
+	int64_t result = std::min<int64_t>(len, std::min(ts.deficit + spare, l.tokens));
+	int64_t fromDeficit = std::min(result, ts.deficit);
+	ts.deficit -= fromDeficit;
+	l.reserved -= fromDeficit;
+	l.tokens -= result;
+	return static_cast<size_t>(result);
+}
+
+void ThrottleManager::returnTokens(int dir, size_t len)
+{
+	Limiter& l = limiters[dir];
+	LOCK(l.cs);
+	l.tokens += len;
+}
+
+void ThrottleManager::addBytes(int dir, const Socket* sock, int bytes)
+{
+	if (bytes > 0)
+		limiters[dir].bytes[getThrottleClass(sock)] += bytes;
+}
+
+unsigned ThrottleManager::getRetryDelay() const
+{
+	return ROUND_TIME - GET_TICK() % ROUND_TIME;
 }
 
 /*
@@ -45,34 +150,21 @@ ThrottleManager::~ThrottleManager()
  */
 int ThrottleManager::read(Socket* sock, void* buffer, size_t len)
 {
-	const size_t downs = downLimit ? DownloadManager::getDownloadCount() : 0;
-	if (downLimit == 0 || downs == 0)
-		return sock->read(buffer, len);
-		
-	boost::unique_lock<boost::mutex> lock(downMutex);
-	
-	if (downTokens > 0)
+	if (limiters[DIR_DOWNLOAD].limit == 0)
 	{
-		const size_t slice = getDownloadLimitInBytes() / downs;
-		size_t readSize = min(slice, min(len, downTokens));
-		
-		// read from socket
-		readSize = sock->read(buffer, readSize);
-		
-		if (readSize > 0)
-			downTokens -= readSize;
-			
-		// next code can't be in critical section, so we must unlock here
-		lock.unlock();
-		
-		// give a chance to other transfers to get a token
-		Thread::yield();
-		return readSize;
+		const int received = sock->read(buffer, len);
+		addBytes(DIR_DOWNLOAD, sock, received);
+		return received;
 	}
-	
-	// no tokens, wait for them
-	downCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-	return -1;  // from BufferedSocket: -1 = retry, 0 = connection close
+
+	const size_t readSize = getTokens(DIR_DOWNLOAD, sock, len);
+	if (!readSize)
+		return THROTTLED;
+	const int received = sock->read(buffer, readSize);
+	if (received < (int) readSize)
+		returnTokens(DIR_DOWNLOAD, readSize - std::max(received, 0));
+	addBytes(DIR_DOWNLOAD, sock, received);
+	return received;
 }
 
 /*
@@ -86,6 +178,7 @@ int ThrottleManager::write(Socket* sock, const void* buffer, size_t& len)
 	{
 		// write to socket
 		const int sent = sock->write(buffer, len);
+		addBytes(DIR_UPLOAD, sock, sent);
 		return sent;
 	}
 	else if (currentMaxSpeed > 0) // individual
@@ -93,52 +186,57 @@ int ThrottleManager::write(Socket* sock, const void* buffer, size_t& len)
 		// Apply individual restriction to the user if it is
 		const int64_t currentBucket = sock->getCurrentBucket();
 		len = min(len, static_cast<size_t>(currentBucket));
-		sock->setCurrentBucket(currentBucket - len);
-		
 		if (!len)
-		{
-			uint64_t delay = GET_TICK() - sock->getBucketUpdateTick();
-			if (delay > CONDWAIT_TIMEOUT) delay = CONDWAIT_TIMEOUT;
-			Thread::sleep(static_cast<unsigned>(delay));
-			return 0;
-		}
+			return THROTTLED;
+		sock->setCurrentBucket(currentBucket - len);
 
 		// write to socket
 		const int sent = sock->write(buffer, len);
+		addBytes(DIR_UPLOAD, sock, sent);
 		return sent;
 	}
 	else // general
 	{
-		if (!upLimit)
-			return sock->write(buffer, len);
-		const size_t ups = UploadManager::getInstance()->getUploadCount();
-		if (!ups)
-			return sock->write(buffer, len);
-		
-		boost::unique_lock<boost::mutex> lock(upMutex);
-		if (upTokens > 0)
+		if (limiters[DIR_UPLOAD].limit == 0)
 		{
-			const size_t slice = getUploadLimitInBytes() / ups;
-			len = min(slice, min(len, upTokens));
-			
-			// Pour buckets of the calculated number of bytes,
-			// but as a real restriction on the specified number of bytes
-			upTokens -= len;
-			
-			// next code can't be in critical section, so we must unlock here
-			lock.unlock();
-			
-			// write to socket
 			const int sent = sock->write(buffer, len);
-			
-			// give a chance to other transfers to get a token
-			Thread::yield();
+			addBytes(DIR_UPLOAD, sock, sent);
 			return sent;
 		}
-		
-		// no tokens, wait for them
-		upCond.timed_wait(lock, boost::posix_time::millisec(CONDWAIT_TIMEOUT));
-		return 0;   // from BufferedSocket: -1 = failed, 0 = retry
+
+		const size_t writeSize = getTokens(DIR_UPLOAD, sock, len);
+		if (!writeSize)
+			return THROTTLED;
+		len = writeSize;
+		const int sent = sock->write(buffer, len);
+		if (sent < (int) len)
+			returnTokens(DIR_UPLOAD, len - std::max(sent, 0));
+		addBytes(DIR_UPLOAD, sock, sent);
+		return sent;
+	}
+}
+
+void ThrottleManager::getStats(int dir, ClassStats stats[CLASS_COUNT]) const
+{
+	const Limiter& l = limiters[dir];
+	LOCK(l.cs);
+	for (int i = 0; i < CLASS_COUNT; ++i)
+	{
+		stats[i].bytes = l.bytes[i];
+		stats[i].speed = l.speed[i];
+		stats[i].connections = l.connections[1][i];
+	}
+}
+
+void ThrottleManager::updateStats(int dir)
+{
+	Limiter& l = limiters[dir];
+	LOCK(l.cs);
+	for (int i = 0; i < CLASS_COUNT; ++i)
+	{
+		const int64_t bytes = l.bytes[i];
+		l.speed[i] = bytes - l.prevBytes[i];
+		l.prevBytes[i] = bytes;
 	}
 }
 
@@ -147,25 +245,12 @@ void ThrottleManager::on(TimerManagerListener::Second, uint64_t /*aTick*/) noexc
 {
 	if (ClientManager::isBeforeShutdown())
 		return;
+	updateStats(DIR_DOWNLOAD);
+	updateStats(DIR_UPLOAD);
 	if (!BOOLSETTING(THROTTLE_ENABLE))
 	{
-		downLimit = 0;
-		upLimit = 0;
-		return;
-	}
-	// readd tokens
-	if (downLimit > 0)
-	{
-		boost::lock_guard<boost::mutex> lock(downMutex);
-		downTokens = downLimit;
-		downCond.notify_all();
-	}
-	
-	if (upLimit > 0)
-	{
-		boost::lock_guard<boost::mutex> lock(upMutex);
-		upTokens = upLimit;
-		upCond.notify_all();
+		setDownloadLimit(0);
+		setUploadLimit(0);
 	}
 }
 
@@ -195,8 +280,8 @@ void ThrottleManager::updateLimits()
 {
 	if (!BOOLSETTING(THROTTLE_ENABLE))
 	{
-		downLimit = 0;
-		upLimit = 0;
+		setDownloadLimit(0);
+		setUploadLimit(0);
 		return;
 	}
 
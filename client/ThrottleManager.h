@@ -22,17 +22,45 @@
 #include "Socket.h"
 #include "TimerManager.h"
 #include "SettingsManager.h"
-#include <boost/thread/condition_variable.hpp>
+#include "Locks.h"
 
 /**
  * Manager for throttling traffic flow speed.
+ * Tokens are added continuously and distributed between active connections
+ * by deficit round robin: in each round a connection may take a quantum
+ * proportional to the weight of its class. Tokens not claimed by the
+ * connections active in the round can be used by any of them.
  * Inspired by Token Bucket algorithm: http://en.wikipedia.org/wiki/Token_bucket
  */
 class ThrottleManager :
 	public Singleton<ThrottleManager>, private TimerManagerListener
 {
 	public:
-	
+		enum
+		{
+			CLASS_NORMAL,
+			CLASS_FAVORITE,
+			CLASS_MINI_SLOT,
+			CLASS_FILE_LIST,
+			CLASS_COUNT
+		};
+
+		enum
+		{
+			DIR_DOWNLOAD,
+			DIR_UPLOAD
+		};
+
+		// Returned by read and write when the socket has to wait for tokens
+		static const int THROTTLED = -2;
+
+		struct ClassStats
+		{
+			int64_t bytes; // total
+			int64_t speed; // bytes per second
+			unsigned connections; // active during the last round
+		};
+
 		/*
 		 * Limits a traffic and reads a packet from the network
 		 */
@@ -43,35 +71,51 @@ class ThrottleManager :
 		 * We must handle this a little bit differently than downloads, because of that stupidity in OpenSSL
 		 */
 		int write(Socket* sock, const void* buffer, size_t& len);
+
+		/*
+		 * Returns the time in milliseconds after which a throttled socket should try again
+		 */
+		unsigned getRetryDelay() const;
+
+		void getStats(int dir, ClassStats stats[CLASS_COUNT]) const;
+
+		/*
+		 * Returns true if writes to the socket are not limited and may bypass write()
+		 */
+		bool isWriteUnlimited(const Socket* sock) const
+		{
+			const auto currentMaxSpeed = sock->getMaxSpeed();
+			return currentMaxSpeed < 0 || (currentMaxSpeed == 0 && limiters[DIR_UPLOAD].limit == 0);
+		}
 		
 		size_t getDownloadLimitInKBytes() const
 		{
-			return downLimit / 1024;
+			return limiters[DIR_DOWNLOAD].limit / 1024;
 		}
 		
 		size_t getDownloadLimitInBytes() const
 		{
-			return downLimit;
+			return limiters[DIR_DOWNLOAD].limit;
 		}
 		
 		void setDownloadLimit(size_t limitKb)
 		{
-			downLimit = limitKb * 1024;
+			limiters[DIR_DOWNLOAD].limit = limitKb * 1024;
 		}
 		
 		size_t getUploadLimitInKBytes() const
 		{
-			return upLimit / 1024;
+			return limiters[DIR_UPLOAD].limit / 1024;
 		}
 		
 		size_t getUploadLimitInBytes() const
 		{
-			return upLimit;
+			return limiters[DIR_UPLOAD].limit;
 		}
 		
 		void setUploadLimit(size_t limitKb)
 		{
-			upLimit = limitKb * 1024;
+			limiters[DIR_UPLOAD].limit = limitKb * 1024;
 		}
 		
 		void updateLimits();
@@ -83,22 +127,32 @@ class ThrottleManager :
 		}
 
 	private:
-		// download limiter
-		size_t downLimit;
-		size_t downTokens;
-		boost::condition_variable downCond;
-		boost::mutex downMutex;
-		
-		// upload limiter
-		size_t upLimit;
-		size_t upTokens;
-		boost::condition_variable upCond;
-		boost::mutex upMutex;
+		struct Limiter
+		{
+			std::atomic<size_t> limit;
+			int64_t tokens;
+			uint64_t lastRefill;
+			uint64_t round;
+			int64_t reserved; // sum of the remaining deficits of connections in this round
+			unsigned weight[2]; // total weight of active connections in the current and previous round
+			unsigned connections[2][CLASS_COUNT];
+			std::atomic<int64_t> bytes[CLASS_COUNT];
+			int64_t prevBytes[CLASS_COUNT];
+			int64_t speed[CLASS_COUNT];
+			mutable FastCriticalSection cs;
+		};
+
+		Limiter limiters[2];
 		
 		friend class Singleton<ThrottleManager>;
 		
 		ThrottleManager();
 		~ThrottleManager();
+
+		size_t getTokens(int dir, Socket* sock, size_t len);
+		void returnTokens(int dir, size_t len);
+		void addBytes(int dir, const Socket* sock, int bytes);
+		void updateStats(int dir);
 		
 		// TimerManagerListener
 		void on(TimerManagerListener::Minute, uint64_t aTick) noexcept override;
@@ -258,6 +258,266 @@ uint8_t* TigerHash::finalize()
 	return getResult();
 }
 
+#if !defined(TIGER_BIG_ENDIAN) && (defined(_M_X64) || defined(__x86_64__))
+#define TIGER_SIMD
+#endif
+
+#ifdef TIGER_SIMD
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TIGER_TARGET_AVX2
+#define TIGER_TARGET_AVX512
+#else
+#define TIGER_TARGET_AVX2 __attribute__((target("avx2")))
+#define TIGER_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+#include <immintrin.h>
+
+/*
+ * The compress function working on several independent messages at once.
+ * Each vector lane holds one message; S-box lookups are done with gathers.
+ * V_* macros are defined by the instruction set specific functions below.
+ */
+#define simd_sbox(n, c, shift) \
+	V_GATHER(table + 256 * (n), V_AND(V_SHR(c, (shift) * 8), byteMask))
+
+#define simd_mul_5(b) V_ADD(V_SHL(b, 2), b)
+#define simd_mul_7(b) V_SUB(V_SHL(b, 3), b)
+#define simd_mul_9(b) V_ADD(V_SHL(b, 3), b)
+
+#define simd_round(a,b,c,x,mul) \
+	c = V_XOR(c, x); \
+	a = V_SUB(a, V_XOR(V_XOR(simd_sbox(0, c, 0), simd_sbox(1, c, 2)), \
+	                   V_XOR(simd_sbox(2, c, 4), simd_sbox(3, c, 6)))); \
+	b = V_ADD(b, V_XOR(V_XOR(simd_sbox(3, c, 1), simd_sbox(2, c, 3)), \
+	                   V_XOR(simd_sbox(1, c, 5), simd_sbox(0, c, 7)))); \
+	b = simd_mul_##mul(b);
+
+#define simd_pass(a,b,c,mul) \
+	simd_round(a,b,c,x0,mul) \
+	simd_round(b,c,a,x1,mul) \
+	simd_round(c,a,b,x2,mul) \
+	simd_round(a,b,c,x3,mul) \
+	simd_round(b,c,a,x4,mul) \
+	simd_round(c,a,b,x5,mul) \
+	simd_round(a,b,c,x6,mul) \
+	simd_round(b,c,a,x7,mul)
+
+#define simd_key_schedule \
+	x0 = V_SUB(x0, V_XOR(x7, V_SET1(_ULL(0xA5A5A5A5A5A5A5A5)))); \
+	x1 = V_XOR(x1, x0); \
+	x2 = V_ADD(x2, x1); \
+	x3 = V_SUB(x3, V_XOR(x2, V_SHL(V_XOR(x1, allOnes), 19))); \
+	x4 = V_XOR(x4, x3); \
+	x5 = V_ADD(x5, x4); \
+	x6 = V_SUB(x6, V_XOR(x5, V_SHR(V_XOR(x4, allOnes), 23))); \
+	x7 = V_XOR(x7, x6); \
+	x0 = V_ADD(x0, x7); \
+	x1 = V_SUB(x1, V_XOR(x0, V_SHL(V_XOR(x7, allOnes), 19))); \
+	x2 = V_XOR(x2, x1); \
+	x3 = V_ADD(x3, x2); \
+	x4 = V_SUB(x4, V_XOR(x3, V_SHR(V_XOR(x2, allOnes), 23))); \
+	x5 = V_XOR(x5, x4); \
+	x6 = V_ADD(x6, x5); \
+	x7 = V_SUB(x7, V_XOR(x6, V_SET1(_ULL(0x0123456789ABCDEF))));
+
+/* str holds 8 words per lane, word-major; state holds 3 words per lane, word-major */
+#define simd_compress_body(LANES) \
+	{ \
+		const V_TYPE byteMask = V_SET1(0xFF); \
+		const V_TYPE allOnes = V_SET1(~_ULL(0)); \
+		V_TYPE a = V_LOAD(state); \
+		V_TYPE b = V_LOAD(state + (LANES)); \
+		V_TYPE c = V_LOAD(state + 2 * (LANES)); \
+		V_TYPE x0 = V_LOAD(str); \
+		V_TYPE x1 = V_LOAD(str + (LANES)); \
+		V_TYPE x2 = V_LOAD(str + 2 * (LANES)); \
+		V_TYPE x3 = V_LOAD(str + 3 * (LANES)); \
+		V_TYPE x4 = V_LOAD(str + 4 * (LANES)); \
+		V_TYPE x5 = V_LOAD(str + 5 * (LANES)); \
+		V_TYPE x6 = V_LOAD(str + 6 * (LANES)); \
+		V_TYPE x7 = V_LOAD(str + 7 * (LANES)); \
+		const V_TYPE aa = a; \
+		const V_TYPE bb = b; \
+		const V_TYPE cc = c; \
+		simd_pass(a,b,c,5) \
+		simd_key_schedule \
+		simd_pass(c,a,b,7) \
+		simd_key_schedule \
+		simd_pass(b,c,a,9) \
+		a = V_XOR(a, aa); \
+		b = V_SUB(b, bb); \
+		c = V_ADD(c, cc); \
+		V_STORE(state, a); \
+		V_STORE(state + (LANES), b); \
+		V_STORE(state + 2 * (LANES), c); \
+	}
+
+#define V_TYPE __m256i
+#define V_LOAD(p) _mm256_loadu_si256((const __m256i*) (p))
+#define V_STORE(p, v) _mm256_storeu_si256((__m256i*) (p), v)
+#define V_SET1(x) _mm256_set1_epi64x((long long) (x))
+#define V_ADD _mm256_add_epi64
+#define V_SUB _mm256_sub_epi64
+#define V_XOR _mm256_xor_si256
+#define V_AND _mm256_and_si256
+#define V_SHL _mm256_slli_epi64
+#define V_SHR _mm256_srli_epi64
+#define V_GATHER(t, idx) _mm256_i64gather_epi64((const long long*) (t), idx, 8)
+
+TIGER_TARGET_AVX2 void TigerHash::compressAVX2(const uint64_t* str, uint64_t* state)
+simd_compress_body(4)
+
+#undef V_TYPE
+#undef V_LOAD
+#undef V_STORE
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_XOR
+#undef V_AND
+#undef V_SHL
+#undef V_SHR
+#undef V_GATHER
+
+#define V_TYPE __m512i
+#define V_LOAD(p) _mm512_loadu_si512((const void*) (p))
+#define V_STORE(p, v) _mm512_storeu_si512((void*) (p), v)
+#define V_SET1(x) _mm512_set1_epi64((long long) (x))
+#define V_ADD _mm512_add_epi64
+#define V_SUB _mm512_sub_epi64
+#define V_XOR _mm512_xor_si512
+#define V_AND _mm512_and_si512
+#define V_SHL _mm512_slli_epi64
+#define V_SHR _mm512_srli_epi64
+#define V_GATHER(t, idx) _mm512_i64gather_epi64(idx, (const void*) (t), 8)
+
+TIGER_TARGET_AVX512 void TigerHash::compressAVX512(const uint64_t* str, uint64_t* state)
+simd_compress_body(8)
+
+#undef V_TYPE
+#undef V_LOAD
+#undef V_STORE
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_XOR
+#undef V_AND
+#undef V_SHL
+#undef V_SHR
+#undef V_GATHER
+
+#ifdef _MSC_VER
+static bool hasAVX(int level)
+{
+	int regs[4];
+	__cpuid(regs, 0);
+	if (regs[0] < 7) return false;
+	__cpuid(regs, 1);
+	// OSXSAVE and AVX
+	if ((regs[2] & 0x18000000) != 0x18000000) return false;
+	const uint64_t xcr0 = _xgetbv(0);
+	// XMM and YMM state, plus opmask and ZMM state for AVX-512
+	const uint64_t xcrMask = level == 512 ? 0xE6 : 0x06;
+	if ((xcr0 & xcrMask) != xcrMask) return false;
+	__cpuidex(regs, 7, 0);
+	return level == 512 ? (regs[1] & (1 << 16)) != 0 : (regs[1] & (1 << 5)) != 0;
+}
+#else
+static bool hasAVX(int level)
+{
+	__builtin_cpu_init();
+	return level == 512 ? __builtin_cpu_supports("avx512f") : __builtin_cpu_supports("avx2");
+}
+#endif
+
+#endif // TIGER_SIMD
+
+/* Extracts the block number index of the padded message (prefix byte followed by data[0..len-1]) */
+static void getMessageBlock(uint8_t* out, const uint8_t* data, size_t len, uint8_t prefix, size_t index)
+{
+	enum { BLOCK_SIZE = 64 };
+	const size_t msgSize = len + 1;
+	const size_t start = index * BLOCK_SIZE;
+	size_t outPos = 0;
+	size_t msgPos = start;
+	if (msgPos == 0)
+	{
+		out[outPos++] = prefix;
+		msgPos++;
+	}
+	if (msgPos < msgSize)
+	{
+		const size_t n = min(msgSize - msgPos, BLOCK_SIZE - outPos);
+		memcpy(out + outPos, data + msgPos - 1, n);
+		outPos += n;
+		msgPos += n;
+	}
+	if (outPos == BLOCK_SIZE) return;
+	memset(out + outPos, 0, BLOCK_SIZE - outPos);
+	if (msgPos == msgSize)
+		out[outPos] = 0x01;
+	if (start + BLOCK_SIZE >= ((msgSize + 8) / BLOCK_SIZE + 1) * BLOCK_SIZE)
+	{
+		const uint64_t bits = (uint64_t) msgSize << 3;
+		memcpy(out + BLOCK_SIZE - sizeof(bits), &bits, sizeof(bits));
+	}
+}
+
+void TigerHash::hashParallel(const uint8_t* data, size_t len, size_t count, uint8_t prefix, uint8_t* result)
+{
+#ifdef TIGER_SIMD
+	typedef void (*CompressFunc)(const uint64_t* str, uint64_t* state);
+	static const size_t lanes = hasAVX(512) ? 8 : hasAVX(2) ? 4 : 0;
+	static const CompressFunc compressFunc = lanes == 8 ? compressAVX512 : compressAVX2;
+	if (lanes && count >= lanes)
+	{
+		const size_t blocks = (len + 1 + 8) / BLOCK_SIZE + 1;
+		uint64_t str[8 * MAX_PARALLEL];
+		uint64_t state[3 * MAX_PARALLEL];
+		uint64_t tmpBlock[BLOCK_SIZE / sizeof(uint64_t)];
+		while (count >= lanes)
+		{
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				state[lane] = _ULL(0x0123456789ABCDEF);
+				state[lanes + lane] = _ULL(0xFEDCBA9876543210);
+				state[2 * lanes + lane] = _ULL(0xF096A5B4C3B2E187);
+			}
+			for (size_t block = 0; block < blocks; ++block)
+			{
+				for (size_t lane = 0; lane < lanes; ++lane)
+				{
+					getMessageBlock((uint8_t*) tmpBlock, data + lane * len, len, prefix, block);
+					for (size_t k = 0; k < 8; ++k)
+						str[k * lanes + lane] = tmpBlock[k];
+				}
+				compressFunc(str, state);
+			}
+			for (size_t lane = 0; lane < lanes; ++lane)
+			{
+				uint64_t res[3] = { state[lane], state[lanes + lane], state[2 * lanes + lane] };
+				memcpy(result, res, BYTES);
+				result += BYTES;
+			}
+			data += lanes * len;
+			count -= lanes;
+		}
+	}
+#endif
+	while (count)
+	{
+		TigerHash h;
+		h.update(&prefix, 1);
+		h.update(data, len);
+		memcpy(result, h.finalize(), BYTES);
+		result += BYTES;
+		data += len;
+		count--;
+	}
+}
+
 const uint64_t TigerHash::table[4 * 256] =
 {
 	_ULL(0x02AAB17CF7E90C5E)   /*    0 */,    _ULL(0xAC424B03E243A8EC)   /*    1 */,
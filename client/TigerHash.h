@@ -63,6 +63,17 @@ class TigerHash
 		{
 			return (uint8_t*) res;
 		}
+
+		/** Maximum number of messages hashed at once by hashParallel. */
+		static const size_t MAX_PARALLEL = 8;
+
+		/**
+		 * Calculates the Tiger hashes of count independent messages, each being
+		 * the prefix byte followed by len bytes of data. Messages are stored one after another.
+		 * Uses AVX2 or AVX-512 when the CPU supports it.
+		 * @param result Receives count * BYTES bytes.
+		 */
+		static void hashParallel(const uint8_t* data, size_t len, size_t count, uint8_t prefix, uint8_t* result);
 	private:
 		enum { BLOCK_SIZE = 512 / 8 };
 		/** 512 bit blocks for the compress function */
@@ -73,6 +84,9 @@ class TigerHash
 		uint64_t pos;
 		/** S boxes */
 		static const uint64_t table[];
+
+		static void compressAVX2(const uint64_t* str, uint64_t* state);
+		static void compressAVX512(const uint64_t* str, uint64_t* state);
 		
 #if 0
 		void tigerCompress(const uint64_t* data, uint64_t state[3]);
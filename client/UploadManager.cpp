@@ -27,6 +27,7 @@
 #include "Upload.h"
 #include "QueueManager.h"
 #include "FinishedManager.h"
+#include "ThrottleManager.h"
 #include "SharedFileStream.h"
 #include "IpGrant.h"
 #include "Wildcards.h"
@@ -703,6 +704,17 @@ ok:
 		// user got a slot
 		source->setSlotType(slotType);
 	}
+
+	int throttleClass;
+	if (u->getType() != Transfer::TYPE_FILE)
+		throttleClass = ThrottleManager::CLASS_FILE_LIST;
+	else if (slotType == UserConnection::EXTRASLOT)
+		throttleClass = ThrottleManager::CLASS_MINI_SLOT;
+	else if (isFavorite || hasReserved)
+		throttleClass = ThrottleManager::CLASS_FAVORITE;
+	else
+		throttleClass = ThrottleManager::CLASS_NORMAL;
+	source->setThrottleClass(throttleClass);
 	
 	return true;
 }
@@ -1044,7 +1056,7 @@ void UploadManager::processGET(UserConnection* source, const AdcCommand& c) noex
 
 void UploadManager::processGFI(UserConnection* source, const AdcCommand& c) noexcept
 {
-	if (c.getParameters().size() < 2)
+	if (c.getParamCount() < 2)
 	{
 		source->send(AdcCommand(AdcCommand::SEV_RECOVERABLE, AdcCommand::ERROR_PROTOCOL_GENERIC, "Missing parameters"));
 		return;
@@ -472,7 +472,7 @@ void UserConnection::addAcceptedSocket(unique_ptr<Socket>& newSock, uint16_t por
 
 void UserConnection::handle(AdcCommand::STA t, const AdcCommand& c)
 {
-	if (c.getParameters().size() >= 2)
+	if (c.getParamCount() >= 2)
 	{
 		const string& code = c.getParam(0);
 		if (!code.empty() && code[0] - '0' == AdcCommand::SEV_FATAL)
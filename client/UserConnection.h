@@ -182,6 +182,11 @@ class UserConnection :
 			if (socket)
 				socket->disconnect(graceless);
 		}
+		void setThrottleClass(int throttleClass)
+		{
+			if (socket)
+				socket->setThrottleClass(throttleClass);
+		}
 		void transmitFile(InputStream* f)
 		{
 			dcassert(socket);
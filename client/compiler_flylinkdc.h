@@ -151,6 +151,14 @@
 #define FLYLINKDC_USE_EXT_JSON
 #define FLYLINKDC_USE_SOCKET_COUNTER
 
+#ifdef __linux__
+#define FLYLINKDC_USE_SOCKET_REACTOR
+#define FLYLINKDC_USE_ZERO_COPY
+#define FLYLINKDC_USE_MMSG
+#define FLYLINKDC_USE_POSITIONAL_IO
+#define FLYLINKDC_USE_SHARE_WATCHER
+#endif
+
 #define HAVE_NATPMP_H
 
 #if defined _POSIX_SOURCE || defined _GNU_SOURCE
@@ -738,7 +738,7 @@ namespace dht
 	// status message
 	bool DHT::handle(AdcCommand::STA, const Node::Ptr& node, AdcCommand& c) noexcept
 	{
-		if (c.getParameters().size() < 3)
+		if (c.getParamCount() < 3)
 			return true;
 
 		Ip4Address fromIP = node->getIdentity().getIP4();
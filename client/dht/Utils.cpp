@@ -72,7 +72,7 @@ namespace dht
 	bool Utils::checkFlood(uint32_t ip, const AdcCommand& cmd)
 	{
 		// ignore empty commands
-		if (cmd.getParameters().empty())
+		if (cmd.getParamCount() == 0)
 			return false;
 
 		// there maximum allowed request packets from one IP per minute
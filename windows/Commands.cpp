@@ -6,6 +6,7 @@
 #include "../client/UploadManager.h"
 #include "../client/CompatibilityManager.h"
 #include "../client/ShareManager.h"
+#include "../client/ThrottleManager.h"
 #include "../client/LocationUtil.h"
 #include "../client/ParamExpander.h"
 #include "../client/HashUtil.h"
@@ -1163,6 +1164,27 @@ bool Commands::processCommand(tstring& cmd, tstring& param, tstring& message, ts
 		localMessage = TSTRING(COMMAND_INVALID_ACTION);
 		return true;
 	}
+	else if (stricmp(cmd.c_str(), _T("throttle")) == 0)
+	{
+		static const TCHAR* classNames[ThrottleManager::CLASS_COUNT] = { _T("normal"), _T("favorite"), _T("mini slot"), _T("file list") };
+		static const TCHAR* dirNames[] = { _T("Download"), _T("Upload") };
+		ThrottleManager::ClassStats stats[ThrottleManager::CLASS_COUNT];
+		for (int dir = ThrottleManager::DIR_DOWNLOAD; dir <= ThrottleManager::DIR_UPLOAD; ++dir)
+		{
+			ThrottleManager::getInstance()->getStats(dir, stats);
+			if (!localMessage.empty()) localMessage += _T('\n');
+			localMessage += dirNames[dir];
+			localMessage += _T(':');
+			for (int i = 0; i < ThrottleManager::CLASS_COUNT; ++i)
+			{
+				localMessage += _T("\n  ");
+				localMessage += classNames[i];
+				localMessage += _T(": ") + Util::formatBytesT(stats[i].speed) + _T("/s, total ") +
+					Util::formatBytesT(stats[i].bytes) + _T(", connections: ") + Util::toStringT(stats[i].connections);
+			}
+		}
+		return true;
+	}
 #endif
 #ifdef DEBUG_GDI_IMAGE
 	else if (stricmp(cmd.c_str(), _T("gdiinfo")) == 0)
@@ -18,7 +18,7 @@
 
 #include "stdafx.h"
 
-#include "../client/BZUtils.h"
+#include "../client/BZCompressor.h"
 #include "../client/FilteredFile.h"
 #include "../client/HashUtil.h"
 #include "../client/HashManager.h"
@@ -249,7 +249,7 @@ size_t DclstGenDlg::packAndSave()
 	try
 	{
 		unique_ptr<OutputStream> outFilePtr(new File(listName, File::WRITE, File::TRUNCATE | File::CREATE, false));
-		FilteredOutputStream<BZFilter, false> outFile(outFilePtr.get());
+		ParallelBZOutputStream outFile(outFilePtr.get());
 		outSize += outFile.write(xml.c_str(), xml.size());
 		outSize += outFile.flushBuffers(true);
 	}